@@ -31,6 +31,7 @@ typedef struct
 	IrcContext *parent;
 	IrcUserList *userlist;
 	char *topic;
+	char *key;
 	gboolean joined;
 } IrcChannelPrivate;
 
@@ -51,6 +52,7 @@ enum {
 	PROP_NAME,
 	PROP_PARENT,
 	PROP_TOPIC,
+	PROP_KEY,
 	PROP_JOINED,
 	N_PROPS
 };
@@ -74,6 +76,37 @@ irc_channel_set_joined (IrcChannel *self, gboolean joined)
 	g_object_notify (G_OBJECT(self), "active");
 }
 
+/**
+ * irc_channel_suspend:
+ *
+ * Marks the channel as not joined after losing the connection. Unlike
+ * irc_channel_set_joined() the users and topic are kept so rejoining only
+ * updates what changed.
+ */
+void
+irc_channel_suspend (IrcChannel *self)
+{
+	IrcChannelPrivate *priv = irc_channel_get_instance_private (self);
+
+	if (!priv->joined)
+		return;
+
+	priv->joined = FALSE;
+	g_object_notify (G_OBJECT(self), "active");
+}
+
+/**
+ * irc_channel_get_key:
+ *
+ * Returns: (nullable): Key sent when rejoining
+ */
+const char *
+irc_channel_get_key (IrcChannel *self)
+{
+	IrcChannelPrivate *priv = irc_channel_get_instance_private (self);
+	return priv->key;
+}
+
 /**
  * irc_channel_get_users:
  *
@@ -146,6 +179,7 @@ irc_channel_finalize (GObject *object)
 
 	g_free (self->name);
 	g_free (priv->topic);
+	g_free (priv->key);
 	g_object_unref (priv->userlist);
 
 	G_OBJECT_CLASS (irc_channel_parent_class)->finalize (object);
@@ -171,6 +205,9 @@ irc_channel_get_property (GObject    *object,
 	case PROP_TOPIC:
 		g_value_set_string (value, priv->topic);
 		break;
+	case PROP_KEY:
+		g_value_set_string (value, priv->key);
+		break;
 	case PROP_JOINED:
 		g_value_set_boolean (value, priv->joined);
 		break;
@@ -200,6 +237,10 @@ irc_channel_set_property (GObject      *object,
 	case PROP_TOPIC:
 		priv->topic = g_value_dup_string (value);
 		break;
+	case PROP_KEY:
+		g_free (priv->key);
+		priv->key = g_value_dup_string (value);
+		break;
 	case PROP_JOINED:
 		priv->joined = g_value_get_boolean (value);
 		break;
@@ -224,6 +265,9 @@ irc_channel_class_init (IrcChannelClass *klass)
 	g_object_class_install_property (object_class, PROP_TOPIC,
 								  g_param_spec_string ("topic", "Topic", "Topic of channel",
 										NULL, G_PARAM_READWRITE));
+	g_object_class_install_property (object_class, PROP_KEY,
+								  g_param_spec_string ("key", "Key", "Key needed to join the channel",
+										NULL, G_PARAM_READWRITE));
 }
 
 static IrcContext *
@@ -38,6 +38,8 @@ struct _IrcChannel
 IrcChannel *irc_channel_new (IrcContext *parent, const char *name) NON_NULL();
 void irc_channel_part (IrcChannel *self) NON_NULL();
 void irc_channel_set_joined (IrcChannel *self, gboolean joined) NON_NULL(1);
+void irc_channel_suspend (IrcChannel *self) NON_NULL();
+const char *irc_channel_get_key (IrcChannel *self) NON_NULL();
 IrcUserList *irc_channel_get_users (IrcChannel *self) NON_NULL() RETURNS_NON_NULL;
 GActionGroup *irc_channel_get_action_group (void);
 
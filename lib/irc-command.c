@@ -33,10 +33,10 @@ static gboolean
 command_say (IrcContext *ctx, const GStrv words, const GStrv words_eol)
 {
 	IrcServer *serv = get_contexts_server (ctx);
-	if (!serv)
+	if (!serv || words_eol[1] == NULL)
 		return FALSE;
 
-	irc_server_write_linef (serv, "PRIVMSG %s :%s", irc_context_get_name (ctx), words_eol[1]);
+	irc_server_write_message (serv, irc_context_get_name (ctx), words_eol[1], FALSE);
 
 	IrcUser *me = irc_server_get_me (serv);
 	if (me)
@@ -52,10 +52,10 @@ static gboolean
 command_me (IrcContext *ctx, const GStrv words, const GStrv words_eol)
 {
 	IrcServer *serv = get_contexts_server (ctx);
-	if (!serv)
+	if (!serv || words_eol[1] == NULL)
 		return FALSE;
 
-	irc_server_write_linef (serv, "PRIVMSG %s :\001ACTION %s\001", irc_context_get_name (ctx), words_eol[1]);
+	irc_server_write_message (serv, irc_context_get_name (ctx), words_eol[1], TRUE);
 
 	IrcUser *me = irc_server_get_me (serv);
 	if (me)
@@ -91,6 +91,58 @@ command_allserv (IrcContext *ctx, const GStrv words, const GStrv words_eol)
 	return TRUE;
 }
 
+static gboolean
+command_stats (IrcContext *ctx, const GStrv words, const GStrv words_eol)
+{
+	IrcServer *serv = IRC_IS_SERVER(ctx) ? IRC_SERVER(ctx) : get_contexts_server (ctx);
+	if (!serv)
+		return FALSE;
+
+	// With a query it is the servers own STATS
+	if (words[1] != NULL)
+		irc_server_write_line (serv, words_eol[0]);
+	else
+		irc_server_print_stats (serv);
+	return TRUE;
+}
+
+static gboolean
+command_rawlog (IrcContext *ctx, const GStrv words, const GStrv words_eol)
+{
+	IrcServer *serv = IRC_IS_SERVER(ctx) ? IRC_SERVER(ctx) : get_contexts_server (ctx);
+	if (!serv)
+		return FALSE;
+
+	IrcRawLog *log = irc_server_get_raw_log (serv);
+	const guint n_lines = irc_raw_log_get_n_lines (log);
+	guint count = 50;
+
+	if (words[1] != NULL)
+	{
+		guint64 parsed;
+		if (!g_ascii_string_to_unsigned (words[1], 10, 1, G_MAXUINT, &parsed, NULL))
+		{
+			g_autofree char *error = g_strdup_printf (_("Invalid number of lines: %s"), words[1]);
+			irc_context_print (ctx, error);
+			return TRUE;
+		}
+		count = (guint)parsed;
+	}
+
+	for (guint i = n_lines - MIN(count, n_lines); i < n_lines; ++i)
+	{
+		IrcRawLogDirection direction;
+		gint64 time;
+		const char *line = irc_raw_log_get_line (log, i, &direction, &time);
+		g_autofree char *formatted = g_strdup_printf ("\00314%s\017 %s",
+													  direction == IRC_RAW_LOG_INBOUND ? ">>" : "<<", line);
+
+		// Not logged or searchable, passwords are hidden but the rest is still raw traffic
+		irc_context_print_transient (IRC_CONTEXT(serv), formatted, (time_t)(time / G_USEC_PER_SEC));
+	}
+	return TRUE;
+}
+
 struct command
 {
 	uint hash; // From irc_str_hash()
@@ -103,6 +155,8 @@ static const struct command commands[] = {
 	{ 0xd98u, command_me, N_("me <message> | Sends an action to current channel") }, // me
 	{ 0x3463f3u, command_part, N_("part [<channel>] | Leaves the channel") }, // part
 	{ 0xc9af9137u, command_allserv, N_("allserv <command> | Runs command on all connected servers") }, // allserv
+	{ 0xc8171a1cu, command_rawlog, N_("rawlog [<lines>] | Shows the last lines sent to and received from the server") }, // rawlog
+	{ 0x68ac49fu, command_stats, N_("stats [<query>] | Shows time spent handling each command, or queries the server") }, // stats
 };
 
 gboolean
@@ -0,0 +1,313 @@
+/* irc-connect-scheduler.c
+ *
+ * Copyright (C) 2017 Patrick Griffis <tingping@tingping.se>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "irc-connect-scheduler.h"
+
+/**
+ * SECTION:irc-connect-scheduler
+ * @title: IrcConnectScheduler
+ * @short_description: Connects servers a few at a time
+ *
+ * Connecting every network at once means all of the handshakes, welcome
+ * bursts and channel joins land together. Servers added here are connected
+ * highest priority first with only a few connecting at a time, the next one
+ * starts once a server is #IrcServer::ready, disconnects or times out.
+ */
+
+typedef struct
+{
+	IrcServer *server;
+	int priority;
+	guint64 serial;
+} Queued;
+
+typedef struct
+{
+	IrcConnectScheduler *scheduler;
+	IrcServer *server;
+	guint timeout_id;
+} Connecting;
+
+struct _IrcConnectScheduler
+{
+	GObject parent_instance;
+
+	guint max_connecting;
+	guint timeout; // Seconds
+	GQueue *queue; // Queued, highest priority first then in order added
+	GPtrArray *connecting; // Connecting
+	guint64 serial;
+	guint start_id;
+};
+
+G_DEFINE_TYPE (IrcConnectScheduler, irc_connect_scheduler, G_TYPE_OBJECT)
+
+/**
+ * irc_connect_scheduler_new:
+ * @max_connecting: Most servers connecting at once
+ * @timeout: Seconds until the next server is started regardless
+ *
+ * Returns: (transfer full): A new #IrcConnectScheduler
+ */
+IrcConnectScheduler *
+irc_connect_scheduler_new (guint max_connecting, guint timeout)
+{
+	IrcConnectScheduler *self = g_object_new (IRC_TYPE_CONNECT_SCHEDULER, NULL);
+
+	self->max_connecting = MAX (max_connecting, 1);
+	self->timeout = timeout;
+	return self;
+}
+
+static void
+queued_free (Queued *queued)
+{
+	g_object_unref (queued->server);
+	g_free (queued);
+}
+
+static void
+connecting_free (Connecting *connecting)
+{
+	g_signal_handlers_disconnect_by_data (connecting->server, connecting);
+	if (connecting->timeout_id)
+		g_source_remove (connecting->timeout_id);
+	g_object_unref (connecting->server);
+	g_free (connecting);
+}
+
+static int
+compare_queued (gconstpointer a, gconstpointer b, gpointer data)
+{
+	const Queued *x = a;
+	const Queued *y = b;
+
+	if (x->priority != y->priority)
+		return x->priority > y->priority ? -1 : 1;
+	return (x->serial > y->serial) - (x->serial < y->serial);
+}
+
+static void schedule_start (IrcConnectScheduler *self);
+
+static void
+finish_connecting (Connecting *connecting)
+{
+	IrcConnectScheduler *self = connecting->scheduler;
+
+	g_ptr_array_remove_fast (self->connecting, connecting);
+	schedule_start (self);
+}
+
+static void
+on_server_ready (IrcServer *server, gpointer data)
+{
+	finish_connecting (data);
+}
+
+static void
+on_server_active (IrcServer *server, GParamSpec *pspec, gpointer data)
+{
+	if (!irc_server_get_is_connected (server))
+		finish_connecting (data);
+}
+
+static gboolean
+on_connect_timeout (gpointer data)
+{
+	Connecting *connecting = data;
+
+	g_debug ("%s took too long to connect, starting the next server",
+			 irc_context_get_name (IRC_CONTEXT(connecting->server)));
+	connecting->timeout_id = 0;
+	finish_connecting (connecting);
+	return G_SOURCE_REMOVE;
+}
+
+static gboolean
+start_queued (gpointer data)
+{
+	IrcConnectScheduler *self = data;
+
+	self->start_id = 0;
+
+	while (self->connecting->len < self->max_connecting && !g_queue_is_empty (self->queue))
+	{
+		Queued *queued = g_queue_pop_head (self->queue);
+		Connecting *connecting = g_new0 (Connecting, 1);
+
+		connecting->scheduler = self;
+		connecting->server = g_steal_pointer (&queued->server);
+		g_free (queued);
+		g_ptr_array_add (self->connecting, connecting);
+
+		// Connecting disconnects first, handlers are only added after
+		irc_server_connect (connecting->server);
+		g_signal_connect (connecting->server, "ready", G_CALLBACK(on_server_ready), connecting);
+		g_signal_connect (connecting->server, "notify::active", G_CALLBACK(on_server_active), connecting);
+		connecting->timeout_id = g_timeout_add_seconds (self->timeout, on_connect_timeout, connecting);
+	}
+
+	return G_SOURCE_REMOVE;
+}
+
+static void
+schedule_start (IrcConnectScheduler *self)
+{
+	// Servers added together are sorted before any are started
+	if (self->start_id == 0 && !g_queue_is_empty (self->queue))
+		self->start_id = g_idle_add (start_queued, self);
+}
+
+static Connecting *
+find_connecting (IrcConnectScheduler *self, IrcServer *server)
+{
+	for (guint i = 0; i < self->connecting->len; ++i)
+	{
+		Connecting *connecting = g_ptr_array_index (self->connecting, i);
+		if (connecting->server == server)
+			return connecting;
+	}
+
+	return NULL;
+}
+
+static GList *
+find_queued (IrcConnectScheduler *self, IrcServer *server)
+{
+	for (GList *l = self->queue->head; l; l = l->next)
+	{
+		if (((Queued*)l->data)->server == server)
+			return l;
+	}
+
+	return NULL;
+}
+
+static void
+insert_queued (IrcConnectScheduler *self, Queued *queued, int priority)
+{
+	queued->priority = priority;
+	g_queue_insert_sorted (self->queue, queued, compare_queued, NULL);
+	schedule_start (self);
+}
+
+/**
+ * irc_connect_scheduler_add:
+ * @server: Server to connect
+ * @priority: Higher priorities are connected first
+ *
+ * Queues @server to be connected, if it is already queued its priority is
+ * changed instead.
+ */
+void
+irc_connect_scheduler_add (IrcConnectScheduler *self, IrcServer *server, int priority)
+{
+	if (find_connecting (self, server) != NULL || irc_connect_scheduler_set_priority (self, server, priority))
+		return;
+
+	Queued *queued = g_new (Queued, 1);
+	queued->server = g_object_ref (server);
+	queued->serial = self->serial++;
+	insert_queued (self, queued, priority);
+}
+
+/**
+ * irc_connect_scheduler_set_priority:
+ * @server: Queued server
+ * @priority: Higher priorities are connected first
+ *
+ * Returns: %FALSE if @server is not waiting to be connected
+ */
+gboolean
+irc_connect_scheduler_set_priority (IrcConnectScheduler *self, IrcServer *server, int priority)
+{
+	GList *link = find_queued (self, server);
+
+	if (link == NULL)
+		return FALSE;
+
+	Queued *queued = link->data;
+	g_queue_delete_link (self->queue, link);
+	insert_queued (self, queued, priority);
+	return TRUE;
+}
+
+/**
+ * irc_connect_scheduler_remove:
+ * @server: Server to forget
+ *
+ * Stops waiting on @server, it is not disconnected.
+ */
+void
+irc_connect_scheduler_remove (IrcConnectScheduler *self, IrcServer *server)
+{
+	Connecting *connecting = find_connecting (self, server);
+	if (connecting != NULL)
+	{
+		finish_connecting (connecting);
+		return;
+	}
+
+	GList *link = find_queued (self, server);
+	if (link != NULL)
+	{
+		queued_free (link->data);
+		g_queue_delete_link (self->queue, link);
+	}
+}
+
+/**
+ * irc_connect_scheduler_get_n_queued:
+ *
+ * Returns: Number of servers waiting to be connected
+ */
+guint
+irc_connect_scheduler_get_n_queued (IrcConnectScheduler *self)
+{
+	return self->queue->length;
+}
+
+static void
+irc_connect_scheduler_finalize (GObject *object)
+{
+	IrcConnectScheduler *self = IRC_CONNECT_SCHEDULER(object);
+
+	if (self->start_id)
+		g_source_remove (self->start_id);
+	g_ptr_array_unref (self->connecting);
+	g_queue_free_full (self->queue, (GDestroyNotify)queued_free);
+
+	G_OBJECT_CLASS (irc_connect_scheduler_parent_class)->finalize (object);
+}
+
+static void
+irc_connect_scheduler_class_init (IrcConnectSchedulerClass *klass)
+{
+	GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+	object_class->finalize = irc_connect_scheduler_finalize;
+}
+
+static void
+irc_connect_scheduler_init (IrcConnectScheduler *self)
+{
+	self->max_connecting = 1;
+	self->timeout = 30;
+	self->queue = g_queue_new ();
+	self->connecting = g_ptr_array_new_with_free_func ((GDestroyNotify)connecting_free);
+}
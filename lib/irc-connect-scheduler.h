@@ -0,0 +1,36 @@
+/* irc-connect-scheduler.h
+ *
+ * Copyright (C) 2017 Patrick Griffis <tingping@tingping.se>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <gio/gio.h>
+#include "irc-server.h"
+#include "irc-utils.h"
+
+G_BEGIN_DECLS
+
+#define IRC_TYPE_CONNECT_SCHEDULER (irc_connect_scheduler_get_type())
+G_DECLARE_FINAL_TYPE (IrcConnectScheduler, irc_connect_scheduler, IRC, CONNECT_SCHEDULER, GObject)
+
+IrcConnectScheduler *irc_connect_scheduler_new (guint max_connecting, guint timeout) RETURNS_NON_NULL;
+void irc_connect_scheduler_add (IrcConnectScheduler *self, IrcServer *server, int priority) NON_NULL();
+gboolean irc_connect_scheduler_set_priority (IrcConnectScheduler *self, IrcServer *server, int priority) NON_NULL();
+void irc_connect_scheduler_remove (IrcConnectScheduler *self, IrcServer *server) NON_NULL();
+guint irc_connect_scheduler_get_n_queued (IrcConnectScheduler *self) NON_NULL();
+
+G_END_DECLS
@@ -270,6 +270,143 @@ irc_context_manager_foreach_parent (IrcContextManager *self, GNodeForeachFunc fu
 	g_node_children_foreach (priv->contexts, G_TRAVERSE_ALL, func, data);
 }
 
+typedef struct
+{
+	char *needle;
+	GPtrArray *contexts;
+	GPtrArray *indexes;
+	IrcContextSearchFunc result_func;
+	gpointer result_data;
+} SearchData;
+
+typedef struct
+{
+	IrcContext *ctx;
+	GArray *lines;
+	GCancellable *cancellable;
+	IrcContextSearchFunc result_func;
+	gpointer result_data;
+} SearchResult;
+
+static void
+search_data_free (SearchData *data)
+{
+	g_free (data->needle);
+	g_ptr_array_unref (data->contexts);
+	g_ptr_array_unref (data->indexes);
+	g_free (data);
+}
+
+static void
+search_result_free (SearchResult *result)
+{
+	g_object_unref (result->ctx);
+	g_array_unref (result->lines);
+	g_clear_object (&result->cancellable);
+	g_free (result);
+}
+
+static gboolean
+search_result_deliver (gpointer data)
+{
+	SearchResult *result = data;
+
+	if (!g_cancellable_is_cancelled (result->cancellable))
+		result->result_func (result->ctx, result->lines, result->result_data);
+
+	return G_SOURCE_REMOVE;
+}
+
+static void
+search_thread (GTask *task, gpointer source, gpointer task_data, GCancellable *cancellable)
+{
+	SearchData *data = task_data;
+	GMainContext *context = g_task_get_context (task);
+
+	for (guint i = 0; i < data->contexts->len; ++i)
+	{
+		if (g_task_return_error_if_cancelled (task))
+			return;
+
+		GArray *lines = irc_search_index_search (g_ptr_array_index (data->indexes, i), data->needle);
+		if (lines->len == 0)
+		{
+			g_array_unref (lines);
+			continue;
+		}
+
+		// Stream each context's matches back as soon as they are found
+		SearchResult *result = g_new (SearchResult, 1);
+		result->ctx = g_object_ref (g_ptr_array_index (data->contexts, i));
+		result->lines = lines;
+		result->cancellable = cancellable ? g_object_ref (cancellable) : NULL;
+		result->result_func = data->result_func;
+		result->result_data = data->result_data;
+		g_main_context_invoke_full (context, G_PRIORITY_DEFAULT, search_result_deliver,
+									result, (GDestroyNotify)search_result_free);
+	}
+
+	g_task_return_boolean (task, TRUE);
+}
+
+static gboolean
+collect_context (GNode *node, gpointer data)
+{
+	SearchData *search = data;
+
+	if (node->data != NULL) // Root
+	{
+		IrcContext *ctx = node->data;
+		g_ptr_array_add (search->contexts, g_object_ref (ctx));
+		g_ptr_array_add (search->indexes, irc_search_index_ref (irc_context_get_search_index (ctx)));
+	}
+
+	return FALSE;
+}
+
+/**
+ * irc_context_manager_search_async:
+ * @needle: Text to search for, case is ignored
+ * @cancellable: (nullable): A #GCancellable
+ * @result_func: (scope notified): Called on the current thread-default main context
+ *   for each context with matches
+ * @result_data: (closure result_func): Data passed to @result_func
+ * @callback: Called once every context has been searched
+ * @user_data: (closure callback): Data passed to @callback
+ *
+ * Searches the scrollback of every context on a worker thread.
+ * @result_data must stay valid until @callback is called.
+ */
+void
+irc_context_manager_search_async (IrcContextManager *self, const char *needle, GCancellable *cancellable,
+								  IrcContextSearchFunc result_func, gpointer result_data,
+								  GAsyncReadyCallback callback, gpointer user_data)
+{
+	IrcContextManagerPrivate *priv = irc_context_manager_get_instance_private (self);
+	g_autoptr(GTask) task = g_task_new (self, cancellable, callback, user_data);
+	SearchData *data = g_new (SearchData, 1);
+
+	data->needle = g_strdup (needle);
+	data->contexts = g_ptr_array_new_with_free_func (g_object_unref);
+	data->indexes = g_ptr_array_new_with_free_func ((GDestroyNotify)irc_search_index_unref);
+	data->result_func = result_func;
+	data->result_data = result_data;
+
+	g_node_traverse (priv->contexts, G_PRE_ORDER, G_TRAVERSE_ALL, -1, collect_context, data);
+
+	g_task_set_source_tag (task, irc_context_manager_search_async);
+	g_task_set_task_data (task, data, (GDestroyNotify)search_data_free);
+	g_task_run_in_thread (task, search_thread);
+}
+
+gboolean
+irc_context_manager_search_finish (IrcContextManager *self, GAsyncResult *result, GError **error)
+{
+	g_return_val_if_fail (g_task_is_valid (result, self), FALSE);
+
+	return g_task_propagate_boolean (G_TASK(result), error);
+}
+
 /**
  * irc_context_manager_get_default:
  *
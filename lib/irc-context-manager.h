@@ -18,7 +18,7 @@
 
 #pragma once
 
-#include <glib-object.h>
+#include <gio/gio.h>
 #include "irc-context.h"
 #include "irc-utils.h"
 
@@ -27,6 +27,14 @@ G_BEGIN_DECLS
 #define IRC_TYPE_CONTEXT_MANAGER (irc_context_manager_get_type())
 G_DECLARE_FINAL_TYPE (IrcContextManager, irc_context_manager, IRC, CONTEXT_MANAGER, GObject)
 
+/**
+ * IrcContextSearchFunc:
+ * @ctx: Context with matches
+ * @lines: (element-type guint): Sorted line numbers that matched, see irc_search_index_search()
+ * @data: User data
+ */
+typedef void (*IrcContextSearchFunc) (IrcContext *ctx, GArray *lines, gpointer data);
+
 IrcContextManager *irc_context_manager_get_default (void) RETURNS_NON_NULL;
 void irc_context_manager_add (IrcContextManager *self, IrcContext *ctx) NON_NULL();
 IrcContext *irc_context_manager_find (IrcContextManager *self, const char *id) NON_NULL();
@@ -35,5 +43,9 @@ void irc_context_manager_remove_by_id (IrcContextManager *self, const char *id)
 void irc_context_manager_set_front_context (IrcContextManager *self, IrcContext *front) NON_NULL();
 IrcContext *irc_context_manager_get_front_context (IrcContextManager *self) NON_NULL();
 void irc_context_manager_foreach_parent (IrcContextManager *self, GNodeForeachFunc func, gpointer data) NON_NULL(1, 2);
+void irc_context_manager_search_async (IrcContextManager *self, const char *needle, GCancellable *cancellable,
+									IrcContextSearchFunc result_func, gpointer result_data,
+									GAsyncReadyCallback callback, gpointer user_data) NON_NULL(1, 2, 4);
+gboolean irc_context_manager_search_finish (IrcContextManager *self, GAsyncResult *result, GError **error) NON_NULL(1, 2);
 
 G_END_DECLS
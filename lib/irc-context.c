@@ -20,6 +20,7 @@
 #include "irc-context.h"
 #include "irc-context-action.h"
 #include "irc-context-manager.h"
+#include "irc-search-index.h"
 #include "irc-private.h"
 #include "irc-marshal.h"
 
@@ -34,11 +35,14 @@ G_DEFINE_INTERFACE (IrcContext, irc_context, G_TYPE_OBJECT)
 enum
 {
 	SIGNAL_PRINT,
+	SIGNAL_PRINT_TRANSIENT,
 	SIGNAL_COMMAND,
 	N_SIGNALS
 };
 
 static guint signals[N_SIGNALS];
+static guint64 print_count;
+static gint64 print_time;
 
 static void
 create_words (const char *content, GStrv *words_in, GStrv *words_eol_in)
@@ -111,6 +115,25 @@ irc_context_get_id (IrcContext *self)
 	return id;
 }
 
+/**
+ * irc_context_get_search_index:
+ *
+ * Returns: (transfer none): Index of everything printed to the context
+ */
+IrcSearchIndex *
+irc_context_get_search_index (IrcContext *self)
+{
+	IrcSearchIndex *index = g_object_get_data (G_OBJECT(self), "search-index");
+
+	if (G_UNLIKELY(index == NULL))
+	{
+		index = irc_search_index_new ();
+		g_object_set_data_full (G_OBJECT(self), "search-index", index, (GDestroyNotify)irc_search_index_unref);
+	}
+
+	return index;
+}
+
 /**
  * irc_context_lookup_setting_boolean:
  * @self: Context to lookup in
@@ -181,7 +204,45 @@ irc_context_get_name (IrcContext *self)
 void
 irc_context_print_with_time (IrcContext *self, const char *message, time_t stamp)
 {
+	const gint64 start = get_monotonic_ns ();
+
+	irc_search_index_append (irc_context_get_search_index (self), message);
 	g_signal_emit (self, signals[SIGNAL_PRINT], 0, message, stamp);
+
+	++print_count;
+	print_time += get_monotonic_ns () - start;
+}
+
+/**
+ * irc_context_print_transient:
+ * @message: Text to show
+ * @stamp: Timestamp of event or 0 for current time
+ *
+ * Shows @message like irc_context_print_with_time() but it is emitted as
+ * #IrcContext::print-transient so it isn't logged, nor can it be searched
+ * for. Used for output that may hold passwords such as the raw log.
+ */
+void
+irc_context_print_transient (IrcContext *self, const char *message, time_t stamp)
+{
+	const gint64 start = get_monotonic_ns ();
+
+	irc_search_index_skip (irc_context_get_search_index (self), message);
+	g_signal_emit (self, signals[SIGNAL_PRINT_TRANSIENT], 0, message, stamp);
+
+	++print_count;
+	print_time += get_monotonic_ns () - start;
+}
+
+/*
+ * Totals of every print so far, time is in nanoseconds. IrcServer compares
+ * them before and after handling a line to know what it cost to show it.
+ */
+void
+context_get_print_totals (guint64 *count, gint64 *time)
+{
+	*count = print_count;
+	*time = print_time;
 }
 
 /**
@@ -301,6 +362,21 @@ irc_context_default_init (IrcContextInterface *iface)
 													irc_marshal_VOID__STRING_INT64,
 													G_TYPE_NONE, 2, G_TYPE_STRING, G_TYPE_INT64);
 
+	/**
+	 * IrcContext::print-transient:
+	 * @object: The #IrcContext printed to
+	 * @message: Text to show
+	 * @stamp: Timestamp of the text
+	 *
+	 * Like #IrcContext::print for text that shouldn't be kept, see
+	 * irc_context_print_transient().
+	 */
+	signals[SIGNAL_PRINT_TRANSIENT] = g_signal_new_class_handler ("print-transient", G_TYPE_FROM_INTERFACE(iface),
+															  G_SIGNAL_RUN_LAST|G_SIGNAL_NO_RECURSE,
+															  NULL, NULL, NULL,
+															  irc_marshal_VOID__STRING_INT64,
+															  G_TYPE_NONE, 2, G_TYPE_STRING, G_TYPE_INT64);
+
 	g_signal_new_class_handler ("activity", G_TYPE_FROM_INTERFACE(iface), G_SIGNAL_RUN_LAST|G_SIGNAL_ACTION,
 											NULL, NULL, NULL, irc_marshal_VOID__BOOLEAN,
 											G_TYPE_NONE, 1, G_TYPE_BOOLEAN);
@@ -20,6 +20,7 @@
 
 #include <gio/gio.h>
 #include "irc-utils.h"
+#include "irc-search-index.h"
 
 G_BEGIN_DECLS
 
@@ -39,7 +40,9 @@ struct _IrcContextInterface
 void irc_context_run_command (IrcContext *self, const char *command) NON_NULL();
 void irc_context_print (IrcContext *self, const char *message) NON_NULL();
 void irc_context_print_with_time (IrcContext *self, const char *message, time_t stamp);
+void irc_context_print_transient (IrcContext *self, const char *message, time_t stamp) NON_NULL();
 const char *irc_context_get_id (IrcContext *self) NON_NULL() RETURNS_NON_NULL;
+IrcSearchIndex *irc_context_get_search_index (IrcContext *self) NON_NULL() RETURNS_NON_NULL;
 const char *irc_context_get_name (IrcContext *self) RETURNS_NON_NULL;
 IrcContext *irc_context_get_parent (IrcContext *self) NON_NULL();
 GMenuModel *irc_context_get_menu (IrcContext *self) RETURNS_NON_NULL NON_NULL();
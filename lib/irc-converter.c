@@ -0,0 +1,187 @@
+/* irc-converter.c
+ *
+ * Copyright (C) 2017 Patrick Griffis <tingping@tingping.se>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <string.h>
+#include "irc-converter.h"
+
+/**
+ * SECTION:irc-converter
+ * @title: IrcConverter
+ * @short_description: Converts lines between character sets
+ *
+ * Lines are converted with a single pass of iconv into a buffer that is
+ * reused for every line. Sequences that are invalid in the source character
+ * set are replaced by the fallback as they are found, so text mixing
+ * encodings costs no more than text that converts cleanly.
+ *
+ * The shift state of the converter is reset after every line.
+ */
+
+struct _IrcConverter
+{
+	gint ref_count;
+	GIConv cd;
+	gboolean from_utf8;
+	char *fallback; // Already in the target character set
+	gsize fallback_len;
+	char *buf;
+	gsize size;
+};
+
+G_DEFINE_BOXED_TYPE (IrcConverter, irc_converter, irc_converter_ref, irc_converter_unref)
+
+/**
+ * irc_converter_new:
+ * @to_codeset: Character set to convert to
+ * @from_codeset: Character set of the input
+ * @fallback: Replaces invalid input, in UTF-8
+ *
+ * Returns: (transfer full) (nullable): A new #IrcConverter or %NULL if the
+ *   conversion is not supported
+ */
+IrcConverter *
+irc_converter_new (const char *to_codeset, const char *from_codeset, const char *fallback, GError **error)
+{
+	GIConv cd = g_iconv_open (to_codeset, from_codeset);
+	gsize fallback_len;
+
+	if (cd == (GIConv)-1)
+	{
+		g_set_error (error, G_CONVERT_ERROR, G_CONVERT_ERROR_NO_CONVERSION,
+					 "Conversion from %s to %s is not supported", from_codeset, to_codeset);
+		return NULL;
+	}
+
+	// Fall back to '?' if the target can't represent it
+	char *converted_fallback = g_convert (fallback, -1, to_codeset, "UTF-8", NULL, &fallback_len, NULL);
+	if (converted_fallback == NULL)
+		converted_fallback = g_convert ("?", -1, to_codeset, "UTF-8", NULL, &fallback_len, NULL);
+
+	IrcConverter *self = g_new0 (IrcConverter, 1);
+	self->ref_count = 1;
+	self->cd = cd;
+	self->from_utf8 = g_ascii_strcasecmp (from_codeset, "UTF-8") == 0;
+	self->fallback = converted_fallback;
+	self->fallback_len = converted_fallback ? fallback_len : 0;
+	self->size = 512;
+	self->buf = g_malloc (self->size);
+
+	return self;
+}
+
+/**
+ * irc_converter_ref:
+ *
+ * Returns: (transfer full): @self
+ */
+IrcConverter *
+irc_converter_ref (IrcConverter *self)
+{
+	g_atomic_int_inc (&self->ref_count);
+	return self;
+}
+
+void
+irc_converter_unref (IrcConverter *self)
+{
+	if (g_atomic_int_dec_and_test (&self->ref_count))
+	{
+		g_iconv_close (self->cd);
+		g_free (self->fallback);
+		g_free (self->buf);
+		g_free (self);
+	}
+}
+
+// Makes room for at least need more bytes after *out
+static void
+reserve (IrcConverter *self, char **out, gsize *out_left, gsize need)
+{
+	if (*out_left >= need)
+		return;
+
+	const gsize used = (gsize)(*out - self->buf);
+	self->size = MAX (self->size * 2, used + need);
+	self->buf = g_realloc (self->buf, self->size);
+	*out = self->buf + used;
+	*out_left = self->size - used;
+}
+
+/**
+ * irc_converter_convert:
+ * @text: Input bytes
+ * @len: Length of @text in bytes
+ * @out_len: (out) (optional): Length of the result in bytes
+ *
+ * Returns: (transfer none): @text converted and nul terminated, it is only
+ *   valid until the next conversion
+ */
+const char *
+irc_converter_convert (IrcConverter *self, const char *text, gsize len, gsize *out_len)
+{
+	char *in = (char*)text;
+	gsize in_left = len;
+	char *out = self->buf;
+	gsize out_left = self->size;
+
+	while (in_left > 0)
+	{
+		if (g_iconv (self->cd, &in, &in_left, &out, &out_left) != (gsize)-1)
+			continue;
+
+		if (errno == E2BIG)
+		{
+			reserve (self, &out, &out_left, in_left * 2 + 16);
+		}
+		else if (errno == EILSEQ || errno == EINVAL)
+		{
+			// Invalid or incomplete, the fallback is written from the initial shift state
+			reserve (self, &out, &out_left, self->fallback_len + 16);
+			g_iconv (self->cd, NULL, NULL, &out, &out_left);
+			memcpy (out, self->fallback, self->fallback_len);
+			out += self->fallback_len;
+			out_left -= self->fallback_len;
+
+			// A character the target can't represent is replaced once, not per byte
+			gsize skip = 1;
+			if (self->from_utf8 && g_utf8_get_char_validated (in, (gssize)in_left) < (gunichar)-2)
+				skip = (gsize)g_utf8_skip[(guchar)*in];
+			in += skip;
+			in_left -= skip;
+		}
+		else
+		{
+			g_warning ("Failed to convert text: %s", g_strerror (errno));
+			break;
+		}
+	}
+
+	// Stateful encodings may end the line with a sequence back to the initial state
+	reserve (self, &out, &out_left, 16);
+	g_iconv (self->cd, NULL, NULL, &out, &out_left);
+	g_iconv (self->cd, NULL, NULL, NULL, NULL);
+
+	// Enough for a nul in any encoding
+	reserve (self, &out, &out_left, 4);
+	memset (out, 0, 4);
+
+	if (out_len)
+		*out_len = (gsize)(out - self->buf);
+	return self->buf;
+}
@@ -0,0 +1,39 @@
+/* irc-converter.h
+ *
+ * Copyright (C) 2017 Patrick Griffis <tingping@tingping.se>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <glib-object.h>
+#include "irc-utils.h"
+
+G_BEGIN_DECLS
+
+typedef struct _IrcConverter IrcConverter;
+
+#define IRC_TYPE_CONVERTER (irc_converter_get_type())
+GType irc_converter_get_type (void) G_GNUC_CONST;
+IrcConverter *irc_converter_new (const char *to_codeset, const char *from_codeset,
+                                 const char *fallback, GError **error) NON_NULL(1, 2, 3);
+IrcConverter *irc_converter_ref (IrcConverter *self) NON_NULL();
+void irc_converter_unref (IrcConverter *self) NON_NULL();
+
+const char *irc_converter_convert (IrcConverter *self, const char *text, gsize len, gsize *out_len) NON_NULL(1, 2);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC(IrcConverter, irc_converter_unref)
+
+G_END_DECLS
@@ -0,0 +1,295 @@
+/* irc-log-file.c
+ *
+ * Copyright (C) 2017 Patrick Griffis <tingping@tingping.se>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "irc-log-file.h"
+#include "irc-private.h"
+
+/**
+ * SECTION:irc-log-file
+ * @title: IrcLogFile
+ * @short_description: Reads chat logs written by #IrcLogger
+ *
+ * The log and its sidecar index are memory mapped. The index points at a
+ * line every so often so reading the last lines, or the page before them,
+ * is one forward read of the range needed instead of a scan of the file.
+ *
+ * It is a snapshot of the file when it was opened and only reads from one
+ * thread at a time.
+ */
+
+struct _IrcLogFile
+{
+	gint ref_count;
+	GMappedFile *log;
+	GMappedFile *index;
+	const char *contents;
+	gsize size; // Up to the last complete line
+	const LogIndexEntry *entries;
+	gsize n_entries;
+	int year, month, day; // From the file name, 0 if it has none
+	GString *line;
+};
+
+G_DEFINE_BOXED_TYPE (IrcLogFile, irc_log_file, irc_log_file_ref, irc_log_file_unref)
+
+static void
+load_index (IrcLogFile *self, const char *path)
+{
+	g_autofree char *index_path = g_strconcat (path, LOG_INDEX_SUFFIX, NULL);
+
+	if ((self->index = g_mapped_file_new (index_path, FALSE, NULL)) == NULL)
+		return;
+
+	const LogIndexEntry *entries = (const LogIndexEntry*)g_mapped_file_get_contents (self->index);
+	const gsize n_entries = g_mapped_file_get_length (self->index) / sizeof(LogIndexEntry);
+
+	// Only the entries that are consistent with the log are used
+	while (self->n_entries < n_entries && entries[self->n_entries].offset < self->size &&
+		   (self->n_entries == 0 || entries[self->n_entries - 1].offset < entries[self->n_entries].offset))
+		++self->n_entries;
+	self->entries = entries;
+}
+
+/**
+ * irc_log_file_new:
+ * @path: (type filename): Log file, its index is used if it exists
+ *
+ * Returns: (transfer full) (nullable): A new #IrcLogFile or %NULL if @path can't be read
+ */
+IrcLogFile *
+irc_log_file_new (const char *path, GError **error)
+{
+	GMappedFile *log = g_mapped_file_new (path, FALSE, error);
+	if (log == NULL)
+		return NULL;
+
+	IrcLogFile *self = g_new0 (IrcLogFile, 1);
+	self->ref_count = 1;
+	self->log = log;
+	self->contents = g_mapped_file_get_contents (log);
+	self->size = self->contents ? g_mapped_file_get_length (log) : 0;
+	self->line = g_string_new (NULL);
+
+	// A line that is still being written is left out
+	while (self->size > 0 && self->contents[self->size - 1] != '\n')
+		--self->size;
+
+	load_index (self, path);
+
+	g_autofree char *basename = g_path_get_basename (path);
+	if (sscanf (basename, "%4d-%2d-%2d.log", &self->year, &self->month, &self->day) != 3)
+		self->year = self->month = self->day = 0;
+
+	return self;
+}
+
+/**
+ * irc_log_file_ref:
+ *
+ * Returns: (transfer full): @self
+ */
+IrcLogFile *
+irc_log_file_ref (IrcLogFile *self)
+{
+	g_atomic_int_inc (&self->ref_count);
+	return self;
+}
+
+void
+irc_log_file_unref (IrcLogFile *self)
+{
+	if (g_atomic_int_dec_and_test (&self->ref_count))
+	{
+		g_mapped_file_unref (self->log);
+		g_clear_pointer (&self->index, g_mapped_file_unref);
+		g_string_free (self->line, TRUE);
+		g_free (self);
+	}
+}
+
+/**
+ * irc_log_file_get_size:
+ *
+ * Returns: Size of the complete lines in the file, reading before it
+ *   reads the last lines.
+ */
+gsize
+irc_log_file_get_size (IrcLogFile *self)
+{
+	return self->size;
+}
+
+/**
+ * irc_log_file_lookup_time:
+ * @stamp: Time to look for
+ *
+ * Times of the lines are only roughly in order, replayed history may be
+ * older than what was logged before it, so this is a starting point.
+ *
+ * Returns: Offset of an indexed line logged at or before @stamp, 0 if there
+ *   is none
+ */
+gsize
+irc_log_file_lookup_time (IrcLogFile *self, time_t stamp)
+{
+	gsize low = 0, high = self->n_entries;
+
+	while (low < high)
+	{
+		const gsize mid = low + (high - low) / 2;
+
+		if (self->entries[mid].time <= (gint64)stamp)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+
+	return low ? (gsize)self->entries[low - 1].offset : 0;
+}
+
+// Number of index entries before offset
+static gsize
+count_entries_before (IrcLogFile *self, gsize offset)
+{
+	gsize low = 0, high = self->n_entries;
+
+	while (low < high)
+	{
+		const gsize mid = low + (high - low) / 2;
+
+		if (self->entries[mid].offset < offset)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+
+	return low;
+}
+
+static guint
+count_lines (const char *p, gsize len)
+{
+	const char *end = p + len;
+	guint n = 0;
+
+	while ((p = memchr (p, '\n', (gsize)(end - p))) != NULL)
+	{
+		++n;
+		++p;
+	}
+
+	return n;
+}
+
+static gboolean
+parse_digits (const char *p, int *value)
+{
+	if (!g_ascii_isdigit (p[0]) || !g_ascii_isdigit (p[1]))
+		return FALSE;
+
+	*value = (p[0] - '0') * 10 + (p[1] - '0');
+	return TRUE;
+}
+
+static void
+emit_line (IrcLogFile *self, const char *line, gsize len, IrcLogFileLineFunc func, gpointer data)
+{
+	int hour, minute, second;
+	time_t stamp = 0;
+
+	// "[HH:MM:SS] text"
+	if (len >= 11 && line[0] == '[' && line[3] == ':' && line[6] == ':' && line[9] == ']' && line[10] == ' ' &&
+		parse_digits (line + 1, &hour) && parse_digits (line + 4, &minute) && parse_digits (line + 7, &second))
+	{
+		if (self->year)
+		{
+			g_autoptr(GDateTime) time = g_date_time_new_local (self->year, self->month, self->day,
+															   hour, minute, second);
+			if (time != NULL)
+				stamp = (time_t)g_date_time_to_unix (time);
+		}
+		line += 11;
+		len -= 11;
+	}
+
+	g_string_truncate (self->line, 0);
+	g_string_append_len (self->line, line, (gssize)len);
+	func (self->line->str, stamp, data);
+}
+
+/**
+ * irc_log_file_read_before:
+ * @end: Offset of the start of a line, such as the size or a previous return value
+ * @max_lines: Most lines to read
+ * @func: (scope call): Called for each line, oldest first
+ * @data: (closure func): User data
+ *
+ * Reads up to @max_lines lines that come before @end.
+ *
+ * Returns: Offset of the first line read, pass it as @end to read the page
+ *   before this one. 0 once the start of the file is reached.
+ */
+gsize
+irc_log_file_read_before (IrcLogFile *self, gsize end, guint max_lines, IrcLogFileLineFunc func, gpointer data)
+{
+	gsize i, start;
+	guint n_lines = 0;
+
+	end = MIN (end, self->size);
+	i = count_entries_before (self, end);
+	start = end;
+
+	// Walk back through the index until the range holds enough lines,
+	// without an index the file is read from the start
+	while (start > 0 && n_lines < max_lines)
+	{
+		gsize chunk_start = 0;
+
+		if (i > 0)
+		{
+			const gsize step = MAX (1, (max_lines - n_lines) / LOG_INDEX_INTERVAL);
+			i -= MIN (i, step);
+			chunk_start = (gsize)self->entries[i].offset;
+		}
+
+		n_lines += count_lines (self->contents + chunk_start, start - chunk_start);
+		start = chunk_start;
+	}
+
+	const char *p = self->contents + start;
+	const char *stop = self->contents + end;
+
+	for (; n_lines > max_lines; --n_lines)
+		p = (const char*)memchr (p, '\n', (gsize)(stop - p)) + 1;
+
+	const gsize first = (gsize)(p - self->contents);
+
+	while (p < stop)
+	{
+		const char *eol = memchr (p, '\n', (gsize)(stop - p));
+		if (eol == NULL)
+			eol = stop;
+
+		emit_line (self, p, (gsize)(eol - p), func, data);
+		p = eol + 1;
+	}
+
+	return first;
+}
@@ -0,0 +1,50 @@
+/* irc-log-file.h
+ *
+ * Copyright (C) 2017 Patrick Griffis <tingping@tingping.se>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <time.h>
+#include <gio/gio.h>
+#include "irc-utils.h"
+
+G_BEGIN_DECLS
+
+/**
+ * IrcLogFileLineFunc:
+ * @text: Line without its timestamp
+ * @stamp: Time of the line or 0 if unknown
+ * @data: User data
+ */
+typedef void (*IrcLogFileLineFunc) (const char *text, time_t stamp, gpointer data);
+
+typedef struct _IrcLogFile IrcLogFile;
+
+#define IRC_TYPE_LOG_FILE (irc_log_file_get_type())
+GType irc_log_file_get_type (void) G_GNUC_CONST;
+IrcLogFile *irc_log_file_new (const char *path, GError **error) NON_NULL(1);
+IrcLogFile *irc_log_file_ref (IrcLogFile *self) NON_NULL();
+void irc_log_file_unref (IrcLogFile *self) NON_NULL();
+
+gsize irc_log_file_get_size (IrcLogFile *self) NON_NULL();
+gsize irc_log_file_lookup_time (IrcLogFile *self, time_t stamp) NON_NULL();
+gsize irc_log_file_read_before (IrcLogFile *self, gsize end, guint max_lines,
+                                IrcLogFileLineFunc func, gpointer data) NON_NULL(1, 4);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC(IrcLogFile, irc_log_file_unref)
+
+G_END_DECLS
@@ -0,0 +1,678 @@
+/* irc-logger.c
+ *
+ * Copyright (C) 2017 Patrick Griffis <tingping@tingping.se>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <glib/gstdio.h>
+#include "irc-logger.h"
+#include "irc-enumtypes.h"
+#include "irc-private.h"
+
+/**
+ * SECTION:irc-logger
+ * @title: IrcLogger
+ * @short_description: Persistent chat logs
+ *
+ * Writes everything printed to the contexts of an #IrcContextManager to
+ * daily files at `<directory>/<network>/<context>/<YYYY-MM-DD>.log`, the
+ * server itself uses `(server)` as its context name.
+ *
+ * Printing only appends to an in-memory batch, a single thread writes the
+ * batch out once a second or once it grows past 64 KiB. Files stay open
+ * while they are being written to and are closed once idle.
+ *
+ * Next to every log is an index used by #IrcLogFile to find lines by time
+ * and read the end of a log without scanning it.
+ */
+
+#define SERVER_NAME "(server)"
+#define FLUSH_INTERVAL (1 * G_USEC_PER_SEC)
+#define FLUSH_SIZE (64 * 1024)
+#define IDLE_TIMEOUT (60 * G_USEC_PER_SEC)
+#define MAX_OPEN_FILES 256
+
+typedef struct
+{
+	int fd;
+	int index_fd;
+	guint64 offset;
+	guint since_index; // Messages since the last index entry
+	gint64 last_write;
+} LogFile;
+
+typedef struct
+{
+	GString *lines;
+	GArray *messages; // LogIndexEntry, offsets are into lines
+} Pending;
+
+struct _IrcLogger
+{
+	GObject parent_instance;
+
+	IrcContextManager *manager;
+	char *directory;
+	gint sync; // IrcLoggerSync, read by the writer
+
+	GMutex lock;
+	GCond cond;
+	GHashTable *pending; // path -> Pending
+	gsize pending_size;
+	guint64 flush_requested;
+	guint64 flushed;
+	gboolean quit;
+	GThread *thread;
+};
+
+G_DEFINE_TYPE (IrcLogger, irc_logger, G_TYPE_OBJECT)
+
+enum {
+	PROP_0,
+	PROP_MANAGER,
+	PROP_DIRECTORY,
+	PROP_SYNC,
+	N_PROPS
+};
+
+static GParamSpec *obj_properties[N_PROPS];
+
+/**
+ * irc_logger_new:
+ * @manager: Manager whose contexts are logged
+ * @directory: Directory logs are written to, created if needed
+ *
+ * Returns: (transfer full): A new #IrcLogger
+ */
+IrcLogger *
+irc_logger_new (IrcContextManager *manager, const char *directory)
+{
+	return g_object_new (IRC_TYPE_LOGGER, "manager", manager, "directory", directory, NULL);
+}
+
+static char *
+sanitize_name (const char *name)
+{
+	char *ret = g_strdelimit (g_strdup (name), "/\\", '_');
+
+	if (ret[0] == '.')
+		ret[0] = '_';
+	return ret;
+}
+
+/**
+ * irc_logger_get_path:
+ * @ctx: Context being logged
+ * @stamp: Time of the log or 0 for now
+ *
+ * Returns: (transfer full) (type filename): Path of the log file for @ctx on the day of @stamp
+ */
+char *
+irc_logger_get_path (IrcLogger *self, IrcContext *ctx, time_t stamp)
+{
+	IrcContext *parent = irc_context_get_parent (ctx);
+	char date[32];
+	struct tm tm;
+
+	if (stamp == 0)
+		stamp = time (NULL);
+	localtime_r (&stamp, &tm);
+	strftime (date, sizeof(date), "%Y-%m-%d.log", &tm);
+
+	g_autofree char *network = sanitize_name (irc_context_get_name (parent ? parent : ctx));
+	g_autofree char *name = sanitize_name (parent ? irc_context_get_name (ctx) : SERVER_NAME);
+
+	return g_build_filename (self->directory, network, name, date, NULL);
+}
+
+static void
+pending_free (Pending *pending)
+{
+	g_string_free (pending->lines, TRUE);
+	g_array_unref (pending->messages);
+	g_free (pending);
+}
+
+static GHashTable *
+new_pending_table (void)
+{
+	return g_hash_table_new_full (g_str_hash, g_str_equal, g_free, (GDestroyNotify)pending_free);
+}
+
+static void
+on_context_print (IrcContext *ctx, const char *message, gint64 stamp, gpointer data)
+{
+	IrcLogger *self = IRC_LOGGER(data);
+	g_autofree char *owned = irc_has_attributes (message) ? irc_strip_attributes (message) : NULL;
+	const char *stripped = owned ? owned : message;
+	const time_t when = stamp ? (time_t)stamp : time (NULL);
+	char prefix[16];
+	struct tm tm;
+
+	if (*stripped == '\0')
+		return;
+
+	localtime_r (&when, &tm);
+	strftime (prefix, sizeof(prefix), "[%H:%M:%S] ", &tm);
+
+	g_autofree char *path = irc_logger_get_path (self, ctx, when);
+
+	g_mutex_lock (&self->lock);
+
+	Pending *pending = g_hash_table_lookup (self->pending, path);
+	if (pending == NULL)
+	{
+		pending = g_new (Pending, 1);
+		pending->lines = g_string_sized_new (256);
+		pending->messages = g_array_new (FALSE, FALSE, sizeof(LogIndexEntry));
+		g_hash_table_insert (self->pending, g_steal_pointer (&path), pending);
+	}
+
+	GString *lines = pending->lines;
+	const gsize before = lines->len;
+	const LogIndexEntry message = { when, before };
+	g_array_append_val (pending->messages, message);
+
+	for (const char *p = stripped; *p != '\0';)
+	{
+		const char *eol = strchr (p, '\n');
+		const gsize len = eol ? (gsize)(eol - p) : strlen (p);
+
+		g_string_append (lines, prefix);
+		g_string_append_len (lines, p, (gssize)len);
+		g_string_append_c (lines, '\n');
+		p += len + (eol != NULL);
+	}
+
+	// The writer sleeps until there is something to write
+	const gboolean was_empty = self->pending_size == 0;
+	self->pending_size += lines->len - before;
+	if (was_empty || self->pending_size >= FLUSH_SIZE)
+		g_cond_broadcast (&self->cond);
+
+	g_mutex_unlock (&self->lock);
+}
+
+static void
+connect_context (IrcLogger *self, IrcContext *ctx)
+{
+	g_signal_connect_object (ctx, "print", G_CALLBACK(on_context_print), self, 0);
+}
+
+static void
+on_context_added (IrcContextManager *manager, IrcContext *ctx, gpointer data)
+{
+	connect_context (IRC_LOGGER(data), ctx);
+}
+
+static void
+on_context_removed (IrcContextManager *manager, IrcContext *ctx, gpointer data)
+{
+	g_signal_handlers_disconnect_by_func (ctx, on_context_print, data);
+}
+
+static void
+connect_child_foreach (GNode *node, gpointer data)
+{
+	connect_context (IRC_LOGGER(data), IRC_CONTEXT(node->data));
+}
+
+static void
+connect_parent_foreach (GNode *node, gpointer data)
+{
+	connect_context (IRC_LOGGER(data), IRC_CONTEXT(node->data));
+	g_node_children_foreach (node, G_TRAVERSE_ALL, connect_child_foreach, data);
+}
+
+static gboolean
+write_all (int fd, const char *buf, gsize len)
+{
+	while (len)
+	{
+		const gssize written = write (fd, buf, len);
+		if (written < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			return FALSE;
+		}
+
+		buf += written;
+		len -= (gsize)written;
+	}
+
+	return TRUE;
+}
+
+static LogFile *
+log_file_open (const char *path)
+{
+	g_autofree char *dirname = g_path_get_dirname (path);
+
+	if (g_mkdir_with_parents (dirname, 0700) < 0)
+	{
+		g_warning ("Failed to create log directory %s: %s", dirname, g_strerror (errno));
+		return NULL;
+	}
+
+	g_autofree char *index_path = g_strconcat (path, LOG_INDEX_SUFFIX, NULL);
+	const int fd = g_open (path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+	const int index_fd = fd < 0 ? -1 : g_open (index_path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+	if (index_fd < 0)
+	{
+		g_warning ("Failed to open log %s: %s", path, g_strerror (errno));
+		if (fd >= 0)
+			close (fd);
+		return NULL;
+	}
+
+	LogFile *file = g_new0 (LogFile, 1);
+	file->fd = fd;
+	file->index_fd = index_fd;
+	file->offset = (guint64)MAX (lseek (fd, 0, SEEK_END), 0);
+	// The first message after opening is always indexed
+	file->since_index = LOG_INDEX_INTERVAL;
+	return file;
+}
+
+static void
+log_file_close (LogFile *file, gboolean sync)
+{
+	if (sync && (fsync (file->fd) < 0 || fsync (file->index_fd) < 0))
+		g_warning ("Failed to sync log: %s", g_strerror (errno));
+	close (file->fd);
+	close (file->index_fd);
+	g_free (file);
+}
+
+static void
+write_batch (IrcLogger *self, GHashTable *files, GHashTable *batch, gint64 now)
+{
+	const gboolean sync = g_atomic_int_get (&self->sync) == IRC_LOGGER_SYNC_FLUSH;
+	g_autoptr(GArray) index = g_array_new (FALSE, FALSE, sizeof(LogIndexEntry));
+	GHashTableIter iter;
+	gpointer key, value;
+
+	g_hash_table_iter_init (&iter, batch);
+	while (g_hash_table_iter_next (&iter, &key, &value))
+	{
+		const char *path = key;
+		Pending *pending = value;
+		GString *lines = pending->lines;
+		LogFile *file = g_hash_table_lookup (files, path);
+
+		if (file == NULL)
+		{
+			if ((file = log_file_open (path)) == NULL)
+				continue;
+			g_hash_table_insert (files, g_strdup (path), file);
+		}
+
+		g_array_set_size (index, 0);
+		for (guint i = 0; i < pending->messages->len; ++i)
+		{
+			const LogIndexEntry *message = &g_array_index (pending->messages, LogIndexEntry, i);
+
+			if (file->since_index++ < LOG_INDEX_INTERVAL)
+				continue;
+
+			const LogIndexEntry entry = { message->time, file->offset + message->offset };
+			g_array_append_val (index, entry);
+			file->since_index = 1;
+		}
+
+		// The index is written after the lines so it never points past them
+		file->last_write = now;
+		if (!write_all (file->fd, lines->str, lines->len))
+		{
+			g_warning ("Failed to write log %s: %s", path, g_strerror (errno));
+			file->offset = (guint64)MAX (lseek (file->fd, 0, SEEK_END), 0);
+			file->since_index = LOG_INDEX_INTERVAL;
+			continue;
+		}
+		file->offset += lines->len;
+
+		if (!write_all (file->index_fd, index->data, index->len * sizeof(LogIndexEntry)))
+			g_warning ("Failed to write log index %s: %s", path, g_strerror (errno));
+		else if (sync && (fsync (file->fd) < 0 || fsync (file->index_fd) < 0))
+			g_warning ("Failed to sync log %s: %s", path, g_strerror (errno));
+	}
+}
+
+static void
+close_files (IrcLogger *self, GHashTable *files, gint64 now, gboolean all)
+{
+	const gboolean sync = g_atomic_int_get (&self->sync) != IRC_LOGGER_SYNC_NONE;
+	// Past the limit only the files from the last batch are kept
+	const gboolean over_limit = g_hash_table_size (files) > MAX_OPEN_FILES;
+	GHashTableIter iter;
+	gpointer value;
+
+	g_hash_table_iter_init (&iter, files);
+	while (g_hash_table_iter_next (&iter, NULL, &value))
+	{
+		LogFile *file = value;
+
+		if (all || now - file->last_write >= IDLE_TIMEOUT || (over_limit && file->last_write != now))
+		{
+			log_file_close (file, sync);
+			g_hash_table_iter_remove (&iter);
+		}
+	}
+}
+
+static gpointer
+writer_thread (gpointer data)
+{
+	IrcLogger *self = data;
+	// Only touched by this thread
+	GHashTable *files = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+
+	g_mutex_lock (&self->lock);
+	for (;;)
+	{
+		gint64 deadline = 0;
+
+		while (!self->quit && self->flushed == self->flush_requested && self->pending_size < FLUSH_SIZE)
+		{
+			// Nothing to write or close so there is no reason to wake up
+			if (self->pending_size == 0 && g_hash_table_size (files) == 0)
+			{
+				g_cond_wait (&self->cond, &self->lock);
+				continue;
+			}
+
+			if (deadline == 0)
+				deadline = g_get_monotonic_time () + FLUSH_INTERVAL;
+			if (!g_cond_wait_until (&self->cond, &self->lock, deadline))
+				break;
+		}
+
+		GHashTable *batch = NULL;
+		const guint64 serial = self->flush_requested;
+		const gboolean quit = self->quit;
+
+		if (self->pending_size)
+		{
+			batch = self->pending;
+			self->pending = new_pending_table ();
+			self->pending_size = 0;
+		}
+		g_mutex_unlock (&self->lock);
+
+		const gint64 now = g_get_monotonic_time ();
+		if (batch != NULL)
+		{
+			write_batch (self, files, batch, now);
+			g_hash_table_unref (batch);
+		}
+		close_files (self, files, now, quit);
+
+		g_mutex_lock (&self->lock);
+		self->flushed = serial;
+		g_cond_broadcast (&self->cond);
+		if (quit)
+			break;
+	}
+	g_mutex_unlock (&self->lock);
+
+	g_hash_table_unref (files);
+	return NULL;
+}
+
+typedef struct
+{
+	char *text;
+	time_t stamp;
+} BacklogLine;
+
+static void
+backlog_line_clear (BacklogLine *line)
+{
+	g_free (line->text);
+}
+
+static void
+collect_backlog_line (const char *text, time_t stamp, gpointer data)
+{
+	GArray *lines = data;
+	const BacklogLine line = { g_strdup (text), stamp };
+
+	g_array_append_val (lines, line);
+}
+
+static int
+compare_names_newest_first (gconstpointer a, gconstpointer b)
+{
+	return strcmp (*(const char**)b, *(const char**)a);
+}
+
+/**
+ * irc_logger_read_backlog:
+ * @ctx: Context to read the logs of
+ * @max_lines: Most lines to read
+ * @func: (scope call): Called for each line, oldest first
+ * @data: (closure func): User data
+ *
+ * Reads the last lines logged for @ctx, going back through older days as
+ * needed. Lines still waiting to be written are not included.
+ */
+void
+irc_logger_read_backlog (IrcLogger *self, IrcContext *ctx, guint max_lines, IrcLogFileLineFunc func, gpointer data)
+{
+	g_autofree char *today = irc_logger_get_path (self, ctx, 0);
+	g_autofree char *dirname = g_path_get_dirname (today);
+	g_autoptr(GDir) dir = g_dir_open (dirname, 0, NULL);
+	const char *name;
+
+	if (dir == NULL)
+		return;
+
+	g_autoptr(GPtrArray) names = g_ptr_array_new_with_free_func (g_free);
+	while ((name = g_dir_read_name (dir)) != NULL)
+	{
+		if (g_str_has_suffix (name, ".log"))
+			g_ptr_array_add (names, g_strdup (name));
+	}
+	g_ptr_array_sort (names, compare_names_newest_first);
+
+	// Days are read newest first so each one goes before what was read
+	g_autoptr(GArray) lines = g_array_new (FALSE, FALSE, sizeof(BacklogLine));
+	g_autoptr(GArray) day_lines = g_array_new (FALSE, FALSE, sizeof(BacklogLine));
+	g_array_set_clear_func (lines, (GDestroyNotify)backlog_line_clear);
+	for (guint i = 0; i < names->len && lines->len < max_lines; ++i)
+	{
+		g_autofree char *path = g_build_filename (dirname, g_ptr_array_index (names, i), NULL);
+		g_autoptr(IrcLogFile) file = irc_log_file_new (path, NULL);
+
+		if (file == NULL)
+			continue;
+
+		g_array_set_size (day_lines, 0);
+		irc_log_file_read_before (file, irc_log_file_get_size (file), max_lines - lines->len,
+								  collect_backlog_line, day_lines);
+		g_array_prepend_vals (lines, day_lines->data, day_lines->len);
+	}
+
+	for (guint i = 0; i < lines->len; ++i)
+	{
+		BacklogLine *line = &g_array_index (lines, BacklogLine, i);
+		func (line->text, line->stamp, data);
+	}
+}
+
+/**
+ * irc_logger_flush:
+ *
+ * Blocks until everything logged so far is written.
+ */
+void
+irc_logger_flush (IrcLogger *self)
+{
+	g_mutex_lock (&self->lock);
+
+	const guint64 serial = ++self->flush_requested;
+	g_cond_broadcast (&self->cond);
+	while (self->flushed < serial)
+		g_cond_wait (&self->cond, &self->lock);
+
+	g_mutex_unlock (&self->lock);
+}
+
+const char *
+irc_logger_get_directory (IrcLogger *self)
+{
+	return self->directory;
+}
+
+IrcLoggerSync
+irc_logger_get_sync (IrcLogger *self)
+{
+	return (IrcLoggerSync)g_atomic_int_get (&self->sync);
+}
+
+/**
+ * irc_logger_set_sync:
+ * @sync: When log files are synced to disk
+ */
+void
+irc_logger_set_sync (IrcLogger *self, IrcLoggerSync sync)
+{
+	if ((IrcLoggerSync)g_atomic_int_get (&self->sync) == sync)
+		return;
+
+	g_atomic_int_set (&self->sync, (gint)sync);
+	g_object_notify_by_pspec (G_OBJECT(self), obj_properties[PROP_SYNC]);
+}
+
+static void
+irc_logger_constructed (GObject *object)
+{
+	IrcLogger *self = IRC_LOGGER(object);
+
+	G_OBJECT_CLASS (irc_logger_parent_class)->constructed (object);
+
+	g_signal_connect_object (self->manager, "context-added", G_CALLBACK(on_context_added), self, 0);
+	g_signal_connect_object (self->manager, "context-removed", G_CALLBACK(on_context_removed), self, 0);
+	irc_context_manager_foreach_parent (self->manager, connect_parent_foreach, self);
+
+	self->thread = g_thread_new ("irc-logger", writer_thread, self);
+}
+
+static void
+irc_logger_finalize (GObject *object)
+{
+	IrcLogger *self = IRC_LOGGER(object);
+
+	// Handlers are gone by now so nothing else is queued
+	g_mutex_lock (&self->lock);
+	self->quit = TRUE;
+	g_cond_broadcast (&self->cond);
+	g_mutex_unlock (&self->lock);
+	g_thread_join (self->thread);
+
+	g_hash_table_unref (self->pending);
+	g_mutex_clear (&self->lock);
+	g_cond_clear (&self->cond);
+	g_clear_object (&self->manager);
+	g_free (self->directory);
+
+	G_OBJECT_CLASS (irc_logger_parent_class)->finalize (object);
+}
+
+static void
+irc_logger_get_property (GObject    *object,
+                         guint       prop_id,
+                         GValue     *value,
+                         GParamSpec *pspec)
+{
+	IrcLogger *self = IRC_LOGGER(object);
+
+	switch (prop_id)
+	{
+	case PROP_MANAGER:
+		g_value_set_object (value, self->manager);
+		break;
+	case PROP_DIRECTORY:
+		g_value_set_string (value, self->directory);
+		break;
+	case PROP_SYNC:
+		g_value_set_enum (value, (gint)irc_logger_get_sync (self));
+		break;
+	default:
+		G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+	}
+}
+
+static void
+irc_logger_set_property (GObject      *object,
+                         guint         prop_id,
+                         const GValue *value,
+                         GParamSpec   *pspec)
+{
+	IrcLogger *self = IRC_LOGGER(object);
+
+	switch (prop_id)
+	{
+	case PROP_MANAGER:
+		self->manager = g_value_dup_object (value);
+		break;
+	case PROP_DIRECTORY:
+		self->directory = g_value_dup_string (value);
+		break;
+	case PROP_SYNC:
+		irc_logger_set_sync (self, (IrcLoggerSync)g_value_get_enum (value));
+		break;
+	default:
+		G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+	}
+}
+
+static void
+irc_logger_class_init (IrcLoggerClass *klass)
+{
+	GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+	object_class->constructed = irc_logger_constructed;
+	object_class->finalize = irc_logger_finalize;
+	object_class->get_property = irc_logger_get_property;
+	object_class->set_property = irc_logger_set_property;
+
+	obj_properties[PROP_MANAGER] = g_param_spec_object ("manager", "Manager", "Manager whose contexts are logged",
+														IRC_TYPE_CONTEXT_MANAGER,
+														G_PARAM_READWRITE|G_PARAM_CONSTRUCT_ONLY|G_PARAM_STATIC_STRINGS);
+	obj_properties[PROP_DIRECTORY] = g_param_spec_string ("directory", "Directory", "Directory logs are written to",
+														  NULL,
+														  G_PARAM_READWRITE|G_PARAM_CONSTRUCT_ONLY|G_PARAM_STATIC_STRINGS);
+	obj_properties[PROP_SYNC] = g_param_spec_enum ("sync", "Sync", "When log files are synced to disk",
+												   IRC_TYPE_LOGGER_SYNC, IRC_LOGGER_SYNC_CLOSE,
+												   G_PARAM_READWRITE|G_PARAM_EXPLICIT_NOTIFY|G_PARAM_STATIC_STRINGS);
+
+	g_object_class_install_properties (object_class, N_PROPS, obj_properties);
+}
+
+static void
+irc_logger_init (IrcLogger *self)
+{
+	self->sync = IRC_LOGGER_SYNC_CLOSE;
+	self->pending = new_pending_table ();
+	g_mutex_init (&self->lock);
+	g_cond_init (&self->cond);
+}
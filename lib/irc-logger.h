@@ -0,0 +1,53 @@
+/* irc-logger.h
+ *
+ * Copyright (C) 2017 Patrick Griffis <tingping@tingping.se>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <gio/gio.h>
+#include "irc-context-manager.h"
+#include "irc-log-file.h"
+#include "irc-utils.h"
+
+G_BEGIN_DECLS
+
+/**
+ * IrcLoggerSync:
+ * @IRC_LOGGER_SYNC_NONE: Never fsync, leave it to the system
+ * @IRC_LOGGER_SYNC_CLOSE: fsync when a log file is closed
+ * @IRC_LOGGER_SYNC_FLUSH: fsync every file after each batch is written
+ */
+typedef enum
+{
+	IRC_LOGGER_SYNC_NONE,
+	IRC_LOGGER_SYNC_CLOSE,
+	IRC_LOGGER_SYNC_FLUSH,
+} IrcLoggerSync;
+
+#define IRC_TYPE_LOGGER (irc_logger_get_type())
+G_DECLARE_FINAL_TYPE (IrcLogger, irc_logger, IRC, LOGGER, GObject)
+
+IrcLogger *irc_logger_new (IrcContextManager *manager, const char *directory) NON_NULL() RETURNS_NON_NULL;
+const char *irc_logger_get_directory (IrcLogger *self) NON_NULL();
+void irc_logger_set_sync (IrcLogger *self, IrcLoggerSync sync) NON_NULL();
+IrcLoggerSync irc_logger_get_sync (IrcLogger *self) NON_NULL();
+char *irc_logger_get_path (IrcLogger *self, IrcContext *ctx, time_t stamp) NON_NULL() WARN_UNUSED_RESULT;
+void irc_logger_read_backlog (IrcLogger *self, IrcContext *ctx, guint max_lines,
+                              IrcLogFileLineFunc func, gpointer data) NON_NULL(1, 2, 4);
+void irc_logger_flush (IrcLogger *self) NON_NULL();
+
+G_END_DECLS
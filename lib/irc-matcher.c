@@ -0,0 +1,239 @@
+/* irc-matcher.c
+ *
+ * Copyright (C) 2017 Patrick Griffis <tingping@tingping.se>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include "irc-matcher.h"
+
+/**
+ * SECTION:irc-matcher
+ * @title: IrcMatcher
+ * @short_description: Looks for any of a set of words in a line
+ *
+ * The words are compiled into an Aho–Corasick automaton over bytes folded
+ * with irc_tolower() so a line is matched in a single pass regardless of
+ * how many words there are.
+ *
+ * A word only matches as a whole, where it begins or ends with a character
+ * that is valid in a nick the text next to it must not be one. So "Ann"
+ * matches "Ann: hi" and "<Ann>" but not "announce".
+ *
+ * The matcher is immutable, build a new one when the words change.
+ */
+
+struct _IrcMatcher
+{
+	gint ref_count;
+	guint8 classes[256]; // byte -> class, 0 for bytes in no word
+	guint n_classes;
+	guint n_states;
+	guint32 *delta; // n_states * n_classes transitions, state 0 is the root
+	guint32 *length; // Length of the word ending at a state, 0 if none does
+	guint32 *output; // Next state on the failure chain a word ends at
+};
+
+G_DEFINE_BOXED_TYPE (IrcMatcher, irc_matcher, irc_matcher_ref, irc_matcher_unref)
+
+static inline gboolean
+is_nick_char (guchar c)
+{
+	return g_ascii_isalnum (c) || c >= 0x80 || strchr ("[]\\`_^{|}-", c) != NULL;
+}
+
+static void
+build_classes (IrcMatcher *self, const char * const *words)
+{
+	guint8 folded[256] = { 0 };
+
+	self->n_classes = 1;
+	for (gsize i = 0; words && words[i]; ++i)
+	{
+		for (const char *p = words[i]; *p; ++p)
+		{
+			const guchar c = irc_tolower ((guchar)*p);
+			if (folded[c] == 0)
+				folded[c] = (guint8)self->n_classes++;
+		}
+	}
+
+	// Case variants of a byte share its class
+	for (guint c = 0; c < 256; ++c)
+		self->classes[c] = folded[irc_tolower ((guchar)c)];
+}
+
+static void
+build_trie (IrcMatcher *self, const char * const *words, GArray *delta, GArray *length)
+{
+	const guint32 zero = 0;
+
+	g_array_set_size (delta, self->n_classes);
+	g_array_append_val (length, zero);
+	self->n_states = 1;
+
+	for (gsize i = 0; words && words[i]; ++i)
+	{
+		guint32 state = 0;
+		guint32 len = 0;
+
+		for (const char *p = words[i]; *p; ++p, ++len)
+		{
+			const guint slot = state * self->n_classes + self->classes[(guchar)*p];
+			guint32 next = g_array_index (delta, guint32, slot);
+
+			if (next == 0)
+			{
+				next = self->n_states++;
+				g_array_index (delta, guint32, slot) = next;
+				g_array_set_size (delta, self->n_states * self->n_classes);
+				g_array_append_val (length, zero);
+			}
+			state = next;
+		}
+
+		// Empty words and duplicates leave nothing new behind
+		if (len > 0)
+			g_array_index (length, guint32, state) = len;
+	}
+}
+
+// Fills in the missing transitions breadth first so each byte is one lookup
+static void
+build_automaton (IrcMatcher *self)
+{
+	const guint n = self->n_classes;
+	g_autofree guint32 *fail = g_new0 (guint32, self->n_states);
+	g_autofree guint32 *queue = g_new (guint32, self->n_states);
+	guint head = 0, tail = 0;
+
+	self->output = g_new0 (guint32, self->n_states);
+
+	for (guint c = 0; c < n; ++c)
+	{
+		const guint32 child = self->delta[c];
+		if (child != 0)
+			queue[tail++] = child;
+	}
+
+	while (head < tail)
+	{
+		const guint32 state = queue[head++];
+
+		for (guint c = 0; c < n; ++c)
+		{
+			guint32 *slot = &self->delta[state * n + c];
+			const guint32 via_fail = self->delta[fail[state] * n + c];
+
+			if (*slot == 0)
+			{
+				*slot = via_fail;
+				continue;
+			}
+
+			fail[*slot] = via_fail;
+			self->output[*slot] = self->length[via_fail] ? via_fail : self->output[via_fail];
+			queue[tail++] = *slot;
+		}
+	}
+}
+
+/**
+ * irc_matcher_new:
+ * @words: (array zero-terminated=1) (nullable): Words to look for, empty
+ *   ones are ignored
+ *
+ * Returns: (transfer full): A new #IrcMatcher
+ */
+IrcMatcher *
+irc_matcher_new (const char * const *words)
+{
+	IrcMatcher *self = g_new0 (IrcMatcher, 1);
+	GArray *delta = g_array_new (FALSE, TRUE, sizeof(guint32));
+	GArray *length = g_array_new (FALSE, TRUE, sizeof(guint32));
+
+	self->ref_count = 1;
+	build_classes (self, words);
+	build_trie (self, words, delta, length);
+	self->delta = (guint32*)(void*)g_array_free (delta, FALSE);
+	self->length = (guint32*)(void*)g_array_free (length, FALSE);
+	build_automaton (self);
+
+	return self;
+}
+
+/**
+ * irc_matcher_ref:
+ *
+ * Returns: (transfer full): @self
+ */
+IrcMatcher *
+irc_matcher_ref (IrcMatcher *self)
+{
+	g_atomic_int_inc (&self->ref_count);
+	return self;
+}
+
+void
+irc_matcher_unref (IrcMatcher *self)
+{
+	if (g_atomic_int_dec_and_test (&self->ref_count))
+	{
+		g_free (self->delta);
+		g_free (self->length);
+		g_free (self->output);
+		g_free (self);
+	}
+}
+
+static inline gboolean
+is_boundary (const guchar *text, gsize start, gsize end)
+{
+	if (is_nick_char (text[start]) && start > 0 && is_nick_char (text[start - 1]))
+		return FALSE;
+	if (is_nick_char (text[end - 1]) && text[end] != '\0' && is_nick_char (text[end]))
+		return FALSE;
+	return TRUE;
+}
+
+/**
+ * irc_matcher_match:
+ * @text: Line to look in
+ *
+ * Returns: %TRUE if any of the words appear in @text as a whole word
+ */
+gboolean
+irc_matcher_match (IrcMatcher *self, const char *text)
+{
+	const guchar *p = (const guchar*)text;
+	const guint n = self->n_classes;
+	guint32 state = 0;
+
+	if (self->n_states == 1)
+		return FALSE;
+
+	for (gsize i = 0; p[i]; ++i)
+	{
+		state = self->delta[state * n + self->classes[p[i]]];
+
+		for (guint32 s = self->length[state] ? state : self->output[state]; s; s = self->output[s])
+		{
+			if (is_boundary (p, i + 1 - self->length[s], i + 1))
+				return TRUE;
+		}
+	}
+
+	return FALSE;
+}
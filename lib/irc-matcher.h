@@ -0,0 +1,38 @@
+/* irc-matcher.h
+ *
+ * Copyright (C) 2017 Patrick Griffis <tingping@tingping.se>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <glib-object.h>
+#include "irc-utils.h"
+
+G_BEGIN_DECLS
+
+typedef struct _IrcMatcher IrcMatcher;
+
+#define IRC_TYPE_MATCHER (irc_matcher_get_type())
+GType irc_matcher_get_type (void) G_GNUC_CONST;
+IrcMatcher *irc_matcher_new (const char * const *words) RETURNS_NON_NULL;
+IrcMatcher *irc_matcher_ref (IrcMatcher *self) NON_NULL();
+void irc_matcher_unref (IrcMatcher *self) NON_NULL();
+
+gboolean irc_matcher_match (IrcMatcher *self, const char *text) NON_NULL();
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC(IrcMatcher, irc_matcher_unref)
+
+G_END_DECLS
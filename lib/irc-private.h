@@ -18,6 +18,35 @@
 
 #pragma once
 
+#include <time.h>
 #include "irc-context.h"
 
 gboolean handle_command (IrcContext *ctx, const GStrv, const GStrv);
+void context_get_print_totals (guint64 *count, gint64 *time);
+
+// Byte at a time references for the vectorized irc-utils functions
+char *irc_strcasestr_scalar (const char *haystack, const char *needle);
+int irc_str_cmp_scalar (const char *s1, const char *s2);
+gboolean irc_str_has_prefix_scalar (const char *s1, const char *s2);
+guint32 irc_str_hash_scalar (const char *str);
+
+// Nanoseconds, g_get_monotonic_time() is too coarse to time single lines
+static inline gint64
+get_monotonic_ns (void)
+{
+	struct timespec ts;
+
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	return (gint64)ts.tv_sec * G_GINT64_CONSTANT(1000000000) + ts.tv_nsec;
+}
+
+// Sidecar index of a chat log, an entry every LOG_INDEX_INTERVAL messages
+// pointing at the start of a line
+#define LOG_INDEX_SUFFIX ".idx"
+#define LOG_INDEX_INTERVAL 64
+
+typedef struct
+{
+	gint64 time;
+	guint64 offset;
+} LogIndexEntry;
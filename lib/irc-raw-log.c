@@ -0,0 +1,471 @@
+/* irc-raw-log.c
+ *
+ * Copyright (C) 2017 Patrick Griffis <tingping@tingping.se>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include "irc-raw-log.h"
+
+/**
+ * SECTION:irc-raw-log
+ * @title: IrcRawLog
+ * @short_description: Recent raw traffic of a server
+ *
+ * Keeps the last lines sent and received in a ring buffer. Optionally they
+ * are also echoed to stdout or written to a file. File writes are batched
+ * and done in a thread, once the file grows past its maximum size it is
+ * moved to `<name>.1` and a new one is started.
+ *
+ * The parameters of PASS, OPER and AUTHENTICATE are hidden before a line is
+ * stored so passwords don't end up on screen or on disk.
+ *
+ * It is not thread safe, only append from one thread.
+ */
+
+#define FLUSH_SIZE (64 * 1024)
+
+typedef struct
+{
+	gint64 time;
+	char *line;
+	IrcRawLogDirection direction;
+} Entry;
+
+struct _IrcRawLog
+{
+	gint ref_count;
+	Entry *entries;
+	guint capacity;
+	guint head; // Oldest entry
+	guint n_entries;
+	gboolean echo;
+
+	// File sink, out is lent to the write job while writing is set
+	GFile *file;
+	GOutputStream *out;
+	goffset size;
+	goffset max_size;
+	gboolean to_file;
+
+	GString *pending;
+	gboolean writing;
+	guint flush_id;
+};
+
+// Everything the thread touches, the stream goes back to the log once it is done
+typedef struct
+{
+	GFile *file;
+	GOutputStream *out;
+	goffset size;
+	goffset max_size;
+	GBytes *bytes;
+} WriteJob;
+
+G_DEFINE_BOXED_TYPE (IrcRawLog, irc_raw_log, irc_raw_log_ref, irc_raw_log_unref)
+
+/**
+ * irc_raw_log_new:
+ * @capacity: How many lines to keep
+ *
+ * Returns: (transfer full): A new empty #IrcRawLog
+ */
+IrcRawLog *
+irc_raw_log_new (guint capacity)
+{
+	IrcRawLog *self = g_new0 (IrcRawLog, 1);
+
+	g_warn_if_fail (capacity > 0);
+
+	self->ref_count = 1;
+	self->capacity = MAX(capacity, 1);
+	self->entries = g_new0 (Entry, capacity);
+	self->pending = g_string_new (NULL);
+
+	return self;
+}
+
+/**
+ * irc_raw_log_ref:
+ *
+ * Returns: (transfer full): @self
+ */
+IrcRawLog *
+irc_raw_log_ref (IrcRawLog *self)
+{
+	g_atomic_int_inc (&self->ref_count);
+	return self;
+}
+
+static void
+close_file (IrcRawLog *self)
+{
+	g_autoptr(GError) err = NULL;
+
+	if (self->out != NULL &&
+		(!g_output_stream_write_all (self->out, self->pending->str, self->pending->len, NULL, NULL, &err) ||
+		 !g_output_stream_close (self->out, NULL, &err)))
+		g_warning ("Failed to write raw log: %s", err->message);
+
+	g_clear_object (&self->out);
+	g_clear_object (&self->file);
+	g_string_truncate (self->pending, 0);
+	self->to_file = FALSE;
+}
+
+static GOutputStream *
+open_file (GFile *file, goffset *size, GError **error)
+{
+	GFileOutputStream *out = g_file_append_to (file, G_FILE_CREATE_PRIVATE, NULL, error);
+	if (out == NULL)
+		return NULL;
+
+	g_autoptr(GFileInfo) info = g_file_query_info (file, G_FILE_ATTRIBUTE_STANDARD_SIZE,
+												   G_FILE_QUERY_INFO_NONE, NULL, NULL);
+	*size = info ? g_file_info_get_size (info) : 0;
+	return G_OUTPUT_STREAM(out);
+}
+
+void
+irc_raw_log_unref (IrcRawLog *self)
+{
+	if (g_atomic_int_dec_and_test (&self->ref_count))
+	{
+		// Writes and the flush timeout hold a reference so neither is pending
+		close_file (self);
+
+		for (guint i = 0; i < self->capacity; ++i)
+			g_free (self->entries[i].line);
+		g_free (self->entries);
+		g_string_free (self->pending, TRUE);
+		g_free (self);
+	}
+}
+
+static gboolean
+rotate_file (WriteJob *job, GError **error)
+{
+	g_autoptr(GFile) parent = g_file_get_parent (job->file);
+	g_autofree char *basename = g_file_get_basename (job->file);
+	g_autofree char *old_basename = g_strconcat (basename, ".1", NULL);
+	g_autoptr(GFile) old_file = g_file_get_child (parent, old_basename);
+
+	if (!g_output_stream_close (job->out, NULL, error))
+		return FALSE;
+	g_clear_object (&job->out);
+
+	if (!g_file_move (job->file, old_file, G_FILE_COPY_OVERWRITE, NULL, NULL, NULL, error))
+		return FALSE;
+
+	job->out = open_file (job->file, &job->size, error);
+	return job->out != NULL;
+}
+
+static void
+write_job_free (gpointer data)
+{
+	WriteJob *job = data;
+
+	g_clear_object (&job->out);
+	g_object_unref (job->file);
+	g_bytes_unref (job->bytes);
+	g_free (job);
+}
+
+static void
+write_thread (GTask *task, gpointer source, gpointer data, GCancellable *cancellable)
+{
+	WriteJob *job = data;
+	GError *err = NULL;
+	gsize len;
+	gconstpointer buf = g_bytes_get_data (job->bytes, &len);
+
+	if (!g_output_stream_write_all (job->out, buf, len, NULL, NULL, &err))
+	{
+		g_task_return_error (task, err);
+		return;
+	}
+
+	job->size += (goffset)len;
+	if (job->size > job->max_size && !rotate_file (job, &err))
+	{
+		g_task_return_error (task, err);
+		return;
+	}
+
+	g_task_return_boolean (task, TRUE);
+}
+
+static void schedule_flush (IrcRawLog *self);
+
+static void
+on_write_done (GObject *source, GAsyncResult *res, gpointer data)
+{
+	IrcRawLog *self = data;
+	WriteJob *job = g_task_get_task_data (G_TASK(res));
+	g_autoptr(GError) err = NULL;
+
+	self->writing = FALSE;
+	if (!g_task_propagate_boolean (G_TASK(res), &err))
+	{
+		g_warning ("Failed to write raw log, stopping: %s", err->message);
+		g_clear_object (&self->file);
+		g_string_truncate (self->pending, 0);
+		self->to_file = FALSE;
+	}
+	else
+	{
+		// A rotation may have replaced the stream
+		self->out = g_steal_pointer (&job->out);
+		self->size = job->size;
+		if (self->pending->len)
+			schedule_flush (self);
+	}
+
+	irc_raw_log_unref (self);
+}
+
+static void
+flush_pending (IrcRawLog *self)
+{
+	if (self->writing || !self->to_file || self->pending->len == 0)
+		return;
+
+	WriteJob *job = g_new (WriteJob, 1);
+	job->file = g_object_ref (self->file);
+	job->out = g_steal_pointer (&self->out);
+	job->size = self->size;
+	job->max_size = self->max_size;
+	job->bytes = g_bytes_new (self->pending->str, self->pending->len);
+	g_string_truncate (self->pending, 0);
+	self->writing = TRUE;
+
+	// The callback holds the reference, the thread is done before it runs
+	GTask *task = g_task_new (NULL, NULL, on_write_done, irc_raw_log_ref (self));
+	g_task_set_task_data (task, job, write_job_free);
+	g_task_run_in_thread (task, write_thread);
+	g_object_unref (task);
+}
+
+static gboolean
+on_flush_timeout (gpointer data)
+{
+	IrcRawLog *self = data;
+
+	self->flush_id = 0;
+	flush_pending (self);
+	return G_SOURCE_REMOVE;
+}
+
+static void
+schedule_flush (IrcRawLog *self)
+{
+	if (self->pending->len >= FLUSH_SIZE)
+		flush_pending (self);
+	else if (self->flush_id == 0)
+		self->flush_id = g_timeout_add_seconds_full (G_PRIORITY_LOW, 1, on_flush_timeout,
+													 irc_raw_log_ref (self), (GDestroyNotify)irc_raw_log_unref);
+}
+
+static const char *
+skip_word (const char *p, const char *end)
+{
+	while (p < end && *p != ' ')
+		++p;
+	while (p < end && *p == ' ')
+		++p;
+
+	return p;
+}
+
+static gboolean
+is_secret_command (const char *command, gsize len)
+{
+	static const char * const commands[] = { "PASS", "OPER", "AUTHENTICATE" };
+
+	for (gsize i = 0; i < G_N_ELEMENTS(commands); ++i)
+	{
+		if (len == strlen (commands[i]) && g_ascii_strncasecmp (command, commands[i], len) == 0)
+			return TRUE;
+	}
+
+	return FALSE;
+}
+
+// Appends one line, hiding the parameters of commands that carry passwords
+static void
+append_redacted (GString *out, const char *line, const char *end)
+{
+	const char *command = line;
+
+	if (command < end && *command == '@')
+		command = skip_word (command, end);
+	if (command < end && *command == ':')
+		command = skip_word (command, end);
+
+	const char *params = skip_word (command, end);
+	const char *command_end = params;
+	while (command_end > command && command_end[-1] == ' ')
+		--command_end;
+
+	const gboolean cr = end > line && end[-1] == '\r';
+	const char *params_end = cr ? end - 1 : end;
+	const gsize params_len = (gsize)(params_end - params);
+
+	// SASL continuations and aborts are fine to show
+	if (!is_secret_command (command, (gsize)(command_end - command)) || params_len == 0 ||
+	    (params_len == 1 && (*params == '+' || *params == '*')))
+	{
+		g_string_append_len (out, line, end - line);
+		return;
+	}
+
+	g_string_append_len (out, line, params - line);
+	g_string_append (out, "<hidden>");
+	if (cr)
+		g_string_append_c (out, '\r');
+}
+
+static char *
+redact_line (const char *line, gsize len)
+{
+	const char *end = line + len;
+	GString *out = g_string_sized_new (len);
+
+	// One write may hold several lines
+	while (TRUE)
+	{
+		const char *eol = memchr (line, '\n', (gsize)(end - line));
+
+		append_redacted (out, line, eol ? eol : end);
+		if (eol == NULL)
+			break;
+
+		g_string_append_c (out, '\n');
+		line = eol + 1;
+	}
+
+	return g_string_free (out, FALSE);
+}
+
+/**
+ * irc_raw_log_append:
+ * @line: Line without the trailing newline
+ * @len: Length of @line or -1 if nul terminated
+ */
+void
+irc_raw_log_append (IrcRawLog *self, IrcRawLogDirection direction, const char *line, gssize len)
+{
+	Entry *entry;
+
+	if (self->n_entries < self->capacity)
+		entry = &self->entries[(self->head + self->n_entries++) % self->capacity];
+	else
+	{
+		entry = &self->entries[self->head];
+		self->head = (self->head + 1) % self->capacity;
+		g_free (entry->line);
+	}
+
+	const char *arrow = direction == IRC_RAW_LOG_INBOUND ? ">>" : "<<";
+
+	entry->time = g_get_real_time ();
+	entry->line = redact_line (line, len < 0 ? strlen (line) : (gsize)len);
+	entry->direction = direction;
+
+	if (self->echo)
+	{
+		g_print ("\033[%dm%s\033[0m %s\n", direction == IRC_RAW_LOG_INBOUND ? 32 : 31, arrow, entry->line);
+	}
+
+	if (self->to_file)
+	{
+		g_autoptr(GDateTime) time = g_date_time_new_from_unix_local (entry->time / G_USEC_PER_SEC);
+		g_autofree char *stamp = g_date_time_format (time, "%F %T");
+
+		g_string_append_printf (self->pending, "%s.%06"G_GINT64_FORMAT" %s %s\n", stamp,
+								entry->time % G_USEC_PER_SEC, arrow, entry->line);
+		schedule_flush (self);
+	}
+}
+
+guint
+irc_raw_log_get_n_lines (IrcRawLog *self)
+{
+	return self->n_entries;
+}
+
+/**
+ * irc_raw_log_get_line:
+ * @i: Line number, 0 is the oldest line kept
+ * @direction: (out) (optional): Direction of the line
+ * @time: (out) (optional): When the line was logged, see g_get_real_time()
+ *
+ * Returns: (transfer none): The line, valid until the next append
+ */
+const char *
+irc_raw_log_get_line (IrcRawLog *self, guint i, IrcRawLogDirection *direction, gint64 *time)
+{
+	g_return_val_if_fail (i < self->n_entries, NULL);
+
+	Entry *entry = &self->entries[(self->head + i) % self->capacity];
+
+	if (direction)
+		*direction = entry->direction;
+	if (time)
+		*time = entry->time;
+	return entry->line;
+}
+
+/**
+ * irc_raw_log_set_echo:
+ * @echo: If every line is printed with g_print()
+ */
+void
+irc_raw_log_set_echo (IrcRawLog *self, gboolean echo)
+{
+	self->echo = echo;
+}
+
+/**
+ * irc_raw_log_set_file:
+ * @file: (nullable): File to append lines to or %NULL to stop
+ * @max_size: Size at which the file is rotated
+ *
+ * The file is written in a thread so this can't be called while a write
+ * is in progress, usually it is set once before anything is logged.
+ *
+ * Returns: %TRUE if @file was opened
+ */
+gboolean
+irc_raw_log_set_file (IrcRawLog *self, GFile *file, goffset max_size, GError **error)
+{
+	g_return_val_if_fail (!self->writing, FALSE);
+
+	close_file (self);
+
+	if (file == NULL)
+		return TRUE;
+
+	self->out = open_file (file, &self->size, error);
+	if (self->out == NULL)
+		return FALSE;
+
+	self->file = g_object_ref (file);
+	self->max_size = max_size;
+	self->to_file = TRUE;
+	return TRUE;
+}
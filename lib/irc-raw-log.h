@@ -0,0 +1,53 @@
+/* irc-raw-log.h
+ *
+ * Copyright (C) 2017 Patrick Griffis <tingping@tingping.se>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <gio/gio.h>
+#include "irc-utils.h"
+
+G_BEGIN_DECLS
+
+/**
+ * IrcRawLogDirection:
+ * @IRC_RAW_LOG_INBOUND: Line received from the server
+ * @IRC_RAW_LOG_OUTBOUND: Line sent to the server
+ */
+typedef enum
+{
+	IRC_RAW_LOG_INBOUND,
+	IRC_RAW_LOG_OUTBOUND,
+} IrcRawLogDirection;
+
+typedef struct _IrcRawLog IrcRawLog;
+
+#define IRC_TYPE_RAW_LOG (irc_raw_log_get_type())
+GType irc_raw_log_get_type (void) G_GNUC_CONST;
+IrcRawLog *irc_raw_log_new (guint capacity) RETURNS_NON_NULL;
+IrcRawLog *irc_raw_log_ref (IrcRawLog *self) NON_NULL();
+void irc_raw_log_unref (IrcRawLog *self) NON_NULL();
+
+void irc_raw_log_append (IrcRawLog *self, IrcRawLogDirection direction, const char *line, gssize len) NON_NULL();
+guint irc_raw_log_get_n_lines (IrcRawLog *self) NON_NULL();
+const char *irc_raw_log_get_line (IrcRawLog *self, guint i, IrcRawLogDirection *direction, gint64 *time) NON_NULL(1);
+void irc_raw_log_set_echo (IrcRawLog *self, gboolean echo) NON_NULL();
+gboolean irc_raw_log_set_file (IrcRawLog *self, GFile *file, goffset max_size, GError **error) NON_NULL(1);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC(IrcRawLog, irc_raw_log_unref)
+
+G_END_DECLS
@@ -0,0 +1,337 @@
+/* irc-search-index.c
+ *
+ * Copyright (C) 2017 Patrick Griffis <tingping@tingping.se>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include "irc-search-index.h"
+
+/**
+ * SECTION:irc-search-index
+ * @title: IrcSearchIndex
+ * @short_description: Trigram index over the scrollback of a context
+ *
+ * Every line printed to a context is stripped of attributes, casefolded and
+ * stored along with the trigrams it contains. A search then only has to
+ * verify the lines listed for the rarest trigram of the needle.
+ *
+ * Lines are numbered in the order they were appended in, starting from 0.
+ * Text containing newlines is split into one line per non-empty part, the
+ * same way the client displays it.
+ *
+ * Only the last lines are kept, see irc_search_index_set_max_lines(). The
+ * rest keep their numbers when the oldest are dropped, so
+ * irc_search_index_get_first_line() tells what can still be found.
+ *
+ * The index is locked internally so it may be searched from another thread.
+ */
+
+struct _IrcSearchIndex
+{
+	gint ref_count;
+	GMutex lock;
+	GPtrArray *lines;
+	GHashTable *postings; // trigram -> GArray of guint line numbers, counted from the first ever appended
+	guint first_line; // Number of lines[0]
+	guint max_lines;
+};
+
+G_DEFINE_BOXED_TYPE (IrcSearchIndex, irc_search_index, irc_search_index_ref, irc_search_index_unref)
+
+#define DEFAULT_MAX_LINES 20000
+
+#define TRIGRAM(p) GUINT_TO_POINTER(((guint)(guchar)(p)[0] << 16) | ((guint)(guchar)(p)[1] << 8) | (guint)(guchar)(p)[2])
+
+/**
+ * irc_search_index_new:
+ *
+ * Returns: (transfer full): A new empty #IrcSearchIndex
+ */
+IrcSearchIndex *
+irc_search_index_new (void)
+{
+	IrcSearchIndex *self = g_new0 (IrcSearchIndex, 1);
+
+	self->ref_count = 1;
+	g_mutex_init (&self->lock);
+	self->lines = g_ptr_array_new_with_free_func (g_free);
+	self->postings = g_hash_table_new_full (NULL, NULL, NULL, (GDestroyNotify)g_array_unref);
+	self->max_lines = DEFAULT_MAX_LINES;
+
+	return self;
+}
+
+/**
+ * irc_search_index_ref:
+ *
+ * Returns: (transfer full): @self
+ */
+IrcSearchIndex *
+irc_search_index_ref (IrcSearchIndex *self)
+{
+	g_atomic_int_inc (&self->ref_count);
+	return self;
+}
+
+void
+irc_search_index_unref (IrcSearchIndex *self)
+{
+	if (g_atomic_int_dec_and_test (&self->ref_count))
+	{
+		g_ptr_array_unref (self->lines);
+		g_hash_table_unref (self->postings);
+		g_mutex_clear (&self->lock);
+		g_free (self);
+	}
+}
+
+static void
+index_line (IrcSearchIndex *self, const char *line, gboolean searchable)
+{
+	if (!searchable)
+	{
+		// Keeps the numbering but can't match anything
+		g_ptr_array_add (self->lines, g_strdup (""));
+		return;
+	}
+
+	g_autofree char *stripped = irc_has_attributes (line) ? irc_strip_attributes (line) : NULL;
+	char *folded = g_utf8_casefold (stripped ? stripped : line, -1);
+	const guint line_no = self->first_line + self->lines->len;
+	const gsize len = strlen (folded);
+
+	g_ptr_array_add (self->lines, folded);
+
+	for (gsize i = 0; i + 3 <= len; ++i)
+	{
+		gpointer key = TRIGRAM(folded + i);
+		GArray *postings = g_hash_table_lookup (self->postings, key);
+
+		if (postings == NULL)
+		{
+			postings = g_array_sized_new (FALSE, FALSE, sizeof(guint), 4);
+			g_hash_table_insert (self->postings, key, postings);
+		}
+		else if (g_array_index (postings, guint, postings->len - 1) == line_no)
+			continue; // Trigram repeated within this line
+
+		g_array_append_val (postings, line_no);
+	}
+}
+
+// Drops the oldest n lines and their postings
+static void
+prune_lines (IrcSearchIndex *self, guint n)
+{
+	GHashTableIter iter;
+	gpointer value;
+
+	g_ptr_array_remove_range (self->lines, 0, n);
+	self->first_line += n;
+
+	g_hash_table_iter_init (&iter, self->postings);
+	while (g_hash_table_iter_next (&iter, NULL, &value))
+	{
+		GArray *postings = value;
+		guint stale = 0;
+
+		while (stale < postings->len && g_array_index (postings, guint, stale) < self->first_line)
+			++stale;
+
+		if (stale == postings->len)
+			g_hash_table_iter_remove (&iter);
+		else if (stale)
+			g_array_remove_range (postings, 0, stale);
+	}
+}
+
+// Pruning a little more than needed means postings aren't rewritten on every line
+static void
+prune_excess (IrcSearchIndex *self)
+{
+	if (self->lines->len > self->max_lines)
+		prune_lines (self, self->lines->len - self->max_lines + self->max_lines / 8);
+}
+
+static void
+append_lines (IrcSearchIndex *self, const char *text, gboolean searchable)
+{
+	g_mutex_lock (&self->lock);
+
+	if (G_UNLIKELY(strchr (text, '\n') != NULL || strchr (text, '\r') != NULL))
+	{
+		g_auto(GStrv) lines = g_strsplit_set (text, "\r\n", 0);
+		for (gsize i = 0; lines[i]; ++i)
+		{
+			if (*lines[i])
+				index_line (self, lines[i], searchable);
+		}
+	}
+	else
+	{
+		index_line (self, text, searchable);
+	}
+
+	prune_excess (self);
+	g_mutex_unlock (&self->lock);
+}
+
+/**
+ * irc_search_index_append:
+ * @text: Text as printed to the context
+ *
+ * Indexes @text, one line per non-empty line it contains.
+ */
+void
+irc_search_index_append (IrcSearchIndex *self, const char *text)
+{
+	append_lines (self, text, TRUE);
+}
+
+/**
+ * irc_search_index_skip:
+ * @text: Text as printed to the context
+ *
+ * Counts the lines of @text without storing them, for lines that are shown
+ * but should never be found.
+ */
+void
+irc_search_index_skip (IrcSearchIndex *self, const char *text)
+{
+	append_lines (self, text, FALSE);
+}
+
+/**
+ * irc_search_index_clear:
+ *
+ * Forgets every indexed line.
+ */
+void
+irc_search_index_clear (IrcSearchIndex *self)
+{
+	g_mutex_lock (&self->lock);
+	g_ptr_array_set_size (self->lines, 0);
+	g_hash_table_remove_all (self->postings);
+	self->first_line = 0;
+	g_mutex_unlock (&self->lock);
+}
+
+/**
+ * irc_search_index_set_max_lines:
+ * @max_lines: Most lines to keep, the oldest are dropped first
+ */
+void
+irc_search_index_set_max_lines (IrcSearchIndex *self, guint max_lines)
+{
+	g_return_if_fail (max_lines > 0);
+
+	g_mutex_lock (&self->lock);
+	self->max_lines = max_lines;
+	prune_excess (self);
+	g_mutex_unlock (&self->lock);
+}
+
+/**
+ * irc_search_index_get_n_lines:
+ *
+ * Returns: Number of lines kept
+ */
+guint
+irc_search_index_get_n_lines (IrcSearchIndex *self)
+{
+	g_mutex_lock (&self->lock);
+	const guint n_lines = self->lines->len;
+	g_mutex_unlock (&self->lock);
+
+	return n_lines;
+}
+
+/**
+ * irc_search_index_get_first_line:
+ *
+ * Returns: Number of the oldest line kept
+ */
+guint
+irc_search_index_get_first_line (IrcSearchIndex *self)
+{
+	g_mutex_lock (&self->lock);
+	const guint first_line = self->first_line;
+	g_mutex_unlock (&self->lock);
+
+	return first_line;
+}
+
+/**
+ * irc_search_index_search:
+ * @needle: Text to look for, case is ignored
+ *
+ * Returns: (transfer full) (element-type guint): Sorted numbers of the kept lines containing @needle
+ */
+GArray *
+irc_search_index_search (IrcSearchIndex *self, const char *needle)
+{
+	g_autofree char *folded = g_utf8_casefold (needle, -1);
+	const gsize len = strlen (folded);
+	GArray *matches = g_array_new (FALSE, FALSE, sizeof(guint));
+
+	if (len == 0)
+		return matches;
+
+	g_mutex_lock (&self->lock);
+
+	if (len < 3)
+	{
+		// Too short to have a trigram, every line is a candidate
+		for (guint i = 0; i < self->lines->len; ++i)
+		{
+			if (strstr (g_ptr_array_index (self->lines, i), folded) != NULL)
+			{
+				const guint line_no = self->first_line + i;
+				g_array_append_val (matches, line_no);
+			}
+		}
+	}
+	else
+	{
+		GArray *candidates = NULL;
+
+		for (gsize i = 0; i + 3 <= len; ++i)
+		{
+			GArray *postings = g_hash_table_lookup (self->postings, TRIGRAM(folded + i));
+
+			if (postings == NULL)
+			{
+				// No line contains this trigram so nothing can match
+				candidates = NULL;
+				break;
+			}
+			if (candidates == NULL || postings->len < candidates->len)
+				candidates = postings;
+		}
+
+		for (guint i = 0; candidates != NULL && i < candidates->len; ++i)
+		{
+			const guint line_no = g_array_index (candidates, guint, i);
+
+			if (strstr (g_ptr_array_index (self->lines, line_no - self->first_line), folded) != NULL)
+				g_array_append_val (matches, line_no);
+		}
+	}
+
+	g_mutex_unlock (&self->lock);
+
+	return matches;
+}
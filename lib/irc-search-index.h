@@ -0,0 +1,44 @@
+/* irc-search-index.h
+ *
+ * Copyright (C) 2017 Patrick Griffis <tingping@tingping.se>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <glib-object.h>
+#include "irc-utils.h"
+
+G_BEGIN_DECLS
+
+typedef struct _IrcSearchIndex IrcSearchIndex;
+
+#define IRC_TYPE_SEARCH_INDEX (irc_search_index_get_type())
+GType irc_search_index_get_type (void) G_GNUC_CONST;
+IrcSearchIndex *irc_search_index_new (void) RETURNS_NON_NULL;
+IrcSearchIndex *irc_search_index_ref (IrcSearchIndex *self) NON_NULL();
+void irc_search_index_unref (IrcSearchIndex *self) NON_NULL();
+
+void irc_search_index_append (IrcSearchIndex *self, const char *text) NON_NULL();
+void irc_search_index_skip (IrcSearchIndex *self, const char *text) NON_NULL();
+void irc_search_index_clear (IrcSearchIndex *self) NON_NULL();
+void irc_search_index_set_max_lines (IrcSearchIndex *self, guint max_lines) NON_NULL();
+guint irc_search_index_get_n_lines (IrcSearchIndex *self) NON_NULL();
+guint irc_search_index_get_first_line (IrcSearchIndex *self) NON_NULL();
+GArray *irc_search_index_search (IrcSearchIndex *self, const char *needle) NON_NULL() WARN_UNUSED_RESULT;
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC(IrcSearchIndex, irc_search_index_unref)
+
+G_END_DECLS
@@ -23,12 +23,16 @@
 #include "irc-context-action.h"
 #include "irc-context-manager.h"
 #include "irc-context.h"
+#include "irc-converter.h"
 #include "irc-user.h"
 #include "irc-channel.h"
 #include "irc-server.h"
+#include "irc-matcher.h"
 #include "irc-message.h"
 #include "irc-query.h"
 #include "irc-utils.h"
+#include "irc-private.h"
+#include "irc-trace.h"
 #include "irc-enumtypes.h"
 #include "irc-marshal.h"
 
@@ -38,28 +42,88 @@ struct _IrcServerClass
 	gboolean (*inbound_line)(IrcServer *self, const char *line);
 };
 
+#define RAW_LOG_LINES 1000
+#define RAW_LOG_MAX_SIZE (10 * 1024 * 1024)
+#define STATS_N_BUCKETS 16
+#define STATS_MAX_COMMANDS 256
+#define DEFAULT_LINE_LEN 512 // Including CRLF
+#define MAX_USERHOST_LEN (2 + 10 + 1 + 63) // "!~user@host" at common limits, until ours is known
+#define WHO_MAX_USERS 2000 // Bigger channels cost more than the details are worth
+#define WHO_TIMEOUT 60 // Seconds without a 315 before the next WHO goes anyway
+#define WHO_RETRY_DELAY 10 // Seconds, after RPL_TRYAGAIN
+#define RECONNECT_MIN_DELAY 2 // Seconds, doubled after each failed attempt
+#define RECONNECT_MAX_DELAY 300
+
+/*
+ * How long handling one command or numeric took, in nanoseconds. The
+ * histogram counts the total time of each line in power of two microseconds,
+ * the last bucket holds everything slower.
+ */
+typedef struct
+{
+	guint64 count;
+	guint64 bytes;
+	guint64 prints;
+	gint64 parse_time;
+	gint64 dispatch_time;
+	gint64 print_time;
+	gint64 max_time;
+	guint64 histogram[STATS_N_BUCKETS];
+} IrcServerStat;
+
+typedef struct
+{
+	gint64 time; // When it was queued
+	gsize len; // Including the CRLF once sent
+	char line[];
+} QueuedLine;
+
+typedef enum
+{
+	ENCODING_UTF8, // Valid lines are passed through untouched
+	ENCODING_ICONV, // Converted with decoder and encoder
+} Encoding;
+
 typedef struct
 {
-  	GIConv in_decoder;
-	GIConv out_encoder;
+	Encoding encoding_kind;
+	IrcConverter *decoder;
+	IrcConverter *encoder;
 	char *host;
 	char *network_name;
 	GSettings *settings;
 	GSocketClient *socket;
 	GSocketConnection *conn;
 	GHashTable *usertable;
+	GHashTable *stale_users; // Nick -> IrcUser still listed from the last connection, until NAMES has them again
 	GHashTable *chantable;
 	GHashTable *querytable;
 	IrcUser *me;
+	IrcMatcher *highlight; // Built on first use from the nick and highlight words
   	GCancellable *connect_cancel;
 	GCancellable *read_cancel;
+	guint reconnect_id;
+	guint reconnect_attempts;
+	gboolean registered; // Got the end of the MOTD on this connection, a later /MOTD sends it again
 	char *nick_prefixes;
 	char *nick_modes;
 	char *chan_types;
   	char *chan_modes;
 	char *statusmsg;
 	char *encoding;
+	GQueue *who_queue; // Channel names waiting on a WHO
+	char *who_pending; // Channel with a WHO in flight
+	GHashTable *who_batch; // IrcUser with frozen notifications -> if it changed
+	guint who_id; // Sends the next WHO, or gives up on the one in flight
+	GHashTable *known_users; // Set of IrcUser with account and realname from this connection
+	GHashTable *targmax; // Command -> most targets, 0 for no limit
+	guint monitor_limit; // 0 for no limit
+	guint line_len;
 	GQueue *sendq;
+	IrcRawLog *raw_log;
+	GHashTable *stats; // command -> IrcServerStat
+	GOutputStream *capture;
+	gint64 capture_start;
 	char *casemapping;
 	gboolean (*str_equal) (const char *, const char *);
 	guint32 (*str_hash) (const char *);
@@ -73,12 +137,18 @@ typedef struct
 	gboolean have_cert;
 
 	guint has_sendq;
+	guint sendq_max_depth;
+	guint64 sendq_lines;
+	gint64 sendq_wait; // Microseconds
+	gint64 sendq_max_wait;
 	guint caps;
   	guint16 port;
 } IrcServerPrivate;
 
 enum {
 	CONNECTED,
+	READY,
+	USERS_UPDATED,
 	INBOUND,
 	N_SIGNALS
 };
@@ -143,7 +213,12 @@ on_user_unref (gpointer data, GObject *obj, gboolean is_last_ref)
 
 	if (is_last_ref)
 	{
-		g_hash_table_remove (priv->usertable, user->nick);
+		// Another user may have its nick by now
+		if (g_hash_table_lookup (priv->usertable, user->nick) == user)
+			g_hash_table_remove (priv->usertable, user->nick);
+		if (g_hash_table_lookup (priv->stale_users, user->nick) == user)
+			g_hash_table_remove (priv->stale_users, user->nick);
+		g_hash_table_remove (priv->known_users, user);
 		g_object_unref (user);
 	}
 }
@@ -171,6 +246,30 @@ usertable_lookup (IrcServer *self, const char *nick)
 	return user;
 }
 
+// Users from the last connection are only trusted again once a channel lists them
+static void
+stale_users_foreach (gpointer key, gpointer value, gpointer data)
+{
+	GHashTable *stale_users = data;
+
+	g_hash_table_replace (stale_users, IRC_USER(value)->nick, value);
+}
+
+static IrcUser *
+revive_stale_user (IrcServer *self, const char *nick)
+{
+	IrcServerPrivate *priv = irc_server_get_instance_private (self);
+
+	IrcUser *user = g_hash_table_lookup (priv->stale_users, nick);
+	if (user == NULL)
+		return NULL;
+
+	g_hash_table_steal (priv->stale_users, nick);
+	if (!g_hash_table_replace (priv->usertable, user->nick, user))
+		g_warning ("User (%s) was already in the user table?", user->nick);
+	return g_object_ref (user);
+}
+
 
 static char *
 nick_from_host (const char *host)
@@ -184,6 +283,20 @@ nick_from_host (const char *host)
 		return g_strndup (host, (guintptr)p - (guintptr)host);
 }
 
+// Takes the username and hostname from "nick!user@host"
+static void
+update_userhost (IrcUser *user, const char *host)
+{
+	const char *bang = strchr (host, '!');
+	const char *at = bang ? strchr (bang, '@') : NULL;
+
+	if (at == NULL)
+		return;
+
+	g_autofree char *username = g_strndup (bang + 1, (gsize)(at - bang - 1));
+	g_object_set (user, "username", username, "hostname", at + 1, NULL);
+}
+
 static void
 inbound_ctcp (IrcServer *self, IrcMessage *msg)
 {
@@ -245,6 +358,39 @@ show_notification (IrcContext *ctx, const char *title, const char *body)
 #endif
 }
 
+static IrcMatcher *
+get_highlight (IrcServer *self)
+{
+	IrcServerPrivate *priv = irc_server_get_instance_private (self);
+
+	if (priv->highlight == NULL)
+	{
+		g_auto(GStrv) words = g_settings_get_strv (priv->settings, "highlight-words");
+		g_autofree char *nickname = g_settings_get_string (priv->settings, "nickname");
+		g_autoptr(GPtrArray) patterns = g_ptr_array_new ();
+
+		// The configured nick still counts while using another one
+		g_ptr_array_add (patterns, priv->me->nick);
+		if (!priv->str_equal (nickname, priv->me->nick))
+			g_ptr_array_add (patterns, nickname);
+		for (gsize i = 0; words[i]; ++i)
+			g_ptr_array_add (patterns, words[i]);
+		g_ptr_array_add (patterns, NULL);
+
+		priv->highlight = irc_matcher_new ((const char * const *)patterns->pdata);
+	}
+
+	return priv->highlight;
+}
+
+static void
+on_highlight_setting_changed (GSettings *settings, const char *key, gpointer data)
+{
+	IrcServerPrivate *priv = irc_server_get_instance_private (IRC_SERVER(data));
+
+	g_clear_pointer (&priv->highlight, irc_matcher_unref);
+}
+
 static void
 inbound_privmsg (IrcServer *self, IrcMessage *msg)
 {
@@ -318,6 +464,10 @@ inbound_privmsg (IrcServer *self, IrcMessage *msg)
 			return;
 		}
 		dest_ctx = IRC_CONTEXT(chan);
+
+		IrcUser *user = g_hash_table_lookup (priv->usertable, ctx_nick);
+		if (user != NULL)
+			irc_user_list_touch (irc_channel_get_users (chan), user);
 	}
 
 	g_autofree char *formatted;
@@ -334,26 +484,24 @@ inbound_privmsg (IrcServer *self, IrcMessage *msg)
 		}
 	}
 
-	if (!is_you && irc_strcasestr (irc_message_get_param(msg, 1), priv->me->nick) != NULL)
-		is_highlight = TRUE;
+	// Only copied when there is formatting to take out
+	const char *param = irc_message_get_param(msg, 1);
+	g_autofree char *owned = irc_has_attributes (param) ? irc_strip_attributes (param) : NULL;
+	const char *plain = owned ? owned : param;
 
-	g_autofree char *stripped = NULL;
-	gboolean strip = irc_context_lookup_setting_boolean (dest_ctx, "stripcolor");
+	// Formatting around a nick would otherwise count as part of the word
+	if (!is_you)
+		is_highlight = irc_matcher_match (get_highlight (self), plain);
 
-	if (is_highlight || !is_chan || strip)
-	{
-		stripped = irc_strip_attributes (irc_message_get_param(msg, 1) + (is_action ? 8 : 0));
-		if (is_action)
-			stripped[strlen(stripped) - 1] = '\0';
-	}
+	gboolean strip = irc_context_lookup_setting_boolean (dest_ctx, "stripcolor");
 
 	if (!is_action)
 	{
-		const char *text = (strip ? stripped : irc_message_get_param(msg, 1));
+		const char *text = (strip ? plain : param);
 		if (is_highlight && is_chan && !is_you)
 		{
 			if (!msg->timestamp)
-				show_notification (dest_ctx, "Highlight", stripped);
+				show_notification (dest_ctx, "Highlight", plain);
 			formatted = g_strdup_printf ("\002\00303%s\002 %s", nick, text);
 		}
 		else if (is_you)
@@ -364,7 +512,7 @@ inbound_privmsg (IrcServer *self, IrcMessage *msg)
 		{
 			if (!is_chan && !msg->timestamp)
 			{
-				show_notification (dest_ctx, "Private Message", stripped);
+				show_notification (dest_ctx, "Private Message", plain);
 			}
 			const char *user_color = NULL;
 			if (priv->caps & IRC_SERVER_CAP_TWITCH_TAGS)
@@ -377,12 +525,16 @@ inbound_privmsg (IrcServer *self, IrcMessage *msg)
 	}
 	else
 	{
-		const char *text = (strip ? stripped : (irc_message_get_param(msg, 1) + 8));
-		const int len = (int)strlen (text) - (strip ? 0 : 1);
+		// Between "\001ACTION " and the closing \001, which are not formatting
+		const char *text = (strip ? plain : param) + 8;
+		const int len = MAX((int)strlen (text) - 1, 0);
+		g_autofree char *body = NULL;
+		if ((is_highlight || !is_chan) && !msg->timestamp)
+			body = g_strndup (plain + 8, (gsize)MAX((int)strlen (plain + 8) - 1, 0));
 		if (is_highlight && is_chan)
 		{
 			if (!msg->timestamp)
-				show_notification (dest_ctx, "Highlight", stripped);
+				show_notification (dest_ctx, "Highlight", body);
 			formatted = g_strdup_printf ("* \002\00303%s\002 %.*s", nick, len, text);
 		}
 		else if (is_you)
@@ -393,7 +545,7 @@ inbound_privmsg (IrcServer *self, IrcMessage *msg)
 		{
 			if (!is_chan && !msg->timestamp)
 			{
-				show_notification (dest_ctx, "Private Message", stripped);
+				show_notification (dest_ctx, "Private Message", body);
 			}
 			formatted = g_strdup_printf ("* \002\00302%s\00399\002 %.*s", nick, len, text);
 		}
@@ -490,6 +642,11 @@ inbound_ujoin (IrcServer *self, IrcMessage *msg)
 	}
 	else
 	{
+		// Users still listed from before a lost connection are updated by NAMES
+		IrcUserList *ulist = irc_channel_get_users (channel);
+		if (g_list_model_get_n_items (G_LIST_MODEL(ulist)) != 0)
+			irc_user_list_begin_sync (ulist);
+
 		irc_channel_set_joined (channel, TRUE);
 	}
 }
@@ -503,6 +660,7 @@ inbound_join (IrcServer *self, IrcMessage *msg)
 	g_autoptr(IrcUser) user = usertable_lookup (self, nick);
 	if (user == priv->me)
 	{
+		update_userhost (user, msg->sender);
 		inbound_ujoin (self, msg);
 		return;
 	}
@@ -525,6 +683,8 @@ inbound_join (IrcServer *self, IrcMessage *msg)
 			g_object_set (user, "account", *account == '*' ? NULL : account, "realname", realname, NULL);
 		}
 		usertable_insert (self, user);
+		if (priv->caps & IRC_SERVER_CAP_EXTENDED_JOIN)
+			g_hash_table_add (priv->known_users, user);
 	}
 
 	if (!irc_context_lookup_setting_boolean (IRC_CONTEXT(channel), "hide-joinpart"))
@@ -557,15 +717,6 @@ inbound_names (IrcServer *self, IrcMessage *msg)
 	}
 
 	IrcUserList *ulist = irc_channel_get_users (channel);
-#if 0
-	// First part of NAMES, clear existing list
-	if (FALSE) // TODO
-	{
-		GtkListStore *list = irc_channel_get_users (channel);
-		gtk_list_store_clear (list); // FIXME: This might free users that will just be re-created...
-	}
-#endif
-
 	g_auto(GStrv) names = g_strsplit (irc_message_get_param (msg, 3), " ", 0);
 	for (gsize i = 0; names[i]; ++i)
 	{
@@ -580,6 +731,8 @@ inbound_names (IrcServer *self, IrcMessage *msg)
 			++offset;
 
 		g_autoptr(IrcUser) user = usertable_lookup (self, nick + offset);
+		if (user == NULL)
+			user = revive_stale_user (self, nick + offset);
 		if (user == NULL)
 		{
 			user = irc_user_new (names[i] + offset); // Want full-host here
@@ -594,59 +747,333 @@ inbound_names (IrcServer *self, IrcMessage *msg)
 	}
 }
 
+// With account-notify known accounts stay current so only new users need a WHO
+static gboolean
+channel_needs_who (IrcServer *self, IrcChannel *channel)
+{
+	IrcServerPrivate *priv = irc_server_get_instance_private (self);
+	GListModel *users = G_LIST_MODEL(irc_channel_get_users (channel));
+	const guint n_users = g_list_model_get_n_items (users);
+
+	if (n_users > WHO_MAX_USERS)
+		return FALSE;
+	if (!(priv->caps & IRC_SERVER_CAP_ACCOUNT_NOTIFY))
+		return TRUE;
+
+	for (guint i = 0; i < n_users; ++i)
+	{
+		g_autoptr(IrcUserListItem) item = g_list_model_get_item (users, i);
+		if (!g_hash_table_contains (priv->known_users, item->user))
+			return TRUE;
+	}
+
+	return FALSE;
+}
+
+// The channel being looked at goes first
+static char *
+pop_next_who (IrcServer *self)
+{
+	IrcServerPrivate *priv = irc_server_get_instance_private (self);
+	IrcContext *front = irc_context_manager_get_front_context (irc_context_manager_get_default ());
+
+	if (front != NULL && IRC_IS_CHANNEL(front) && irc_context_get_parent (front) == IRC_CONTEXT(self))
+	{
+		for (GList *l = priv->who_queue->head; l; l = l->next)
+		{
+			if (priv->str_equal (l->data, IRC_CHANNEL(front)->name))
+			{
+				char *name = l->data;
+				g_queue_delete_link (priv->who_queue, l);
+				return name;
+			}
+		}
+	}
+
+	return g_queue_pop_head (priv->who_queue);
+}
+
+static gboolean who_timed_out (gpointer data);
+
+static gboolean
+send_next_who (gpointer data)
+{
+	IrcServer *self = IRC_SERVER(data);
+	IrcServerPrivate *priv = irc_server_get_instance_private (self);
+	char *name;
+
+	priv->who_id = 0;
+
+	// Anything else waiting to be sent goes first
+	if (priv->has_sendq)
+	{
+		priv->who_id = g_timeout_add_seconds (1, send_next_who, self);
+		return G_SOURCE_REMOVE;
+	}
+
+	while ((name = pop_next_who (self)) != NULL)
+	{
+		IrcChannel *channel = g_hash_table_lookup (priv->chantable, name);
+		gboolean joined = FALSE;
+
+		if (channel != NULL)
+			g_object_get (channel, "active", &joined, NULL);
+
+		if (joined && channel_needs_who (self, channel))
+		{
+			priv->who_pending = name;
+			irc_server_write_linef (self, "WHO %s %%chtsunfra,152", name);
+			priv->who_id = g_timeout_add_seconds (WHO_TIMEOUT, who_timed_out, self);
+			break;
+		}
+		g_free (name);
+	}
+
+	return G_SOURCE_REMOVE;
+}
+
+// One WHO at a time, when the connection is otherwise idle
 static void
-inbound_endofnames (IrcServer *self, IrcMessage *msg)
+schedule_who (IrcServer *self)
+{
+	IrcServerPrivate *priv = irc_server_get_instance_private (self);
+
+	if (priv->who_id == 0 && priv->who_pending == NULL && !g_queue_is_empty (priv->who_queue))
+		priv->who_id = g_idle_add_full (G_PRIORITY_LOW, send_next_who, self, NULL);
+}
+
+static void
+queue_who (IrcServer *self, const char *channel)
 {
 	IrcServerPrivate *priv = irc_server_get_instance_private (self);
+
 	if (!(priv->caps & IRC_SERVER_SUPPORT_WHOX))
 		return;
 
-	irc_server_write_linef (self, "WHO %s %%chtsunfra,152", irc_message_get_param(msg, 1));
+	if (priv->who_pending && priv->str_equal (priv->who_pending, channel))
+		return;
+	for (GList *l = priv->who_queue->head; l; l = l->next)
+	{
+		if (priv->str_equal (l->data, channel))
+			return;
+	}
+
+	g_queue_push_tail (priv->who_queue, g_strdup (channel));
+	schedule_who (self);
 }
 
-static char *
-join_list (GList *list, const char sep)
+static void
+clear_who_queue (IrcServer *self)
+{
+	IrcServerPrivate *priv = irc_server_get_instance_private (self);
+
+	g_queue_foreach (priv->who_queue, (GFunc)g_free, NULL);
+	g_queue_clear (priv->who_queue);
+	g_clear_pointer (&priv->who_pending, g_free);
+	if (priv->who_id)
+	{
+		g_source_remove (priv->who_id);
+		priv->who_id = 0;
+	}
+}
+
+static void
+inbound_endofnames (IrcServer *self, IrcMessage *msg)
+{
+	IrcServerPrivate *priv = irc_server_get_instance_private (self);
+
+	IrcChannel *channel = g_hash_table_lookup (priv->chantable, irc_message_get_param(msg, 1));
+	if (channel != NULL)
+		irc_user_list_end_sync (irc_channel_get_users (channel));
+
+	queue_who (self, irc_message_get_param(msg, 1));
+}
+
+static void finish_who_batch (IrcServer *self, gboolean emit);
+
+// The WHO in flight is done one way or another, the next one can go
+static void
+end_pending_who (IrcServer *self)
+{
+	IrcServerPrivate *priv = irc_server_get_instance_private (self);
+
+	g_clear_pointer (&priv->who_pending, g_free);
+	if (priv->who_id)
+	{
+		g_source_remove (priv->who_id);
+		priv->who_id = 0;
+	}
+	schedule_who (self);
+}
+
+static void
+inbound_endofwho (IrcServer *self, IrcMessage *msg)
+{
+	IrcServerPrivate *priv = irc_server_get_instance_private (self);
+
+	finish_who_batch (self, TRUE);
+
+	if (priv->who_pending && priv->str_equal (priv->who_pending, irc_message_get_param(msg, 1)))
+		end_pending_who (self);
+}
+
+static gboolean
+who_timed_out (gpointer data)
+{
+	IrcServer *self = IRC_SERVER(data);
+	IrcServerPrivate *priv = irc_server_get_instance_private (self);
+
+	g_debug ("No end of WHO for %s", priv->who_pending);
+	priv->who_id = 0;
+	finish_who_batch (self, FALSE);
+	end_pending_who (self);
+	return G_SOURCE_REMOVE;
+}
+
+// RPL_TRYAGAIN or an error instead of the reply to our WHO, no 315 follows either
+static gboolean
+inbound_who_error (IrcServer *self, IrcMessage *msg)
+{
+	IrcServerPrivate *priv = irc_server_get_instance_private (self);
+	const char *param = irc_message_get_param(msg, 1);
+	const gboolean about_who = g_ascii_strcasecmp (param, "WHO") == 0;
+
+	if (priv->who_pending == NULL)
+		return FALSE;
+
+	if (msg->numeric == 263 && about_who) // RPL_TRYAGAIN
+	{
+		// Same channel again once the server is willing
+		finish_who_batch (self, FALSE);
+		g_queue_push_head (priv->who_queue, g_steal_pointer (&priv->who_pending));
+		if (priv->who_id)
+			g_source_remove (priv->who_id);
+		priv->who_id = g_timeout_add_seconds (WHO_RETRY_DELAY, send_next_who, self);
+		return TRUE;
+	}
+	if (msg->numeric >= 400 && msg->numeric < 500
+		&& (about_who || (msg->numeric == 403 && priv->str_equal (param, priv->who_pending)))) // ERR_NOSUCHCHANNEL
+	{
+		finish_who_batch (self, FALSE);
+		end_pending_who (self);
+		return TRUE;
+	}
+
+	return FALSE;
+}
+
+// Users kept from the last connection can't be synced if the channel isn't joined again
+static void
+inbound_join_failed (IrcServer *self, IrcMessage *msg)
 {
-	GString *str = g_string_new (list->data);
+	IrcServerPrivate *priv = irc_server_get_instance_private (self);
+	gboolean joined;
 
-	while ((list = g_list_next (list)))
+	switch (msg->numeric)
 	{
-		g_string_append_c (str, sep);
-		g_string_append (str, list->data);
+	case 403: // ERR_NOSUCHCHANNEL
+	case 405: // ERR_TOOMANYCHANNELS
+	case 471: // ERR_CHANNELISFULL
+	case 473: // ERR_INVITEONLYCHAN
+	case 474: // ERR_BANNEDFROMCHAN
+	case 475: // ERR_BADCHANNELKEY
+	case 477: // ERR_NEEDREGGEDNICK
+		break;
+	default:
+		return;
 	}
 
-	return g_string_free (str, FALSE);
+	IrcChannel *channel = g_hash_table_lookup (priv->chantable, irc_message_get_param(msg, 1));
+	if (channel == NULL)
+		return;
+
+	g_object_get (channel, "active", &joined, NULL);
+	if (!joined)
+		irc_channel_set_joined (channel, FALSE);
+}
+
+static guint
+get_targmax (IrcServer *self, const char *command)
+{
+	IrcServerPrivate *priv = irc_server_get_instance_private (self);
+
+	return GPOINTER_TO_UINT(g_hash_table_lookup (priv->targmax, command));
+}
+
+// Sends targets in as few lines as the server allows, they go through the send queue
+static void
+write_batched (IrcServer *self, const char *command, GPtrArray *targets, GPtrArray *keys,
+               char separator, guint max_targets)
+{
+	IrcServerPrivate *priv = irc_server_get_instance_private (self);
+
+	g_ptr_array_add (targets, NULL);
+	if (keys != NULL)
+		g_ptr_array_add (keys, NULL);
+
+	g_auto(GStrv) lines = irc_batch_targets (command, (const char * const *)targets->pdata,
+											 keys ? (const char * const *)keys->pdata : NULL,
+											 separator, max_targets, priv->line_len - 2);
+	for (gsize i = 0; lines[i]; ++i)
+		irc_server_write_line (self, lines[i]);
 }
 
 static void
 inbound_endofmotd (IrcServer *self)
 {
   	IrcServerPrivate *priv = irc_server_get_instance_private (self);
+	GHashTableIter iter;
+	gpointer value;
+
+	if (priv->registered)
+		return;
+	priv->registered = TRUE;
 
 	if (g_hash_table_size (priv->chantable) != 0) // Had previous connection
 	{
-		g_autoptr(GList) channels = g_hash_table_get_keys (priv->chantable);
-		g_autofree char *join_str = join_list (channels, ',');
+		g_autoptr(GPtrArray) channels = g_ptr_array_new ();
+		g_autoptr(GPtrArray) keys = g_ptr_array_new ();
+
+		g_hash_table_iter_init (&iter, priv->chantable);
+		while (g_hash_table_iter_next (&iter, NULL, &value))
+		{
+			const char *key = irc_channel_get_key (value);
 
-		// TODO: Keys and long lines
-		irc_server_write_linef (self, "JOIN %s", join_str);
+			g_ptr_array_add (channels, IRC_CHANNEL(value)->name);
+			g_ptr_array_add (keys, (char*)(key ? key : ""));
+		}
+
+		write_batched (self, "JOIN", channels, keys, ',', get_targmax (self, "JOIN"));
 	}
 	if (g_hash_table_size (priv->querytable) != 0)
 	{
-		g_autoptr(GList) queries = g_hash_table_get_keys (priv->querytable);
+		g_autoptr(GPtrArray) queries = g_ptr_array_new ();
+
+		g_hash_table_iter_init (&iter, priv->querytable);
+		while (g_hash_table_iter_next (&iter, NULL, &value))
+			g_ptr_array_add (queries, (char*)irc_context_get_name (value));
+
 		if (priv->caps & IRC_SERVER_SUPPORT_MONITOR)
 		{
-			g_autofree char *join_str = join_list (queries, ',');
+			// The rest are at least checked once like servers without MONITOR
+			if (priv->monitor_limit && queries->len > priv->monitor_limit)
+			{
+				g_autoptr(GPtrArray) overflow = g_ptr_array_new ();
 
-			irc_server_write_linef (self, "MONITOR + %s", join_str);
+				g_debug ("Only monitoring %u of %u queries", priv->monitor_limit, queries->len);
+				for (guint i = priv->monitor_limit; i < queries->len; ++i)
+					g_ptr_array_add (overflow, g_ptr_array_index (queries, i));
+				g_ptr_array_set_size (queries, (gint)priv->monitor_limit);
+				write_batched (self, "ISON", overflow, NULL, ' ', 0);
+			}
+			write_batched (self, "MONITOR +", queries, NULL, ',', 0);
 		}
 		else
-		{
-			g_autofree char *join_str = join_list (queries, ' ');
-
-			irc_server_write_linef (self, "ISON %s", join_str);
-		}
+			write_batched (self, "ISON", queries, NULL, ' ', 0);
 	}
+
+	priv->reconnect_attempts = 0;
+	g_signal_emit (self, obj_signals[READY], 0);
 }
 
 static void
@@ -667,25 +1094,73 @@ inbound_whox (IrcServer *self, IrcMessage *msg)
 		return;
 	}
 
+	// Notifications are held until the end of the reply
+	if (!g_hash_table_contains (priv->who_batch, user))
+		g_object_freeze_notify (G_OBJECT(user));
+
 	const char *account = irc_message_get_param(msg, 8);
 	const char *realname = irc_message_get_param(msg, 9);
+	if (*account == '*')
+		account = NULL;
 
-	g_object_set (user, "account", *account == '*' ? NULL : account, "realname", realname, NULL);
+	gboolean changed = g_strcmp0 (user->account, account) != 0 || g_strcmp0 (user->realname, realname) != 0;
+	g_object_set (user, "account", account, "realname", realname, NULL);
+	g_hash_table_add (priv->known_users, user);
 
 	if (!(priv->caps & IRC_SERVER_CAP_USERHOST_IN_NAMES))
 	{
-		g_object_set (user, "hostname", irc_message_get_param(msg, 4), "username", irc_message_get_param(msg, 3), NULL);
+		const char *hostname = irc_message_get_param(msg, 4);
+		const char *username = irc_message_get_param(msg, 3);
+
+		changed |= g_strcmp0 (user->hostname, hostname) != 0 || g_strcmp0 (user->username, username) != 0;
+		g_object_set (user, "hostname", hostname, "username", username, NULL);
 	}
 
 	// If server doesn't have away-notify there is no point in setting this
 	if ((priv->caps & IRC_SERVER_CAP_AWAY_NOTIFY))
 	{
-		g_object_set (user, "away", *irc_message_get_param(msg, 7) == 'G', NULL);
+		const gboolean away = *irc_message_get_param(msg, 7) == 'G';
+		gboolean was_away;
+
+		g_object_get (user, "away", &was_away, NULL);
+		changed |= away != was_away;
+		g_object_set (user, "away", away, NULL);
 	}
 
+	// A user can be in several replies, it changed if any of them changed it
+	changed |= GPOINTER_TO_INT(g_hash_table_lookup (priv->who_batch, user));
+	g_hash_table_insert (priv->who_batch, g_object_ref (user), GINT_TO_POINTER(changed));
+
 	// We could grab the users prefix here, but we don't need it?
 }
 
+// Without emit the reply was cut short and only notifications are sent
+static void
+finish_who_batch (IrcServer *self, gboolean emit)
+{
+	IrcServerPrivate *priv = irc_server_get_instance_private (self);
+	GHashTableIter iter;
+	gpointer user, changed;
+
+	if (g_hash_table_size (priv->who_batch) == 0)
+		return;
+
+	g_autoptr(GHashTable) batch = priv->who_batch;
+	g_autoptr(GPtrArray) updated = g_ptr_array_new ();
+	priv->who_batch = g_hash_table_new_full (NULL, NULL, g_object_unref, NULL);
+
+	g_hash_table_iter_init (&iter, batch);
+	while (g_hash_table_iter_next (&iter, &user, &changed))
+	{
+		g_object_thaw_notify (G_OBJECT(user));
+		if (GPOINTER_TO_INT(changed))
+			g_ptr_array_add (updated, user);
+	}
+
+	if (emit && updated->len)
+		g_signal_emit (self, obj_signals[USERS_UPDATED], 0, updated);
+}
+
 static void
 nick_change_foreach (gpointer key, gpointer val, gpointer data)
 {
@@ -708,8 +1183,16 @@ change_users_nick (IrcServer *self, IrcUser *user, const char *new_nick)
 	if (!g_hash_table_steal (priv->usertable, user->nick))
 		g_assert_not_reached ();
 	g_object_set (user, "nick", new_nick, NULL);
+	// A WHO reply holds notifications back but user lists must re-sort now
+	if (g_hash_table_contains (priv->who_batch, user))
+	{
+		g_object_thaw_notify (G_OBJECT(user));
+		g_object_freeze_notify (G_OBJECT(user));
+	}
 	if (!g_hash_table_replace (priv->usertable, user->nick, user))
 		g_assert_not_reached ();
+	if (user == priv->me)
+		g_clear_pointer (&priv->highlight, irc_matcher_unref);
 
   	g_hash_table_foreach (priv->chantable, nick_change_foreach, user);
 }
@@ -788,6 +1271,51 @@ inbound_account (IrcServer *self, IrcMessage *msg)
 	g_object_set (user, "account", *account == '*' ? NULL : account, NULL);
 }
 
+// If a channel mode takes a parameter, from PREFIX and CHANMODES
+static gboolean
+chanmode_has_param (IrcServerPrivate *priv, char mode, gboolean adding)
+{
+	guint type = 0;
+
+	if (strchr (priv->nick_modes, mode) != NULL)
+		return TRUE;
+
+	for (const char *p = priv->chan_modes; *p; ++p)
+	{
+		if (*p == ',')
+			++type;
+		else if (*p == mode)
+			return type < 2 || (type == 2 && adding); // Lists and keys always, limits when set
+	}
+
+	return FALSE;
+}
+
+// Only the key is remembered so it can be sent when rejoining
+static void
+update_channel_key (IrcServer *self, IrcChannel *channel, IrcMessage *msg, gsize modes_param)
+{
+	IrcServerPrivate *priv = irc_server_get_instance_private (self);
+	const gsize len = g_strv_length (msg->params);
+	gsize param = modes_param + 1;
+	gboolean adding = TRUE;
+
+	for (const char *p = irc_message_get_param (msg, modes_param); *p; ++p)
+	{
+		if (*p == '+' || *p == '-')
+		{
+			adding = *p == '+';
+			continue;
+		}
+
+		const gboolean has_param = chanmode_has_param (priv, *p, adding);
+		if (*p == 'k')
+			g_object_set (channel, "key", adding && param < len ? irc_message_get_param (msg, param) : NULL, NULL);
+		if (has_param)
+			++param;
+	}
+}
+
 static void
 inbound_mode (IrcServer *self, IrcMessage *msg)
 {
@@ -799,6 +1327,8 @@ inbound_mode (IrcServer *self, IrcMessage *msg)
 		return;
 	}
 
+	update_channel_key (self, channel, msg, 1);
+
 #if 0
 	// TODO: Loop over mode changes and handle them
 
@@ -1207,6 +1737,25 @@ irc_server_set_casemapping (IrcServer *self, const char *mapping)
 		g_assert_not_reached ();
 }
 
+// TARGMAX=PRIVMSG:4,NOTICE:4,JOIN:
+static void
+inbound_targmax (IrcServer *self, const char *value)
+{
+	IrcServerPrivate *priv = irc_server_get_instance_private (self);
+	g_auto(GStrv) limits = g_strsplit (value, ",", 0);
+
+	for (gsize i = 0; limits[i]; ++i)
+	{
+		char *limit = strchr (limits[i], ':');
+		if (limit == NULL)
+			continue;
+
+		*limit++ = '\0';
+		g_hash_table_insert (priv->targmax, g_ascii_strup (limits[i], -1),
+							 GUINT_TO_POINTER((guint)g_ascii_strtoull (limit, NULL, 10)));
+	}
+}
+
 static void
 inbound_005 (IrcServer *self, IrcMessage *msg)
 {
@@ -1250,10 +1799,22 @@ inbound_005 (IrcServer *self, IrcMessage *msg)
 		{
 			g_object_set (self, "statusmsg", word + 10, NULL);
 		}
+		else if (g_str_has_prefix (word, "TARGMAX="))
+		{
+			inbound_targmax (self, word + 8);
+		}
+		else if (g_str_has_prefix (word, "LINELEN="))
+		{
+			priv->line_len = MAX((guint)g_ascii_strtoull (word + 8, NULL, 10), DEFAULT_LINE_LEN);
+		}
 		else if (g_str_equal (word, "WHOX"))
 			priv->caps |= IRC_SERVER_SUPPORT_WHOX;
 		else if (g_str_has_prefix (word, "MONITOR"))
+		{
 			priv->caps |= IRC_SERVER_SUPPORT_MONITOR;
+			if (word[7] == '=')
+				priv->monitor_limit = (guint)g_ascii_strtoull (word + 8, NULL, 10);
+		}
 		else if (g_str_has_prefix (word, "-MONITOR"))
 			priv->caps ^= IRC_SERVER_SUPPORT_MONITOR;
 		else if (g_str_equal (word, "-WHOX"))
@@ -1282,12 +1843,9 @@ enum {
 };
 
 static gboolean
-handle_incoming (IrcServer *self, const char *line)
+dispatch_message (IrcServer *self, IrcMessage *msg)
 {
 	IrcServerPrivate *priv = irc_server_get_instance_private (self);
-	g_autoptr(IrcMessage) msg = irc_message_new (line);
-	if (msg == NULL)
-		return TRUE;
 
 	if (msg->numeric)
 	{
@@ -1304,6 +1862,14 @@ handle_incoming (IrcServer *self, const char *line)
 			inbound_user_online (self, irc_message_get_param(msg, 1), TRUE, " ");
 			break;
 		case 315: // RPL_ENDOFWHO
+			inbound_endofwho (self, msg);
+			break;
+		case 324: // RPL_CHANNELMODEIS
+			{
+				IrcChannel *channel = g_hash_table_lookup (priv->chantable, irc_message_get_param(msg, 1));
+				if (channel != NULL)
+					update_channel_key (self, channel, msg, 2);
+			}
 			break;
 		case 332: // RPL_TOPIC
 			inbound_topic (self, irc_message_get_param(msg, 1), irc_message_get_param(msg, 2));
@@ -1324,6 +1890,7 @@ handle_incoming (IrcServer *self, const char *line)
 			irc_context_print_with_time (IRC_CONTEXT(self), irc_message_get_param(msg, 1), msg->timestamp);
 			break;
 		case 376: // RPL_ENDOFMOTD
+		case 422: // ERR_NOMOTD
 			inbound_endofmotd (self);
 			break;
 		case 433: // ERR_NICKNAMEINUSE
@@ -1348,6 +1915,9 @@ handle_incoming (IrcServer *self, const char *line)
 			inbound_authenticate_response (self, msg);
 			break;
 		default:
+			if (inbound_who_error (self, msg))
+				break;
+			inbound_join_failed (self, msg);
 			g_debug ("Unhandled numeric %"G_GUINT16_FORMAT, msg->numeric);
 			return FALSE;
 		}
@@ -1412,18 +1982,287 @@ handle_incoming (IrcServer *self, const char *line)
 	return TRUE;
 }
 
+static const char *
+get_message_name (IrcMessage *msg, char numeric[8])
+{
+	if (msg == NULL)
+		return "(invalid)";
+	else if (msg->numeric == 0)
+		return msg->command;
+
+	g_snprintf (numeric, 8, "%03"G_GUINT16_FORMAT, msg->numeric);
+	return numeric;
+}
+
+static IrcServerStat *
+get_stat (IrcServer *self, const char *name)
+{
+	IrcServerPrivate *priv = irc_server_get_instance_private (self);
+	IrcServerStat *stat = g_hash_table_lookup (priv->stats, name);
+
+	if (G_UNLIKELY(stat == NULL))
+	{
+		// Servers can send anything as a command
+		if (g_hash_table_size (priv->stats) >= STATS_MAX_COMMANDS && strcmp (name, "(other)") != 0)
+			return get_stat (self, "(other)");
+
+		stat = g_new0 (IrcServerStat, 1);
+		g_hash_table_insert (priv->stats, g_strdup (name), stat);
+	}
+
+	return stat;
+}
+
+static inline guint
+stat_bucket (gint64 time)
+{
+	const gulong usec = (gulong)(time / 1000);
+
+	return usec == 0 ? 0 : MIN(g_bit_storage (usec), STATS_N_BUCKETS - 1);
+}
+
+static gboolean
+handle_incoming (IrcServer *self, const char *line)
+{
+	guint64 prints_before, prints_after;
+	gint64 print_time_before, print_time_after;
+
+	IRC_TRACE_BEGIN(handle_incoming);
+	const gint64 start = get_monotonic_ns ();
+	IRC_TRACE_BEGIN(irc_message_new);
+	g_autoptr(IrcMessage) msg = irc_message_new (line);
+	IRC_TRACE_END(irc_message_new, NULL);
+	const gint64 parsed = get_monotonic_ns ();
+
+	char numeric[8];
+	const char *name = get_message_name (msg, numeric);
+
+	context_get_print_totals (&prints_before, &print_time_before);
+	IRC_TRACE_BEGIN(inbound);
+	const gboolean handled = msg == NULL || dispatch_message (self, msg);
+	IRC_TRACE_END(inbound, name);
+	context_get_print_totals (&prints_after, &print_time_after);
+	const gint64 end = get_monotonic_ns ();
+
+	IrcServerStat *stat = get_stat (self, name);
+	++stat->count;
+	stat->bytes += strlen (line);
+	stat->prints += prints_after - prints_before;
+	stat->parse_time += parsed - start;
+	stat->dispatch_time += end - parsed;
+	stat->print_time += print_time_after - print_time_before;
+	stat->max_time = MAX(stat->max_time, end - start);
+	++stat->histogram[stat_bucket (end - start)];
+
+	IRC_TRACE_END(handle_incoming, line);
+	return handled;
+}
+
+static void send_line (IrcServer *self, QueuedLine *queued);
+
+// Room for len bytes of a line along with its CRLF
+static QueuedLine *
+queued_line_new (gsize len)
+{
+	QueuedLine *queued = g_malloc (sizeof(QueuedLine) + len + sizeof("\r\n"));
+
+	queued->len = len;
+	return queued;
+}
+
 void
 irc_server_write_linef (IrcServer *self, const char *fmt, ...)
 {
-	char *formatted;
-	va_list args;
+	IrcServerPrivate *priv = irc_server_get_instance_private (self);
+	va_list args, args_copy;
+
+	g_return_if_fail (priv->conn != NULL);
+	g_return_if_fail (g_socket_connection_is_connected (priv->conn));
 
+	// Measured first so the line is formatted straight into its buffer
 	va_start (args, fmt);
-	formatted = g_strdup_vprintf (fmt, args);
+	va_copy (args_copy, args);
+	const gint len = g_vsnprintf (NULL, 0, fmt, args);
 	va_end (args);
 
-	irc_server_write_line (self, formatted);
-	g_free (formatted);
+	QueuedLine *queued = queued_line_new ((gsize)MAX(len, 0));
+	g_vsnprintf (queued->line, (gulong)queued->len + 1, fmt, args_copy);
+	va_end (args_copy);
+
+	send_line (self, queued);
+}
+
+static gsize
+escaped_tag_value_len (const char *value)
+{
+	gsize len = 0;
+
+	for (const char *p = value; *p; ++p)
+		len += strchr (";\\ \r\n", *p) ? 2 : 1;
+
+	return len;
+}
+
+static char *
+append_escaped_tag_value (char *out, const char *value)
+{
+	for (const char *p = value; *p; ++p)
+	{
+		const char *escape;
+
+		switch (*p)
+		{
+		case ';': escape = "\\:"; break;
+		case ' ': escape = "\\s"; break;
+		case '\\': escape = "\\\\"; break;
+		case '\r': escape = "\\r"; break;
+		case '\n': escape = "\\n"; break;
+		default:
+			*out++ = *p;
+			continue;
+		}
+		*out++ = escape[0];
+		*out++ = escape[1];
+	}
+
+	return out;
+}
+
+// Line breaks can't be sent inside a line, they become spaces
+static char *
+append_text (char *out, const char *text)
+{
+	for (const char *p = text; *p; ++p)
+		*out++ = (*p == '\r' || *p == '\n') ? ' ' : *p;
+
+	return out;
+}
+
+static gboolean
+is_valid_middle_param (const char *param)
+{
+	return *param != '\0' && *param != ':' && strpbrk (param, " \r\n") == NULL;
+}
+
+/**
+ * irc_server_write_command:
+ * @tags: (array zero-terminated=1) (nullable): Tags as `key` or `key=value`,
+ *   values are escaped
+ * @command: Command to send
+ * @params: (array zero-terminated=1) (nullable): Parameters before @trailing,
+ *   they can't be empty, start with ':' or contain spaces
+ * @trailing: (nullable): Last parameter, it may contain spaces
+ *
+ * Builds the line directly in the buffer it is sent from instead of
+ * formatting it first. Line breaks in @trailing are sent as spaces.
+ */
+void
+irc_server_write_command (IrcServer *self, const char * const *tags, const char *command,
+                          const char * const *params, const char *trailing)
+{
+	IrcServerPrivate *priv = irc_server_get_instance_private (self);
+	gsize len = strlen (command);
+
+	g_return_if_fail (priv->conn != NULL);
+	g_return_if_fail (g_socket_connection_is_connected (priv->conn));
+
+	for (gsize i = 0; tags && tags[i]; ++i)
+	{
+		const char *value = strchr (tags[i], '=');
+		len += 1 + (value ? (gsize)(value - tags[i]) + 1 + escaped_tag_value_len (value + 1) : strlen (tags[i]));
+	}
+	for (gsize i = 0; params && params[i]; ++i)
+	{
+		g_return_if_fail (is_valid_middle_param (params[i]));
+		len += 1 + strlen (params[i]);
+	}
+	if (trailing)
+		len += 2 + strlen (trailing);
+
+	QueuedLine *queued = queued_line_new (len);
+	char *out = queued->line;
+
+	for (gsize i = 0; tags && tags[i]; ++i)
+	{
+		const char *value = strchr (tags[i], '=');
+		const gsize key_len = value ? (gsize)(value - tags[i]) + 1 : strlen (tags[i]);
+
+		*out++ = i == 0 ? '@' : ';';
+		memcpy (out, tags[i], key_len);
+		out += key_len;
+		if (value)
+			out = append_escaped_tag_value (out, value + 1);
+	}
+	if (tags && tags[0])
+		*out++ = ' ';
+
+	out = g_stpcpy (out, command);
+	for (gsize i = 0; params && params[i]; ++i)
+	{
+		*out++ = ' ';
+		out = g_stpcpy (out, params[i]);
+	}
+	if (trailing)
+	{
+		*out++ = ' ';
+		*out++ = ':';
+		out = append_text (out, trailing);
+	}
+	g_assert ((gsize)(out - queued->line) == len);
+
+	send_line (self, queued);
+}
+
+// Room left for the text of a message once the server puts its prefix and
+// ours in front of it
+static gsize
+get_max_message_len (IrcServer *self, const char *command, const char *target, gsize extra)
+{
+	IrcServerPrivate *priv = irc_server_get_instance_private (self);
+	const IrcUser *me = priv->me;
+
+	// ":nick!user@host COMMAND target :"
+	gsize overhead = 1 + strlen (me->nick) + 1 + strlen (command) + 1 + strlen (target) + 2 + extra;
+	if (me->hostname != NULL && me->username != NULL)
+		overhead += 1 + strlen (me->username) + 1 + strlen (me->hostname);
+	else
+		overhead += MAX_USERHOST_LEN;
+
+	const gsize max_len = priv->line_len - 2;
+	return max_len > overhead ? max_len - overhead : 0;
+}
+
+/**
+ * irc_server_write_message:
+ * @target: Channel or nick to send to
+ * @text: Message to send
+ * @action: Send it as a CTCP ACTION
+ *
+ * Sends a PRIVMSG split into as many lines as it takes for none of them to
+ * be cut off by the server, see irc_split_message(). The lines are queued
+ * together so nothing else is sent between them.
+ */
+void
+irc_server_write_message (IrcServer *self, const char *target, const char *text, gboolean action)
+{
+	IrcServerPrivate *priv = irc_server_get_instance_private (self);
+	const char * const params[] = { target, NULL };
+
+	g_return_if_fail (priv->me != NULL);
+
+	const gsize max_len = get_max_message_len (self, "PRIVMSG", target, action ? strlen ("\001ACTION \001") : 0);
+	g_auto(GStrv) lines = irc_split_message (text, max_len);
+
+	for (gsize i = 0; lines[i]; ++i)
+	{
+		if (action)
+		{
+			g_autofree char *ctcp = g_strconcat ("\001ACTION ", lines[i], "\001", NULL);
+			irc_server_write_command (self, NULL, "PRIVMSG", params, ctcp);
+		}
+		else
+			irc_server_write_command (self, NULL, "PRIVMSG", params, lines[i]);
+	}
 }
 
 static void
@@ -1431,7 +2270,7 @@ on_writeline_ready (GObject *source, GAsyncResult *res, gpointer data)
 {
 	GError *err = NULL;
 
-	g_output_stream_write_finish (G_OUTPUT_STREAM(source), res, &err);
+	g_output_stream_write_bytes_finish (G_OUTPUT_STREAM(source), res, &err);
 	if (err != NULL)
 	{
 		g_warning ("Writing error: %s", err->message);
@@ -1439,6 +2278,34 @@ on_writeline_ready (GObject *source, GAsyncResult *res, gpointer data)
 	}
 }
 
+// Writes len bytes of line, owner is freed once they are no longer needed
+static void
+write_encoded (IrcServer *self, GOutputStream *out_stream, const char *line, gsize len, gpointer owner)
+{
+	IrcServerPrivate *priv = irc_server_get_instance_private (self);
+	g_autoptr(GBytes) bytes = NULL;
+
+	if (priv->encoding_kind == ENCODING_UTF8 && irc_utf8_validate (line, len))
+		bytes = g_bytes_new_with_free_func (line, len, g_free, owner);
+	else
+	{
+		if (priv->encoding_kind == ENCODING_UTF8)
+		{
+			char *valid = g_utf8_make_valid (line, (gssize)len);
+			bytes = g_bytes_new_take (valid, strlen (valid));
+		}
+		else
+		{
+			gsize encoded_len;
+			const char *encoded = irc_converter_convert (priv->encoder, line, len, &encoded_len);
+			bytes = g_bytes_new (encoded, encoded_len);
+		}
+		g_free (owner);
+	}
+
+	g_output_stream_write_bytes_async (out_stream, bytes, G_PRIORITY_DEFAULT, NULL, on_writeline_ready, self);
+}
+
 static gboolean
 process_sendq (gpointer data)
 {
@@ -1449,15 +2316,15 @@ process_sendq (gpointer data)
 	if (g_output_stream_has_pending (out_stream))
 		return G_SOURCE_CONTINUE;
 
-	g_autofree char *out_buf = g_queue_pop_head (priv->sendq);
-	g_print ("\033[31m<<\033[0m %s", out_buf);
-	g_autofree char *out_encoded;
-	if (g_ascii_strcasecmp (priv->encoding, "UTF-8") == 0)
-		out_encoded = g_utf8_make_valid (out_buf, (gssize)strlen(out_buf));
-	else
-		out_encoded = irc_convert_invalid_text (out_buf, (gssize)strlen(out_buf), priv->out_encoder, "?");
-	g_output_stream_write_async (out_stream, out_encoded, strlen(out_encoded), G_PRIORITY_DEFAULT, NULL,
-								on_writeline_ready, self);
+	QueuedLine *queued = g_queue_pop_head (priv->sendq);
+	const gint64 wait = g_get_monotonic_time () - queued->time;
+
+	++priv->sendq_lines;
+	priv->sendq_wait += wait;
+	priv->sendq_max_wait = MAX(priv->sendq_max_wait, wait);
+
+	irc_raw_log_append (priv->raw_log, IRC_RAW_LOG_OUTBOUND, queued->line, (gssize)queued->len - 2);
+	write_encoded (self, out_stream, queued->line, queued->len, queued);
 
 	if (g_queue_get_length (priv->sendq))
 		return G_SOURCE_CONTINUE;
@@ -1485,23 +2352,24 @@ irc_server_get_me (IrcServer *self)
 	return priv->me;
 }
 
-void
-irc_server_write_line (IrcServer *self, const char *line)
+// Sends a line from queued_line_new() or queues it behind the earlier ones
+static void
+send_line (IrcServer *self, QueuedLine *queued)
 {
   	IrcServerPrivate *priv = irc_server_get_instance_private (self);
-	GOutputStream *out_stream;
-
-	g_return_if_fail (priv->conn != NULL);
-	g_return_if_fail (g_socket_connection_is_connected (priv->conn));
+	GOutputStream *out_stream = g_io_stream_get_output_stream (G_IO_STREAM(priv->conn));
 
-	out_stream = g_io_stream_get_output_stream (G_IO_STREAM(priv->conn));
+	memcpy (queued->line + queued->len, "\r\n", sizeof("\r\n"));
+	queued->len += 2;
 
-	char *out_buf = g_strdup_printf ("%s\r\n", line);
 	if (g_output_stream_has_pending (out_stream) || priv->has_sendq)
 	{
+		queued->time = g_get_monotonic_time ();
+
 		// Might need to tweak to be faster at first but throttle with tons of lines
 		// Also maybe queue certain events before others (PRIVMSG > WHO)
-		g_queue_push_tail (priv->sendq, out_buf);
+		g_queue_push_tail (priv->sendq, queued);
+		priv->sendq_max_depth = MAX(priv->sendq_max_depth, g_queue_get_length (priv->sendq));
 		if (!priv->has_sendq)
 		{
 			priv->has_sendq = g_timeout_add_seconds (1, process_sendq, self);
@@ -1509,18 +2377,127 @@ irc_server_write_line (IrcServer *self, const char *line)
 	}
 	else
 	{
-		g_print ("\033[31m<<\033[0m %s", out_buf);
-		g_autofree char *out_encoded;
-		if (g_ascii_strcasecmp (priv->encoding, "UTF-8") == 0)
-			out_encoded = g_utf8_make_valid (out_buf, (gssize)strlen(out_buf));
-		else
-			out_encoded = irc_convert_invalid_text (out_buf, (gssize)strlen(out_buf), priv->out_encoder, "?");
-		g_output_stream_write_async (out_stream, out_encoded, strlen(out_encoded), G_PRIORITY_DEFAULT, NULL,
-									on_writeline_ready, self);
-		g_free (out_buf);
+		irc_raw_log_append (priv->raw_log, IRC_RAW_LOG_OUTBOUND, queued->line, (gssize)queued->len - 2);
+		write_encoded (self, out_stream, queued->line, queued->len, queued);
 	}
 }
 
+void
+irc_server_write_line (IrcServer *self, const char *line)
+{
+  	IrcServerPrivate *priv = irc_server_get_instance_private (self);
+
+	g_return_if_fail (priv->conn != NULL);
+	g_return_if_fail (g_socket_connection_is_connected (priv->conn));
+
+	const gsize len = strlen (line);
+	QueuedLine *queued = queued_line_new (len);
+	memcpy (queued->line, line, len);
+	send_line (self, queued);
+}
+
+/**
+ * irc_server_start_capture:
+ * @file: File to write to, it is replaced
+ *
+ * Records every line received, before decoding, along with the time it
+ * arrived until irc_server_stop_capture() is called or the server
+ * disconnects. The capture can be fed back into a server with the
+ * irc-replay tool.
+ *
+ * The format is a header line `IRCCAPTURE 1 <nick>` followed by one
+ * record per line: `<microseconds since start> <length>\n<raw bytes>\n`.
+ *
+ * Returns: %TRUE if the file could be opened
+ */
+gboolean
+irc_server_start_capture (IrcServer *self, GFile *file, GError **error)
+{
+	g_return_val_if_fail (IRC_IS_SERVER(self), FALSE);
+	g_return_val_if_fail (G_IS_FILE(file), FALSE);
+
+	IrcServerPrivate *priv = irc_server_get_instance_private (self);
+
+	irc_server_stop_capture (self);
+
+	// Private messages end up in here
+	g_autoptr(GFileOutputStream) stream = g_file_replace (file, NULL, FALSE, G_FILE_CREATE_PRIVATE, NULL, error);
+	if (stream == NULL)
+		return FALSE;
+
+	g_autoptr(GOutputStream) buffered = g_buffered_output_stream_new_sized (G_OUTPUT_STREAM(stream), 64 * 1024);
+	g_autofree char *header = g_strdup_printf ("IRCCAPTURE 1 %s\n", priv->me ? priv->me->nick : "*");
+	if (!g_output_stream_write_all (buffered, header, strlen (header), NULL, NULL, error))
+		return FALSE;
+
+	priv->capture = g_steal_pointer (&buffered);
+	priv->capture_start = g_get_monotonic_time ();
+	return TRUE;
+}
+
+/**
+ * irc_server_stop_capture:
+ *
+ * Flushes and closes the capture started by irc_server_start_capture() if any.
+ */
+void
+irc_server_stop_capture (IrcServer *self)
+{
+	g_return_if_fail (IRC_IS_SERVER(self));
+
+	IrcServerPrivate *priv = irc_server_get_instance_private (self);
+
+	if (priv->capture == NULL)
+		return;
+
+	g_autoptr(GError) err = NULL;
+	if (!g_output_stream_close (priv->capture, NULL, &err))
+		g_warning ("Failed to close capture: %s", err->message);
+	g_clear_object (&priv->capture);
+}
+
+static void
+capture_line (IrcServer *self, const char *line, gsize len)
+{
+	IrcServerPrivate *priv = irc_server_get_instance_private (self);
+	g_autoptr(GError) err = NULL;
+	char record[64];
+
+	const int record_len = g_snprintf (record, sizeof(record), "%" G_GINT64_FORMAT " %" G_GSIZE_FORMAT "\n",
+									   g_get_monotonic_time () - priv->capture_start, len);
+
+	if (!g_output_stream_write_all (priv->capture, record, (gsize)record_len, NULL, NULL, &err) ||
+		!g_output_stream_write_all (priv->capture, line, len, NULL, NULL, &err) ||
+		!g_output_stream_write_all (priv->capture, "\n", 1, NULL, NULL, &err))
+	{
+		g_warning ("Failed to write capture, stopping: %s", err->message);
+		irc_server_stop_capture (self);
+	}
+}
+
+static void
+start_capture_from_env (IrcServer *self)
+{
+	IrcServerPrivate *priv = irc_server_get_instance_private (self);
+	const char *capture_dir = g_getenv ("IRC_CAPTURE_DIR");
+
+	if (capture_dir == NULL || *capture_dir == '\0')
+		return;
+
+	g_autoptr(GDateTime) now = g_date_time_new_now_local ();
+	g_autofree char *timestamp = g_date_time_format (now, "%Y%m%d-%H%M%S");
+	g_autofree char *filename = g_strdup_printf ("%s-%s.capture", priv->network_name, timestamp);
+	g_autoptr(GFile) file = g_file_new_build_filename (capture_dir, filename, NULL);
+	g_autoptr(GError) err = NULL;
+
+	if (!irc_server_start_capture (self, file, &err))
+		g_warning ("Failed to start capture: %s", err->message);
+	else
+		g_info ("Capturing to %s", g_file_peek_path (file));
+}
+
+static void connection_lost (IrcServer *self);
+
 static void
 on_readline_ready (GObject *source, GAsyncResult *res, gpointer data)
 {
@@ -1530,31 +2507,43 @@ on_readline_ready (GObject *source, GAsyncResult *res, gpointer data)
 	gsize len;
 	IrcServer *server = IRC_SERVER(data);
 
+	IRC_TRACE_BEGIN(read);
 	input = g_data_input_stream_read_line_finish (in_stream, res, &len, &err);
+	IRC_TRACE_END(read, NULL);
 	if (err != NULL)
 	{
-		g_warning ("Reading error: %s (%d)", err->message, err->code);
-		if (err->code != G_IO_ERROR_CLOSED)
-			irc_server_disconnect (server);
+		// Cancelled means we closed it ourselves
+		if (!g_error_matches (err, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+		{
+			g_warning ("Reading error: %s (%d)", err->message, err->code);
+			if (err->code != G_IO_ERROR_CLOSED)
+				connection_lost (server);
+		}
 		g_clear_error (&err);
 		return;
 	}
 	else if (input == NULL)
 	{
 		g_warning ("Empty line, End of stream");
-		irc_server_disconnect (server);
+		connection_lost (server);
 		return;
 	}
 
 	IrcServerPrivate *priv = irc_server_get_instance_private (server);
 
+	if (priv->capture != NULL)
+		capture_line (server, input, len);
+
 	g_assert (len <= G_MAXSSIZE);
-	g_autofree char *utf8_input;
-	if (g_ascii_strcasecmp (priv->encoding, "UTF-8") == 0)
-		utf8_input = g_utf8_make_valid (input, (gssize)len);
-	else
-		utf8_input = irc_convert_invalid_text (input, (gssize)len, priv->in_decoder, "�");
-	g_print ("\033[32m>>\033[0m %s\n", utf8_input);
+	IRC_TRACE_BEGIN(decode);
+	g_autofree char *repaired = NULL;
+	const char *utf8_input = input;
+	if (priv->encoding_kind == ENCODING_ICONV)
+		utf8_input = irc_converter_convert (priv->decoder, input, len, NULL);
+	else if (!irc_utf8_validate (input, len))
+		utf8_input = repaired = g_utf8_make_valid (input, (gssize)len);
+	IRC_TRACE_END(decode, priv->encoding);
+	irc_raw_log_append (priv->raw_log, IRC_RAW_LOG_INBOUND, utf8_input, -1);
 	gboolean handled;
 	g_signal_emit (server, obj_signals[INBOUND], 0, utf8_input, &handled);
 
@@ -1571,7 +2560,12 @@ connect_ready(GObject *source, GAsyncResult *res, gpointer data)
 	connection = g_socket_client_connect_to_uri_finish (G_SOCKET_CLIENT(source), res, &err);
   	if (err != NULL)
 	{
-		g_warning ("Connecting error: %s", err->message);
+		// Cancelled by a disconnect or a newer connection
+		if (!g_error_matches (err, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+		{
+			g_warning ("Connecting error: %s", err->message);
+			connection_lost (IRC_SERVER(data));
+		}
 		g_clear_error (&err);
 		return;
 	}
@@ -1600,10 +2594,13 @@ connect_ready(GObject *source, GAsyncResult *res, gpointer data)
 	g_autofree char *username = g_settings_get_string (priv->settings, "server-username");
 	g_autofree char *password = g_settings_get_string (priv->settings, "server-password");
 	priv->me = irc_user_new (nick);
+	g_clear_pointer (&priv->highlight, irc_matcher_unref);
 	g_object_set (priv->me, "realname", realname, "username", username, NULL); // FIXME: Username might be wrong
 	if (!g_hash_table_replace (priv->usertable, priv->me->nick, priv->me))
 		g_assert_not_reached ();
 
+	start_capture_from_env (self);
+
 	if (*password)
 		irc_server_write_linef (self, "PASS %s\r\nCAP LS 302\r\nNICK %s\r\nUSER %s * * :%s",
 							password, priv->me->nick, priv->me->username, priv->me->realname);
@@ -1612,13 +2609,9 @@ connect_ready(GObject *source, GAsyncResult *res, gpointer data)
 							priv->me->nick, priv->me->username, priv->me->realname);
 }
 
-void
-irc_server_connect (IrcServer *self)
+static void
+start_connecting (IrcServer *self)
 {
-  	g_return_if_fail (IRC_IS_SERVER(self));
-
-	irc_server_disconnect (self); // Clean up any previous state
-
 	IrcServerPrivate *priv = irc_server_get_instance_private (self);
 	gboolean tls = g_socket_client_get_tls (priv->socket);
 	if (!tls && check_sts_enforcement (self))
@@ -1642,6 +2635,12 @@ foreach_channel_set_parted (gpointer key, gpointer value, gpointer data)
 	irc_channel_set_joined (channel, FALSE);
 }
 
+static void
+foreach_channel_suspend (gpointer key, gpointer value, gpointer data)
+{
+	irc_channel_suspend (IRC_CHANNEL(value));
+}
+
 static void
 foreach_query_set_offline (gpointer key, gpointer value, gpointer data)
 {
@@ -1649,14 +2648,20 @@ foreach_query_set_offline (gpointer key, gpointer value, gpointer data)
 	irc_query_set_online (query, FALSE);
 }
 
-void
-irc_server_disconnect (IrcServer *self)
+/*
+ * Drops the connection and its state. With keep_channels the channels keep
+ * their users so rejoining only syncs what changed, those users move to the
+ * stale users until NAMES lists them again.
+ */
+static void
+close_connection (IrcServer *self, gboolean send_quit, gboolean keep_channels)
 {
-	g_return_if_fail (IRC_IS_SERVER(self));
-
 	IrcServerPrivate *priv = irc_server_get_instance_private (self);
 
 	g_debug ("Disconnecting");
+	irc_server_stop_capture (self);
+	finish_who_batch (self, FALSE); // Its references would keep users around
+
 	if (priv->connect_cancel)
 	{
 		g_cancellable_cancel (priv->connect_cancel);
@@ -1671,12 +2676,14 @@ irc_server_disconnect (IrcServer *self)
 
   	if (priv->conn)
 	{
-		irc_server_write_line (self, "QUIT");
+		if (send_quit)
+			irc_server_write_line (self, "QUIT");
 		g_io_stream_close_async (G_IO_STREAM(priv->conn), G_PRIORITY_HIGH, NULL, NULL, NULL);
 		g_clear_object (&priv->conn);
 	}
+	irc_server_flushq (self); // Lines queued for the old connection
 
-	g_hash_table_foreach (priv->chantable, foreach_channel_set_parted, NULL);
+	g_hash_table_foreach (priv->chantable, keep_channels ? foreach_channel_suspend : foreach_channel_set_parted, NULL);
   	g_hash_table_foreach (priv->querytable, foreach_query_set_offline, NULL);
 	//g_hash_table_remove_all (priv->usertable); // Chan/Query references users
 	if (priv->me)
@@ -1685,7 +2692,14 @@ irc_server_disconnect (IrcServer *self)
 		g_clear_object (&priv->me);
 	}
 
-	g_assert (g_hash_table_size (priv->usertable) == 0); // Nothing should be left
+	// Their nicks may belong to anyone on the next connection, including us
+	g_hash_table_foreach (priv->usertable, stale_users_foreach, priv->stale_users);
+	g_hash_table_steal_all (priv->usertable);
+
+	if (!keep_channels)
+		g_assert (g_hash_table_size (priv->stale_users) == 0); // Nothing should be left
+
+	priv->registered = FALSE;
 
 	// Reset CAP state
 	update_sts_expiration (self);
@@ -1697,9 +2711,95 @@ irc_server_disconnect (IrcServer *self)
 	priv->waiting_on_cap = FALSE;
 	priv->waiting_on_sasl = FALSE;
 
+	// Whatever was learned may have changed while disconnected
+	clear_who_queue (self);
+	g_hash_table_remove_all (priv->known_users);
+
+	// And ISUPPORT
+	g_hash_table_remove_all (priv->targmax);
+	priv->monitor_limit = 0;
+	priv->line_len = DEFAULT_LINE_LEN;
+
 	g_object_notify (G_OBJECT(self), "active");
 }
 
+static void
+cancel_reconnect (IrcServer *self)
+{
+	IrcServerPrivate *priv = irc_server_get_instance_private (self);
+
+	if (priv->reconnect_id)
+	{
+		g_source_remove (priv->reconnect_id);
+		priv->reconnect_id = 0;
+	}
+	priv->reconnect_attempts = 0;
+}
+
+static gboolean
+on_reconnect_timeout (gpointer data)
+{
+	IrcServer *self = IRC_SERVER(data);
+	IrcServerPrivate *priv = irc_server_get_instance_private (self);
+
+	priv->reconnect_id = 0;
+	start_connecting (self);
+	return G_SOURCE_REMOVE;
+}
+
+static void
+connection_lost (IrcServer *self)
+{
+	IrcServerPrivate *priv = irc_server_get_instance_private (self);
+
+	close_connection (self, FALSE, TRUE);
+
+	// Exponential backoff where the second half is random so networks that
+	// dropped together don't all come back at the same moment
+	const guint max_delay = MIN(RECONNECT_MAX_DELAY, RECONNECT_MIN_DELAY << MIN(priv->reconnect_attempts, 8)) * 1000;
+	const guint delay = max_delay / 2 + (guint)g_random_int_range (0, (gint32)(max_delay / 2) + 1);
+	++priv->reconnect_attempts;
+
+	g_autofree char *message = g_strdup_printf (_("Disconnected, reconnecting in %.1f seconds"), delay / 1000.0);
+	irc_context_print (IRC_CONTEXT(self), message);
+
+	priv->reconnect_id = g_timeout_add (delay, on_reconnect_timeout, self);
+}
+
+static void
+on_network_changed (GNetworkMonitor *monitor, gboolean available, gpointer data)
+{
+	IrcServer *self = IRC_SERVER(data);
+	IrcServerPrivate *priv = irc_server_get_instance_private (self);
+
+	// Whatever failed is likely to work on the new network, don't wait it out
+	if (available && priv->reconnect_id)
+	{
+		g_source_remove (priv->reconnect_id);
+		on_reconnect_timeout (self);
+	}
+}
+
+void
+irc_server_connect (IrcServer *self)
+{
+  	g_return_if_fail (IRC_IS_SERVER(self));
+
+	// Channels are kept so reconnecting by hand resyncs them too
+	cancel_reconnect (self);
+	close_connection (self, TRUE, TRUE);
+	start_connecting (self);
+}
+
+void
+irc_server_disconnect (IrcServer *self)
+{
+	g_return_if_fail (IRC_IS_SERVER(self));
+
+	cancel_reconnect (self);
+	close_connection (self, TRUE, FALSE);
+}
+
 void
 irc_server_flushq (IrcServer *self)
 {
@@ -1730,6 +2830,147 @@ irc_server_get_is_connected (IrcServer *self)
 	return FALSE;
 }
 
+static GVariant *
+stat_to_variant (IrcServerStat *stat)
+{
+	GVariantDict dict;
+
+	g_variant_dict_init (&dict, NULL);
+	g_variant_dict_insert (&dict, "count", "t", stat->count);
+	g_variant_dict_insert (&dict, "bytes", "t", stat->bytes);
+	g_variant_dict_insert (&dict, "prints", "t", stat->prints);
+	g_variant_dict_insert (&dict, "parse-time", "x", stat->parse_time);
+	g_variant_dict_insert (&dict, "dispatch-time", "x", stat->dispatch_time);
+	g_variant_dict_insert (&dict, "print-time", "x", stat->print_time);
+	g_variant_dict_insert (&dict, "max-time", "x", stat->max_time);
+	g_variant_dict_insert_value (&dict, "histogram",
+								 g_variant_new_fixed_array (G_VARIANT_TYPE_UINT64, stat->histogram,
+															STATS_N_BUCKETS, sizeof(guint64)));
+
+	return g_variant_dict_end (&dict);
+}
+
+/**
+ * irc_server_get_stats:
+ *
+ * Snapshot of the time spent handling each command and numeric since the
+ * server was created. Keyed by command in `commands`, times are in
+ * nanoseconds and `dispatch-time` includes `print-time`. Bucket `n` of
+ * `histogram` counts lines that took less than 2^n microseconds.
+ *
+ * The send queue is described by `sendq-*` keys, times are in microseconds.
+ *
+ * Returns: (transfer floating): Dictionary of type `a{sv}`
+ */
+GVariant *
+irc_server_get_stats (IrcServer *self)
+{
+	IrcServerPrivate *priv = irc_server_get_instance_private (self);
+	GVariantBuilder commands;
+	GVariantDict dict;
+	GHashTableIter iter;
+	gpointer key, value;
+
+	g_variant_builder_init (&commands, G_VARIANT_TYPE("a{sa{sv}}"));
+	g_hash_table_iter_init (&iter, priv->stats);
+	while (g_hash_table_iter_next (&iter, &key, &value))
+		g_variant_builder_add (&commands, "{s@a{sv}}", key, stat_to_variant (value));
+
+	g_variant_dict_init (&dict, NULL);
+	g_variant_dict_insert_value (&dict, "commands", g_variant_builder_end (&commands));
+	g_variant_dict_insert (&dict, "sendq-depth", "u", g_queue_get_length (priv->sendq));
+	g_variant_dict_insert (&dict, "sendq-max-depth", "u", priv->sendq_max_depth);
+	g_variant_dict_insert (&dict, "sendq-lines", "t", priv->sendq_lines);
+	g_variant_dict_insert (&dict, "sendq-wait", "x", priv->sendq_wait);
+	g_variant_dict_insert (&dict, "sendq-max-wait", "x", priv->sendq_max_wait);
+
+	return g_variant_dict_end (&dict);
+}
+
+static gint64
+stat_percentile (IrcServerStat *stat, guint64 percent)
+{
+	const guint64 target = (stat->count * percent + 99) / 100;
+	guint64 seen = 0;
+
+	for (guint i = 0; i < STATS_N_BUCKETS - 1; ++i)
+	{
+		seen += stat->histogram[i];
+		if (seen >= target)
+			return (gint64)1 << i; // Upper bound of the bucket
+	}
+
+	return stat->max_time / 1000;
+}
+
+static int
+compare_stat_time (gconstpointer a, gconstpointer b, gpointer data)
+{
+	GHashTable *stats = data;
+	IrcServerStat *stat1 = g_hash_table_lookup (stats, *(const char**)a);
+	IrcServerStat *stat2 = g_hash_table_lookup (stats, *(const char**)b);
+	const gint64 time1 = stat1->parse_time + stat1->dispatch_time;
+	const gint64 time2 = stat2->parse_time + stat2->dispatch_time;
+
+	return (time1 < time2) - (time1 > time2);
+}
+
+/**
+ * irc_server_print_stats:
+ *
+ * Prints irc_server_get_stats() to the server, slowest commands first.
+ */
+void
+irc_server_print_stats (IrcServer *self)
+{
+	IrcServerPrivate *priv = irc_server_get_instance_private (self);
+	g_autoptr(GPtrArray) keys = g_hash_table_get_keys_as_ptr_array (priv->stats);
+
+	g_ptr_array_sort_with_data (keys, compare_stat_time, priv->stats);
+	irc_context_print (IRC_CONTEXT(self), _("Time spent handling each command:"));
+
+	for (guint i = 0; i < keys->len; ++i)
+	{
+		const char *command = g_ptr_array_index (keys, i);
+		IrcServerStat *stat = g_hash_table_lookup (priv->stats, command);
+		g_autofree char *size = g_format_size (stat->bytes);
+		g_autofree char *line = g_strdup_printf (_("%s: %"G_GUINT64_FORMAT" lines, %s, %.1f ms "
+												   "(parsing %.1f ms, %"G_GUINT64_FORMAT" prints %.1f ms), "
+												   "p50 %"G_GINT64_FORMAT" µs, p99 %"G_GINT64_FORMAT" µs, "
+												   "max %.1f ms"),
+												 command, stat->count, size,
+												 (double)(stat->parse_time + stat->dispatch_time) / 1e6,
+												 (double)stat->parse_time / 1e6,
+												 stat->prints, (double)stat->print_time / 1e6,
+												 stat_percentile (stat, 50), stat_percentile (stat, 99),
+												 (double)stat->max_time / 1e6);
+		irc_context_print (IRC_CONTEXT(self), line);
+	}
+
+	g_autofree char *sendq = g_strdup_printf (_("Send queue: %u lines waiting (at most %u), "
+												"%"G_GUINT64_FORMAT" lines delayed %.1f s on average and at most %.1f s"),
+											  g_queue_get_length (priv->sendq), priv->sendq_max_depth, priv->sendq_lines,
+											  priv->sendq_lines ? (double)priv->sendq_wait / 1e6 / (double)priv->sendq_lines : 0.0,
+											  (double)priv->sendq_max_wait / 1e6);
+	irc_context_print (IRC_CONTEXT(self), sendq);
+}
+
+/**
+ * irc_server_get_raw_log:
+ *
+ * Lines are only echoed to stdout if `IRC_RAW_LOG_STDOUT` is set and written
+ * to `$IRC_RAW_LOG_DIR/<network>.log` if that is set.
+ *
+ * Returns: (transfer none): Recent lines sent and received
+ */
+IrcRawLog *
+irc_server_get_raw_log (IrcServer *self)
+{
+	IrcServerPrivate *priv = irc_server_get_instance_private (self);
+
+	return priv->raw_log;
+}
+
 /**
  * irc_server_get_action_group:
  *
@@ -1743,9 +2984,12 @@ irc_server_get_action_group (void)
 									IRC_CONTEXT_ACTION_CALLBACK(irc_server_disconnect));
 	GAction *connect_action = irc_context_action_new ("connect",
 								IRC_CONTEXT_ACTION_CALLBACK(irc_server_connect));
+	GAction *stats_action = irc_context_action_new ("stats",
+								IRC_CONTEXT_ACTION_CALLBACK(irc_server_print_stats));
 
 	g_action_map_add_action (G_ACTION_MAP(group), disconnect_action);
 	g_action_map_add_action (G_ACTION_MAP(group), connect_action);
+	g_action_map_add_action (G_ACTION_MAP(group), stats_action);
 	return G_ACTION_GROUP (group);
 }
 
@@ -1852,13 +3096,25 @@ irc_server_finalize (GObject *object)
 	irc_server_flushq (self);
 	irc_server_disconnect (self);
 	g_queue_free (priv->sendq);
+	irc_raw_log_unref (priv->raw_log);
+	g_hash_table_unref (priv->stats);
+	g_hash_table_unref (priv->targmax);
+	g_queue_free (priv->who_queue);
+	g_hash_table_unref (priv->who_batch);
 	g_clear_object (&priv->socket);
 	g_free (priv->host);
+	g_free (priv->encoding);
+	g_clear_pointer (&priv->decoder, irc_converter_unref);
+	g_clear_pointer (&priv->encoder, irc_converter_unref);
 	g_clear_pointer (&priv->sasl_mech, g_free);
   	g_hash_table_unref (priv->chantable);
 	g_hash_table_unref (priv->querytable);
   	g_hash_table_unref (priv->usertable); // channels reference users
+	g_hash_table_unref (priv->stale_users);
+	g_hash_table_unref (priv->known_users);
   	g_clear_object (&priv->me);
+	g_clear_pointer (&priv->highlight, irc_matcher_unref);
+	g_signal_handlers_disconnect_by_data (priv->settings, self);
 	g_clear_object (&priv->settings);
 
 	G_OBJECT_CLASS (irc_server_parent_class)->finalize (object);
@@ -2004,20 +3260,26 @@ irc_server_set_property (GObject      *object,
 		priv->statusmsg = g_value_dup_string (value);
 		break;
 	case PROP_ENCODING:
-		if (priv->encoding)
-		{
-			g_free (priv->encoding);
-			g_iconv_close (priv->in_decoder);
-			g_iconv_close (priv->out_encoder);
-			priv->in_decoder = NULL;
-			priv->out_encoder = NULL;
-		}
+		g_free (priv->encoding);
+		g_clear_pointer (&priv->decoder, irc_converter_unref);
+		g_clear_pointer (&priv->encoder, irc_converter_unref);
 		priv->encoding = g_value_dup_string (value);
-		if (g_ascii_strcasecmp (priv->encoding, "UTF-8") != 0)
+		priv->encoding_kind = ENCODING_UTF8;
+		if (g_ascii_strcasecmp (priv->encoding, "UTF-8") != 0 && g_ascii_strcasecmp (priv->encoding, "UTF8") != 0)
 		{
-			// TODO: Ensure valid encoding
-			priv->in_decoder = g_iconv_open ("UTF-8", priv->encoding);
-			priv->out_encoder = g_iconv_open (priv->encoding, "UTF-8");
+			g_autoptr(GError) err = NULL;
+
+			priv->decoder = irc_converter_new ("UTF-8", priv->encoding, "�", &err);
+			if (priv->decoder != NULL)
+				priv->encoder = irc_converter_new (priv->encoding, "UTF-8", "?", &err);
+
+			if (priv->encoder != NULL)
+				priv->encoding_kind = ENCODING_ICONV;
+			else
+			{
+				g_warning ("Using UTF-8 instead of %s: %s", priv->encoding, err->message);
+				g_clear_pointer (&priv->decoder, irc_converter_unref);
+			}
 		}
 		break;
 	default:
@@ -2033,6 +3295,19 @@ irc_server_constructed (GObject *object)
 
 	g_autofree char *path = g_strconcat ("/se/tingping/IrcClient/", priv->network_name, "/", NULL);
 	priv->settings = g_settings_new_with_path ("se.tingping.network", path);
+	g_signal_connect (priv->settings, "changed::highlight-words", G_CALLBACK(on_highlight_setting_changed), self);
+	g_signal_connect (priv->settings, "changed::nickname", G_CALLBACK(on_highlight_setting_changed), self);
+
+	const char *raw_log_dir = g_getenv ("IRC_RAW_LOG_DIR");
+	if (raw_log_dir != NULL && *raw_log_dir != '\0')
+	{
+		g_autofree char *filename = g_strconcat (priv->network_name, ".log", NULL);
+		g_autoptr(GFile) file = g_file_new_build_filename (raw_log_dir, filename, NULL);
+		g_autoptr(GError) err = NULL;
+
+		if (!irc_raw_log_set_file (priv->raw_log, file, RAW_LOG_MAX_SIZE, &err))
+			g_warning ("Failed to open raw log: %s", err->message);
+	}
 }
 
 static void
@@ -2098,6 +3373,25 @@ irc_server_class_init (IrcServerClass *klass)
 	obj_signals[CONNECTED] = g_signal_new ("connected", G_TYPE_FROM_CLASS(klass), G_SIGNAL_RUN_LAST,
 										   0, NULL, NULL, NULL, G_TYPE_NONE, 0);
 
+	/**
+	 * IrcServer::ready:
+	 *
+	 * Registration finished and the MOTD was received, channels are being rejoined.
+	 */
+	obj_signals[READY] = g_signal_new ("ready", G_TYPE_FROM_CLASS(klass), G_SIGNAL_RUN_LAST,
+									   0, NULL, NULL, NULL, G_TYPE_NONE, 0);
+
+	/**
+	 * IrcServer::users-updated:
+	 * @users: (element-type IrcUser): Users with new details
+	 *
+	 * Emitted at the end of a WHO reply with every user it changed. The
+	 * users' own notifications are held until then.
+	 */
+	obj_signals[USERS_UPDATED] = g_signal_new ("users-updated", G_TYPE_FROM_CLASS(klass), G_SIGNAL_RUN_LAST,
+											   0, NULL, NULL, NULL, G_TYPE_NONE, 1,
+											   G_TYPE_PTR_ARRAY | G_SIGNAL_TYPE_STATIC_SCOPE);
+
   	obj_signals[INBOUND] = g_signal_new ("inbound", G_TYPE_FROM_CLASS(klass), G_SIGNAL_RUN_LAST|G_SIGNAL_ACTION|G_SIGNAL_NO_RECURSE,
 										G_STRUCT_OFFSET(IrcServerClass, inbound_line),
 										g_signal_accumulator_true_handled, NULL,
@@ -2128,9 +3422,13 @@ irc_server_init (IrcServer *self)
   	g_socket_client_set_timeout (priv->socket, 180);
 
 	g_signal_connect (priv->socket, "event", G_CALLBACK(on_socket_client_event), self);
+	g_signal_connect_object (g_network_monitor_get_default (), "network-changed",
+							 G_CALLBACK(on_network_changed), self, 0);
 
 	priv->usertable = g_hash_table_new_full ((GHashFunc)priv->str_hash, (GEqualFunc)priv->str_equal,
 												NULL, NULL);
+	priv->stale_users = g_hash_table_new_full ((GHashFunc)priv->str_hash, (GEqualFunc)priv->str_equal,
+												NULL, NULL);
 
 	priv->chantable = g_hash_table_new_full ((GHashFunc)priv->str_hash, (GEqualFunc)priv->str_equal,
 												NULL, g_object_unref);
@@ -2139,4 +3437,12 @@ irc_server_init (IrcServer *self)
 												NULL, g_object_unref);
 
 	priv->sendq = g_queue_new ();
+	priv->raw_log = irc_raw_log_new (RAW_LOG_LINES);
+	irc_raw_log_set_echo (priv->raw_log, g_getenv ("IRC_RAW_LOG_STDOUT") != NULL);
+	priv->stats = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+	priv->targmax = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+	priv->who_queue = g_queue_new ();
+	priv->who_batch = g_hash_table_new_full (NULL, NULL, g_object_unref, NULL);
+	priv->known_users = g_hash_table_new (NULL, NULL);
+	priv->line_len = DEFAULT_LINE_LEN;
 }
@@ -20,6 +20,7 @@
 
 #include <gio/gio.h>
 #include "irc-channel.h"
+#include "irc-raw-log.h"
 #include "irc-utils.h"
 
 G_BEGIN_DECLS
@@ -76,6 +77,14 @@ gboolean irc_server_get_is_connected (IrcServer *self) NON_NULL();
 void irc_server_write_line (IrcServer *self, const char *line) NON_NULL();
 gboolean irc_server_str_equal (IrcServer *self, const char *str1, const char *str2) NON_NULL();
 void irc_server_write_linef (IrcServer *self, const char *format, ...) G_GNUC_PRINTF(2, 3);
+void irc_server_write_command (IrcServer *self, const char * const *tags, const char *command,
+                               const char * const *params, const char *trailing) NON_NULL(1, 3);
+void irc_server_write_message (IrcServer *self, const char *target, const char *text, gboolean action) NON_NULL();
 GActionGroup *irc_server_get_action_group (void);
+gboolean irc_server_start_capture (IrcServer *self, GFile *file, GError **error) NON_NULL(1,2);
+void irc_server_stop_capture (IrcServer *self) NON_NULL();
+GVariant *irc_server_get_stats (IrcServer *self) NON_NULL();
+void irc_server_print_stats (IrcServer *self) NON_NULL();
+IrcRawLog *irc_server_get_raw_log (IrcServer *self) NON_NULL();
 
 G_END_DECLS
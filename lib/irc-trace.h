@@ -0,0 +1,50 @@
+/* irc-trace.h
+ *
+ * Copyright (C) 2017 Patrick Griffis <tingping@tingping.se>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <glib.h>
+
+/*
+ * Marks shown by sysprof for each step a line goes through, so a capture
+ * shows where main thread time goes line by line. Only built with
+ * -Dwith-sysprof=true, otherwise they compile to nothing and the message
+ * is never evaluated.
+ *
+ *   IRC_TRACE_BEGIN(decode);
+ *   ...
+ *   IRC_TRACE_END(decode, line);
+ *
+ * Both have to be in the same scope.
+ */
+#if ENABLE_TRACING
+
+#include <sysprof-capture.h>
+
+#define IRC_TRACE_BEGIN(name) \
+	const gint64 irc_trace_begin_##name = SYSPROF_CAPTURE_CURRENT_TIME
+#define IRC_TRACE_END(name, message) \
+	sysprof_collector_mark (irc_trace_begin_##name, SYSPROF_CAPTURE_CURRENT_TIME - irc_trace_begin_##name, \
+							"irc", #name, (message))
+
+#else
+
+#define IRC_TRACE_BEGIN(name) G_STMT_START { } G_STMT_END
+#define IRC_TRACE_END(name, message) G_STMT_START { } G_STMT_END
+
+#endif
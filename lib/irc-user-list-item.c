@@ -66,8 +66,12 @@ irc_user_list_item_set_property (GObject      *object,
 	switch (prop_id)
 	{
 	case PROP_PREFIX:
-		g_free (self->prefix);
-		self->prefix = g_value_dup_string (value);
+		if (g_strcmp0 (self->prefix, g_value_get_string (value)) != 0)
+		{
+			g_free (self->prefix);
+			self->prefix = g_value_dup_string (value);
+			g_object_notify_by_pspec (object, pspec);
+		}
 		break;
 	case PROP_USER:
 		self->user = g_value_dup_object (value);
@@ -99,7 +103,7 @@ irc_user_list_item_class_init (IrcUserListItemClass *klass)
 
 	g_object_class_install_property (object_class, PROP_PREFIX,
 									g_param_spec_string ("prefix", _("Prefix"), _("Prefix of user"),
-										NULL, G_PARAM_READWRITE|G_PARAM_CONSTRUCT|G_PARAM_STATIC_STRINGS));
+										NULL, G_PARAM_READWRITE|G_PARAM_CONSTRUCT|G_PARAM_EXPLICIT_NOTIFY|G_PARAM_STATIC_STRINGS));
 
   	g_object_class_install_property (object_class, PROP_USER,
 									g_param_spec_object ("user", _("User"), _("A User"),
@@ -33,6 +33,7 @@ struct _IrcUserListItem
 
 	char *prefix;
 	IrcUser *user;
+	gint64 last_active;
 };
 
 IrcUserListItem *irc_user_list_item_new (IrcUser *user, const char *prefix) NON_NULL(1);
@@ -26,6 +26,8 @@ struct _IrcUserList
 typedef struct
 {
 	GSequence *users;
+	GHashTable *iters; // IrcUser -> GSequenceIter
+	GHashTable *synced; // Set of IrcUser added since irc_user_list_begin_sync()
 
 	/* cache */
 	guint last_position;
@@ -44,29 +46,20 @@ irc_user_list_new (void)
 	return g_object_new (IRC_TYPE_USER_LIST, NULL);
 }
 
-static GSequenceIter *
-get_iter_by_user (GSequence *seq, IrcUser *user)
+static inline GSequenceIter *
+get_iter_by_user (IrcUserList *self, IrcUser *user)
 {
-	g_return_val_if_fail (user != NULL, NULL);
-
-	GSequenceIter *it = g_sequence_get_begin_iter (seq);
-	while (!g_sequence_iter_is_end (it))
-	{
-		IrcUserListItem *item = g_sequence_get (it);
-		if (item->user == user)
-			return it;
+	IrcUserListPrivate *priv = irc_user_list_get_instance_private (self);
 
-		it = g_sequence_iter_next (it);
-	}
+	g_return_val_if_fail (user != NULL, NULL);
 
-	return NULL;
+	return g_hash_table_lookup (priv->iters, user);
 }
 
 const char *
 irc_user_list_get_users_prefix (IrcUserList *self, IrcUser *user)
 {
-	IrcUserListPrivate *priv = irc_user_list_get_instance_private (self);
-	GSequenceIter *it = get_iter_by_user (priv->users, user);
+	GSequenceIter *it = get_iter_by_user (self, user);
 	if (it)
 		return IRC_USER_LIST_ITEM(g_sequence_get (it))->prefix;
 
@@ -76,8 +69,7 @@ irc_user_list_get_users_prefix (IrcUserList *self, IrcUser *user)
 void
 irc_user_list_set_users_prefix (IrcUserList *self, IrcUser *user, const char *prefix)
 {
-	IrcUserListPrivate *priv = irc_user_list_get_instance_private (self);
-	GSequenceIter *it = get_iter_by_user (priv->users, user);
+	GSequenceIter *it = get_iter_by_user (self, user);
 	if (!it)
 		return;
 
@@ -106,12 +98,24 @@ irc_user_list_items_changed (IrcUserList *self, guint position, guint removed, g
 	g_list_model_items_changed (G_LIST_MODEL (self), position, removed, added);
 }
 
+static guint
+insert_item (IrcUserList *self, IrcUserListItem *item)
+{
+	IrcUserListPrivate *priv = irc_user_list_get_instance_private (self);
+
+	GSequenceIter *it = g_sequence_insert_sorted (priv->users, item,
+                                    (GCompareDataFunc)irc_user_compare_func, NULL);
+	g_assert (it != NULL);
+	g_hash_table_insert (priv->iters, item->user, it);
+
+	return (guint)g_sequence_iter_get_position (it);
+}
+
 static void
 on_nick_changed (IrcUser *user, GParamSpec *pspec, gpointer data)
 {
 	IrcUserList *self = IRC_USER_LIST(data);
-	IrcUserListPrivate *priv = irc_user_list_get_instance_private (self);
-	GSequenceIter *it = get_iter_by_user (priv->users, user);
+	GSequenceIter *it = get_iter_by_user (self, user);
 	if (it == NULL)
 	{
 		g_warning ("Got notify::nick signal from user not in channel user list");
@@ -124,32 +128,58 @@ on_nick_changed (IrcUser *user, GParamSpec *pspec, gpointer data)
 	guint position = (guint)g_sequence_iter_get_position (it);
 	g_sequence_remove (it);
 	irc_user_list_items_changed (self, position, 1, 0);
-	irc_user_list_add (self, item->user, item->prefix);
+
+	position = insert_item (self, g_steal_pointer (&item));
+	irc_user_list_items_changed (self, position, 0, 1);
 }
 
+/**
+ * irc_user_list_add:
+ * @user: User to add
+ * @prefix: (nullable): Prefix of @user in the channel
+ *
+ * While syncing a user already in the list only has its prefix updated.
+ */
 void
 irc_user_list_add (IrcUserList *self, IrcUser *user, const char *prefix)
 {
 	IrcUserListPrivate *priv = irc_user_list_get_instance_private (self);
-	IrcUserListItem *item = irc_user_list_item_new (user, prefix);
 
-	GSequenceIter *it = g_sequence_insert_sorted (priv->users, item,
-                                    (GCompareDataFunc)irc_user_compare_func, NULL);
-	g_assert (it != NULL);
-	guint position = (guint)g_sequence_iter_get_position (it);
+	if (priv->synced != NULL)
+	{
+		g_hash_table_add (priv->synced, user);
+		if (irc_user_list_contains (self, user))
+		{
+			if (g_strcmp0 (irc_user_list_get_users_prefix (self, user), prefix) != 0)
+				irc_user_list_set_users_prefix (self, user, prefix);
+			return;
+		}
+	}
+
+	guint position = insert_item (self, irc_user_list_item_new (user, prefix));
 
 	g_signal_connect (user, "notify::nick", G_CALLBACK(on_nick_changed), self);
 	irc_user_list_items_changed (self, position, 0, 1);
 }
 
+static void
+disconnect_user (gpointer key, gpointer value, gpointer data)
+{
+	g_signal_handlers_disconnect_by_func (key, on_nick_changed, data);
+}
+
 void
 irc_user_list_clear (IrcUserList *self)
 {
 	IrcUserListPrivate *priv = irc_user_list_get_instance_private (self);
 	GSequenceIter *begin, *end;
+	g_clear_pointer (&priv->synced, g_hash_table_unref);
 	if (g_sequence_is_empty (priv->users))
 		return;
 
+	g_hash_table_foreach (priv->iters, disconnect_user, self);
+	g_hash_table_remove_all (priv->iters);
+
 	guint len = (guint)g_sequence_get_length(priv->users);
 	begin = g_sequence_get_begin_iter (priv->users);
 	end = g_sequence_get_end_iter (priv->users);
@@ -162,10 +192,14 @@ gboolean
 irc_user_list_remove (IrcUserList *self, IrcUser *user)
 {
 	IrcUserListPrivate *priv = irc_user_list_get_instance_private (self);
-	GSequenceIter *it = get_iter_by_user (priv->users, user);
+	GSequenceIter *it = get_iter_by_user (self, user);
 	if (it)
 	{
 		guint position = (guint)g_sequence_iter_get_position (it);
+		g_hash_table_remove (priv->iters, user);
+		if (priv->synced != NULL)
+			g_hash_table_remove (priv->synced, user);
+		g_signal_handlers_disconnect_by_func (user, on_nick_changed, self);
 		g_sequence_remove (it);
 
 		irc_user_list_items_changed (self, position, 1, 0);
@@ -177,10 +211,151 @@ irc_user_list_remove (IrcUserList *self, IrcUser *user)
 
 gboolean
 irc_user_list_contains (IrcUserList *self, IrcUser *user)
+{
+	return get_iter_by_user (self, user) != NULL;
+}
+
+/**
+ * irc_user_list_begin_sync:
+ *
+ * Starts replacing the users with a fresh list, such as NAMES after
+ * rejoining. Users added until irc_user_list_end_sync() keep their place
+ * so only the ones that changed are removed and added.
+ */
+void
+irc_user_list_begin_sync (IrcUserList *self)
 {
 	IrcUserListPrivate *priv = irc_user_list_get_instance_private (self);
-	GSequenceIter *it = get_iter_by_user (priv->users, user);
-	return (it != NULL);
+
+	g_clear_pointer (&priv->synced, g_hash_table_unref);
+	priv->synced = g_hash_table_new (NULL, NULL);
+}
+
+/**
+ * irc_user_list_end_sync:
+ *
+ * Removes every user that was not added since irc_user_list_begin_sync(),
+ * does nothing if not syncing.
+ */
+void
+irc_user_list_end_sync (IrcUserList *self)
+{
+	IrcUserListPrivate *priv = irc_user_list_get_instance_private (self);
+	g_autoptr(GHashTable) synced = g_steal_pointer (&priv->synced);
+	g_autoptr(GPtrArray) stale = g_ptr_array_new ();
+	GHashTableIter iter;
+	gpointer user;
+
+	if (synced == NULL)
+		return;
+
+	g_hash_table_iter_init (&iter, priv->iters);
+	while (g_hash_table_iter_next (&iter, &user, NULL))
+	{
+		if (!g_hash_table_contains (synced, user))
+			g_ptr_array_add (stale, user);
+	}
+
+	for (guint i = 0; i < stale->len; ++i)
+		irc_user_list_remove (self, g_ptr_array_index (stale, i));
+}
+
+/**
+ * irc_user_list_touch:
+ * @user: User who just spoke
+ *
+ * Records activity for @user, used to rank completions.
+ */
+void
+irc_user_list_touch (IrcUserList *self, IrcUser *user)
+{
+	GSequenceIter *it = get_iter_by_user (self, user);
+	if (it)
+		IRC_USER_LIST_ITEM(g_sequence_get (it))->last_active = g_get_monotonic_time ();
+}
+
+static int
+compare_to_prefix (gconstpointer item, gconstpointer prefix, gpointer data)
+{
+	// Never equal so the search lands on the first nick not sorting before the prefix
+	return irc_str_cmp (IRC_USER_LIST_ITEM(item)->user->nick, prefix) < 0 ? -1 : 1;
+}
+
+static GSequenceIter *
+lookup_prefix (IrcUserList *self, const char *prefix)
+{
+	IrcUserListPrivate *priv = irc_user_list_get_instance_private (self);
+
+	return g_sequence_search (priv->users, (gpointer)prefix, compare_to_prefix, NULL);
+}
+
+/**
+ * irc_user_list_get_prefix_range:
+ * @prefix: Start of nicks to look for
+ * @position: (out): Position of the first matching user
+ * @n_items: (out): Number of matching users
+ *
+ * Matching users are always sorted next to each other so they can be
+ * found by binary search.
+ */
+void
+irc_user_list_get_prefix_range (IrcUserList *self, const char *prefix, guint *position, guint *n_items)
+{
+	GSequenceIter *it = lookup_prefix (self, prefix);
+
+	*position = (guint)g_sequence_iter_get_position (it);
+	*n_items = 0;
+
+	while (!g_sequence_iter_is_end (it) &&
+		   irc_str_has_prefix (IRC_USER_LIST_ITEM(g_sequence_get (it))->user->nick, prefix))
+	{
+		++*n_items;
+		it = g_sequence_iter_next (it);
+	}
+}
+
+static int
+compare_by_activity (gconstpointer a, gconstpointer b)
+{
+	IrcUserListItem *i1 = *(IrcUserListItem**)a;
+	IrcUserListItem *i2 = *(IrcUserListItem**)b;
+
+	if (i1->last_active != i2->last_active)
+		return i1->last_active > i2->last_active ? -1 : 1;
+
+	return irc_str_cmp (i1->user->nick, i2->user->nick);
+}
+
+/**
+ * irc_user_list_complete:
+ * @prefix: Start of nicks to complete
+ * @by_activity: Order by who spoke last rather than by nick
+ *
+ * Returns: (transfer full) (element-type IrcUser): Users with a nick starting with @prefix
+ */
+GPtrArray *
+irc_user_list_complete (IrcUserList *self, const char *prefix, gboolean by_activity)
+{
+	g_autoptr(GPtrArray) items = g_ptr_array_new ();
+	GPtrArray *users;
+
+	for (GSequenceIter *it = lookup_prefix (self, prefix); !g_sequence_iter_is_end (it); it = g_sequence_iter_next (it))
+	{
+		IrcUserListItem *item = g_sequence_get (it);
+		if (!irc_str_has_prefix (item->user->nick, prefix))
+			break;
+
+		g_ptr_array_add (items, item);
+	}
+
+	if (by_activity)
+		g_ptr_array_sort (items, compare_by_activity);
+
+	users = g_ptr_array_new_full (items->len, g_object_unref);
+	for (guint i = 0; i < items->len; ++i)
+		g_ptr_array_add (users, g_object_ref (IRC_USER_LIST_ITEM(g_ptr_array_index (items, i))->user));
+
+	return users;
 }
 
 static gpointer
@@ -239,6 +414,9 @@ irc_user_list_finalize (GObject *object)
 	IrcUserList *self = IRC_USER_LIST(object);
 	IrcUserListPrivate *priv = irc_user_list_get_instance_private (self);
 
+	g_hash_table_foreach (priv->iters, disconnect_user, self);
+	g_clear_pointer (&priv->iters, g_hash_table_unref);
+	g_clear_pointer (&priv->synced, g_hash_table_unref);
 	g_clear_pointer (&priv->users, g_sequence_free);
 
 	G_OBJECT_CLASS (irc_user_list_parent_class)->finalize (object);
@@ -266,5 +444,6 @@ irc_user_list_init (IrcUserList *self)
 	IrcUserListPrivate *priv = irc_user_list_get_instance_private (self);
 
 	priv->users = g_sequence_new (g_object_unref);
+	priv->iters = g_hash_table_new (NULL, NULL);
 	priv->last_position = -1u;
 }
@@ -33,7 +33,12 @@ void irc_user_list_add (IrcUserList *list, IrcUser *user, const char *prefix) NO
 void irc_user_list_clear (IrcUserList *list) NON_NULL();
 gboolean irc_user_list_remove (IrcUserList *list, IrcUser *user) NON_NULL();
 gboolean irc_user_list_contains (IrcUserList *list, IrcUser *user) NON_NULL();
+void irc_user_list_begin_sync (IrcUserList *list) NON_NULL();
+void irc_user_list_end_sync (IrcUserList *list) NON_NULL();
 const char *irc_user_list_get_users_prefix (IrcUserList *list, IrcUser *user) NON_NULL();
 void irc_user_list_set_users_prefix (IrcUserList *list, IrcUser *user, const char *prefix) NON_NULL(1,2);
+void irc_user_list_touch (IrcUserList *list, IrcUser *user) NON_NULL();
+void irc_user_list_get_prefix_range (IrcUserList *list, const char *prefix, guint *position, guint *n_items) NON_NULL();
+GPtrArray *irc_user_list_complete (IrcUserList *list, const char *prefix, gboolean by_activity) NON_NULL() WARN_UNUSED_RESULT;
 
 G_END_DECLS
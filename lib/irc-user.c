@@ -128,6 +128,20 @@ irc_user_get_property (GObject *obj, guint prop_id, GValue *val, GParamSpec *psp
 	}
 }
 
+// Properties only notify when they change so repeated WHO replies are quiet
+static void
+set_string (IrcUser *self, char **field, const GValue *val, GParamSpec *pspec)
+{
+	const char *str = g_value_get_string (val);
+
+	if (g_strcmp0 (*field, str) == 0)
+		return;
+
+	g_free (*field);
+	*field = g_strdup (str);
+	g_object_notify_by_pspec (G_OBJECT(self), pspec);
+}
+
 static void
 irc_user_set_property (GObject *obj, guint prop_id, const GValue *val, GParamSpec *pspec)
 {
@@ -137,31 +151,29 @@ irc_user_set_property (GObject *obj, guint prop_id, const GValue *val, GParamSpe
 	switch (prop_id)
 	{
 	case PROP_NICK:
-		g_free (self->nick);
-		self->nick = g_value_dup_string (val);
+		set_string (self, &self->nick, val, pspec);
 		break;
 	case PROP_USER:
-		g_free (self->username);
-		self->username = g_value_dup_string (val);
+		set_string (self, &self->username, val, pspec);
 		break;
 	case PROP_HOST:
-		g_free (self->hostname);
-		self->hostname = g_value_dup_string (val);
+		set_string (self, &self->hostname, val, pspec);
 		break;
 	case PROP_ACCOUNT:
-		g_free (self->account);
-		self->account = g_value_dup_string (val);
+		set_string (self, &self->account, val, pspec);
 		break;
 	case PROP_REAL:
-		g_free (self->realname);
-		self->realname = g_value_dup_string (val);
+		set_string (self, &self->realname, val, pspec);
 		break;
 	case PROP_AWAY:
-		priv->away = g_value_get_boolean (val);
+		if (priv->away != g_value_get_boolean (val))
+		{
+			priv->away = g_value_get_boolean (val);
+			g_object_notify_by_pspec (obj, pspec);
+		}
 		break;
 	case PROP_AWAY_REASON:
-		g_free (priv->away_reason);
-		priv->away_reason = g_value_dup_string (val);
+		set_string (self, &priv->away_reason, val, pspec);
 		break;
 	default:
 		G_OBJECT_WARN_INVALID_PROPERTY_ID (obj, prop_id, pspec);
@@ -178,27 +190,27 @@ irc_user_class_init (IrcUserClass *cls)
 	object_class->set_property = irc_user_set_property;
 
   	obj_props[PROP_REAL] = g_param_spec_string ("realname", _("Real name"), _("Real name of user"),
-							NULL, G_PARAM_READWRITE|G_PARAM_CONSTRUCT);
+							NULL, G_PARAM_READWRITE|G_PARAM_CONSTRUCT|G_PARAM_EXPLICIT_NOTIFY);
 
   	obj_props[PROP_HOST] = g_param_spec_string ("hostname", _("Hostname"), _("Hostname of user"),
-							NULL, G_PARAM_READWRITE|G_PARAM_CONSTRUCT);
+							NULL, G_PARAM_READWRITE|G_PARAM_CONSTRUCT|G_PARAM_EXPLICIT_NOTIFY);
 
   	obj_props[PROP_NICK] = g_param_spec_string ("nick", _("Nickname"), _("Nickname of user"),
-							NULL, G_PARAM_READWRITE|G_PARAM_CONSTRUCT);
+							NULL, G_PARAM_READWRITE|G_PARAM_CONSTRUCT|G_PARAM_EXPLICIT_NOTIFY);
 
 	obj_props[PROP_USER] = g_param_spec_string ("username", _("Username"), _("Username of user"),
-							NULL, G_PARAM_READWRITE|G_PARAM_CONSTRUCT);
+							NULL, G_PARAM_READWRITE|G_PARAM_CONSTRUCT|G_PARAM_EXPLICIT_NOTIFY);
 
 	/**
 	 * IrcUser:account:
 	 * Users account name or %NULL
 	 */
 	obj_props[PROP_ACCOUNT] = g_param_spec_string ("account", _("Account"), _("Account of user"),
-							NULL, G_PARAM_READWRITE|G_PARAM_CONSTRUCT);
+							NULL, G_PARAM_READWRITE|G_PARAM_CONSTRUCT|G_PARAM_EXPLICIT_NOTIFY);
 	obj_props[PROP_AWAY_REASON] = g_param_spec_string ("away-reason", _("Away Reason"), _("Away reason of user"),
-							NULL, G_PARAM_READWRITE|G_PARAM_CONSTRUCT);
+							NULL, G_PARAM_READWRITE|G_PARAM_CONSTRUCT|G_PARAM_EXPLICIT_NOTIFY);
 	obj_props[PROP_AWAY] = g_param_spec_boolean ("away", _("Away"), _("User is away"),
-							FALSE, G_PARAM_READWRITE|G_PARAM_CONSTRUCT);
+							FALSE, G_PARAM_READWRITE|G_PARAM_CONSTRUCT|G_PARAM_EXPLICIT_NOTIFY);
 
 	g_object_class_install_properties (object_class, N_PROPS, obj_props);
 }
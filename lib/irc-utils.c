@@ -19,6 +19,12 @@
  */
 
 #include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
 #include "irc-utils.h"
 #include "irc-private.h"
 
@@ -35,6 +41,85 @@ irc_util_is_valid_hex_color (const char *str, const gsize len)
 	return TRUE;
 }
 
+// Every attribute irc_strip_attributes() removes is below 0x20
+#define STRIPPED_MASK ((1u << BOLD) | (1u << COLOR) | (1u << HEXCOLOR) | (1u << BEEP) | (1u << HIDDEN) | \
+                       (1u << RESET) | (1u << MONOSPACE) | (1u << REVERSE) | (1u << ITALIC) | \
+                       (1u << STRIKETHROUGH) | (1u << UNDERLINE))
+
+static inline gboolean
+is_stripped (guchar c)
+{
+	return c < 0x20 && (STRIPPED_MASK >> c) & 1;
+}
+
+// Offset of the first attribute in str or len if there is none
+static gsize
+find_attribute (const char *str, gsize len)
+{
+	gsize i = 0;
+
+#ifdef __AVX2__
+	const __m256i max32 = _mm256_set1_epi8 (0x1F);
+
+	for (; i + 32 <= len; i += 32)
+	{
+		const __m256i chunk = _mm256_loadu_si256 ((const __m256i*)(const void*)(str + i));
+		guint mask = (guint)_mm256_movemask_epi8 (_mm256_cmpeq_epi8 (_mm256_min_epu8 (chunk, max32), chunk));
+
+		for (; mask != 0; mask &= mask - 1)
+		{
+			const gsize j = i + (guint)g_bit_nth_lsf (mask, -1);
+			if (is_stripped ((guchar)str[j]))
+				return j;
+		}
+	}
+#endif
+
+#ifdef __SSE2__
+	const __m128i max = _mm_set1_epi8 (0x1F);
+
+	for (; i + 16 <= len; i += 16)
+	{
+		const __m128i chunk = _mm_loadu_si128 ((const __m128i*)(const void*)(str + i));
+		// Bytes that are unchanged by min() with 0x1F are control characters
+		guint mask = (guint)_mm_movemask_epi8 (_mm_cmpeq_epi8 (_mm_min_epu8 (chunk, max), chunk));
+
+		for (; mask != 0; mask &= mask - 1)
+		{
+			const gsize j = i + (guint)g_bit_nth_lsf (mask, -1);
+			if (is_stripped ((guchar)str[j]))
+				return j;
+		}
+	}
+#endif
+
+	for (; i < len; ++i)
+	{
+		if (is_stripped ((guchar)str[i]))
+			return i;
+	}
+
+	return len;
+}
+
+/**
+ * irc_has_attributes:
+ * @str: String to check
+ *
+ * Lets callers skip irc_strip_attributes() for the common case of text
+ * without any formatting.
+ *
+ * See Also: #IrcAttribute
+ * Returns: %TRUE if irc_strip_attributes() would change @str
+ */
+gboolean
+irc_has_attributes (const char *str)
+{
+	const gsize len = strlen (str);
+
+	return find_attribute (str, len) != len;
+}
+
 /**
  * irc_strip_attributes:
  * @str: String to strip
@@ -48,10 +133,19 @@ char *
 irc_strip_attributes (const char *str)
 {
 	gsize len = strlen (str);
-	char *stripped = g_malloc (len + 1);
+	const gsize clean = find_attribute (str, len);
 	guint8 parsing_color = 0; // Goes to 2 and counts down
 	gboolean parsing_bg = FALSE, parsing_hexcolor = FALSE;
-	char *dst = stripped;
+
+	if (clean == len)
+		return g_strndup (str, len);
+
+	char *stripped = g_malloc (len + 1);
+	char *dst = stripped + clean;
+
+	memcpy (stripped, str, clean);
+	str += clean;
+	len -= clean;
 
 	#define COLOR_START 2
 
@@ -105,7 +199,14 @@ irc_strip_attributes (const char *str)
 			case MONOSPACE:
 				break;
 			default:
-				*dst++ = *str;
+			{
+				// Copy everything up to the next attribute at once
+				const gsize run = find_attribute (str, len + 1);
+				memcpy (dst, str, run);
+				dst += run;
+				str += run - 1;
+				len -= run - 1;
+			}
 			}
 		}
 		str++;
@@ -191,6 +292,152 @@ irc_tolower (const guchar c)
 	return irc_tolower_table[c];
 }
 
+// Scalar versions of the functions below, the tests check they agree
+
+char *
+irc_strcasestr_scalar (const char *haystack, const char *needle)
+{
+	const gsize needle_len = strlen (needle);
+	const gsize haystack_len = strlen (haystack);
+
+	for (gsize i = 0; haystack_len - i >= needle_len; ++i, ++haystack)
+	{
+		char *haystack_p = (char*)haystack;
+		char *needle_p = (char*)needle;
+		gsize matched = 0;
+
+		while (*needle_p && irc_tolower(*haystack_p) == irc_tolower(*needle_p))
+		{
+			++haystack_p;
+			++needle_p;
+			++matched;
+		}
+		if (matched == needle_len)
+			return (char*)haystack;
+	}
+	return NULL;
+}
+
+int
+irc_str_cmp_scalar (const char *s1, const char *s2)
+{
+    int c1, c2;
+
+	while (*s1 && *s2)
+	{
+		c1 = (int)irc_tolower ((guchar)*s1);
+		c2 = (int)irc_tolower ((guchar)*s2);
+		if (c1 != c2)
+			return (c1 - c2);
+		s1++; s2++;
+	}
+
+	return (((int)(guchar)*s1) - ((int)(guchar)*s2));
+}
+
+gboolean
+irc_str_has_prefix_scalar (const char *s1, const char *s2)
+{
+	const gsize len = strlen (s2);
+	gsize i = 0;
+	int c1, c2;
+
+	while (i < len)
+	{
+		if (!*s1)
+			return FALSE;
+
+		c1 = irc_tolower ((guchar)*s1);
+		c2 = irc_tolower ((guchar)*s2);
+		if (c1 != c2)
+			return FALSE;
+		s1++; s2++; i++;
+	}
+
+	return TRUE;
+}
+
+guint32
+irc_str_hash_scalar (const char *str)
+{
+	const char *p = str;
+	guint32 h = irc_tolower_table [(guchar)*p];
+
+	if (h)
+	{
+		for (p += 1; *p != '\0'; ++p)
+			h = (h << 5) - h + irc_tolower_table [(guchar)*p];
+	}
+
+	return h;
+}
+
+#ifdef __SSE2__
+// Same as irc_tolower_table, 'A' to '^' become 'a' to '~'
+static inline __m128i
+fold_chunk (const char *p)
+{
+	const __m128i chunk = _mm_loadu_si128 ((const __m128i*)(const void*)p);
+	const __m128i offset = _mm_sub_epi8 (chunk, _mm_set1_epi8 ('A'));
+	const __m128i upper = _mm_cmpeq_epi8 (_mm_min_epu8 (offset, _mm_set1_epi8 ('^' - 'A')), offset);
+
+	return _mm_add_epi8 (chunk, _mm_and_si128 (upper, _mm_set1_epi8 ('a' - 'A')));
+}
+
+// Bit set for each byte of the chunks that differs once folded
+static inline guint
+fold_diff (const char *p1, const char *p2)
+{
+	return (guint)_mm_movemask_epi8 (_mm_cmpeq_epi8 (fold_chunk (p1), fold_chunk (p2))) ^ 0xFFFF;
+}
+#endif
+
+#ifdef __AVX2__
+// fold_chunk() for 32 bytes
+static inline __m256i
+fold_chunk32 (const char *p)
+{
+	const __m256i chunk = _mm256_loadu_si256 ((const __m256i*)(const void*)p);
+	const __m256i offset = _mm256_sub_epi8 (chunk, _mm256_set1_epi8 ('A'));
+	const __m256i upper = _mm256_cmpeq_epi8 (_mm256_min_epu8 (offset, _mm256_set1_epi8 ('^' - 'A')), offset);
+
+	return _mm256_add_epi8 (chunk, _mm256_and_si256 (upper, _mm256_set1_epi8 ('a' - 'A')));
+}
+#endif
+
+// Offset of the first of len bytes that differ once folded or len
+static gsize
+fold_mismatch (const char *s1, const char *s2, gsize len)
+{
+	gsize i = 0;
+
+#ifdef __AVX2__
+	for (; i + 32 <= len; i += 32)
+	{
+		const guint diff = ~(guint)_mm256_movemask_epi8 (_mm256_cmpeq_epi8 (fold_chunk32 (s1 + i), fold_chunk32 (s2 + i)));
+		if (diff != 0)
+			return i + (guint)g_bit_nth_lsf (diff, -1);
+	}
+#endif
+
+#ifdef __SSE2__
+	for (; i + 16 <= len; i += 16)
+	{
+		const guint diff = fold_diff (s1 + i, s2 + i);
+		if (diff != 0)
+			return i + (guint)g_bit_nth_lsf (diff, -1);
+	}
+#endif
+
+	for (; i < len; ++i)
+	{
+		if (irc_tolower_table[(guchar)s1[i]] != irc_tolower_table[(guchar)s2[i]])
+			return i;
+	}
+
+	return len;
+}
+
 /**
  * irc_strcasestr:
  * @haystack: String to look in
@@ -208,22 +455,42 @@ irc_strcasestr (const char *haystack, const char *needle)
 {
 	const gsize needle_len = strlen (needle);
 	const gsize haystack_len = strlen (haystack);
+	gsize i = 0;
 
-	for (gsize i = 0; haystack_len - i >= needle_len; ++i, ++haystack)
+	if (needle_len == 0)
+		return (char*)haystack;
+	if (needle_len > haystack_len)
+		return NULL;
+
+	const gsize last = haystack_len - needle_len;
+	const guchar first = irc_tolower_table[(guchar)*needle];
+
+#ifdef __SSE2__
+	// Only positions starting with the first byte of needle are compared
+	const __m128i first_chunk = _mm_set1_epi8 ((char)first);
+
+	for (; i + 16 <= haystack_len && i <= last; i += 16)
 	{
-		char *haystack_p = (char*)haystack;
-		char *needle_p = (char*)needle;
-		gsize matched = 0;
+		guint mask = (guint)_mm_movemask_epi8 (_mm_cmpeq_epi8 (fold_chunk (haystack + i), first_chunk));
 
-		while (*needle_p && irc_tolower(*haystack_p) == irc_tolower(*needle_p))
+		for (; mask != 0; mask &= mask - 1)
 		{
-			++haystack_p;
-			++needle_p;
-			++matched;
+			const gsize start = i + (guint)g_bit_nth_lsf (mask, -1);
+			if (start > last)
+				return NULL;
+			if (fold_mismatch (haystack + start, needle, needle_len) == needle_len)
+				return (char*)haystack + start;
 		}
-		if (matched == needle_len)
-			return (char*)haystack;
 	}
+#endif
+
+	for (; i <= last; ++i)
+	{
+		if (irc_tolower_table[(guchar)haystack[i]] == first &&
+			fold_mismatch (haystack + i, needle, needle_len) == needle_len)
+			return (char*)haystack + i;
+	}
+
 	return NULL;
 }
 
@@ -241,18 +508,14 @@ irc_strcasestr (const char *haystack, const char *needle)
 int
 irc_str_cmp (const char *s1, const char *s2)
 {
-    int c1, c2;
+	const gsize len1 = strlen (s1);
+	const gsize len = strnlen (s2, len1);
+	const gsize i = fold_mismatch (s1, s2, len);
 
-	while (*s1 && *s2)
-	{
-		c1 = (int)irc_tolower (*s1);
-		c2 = (int)irc_tolower (*s2);
-		if (c1 != c2)
-			return (c1 - c2);
-		s1++; s2++;
-	}
+	if (i < len)
+		return (int)irc_tolower_table[(guchar)s1[i]] - (int)irc_tolower_table[(guchar)s2[i]];
 
-	return (((int)*s1) - ((int)*s2));
+	return (int)(guchar)s1[len] - (int)(guchar)s2[len];
 }
 
 /**
@@ -270,22 +533,8 @@ gboolean
 irc_str_has_prefix (const char *s1, const char *s2)
 {
 	const gsize len = strlen (s2);
-	gsize i = 0;
-	int c1, c2;
 
-	while (i < len)
-	{
-		if (!*s1)
-			return FALSE;
-
-		c1 = irc_tolower ((guchar)*s1);
-		c2 = irc_tolower ((guchar)*s2);
-		if (c1 != c2)
-			return FALSE;
-		s1++; s2++; i++;
-	}
-
-	return TRUE;
+	return strnlen (s1, len) == len && fold_mismatch (s1, s2, len) == len;
 }
 
 /**
@@ -299,10 +548,12 @@ irc_str_has_prefix (const char *s1, const char *s2)
  * See Also: irc_tolower()
  * Returns: %TRUE when equal otherwise %FALSE
  */
-inline gboolean
+gboolean
 irc_str_equal (const char *str1, const char *str2)
 {
-	return irc_str_cmp (str1, str2) == 0;
+	const gsize len = strlen (str1);
+
+	return strlen (str2) == len && fold_mismatch (str1, str2, len) == len;
 }
 
 /**
@@ -317,14 +568,23 @@ irc_str_equal (const char *str1, const char *str2)
 guint32
 irc_str_hash (const char *str)
 {
-	const char *p = str;
-	guint32 h = irc_tolower_table [(guchar)*p];
+	const gsize len = strlen (str);
+	guint32 h = 0;
+	gsize i = 0;
 
-	if (h)
+#ifdef __SSE2__
+	guchar folded[16];
+
+	for (; i + 16 <= len; i += 16)
 	{
-		for (p += 1; *p != '\0'; ++p)
-			h = (h << 5) - h + irc_tolower_table [(guchar)*p];
+		_mm_storeu_si128 ((__m128i*)(void*)folded, fold_chunk (str + i));
+		for (guint j = 0; j < 16; ++j)
+			h = (h << 5) - h + folded[j];
 	}
+#endif
+
+	for (; i < len; ++i)
+		h = (h << 5) - h + irc_tolower_table [(guchar)str[i]];
 
 	return h;
 }
@@ -369,6 +629,97 @@ irc_strv_append (GStrv array, const char *str)
 	return new_array;
 }
 
+// Length of the valid UTF-8 sequence starting with a byte over 0x7F or 0
+static gsize
+utf8_sequence_length (const guchar *p, gsize len)
+{
+	guchar min = 0x80, max = 0xBF;
+	gsize n;
+
+	// Overlong forms, surrogates and anything past U+10FFFF are rejected
+	if (p[0] >= 0xC2 && p[0] <= 0xDF)
+		n = 2;
+	else if (p[0] >= 0xE0 && p[0] <= 0xEF)
+	{
+		n = 3;
+		if (p[0] == 0xE0)
+			min = 0xA0;
+		else if (p[0] == 0xED)
+			max = 0x9F;
+	}
+	else if (p[0] >= 0xF0 && p[0] <= 0xF4)
+	{
+		n = 4;
+		if (p[0] == 0xF0)
+			min = 0x90;
+		else if (p[0] == 0xF4)
+			max = 0x8F;
+	}
+	else
+		return 0;
+
+	if (len < n || p[1] < min || p[1] > max)
+		return 0;
+	for (gsize i = 2; i < n; ++i)
+	{
+		if ((p[i] & 0xC0) != 0x80)
+			return 0;
+	}
+
+	return n;
+}
+
+/**
+ * irc_utf8_validate:
+ * @str: Text to check
+ * @len: Length of @str in bytes
+ *
+ * Same as g_utf8_validate() with a length, embedded nul bytes are invalid,
+ * but runs of ASCII are checked 16 bytes at a time.
+ *
+ * Returns: %TRUE if @str is valid UTF-8
+ */
+gboolean
+irc_utf8_validate (const char *str, gsize len)
+{
+	const guchar *p = (const guchar*)str;
+	gsize i = 0;
+
+	while (i < len)
+	{
+#ifdef __SSE2__
+		for (; i + 16 <= len; i += 16)
+		{
+			const __m128i chunk = _mm_loadu_si128 ((const __m128i*)(const void*)(p + i));
+			const guint mask = (guint)_mm_movemask_epi8 (chunk) |
+			                   (guint)_mm_movemask_epi8 (_mm_cmpeq_epi8 (chunk, _mm_setzero_si128 ()));
+			if (mask != 0)
+			{
+				i += (guint)g_bit_nth_lsf (mask, -1);
+				break;
+			}
+		}
+		if (i == len)
+			break;
+#endif
+
+		if (p[i] == '\0')
+			return FALSE;
+		if (p[i] < 0x80)
+		{
+			++i;
+			continue;
+		}
+
+		const gsize n = utf8_sequence_length (p + i, len - i);
+		if (n == 0)
+			return FALSE;
+		i += n;
+	}
+
+	return TRUE;
+}
+
 /**
  * irc_convert_invalid_text: (skip)
  * @text: Input bytes
@@ -454,3 +805,285 @@ irc_convert_invalid_text (const char *text, gssize len, GIConv converter, const
 }
 
 
+
+static void
+finish_batch (GPtrArray *lines, GString *targets, GString *keys)
+{
+	if (keys->len)
+	{
+		g_string_append_c (targets, ' ');
+		g_string_append (targets, keys->str);
+	}
+
+	g_ptr_array_add (lines, g_strdup (targets->str));
+}
+
+/**
+ * irc_batch_targets:
+ * @command: Start of every line such as `JOIN` or `MONITOR +`
+ * @targets: (array zero-terminated=1): Targets to send
+ * @keys: (array zero-terminated=1) (nullable): Key of each target, empty if it has none
+ * @separator: Put between targets, and keys
+ * @max_targets: Most targets in one line, 0 for no limit
+ * @max_len: Longest line in bytes, not counting the CRLF
+ *
+ * Splits @targets into as few lines as fit. Keys are matched to targets by
+ * position so targets that have one are sent first. A single target that is
+ * too long on its own still gets a line.
+ *
+ * Returns: (transfer full): Lines to send
+ */
+GStrv
+irc_batch_targets (const char *command, const char * const *targets, const char * const *keys,
+                   char separator, guint max_targets, gsize max_len)
+{
+	GPtrArray *lines = g_ptr_array_new ();
+	g_autoptr(GPtrArray) order = g_ptr_array_new ();
+	g_autoptr(GString) line = g_string_new (NULL);
+	g_autoptr(GString) line_keys = g_string_new (NULL);
+	guint n_targets = 0;
+
+	for (gsize i = 0; targets[i]; ++i)
+	{
+		if (keys && *keys[i])
+			g_ptr_array_add (order, GSIZE_TO_POINTER(i));
+	}
+	for (gsize i = 0; targets[i]; ++i)
+	{
+		if (!keys || !*keys[i])
+			g_ptr_array_add (order, GSIZE_TO_POINTER(i));
+	}
+
+	for (guint i = 0; i < order->len; ++i)
+	{
+		const gsize index = GPOINTER_TO_SIZE(g_ptr_array_index (order, i));
+		const char *key = keys ? keys[index] : "";
+		const gsize len = strlen (targets[index]);
+		const gsize key_len = *key ? strlen (key) + 1 : 0; // With its separator
+		const gsize keys_len = line_keys->len ? line_keys->len + 1 + key_len : key_len;
+
+		if (n_targets && ((max_targets && n_targets == max_targets) || line->len + 1 + len + keys_len > max_len))
+		{
+			finish_batch (lines, line, line_keys);
+			n_targets = 0;
+		}
+
+		if (n_targets == 0)
+		{
+			g_string_assign (line, command);
+			g_string_append_c (line, ' ');
+			g_string_truncate (line_keys, 0);
+		}
+		else
+			g_string_append_c (line, separator);
+		g_string_append (line, targets[index]);
+
+		if (*key)
+		{
+			if (line_keys->len)
+				g_string_append_c (line_keys, separator);
+			g_string_append (line_keys, key);
+		}
+		++n_targets;
+	}
+
+	if (n_targets)
+		finish_batch (lines, line, line_keys);
+
+	g_ptr_array_add (lines, NULL);
+	return (GStrv)g_ptr_array_free (lines, FALSE);
+}
+
+// Formatting in effect at some point of a message
+typedef struct
+{
+	guint32 toggles; // 1 << attribute
+	int fg, bg; // -1 when unset
+	char hex[14]; // Code after HEXCOLOR, empty when unset
+} FormatState;
+
+static const guchar format_toggles[] = { BOLD, ITALIC, UNDERLINE, STRIKETHROUGH, MONOSPACE, REVERSE, HIDDEN };
+
+static gsize
+parse_color_number (const char *p, int *number)
+{
+	gsize n = 0;
+
+	*number = 0;
+	while (n < 2 && g_ascii_isdigit (p[n]))
+		*number = *number * 10 + (p[n++] - '0');
+
+	return n;
+}
+
+static gsize
+hex_color_len (const char *p)
+{
+	for (gsize i = 0; i < 6; ++i)
+	{
+		if (!g_ascii_isxdigit (p[i]))
+			return 0;
+	}
+
+	return 6;
+}
+
+// Length of the character or formatting code at p, applying it to state
+static gsize
+apply_format_unit (const char *p, FormatState *state)
+{
+	const guchar c = (guchar)*p;
+	gsize len = 1;
+
+	switch (c)
+	{
+	case COLOR:
+	{
+		int fg, bg;
+		gsize n = parse_color_number (p + 1, &fg);
+
+		state->hex[0] = '\0';
+		if (n == 0)
+		{
+			state->fg = state->bg = -1;
+			return 1;
+		}
+		state->fg = fg;
+		len += n;
+
+		if (p[len] == ',' && (n = parse_color_number (p + len + 1, &bg)) != 0)
+		{
+			state->bg = bg;
+			len += 1 + n;
+		}
+		return len;
+	}
+	case HEXCOLOR:
+		state->fg = state->bg = -1;
+		if ((len += hex_color_len (p + 1)) != 1 && p[len] == ',' && hex_color_len (p + len + 1))
+			len += 7;
+		memcpy (state->hex, p + 1, len - 1);
+		state->hex[len - 1] = '\0';
+		return len;
+	case RESET:
+		*state = (FormatState){ 0, -1, -1, "" };
+		return 1;
+	case BOLD:
+	case ITALIC:
+	case UNDERLINE:
+	case STRIKETHROUGH:
+	case MONOSPACE:
+	case REVERSE:
+	case HIDDEN:
+		state->toggles ^= 1u << c;
+		return 1;
+	}
+
+	// A whole UTF-8 sequence, as far as it goes when it is invalid
+	const gsize expected = c < 0xC0 ? 1 : c < 0xE0 ? 2 : c < 0xF0 ? 3 : 4;
+	while (len < expected && ((guchar)p[len] & 0xC0) == 0x80)
+		++len;
+
+	return len;
+}
+
+static void
+append_color_number (GString *str, int number)
+{
+	g_string_append_c (str, (char)('0' + number / 10));
+	g_string_append_c (str, (char)('0' + number % 10));
+}
+
+// Codes that restore state at the start of a line
+static void
+append_format_state (GString *str, const FormatState *state)
+{
+	if (state->fg != -1)
+	{
+		// Always two digits so text starting with one isn't read as part of it
+		g_string_append_c (str, COLOR);
+		append_color_number (str, state->fg);
+		if (state->bg != -1)
+		{
+			g_string_append_c (str, ',');
+			append_color_number (str, state->bg);
+		}
+	}
+	else if (state->hex[0])
+	{
+		g_string_append_c (str, HEXCOLOR);
+		g_string_append (str, state->hex);
+	}
+
+	for (gsize i = 0; i < G_N_ELEMENTS(format_toggles); ++i)
+	{
+		if (state->toggles & (1u << format_toggles[i]))
+			g_string_append_c (str, (char)format_toggles[i]);
+	}
+}
+
+/**
+ * irc_split_message:
+ * @text: Message to send
+ * @max_len: Longest line in bytes
+ *
+ * Splits @text into lines that fit, between words where possible and never
+ * inside a character or formatting code. Each line starts with the codes
+ * needed for the formatting left on by the line before it. A single
+ * character that doesn't fit still gets a line.
+ *
+ * Returns: (transfer full): Lines to send, none if @text is empty
+ */
+GStrv
+irc_split_message (const char *text, gsize max_len)
+{
+	GPtrArray *lines = g_ptr_array_new ();
+	g_autoptr(GString) line = g_string_new (NULL);
+	FormatState state = { 0, -1, -1, "" };
+	const char *p = text;
+
+	while (*p)
+	{
+		g_string_truncate (line, 0);
+		append_format_state (line, &state);
+
+		const gsize budget = max_len > line->len ? max_len - line->len : 0;
+		FormatState end_state = state, space_state = state;
+		const char *end = p, *space = NULL;
+
+		while (*end)
+		{
+			FormatState next = end_state;
+
+			if (*end == ' ' && end != p)
+			{
+				space = end;
+				space_state = end_state;
+			}
+
+			const gsize len = apply_format_unit (end, &next);
+			if ((gsize)(end - p) + len > budget && end != p)
+				break;
+
+			end += len;
+			end_state = next;
+		}
+
+		const char *resume = end;
+		if (*end && space != NULL)
+		{
+			// The space is dropped, the next line starts on the next word
+			end = space;
+			resume = space + 1;
+			end_state = space_state;
+		}
+
+		g_string_append_len (line, p, end - p);
+		g_ptr_array_add (lines, g_strndup (line->str, line->len));
+		state = end_state;
+		p = resume;
+	}
+
+	g_ptr_array_add (lines, NULL);
+	return (GStrv)g_ptr_array_free (lines, FALSE);
+}
@@ -88,6 +88,7 @@ typedef enum {
 
 gboolean irc_isattr (guchar c) G_GNUC_CONST;
 guint32 irc_str_hash (const char *str) G_GNUC_PURE NON_NULL();
+gboolean irc_has_attributes (const char *str) G_GNUC_PURE NON_NULL();
 char *irc_strip_attributes (const char *str) G_GNUC_PURE NON_NULL();
 int irc_str_cmp (const char *s1, const char *s2) G_GNUC_PURE NON_NULL();
 gboolean irc_str_equal (const char *str1, const char *str2) G_GNUC_PURE NON_NULL();
@@ -96,6 +97,10 @@ guchar irc_tolower (const guchar c) G_GNUC_CONST;
 char *irc_strcasestr (const char *haystack, const char *needle) G_GNUC_PURE NON_NULL();
 char *irc_sasl_encode_plain (const char *username, const char *password) NON_NULL();
 GStrv irc_strv_append (GStrv array, const char *str) G_GNUC_PURE;
+gboolean irc_utf8_validate (const char *str, gsize len) G_GNUC_PURE NON_NULL();
 char *irc_convert_invalid_text (const char *text, gssize len, GIConv converter, const char *fallback_char) G_GNUC_PURE NON_NULL();
 gboolean irc_util_is_valid_hex_color (const char *str, const gsize len);
+GStrv irc_batch_targets (const char *command, const char * const *targets, const char * const *keys,
+                         char separator, guint max_targets, gsize max_len) NON_NULL(1, 2) WARN_UNUSED_RESULT;
+GStrv irc_split_message (const char *text, gsize max_len) NON_NULL() WARN_UNUSED_RESULT;
 
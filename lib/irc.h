@@ -19,11 +19,18 @@
 #pragma once
 
 #include "irc-channel.h"
+#include "irc-connect-scheduler.h"
 #include "irc-context-action.h"
 #include "irc-context-manager.h"
 #include "irc-context.h"
+#include "irc-converter.h"
+#include "irc-log-file.h"
+#include "irc-logger.h"
+#include "irc-matcher.h"
 #include "irc-message.h"
 #include "irc-query.h"
+#include "irc-raw-log.h"
+#include "irc-search-index.h"
 #include "irc-server.h"
 #include "irc-user.h"
 #include "irc-utils.h"
@@ -28,6 +28,7 @@ enum
 	COL_HIGHLIGHT,
 	COL_CTX,
 	COL_ACTIVE,
+	COL_SORT_KEY,
 	N_COL
 };
 
@@ -78,13 +79,13 @@ irc_chanstore_drop_possible (GtkTreeDragDest *dest, GtkTreePath *dest_path, GtkS
 static int
 irc_chanstore_sort (GtkTreeModel *model, GtkTreeIter *a, GtkTreeIter *b, gpointer userdata)
 {
-	g_autofree char *name1;
-	g_autofree char *name2;
+	const char *key1, *key2;
 
-	gtk_tree_model_get (model, a, COL_NAME, &name1, -1);
-	gtk_tree_model_get (model, b, COL_NAME, &name2, -1);
+	// Keys are already casemapped and pointers aren't copied out
+	gtk_tree_model_get (model, a, COL_SORT_KEY, &key1, -1);
+	gtk_tree_model_get (model, b, COL_SORT_KEY, &key2, -1);
 
-	return irc_str_cmp (name1, name2);
+	return g_strcmp0 (key1, key2);
 }
 
 IrcChanstore *
@@ -92,7 +93,7 @@ irc_chanstore_new (void)
 {
 	IrcChanstore *store = g_object_new (IRC_TYPE_CHANSTORE, NULL);
 
-	GType types[] = { G_TYPE_STRING, G_TYPE_UINT, G_TYPE_BOOLEAN, IRC_TYPE_CONTEXT, G_TYPE_STRING };
+	GType types[] = { G_TYPE_STRING, G_TYPE_UINT, G_TYPE_BOOLEAN, IRC_TYPE_CONTEXT, G_TYPE_STRING, G_TYPE_POINTER };
 	G_STATIC_ASSERT (G_N_ELEMENTS(types) == N_COL);
 
 	gtk_tree_store_set_column_types (GTK_TREE_STORE(store), G_N_ELEMENTS(types), types);
@@ -21,13 +21,21 @@
 #include "irc-context.h"
 #include "irc-context-manager.h"
 #include "irc-cellrenderer-bubble.h"
+#include "irc-utils.h"
 
 struct _IrcContextview
 {
 	GtkTreeView parent_instance;
 };
 
-G_DEFINE_TYPE (IrcContextview, irc_contextview, GTK_TYPE_TREE_VIEW)
+typedef struct
+{
+	GHashTable *rows; // IrcContext -> GtkTreeRowReference
+	GHashTable *pending_activity; // IrcContext -> packed activity count and highlight
+	guint activity_tick;
+} IrcContextviewPrivate;
+
+G_DEFINE_TYPE_WITH_PRIVATE (IrcContextview, irc_contextview, GTK_TYPE_TREE_VIEW)
 
 // Kept in sync with irc-chanstore.c
 enum
@@ -37,30 +45,78 @@ enum
 	COL_HIGHLIGHT,
 	COL_CTX,
 	COL_ACTIVE,
+	COL_SORT_KEY,
 	N_COL
 };
 
-static gboolean
-remove_ctx_foreach (GtkTreeModel *model, GtkTreePath *path, GtkTreeIter *iter, gpointer data)
+#define PENDING_HIGHLIGHT 1u
+#define PENDING_COUNT(x) ((x) >> 1)
+
+struct find_data
 {
-	g_autoptr(IrcContext) row_ctx;
+	IrcContext *ctx;
+	GtkTreePath *path;
+};
 
-	gtk_tree_model_get (model, iter, COL_CTX, &row_ctx, -1);
+static gboolean
+find_ctx_foreach (GtkTreeModel *model, GtkTreePath *path, GtkTreeIter *iter, gpointer data)
+{
+	struct find_data *find = data;
+	g_autoptr(IrcContext) ctx;
 
-	if (row_ctx != data)
+	gtk_tree_model_get (model, iter, COL_CTX, &ctx, -1);
+	if (ctx != find->ctx)
 		return FALSE;
 
-	gtk_tree_store_remove (GTK_TREE_STORE(model), iter);
-	//TODO: Change selection here?
+	find->path = gtk_tree_path_copy (path);
 	return TRUE;
 }
 
+static gboolean
+get_context_iter (IrcContextview *self, IrcContext *ctx, GtkTreeIter *iter)
+{
+	IrcContextviewPrivate *priv = irc_contextview_get_instance_private (self);
+	GtkTreeModel *model = gtk_tree_view_get_model (GTK_TREE_VIEW(self));
+	GtkTreeRowReference *ref = g_hash_table_lookup (priv->rows, ctx);
+	GtkTreePath *path;
+
+	if (ref != NULL && gtk_tree_row_reference_valid (ref))
+	{
+		path = gtk_tree_row_reference_get_path (ref);
+	}
+	else
+	{
+		// Dragging a row copies it so the old reference is lost, look it up once
+		struct find_data find = { ctx, NULL };
+		gtk_tree_model_foreach (model, find_ctx_foreach, &find);
+		if (find.path == NULL)
+			return FALSE;
+
+		path = find.path;
+		g_hash_table_insert (priv->rows, ctx, gtk_tree_row_reference_new (model, path));
+	}
+
+	gboolean found = gtk_tree_model_get_iter (model, iter, path);
+	gtk_tree_path_free (path);
+
+	return found;
+}
+
 static void
 on_context_removed (IrcContextManager *mgr, IrcContext *ctx, gpointer data)
 {
-	GtkTreeView *view = GTK_TREE_VIEW(data);
-	GtkTreeModel *model = gtk_tree_view_get_model (view);
-	gtk_tree_model_foreach (model, remove_ctx_foreach, ctx);
+	IrcContextview *self = IRC_CONTEXTVIEW(data);
+	IrcContextviewPrivate *priv = irc_contextview_get_instance_private (self);
+	GtkTreeModel *model = gtk_tree_view_get_model (GTK_TREE_VIEW(self));
+	GtkTreeIter iter;
+
+	if (get_context_iter (self, ctx, &iter))
+		gtk_tree_store_remove (GTK_TREE_STORE(model), &iter);
+	//TODO: Change selection here?
+
+	g_hash_table_remove (priv->rows, ctx);
+	g_hash_table_remove (priv->pending_activity, ctx);
+	g_signal_handlers_disconnect_by_data (ctx, self);
 }
 
 static void
@@ -81,153 +137,175 @@ on_selection_changed (GtkTreeSelection *sel, gpointer data)
 	irc_context_manager_set_front_context (mgr, ctx);
 }
 
-struct changed_foreach_data
+static void
+on_front_context_changed (IrcContextManager *mgr, IrcContext *ctx, gpointer data)
 {
-	GtkTreeSelection *sel;
-	IrcContext *ctx;
-};
+	IrcContextview *self = IRC_CONTEXTVIEW(data);
+	IrcContextviewPrivate *priv = irc_contextview_get_instance_private (self);
+	GtkTreeModel *model = gtk_tree_view_get_model (GTK_TREE_VIEW(self));
+	GtkTreeSelection *sel = gtk_tree_view_get_selection (GTK_TREE_VIEW(self));
+	GtkTreeIter iter;
 
-static gboolean
-front_changed_foreach (GtkTreeModel *model, GtkTreePath *path, GtkTreeIter *iter, gpointer data)
-{
-  	GtkTreeSelection *sel = ((struct changed_foreach_data*)data)->sel;
-	IrcContext *ctx = ((struct changed_foreach_data*)data)->ctx;
-	g_autoptr(IrcContext) row_ctx;
-	gtk_tree_model_get (model, iter, COL_CTX, &row_ctx, -1);
-	if (row_ctx == ctx)
-	{
-		gtk_tree_store_set (GTK_TREE_STORE(model), iter, COL_ACT, 0, COL_HIGHLIGHT, FALSE, -1);
-		g_signal_handlers_block_by_func (sel, on_selection_changed, NULL);
-		gtk_tree_selection_select_iter (sel, iter);
-		g_signal_handlers_unblock_by_func (sel, on_selection_changed, NULL);
-		return TRUE;
-	}
+	g_hash_table_remove (priv->pending_activity, ctx);
+
+	if (!get_context_iter (self, ctx, &iter))
+		return;
 
-	return FALSE;
+	gtk_tree_store_set (GTK_TREE_STORE(model), &iter, COL_ACT, 0, COL_HIGHLIGHT, FALSE, -1);
+	g_signal_handlers_block_by_func (sel, on_selection_changed, NULL);
+	gtk_tree_selection_select_iter (sel, &iter);
+	g_signal_handlers_unblock_by_func (sel, on_selection_changed, NULL);
 }
 
 static void
-on_front_context_changed (IrcContextManager *mgr, IrcContext *ctx, gpointer data)
+on_context_active (IrcContext *ctx, GParamSpec *pspec, gpointer data)
 {
-	GtkTreeView *view = GTK_TREE_VIEW(data);
-	GtkTreeModel *model = gtk_tree_view_get_model (view);
-	GtkTreeSelection *sel = gtk_tree_view_get_selection (view);
-	struct changed_foreach_data foreach_data = { sel, ctx };
+	IrcContextview *self = IRC_CONTEXTVIEW(data);
+	GtkTreeModel *model = gtk_tree_view_get_model (GTK_TREE_VIEW(self));
+	GtkTreeIter iter;
+	gboolean is_active;
 
-	gtk_tree_model_foreach (model, front_changed_foreach, &foreach_data);
-}
+	if (!get_context_iter (self, ctx, &iter))
+		return;
 
-struct foreach_data
-{
-	IrcContext *ctx;
-	gboolean bool_data;
-};
+	g_object_get (ctx, "active", &is_active, NULL);
+	//g_debug ("Context active %d", is_active);
+	gtk_tree_store_set (GTK_TREE_STORE(model), &iter, COL_ACTIVE, is_active ? NULL : "grey", -1);
+}
 
 static gboolean
-set_active (GtkTreeModel *model, GtkTreePath *path, GtkTreeIter *iter, gpointer data)
+flush_activity (GtkWidget *widget, GdkFrameClock *clock, gpointer data)
 {
-	IrcContext *active_ctx = IRC_CONTEXT(((struct foreach_data*)data)->ctx);
-	const gboolean is_active = ((struct foreach_data*)data)->bool_data;
-	g_autoptr(IrcContext) row_ctx;
-	gtk_tree_model_get (model, iter, COL_CTX, &row_ctx, -1);
-	if (row_ctx == active_ctx)
+	IrcContextview *self = IRC_CONTEXTVIEW(widget);
+	IrcContextviewPrivate *priv = irc_contextview_get_instance_private (self);
+	GtkTreeModel *model = gtk_tree_view_get_model (GTK_TREE_VIEW(self));
+	GHashTableIter hash_iter;
+	gpointer ctx, value;
+
+	g_hash_table_iter_init (&hash_iter, priv->pending_activity);
+	while (g_hash_table_iter_next (&hash_iter, &ctx, &value))
 	{
-		gtk_tree_store_set (GTK_TREE_STORE(model), iter, COL_ACTIVE, is_active ? NULL : "grey", -1);
-		return TRUE;
+		const guint pending = GPOINTER_TO_UINT(value);
+		GtkTreeIter iter;
+		guint32 last_act;
+		gboolean had_highlight;
+
+		if (!get_context_iter (self, ctx, &iter))
+			continue;
+
+		gtk_tree_model_get (model, &iter, COL_ACT, &last_act, COL_HIGHLIGHT, &had_highlight, -1);
+		gtk_tree_store_set (GTK_TREE_STORE(model), &iter, COL_ACT, last_act + PENDING_COUNT(pending),
+							COL_HIGHLIGHT, had_highlight || (pending & PENDING_HIGHLIGHT), -1);
 	}
-	return FALSE;
+
+	g_hash_table_remove_all (priv->pending_activity);
+	priv->activity_tick = 0;
+	return G_SOURCE_REMOVE;
 }
 
 static void
-on_context_active (IrcContext *ctx, GParamSpec *pspec, gpointer data)
+on_context_activity (IrcContext *ctx, gboolean is_highlight, gpointer data)
 {
-	GtkTreeModel *model = GTK_TREE_MODEL (data);
-	struct foreach_data for_data = { .ctx = ctx };
+	IrcContextview *self = IRC_CONTEXTVIEW(data);
+	IrcContextviewPrivate *priv = irc_contextview_get_instance_private (self);
+  	IrcContextManager *mgr = irc_context_manager_get_default ();
+
+	if (ctx == irc_context_manager_get_front_context (mgr))
+		return;
 
-	g_object_get (ctx, "active", &for_data.bool_data, NULL);
-	//g_debug ("Context active %d", for_data.bool_data);
-	gtk_tree_model_foreach (model, set_active, &for_data);
+	// Activity is only counted here and written to the store once per frame
+	guint pending = GPOINTER_TO_UINT(g_hash_table_lookup (priv->pending_activity, ctx));
+	pending = ((PENDING_COUNT(pending) + 1) << 1) | (pending & PENDING_HIGHLIGHT) | (is_highlight ? PENDING_HIGHLIGHT : 0);
+	g_hash_table_insert (priv->pending_activity, ctx, GUINT_TO_POINTER(pending));
+
+	if (priv->activity_tick == 0)
+		priv->activity_tick = gtk_widget_add_tick_callback (GTK_WIDGET(self), flush_activity, NULL, NULL);
 }
 
+static char *
+create_sort_key (const char *name)
+{
+	char *key = g_strdup (name);
 
-static gboolean
-add_activity (GtkTreeModel *model, GtkTreePath *path, GtkTreeIter *iter, gpointer data)
+	for (char *p = key; *p; ++p)
+		*p = (char)irc_tolower ((guchar)*p);
+
+	return key;
+}
+
+static void
+on_context_name (IrcContext *ctx, GParamSpec *pspec, gpointer data)
 {
-	IrcContext *activity_ctx = IRC_CONTEXT(((struct foreach_data*)data)->ctx);
-	const gboolean is_highlight = ((struct foreach_data*)data)->bool_data;
-	g_autoptr(IrcContext) row_ctx;
-	gtk_tree_model_get (model, iter, COL_CTX, &row_ctx, -1);
-	if (row_ctx == activity_ctx)
-	{
-		guint32 last_act;
-		gboolean had_highlight;
-		gtk_tree_model_get (model, iter, COL_ACT, &last_act, COL_HIGHLIGHT, &had_highlight, -1);
-		gtk_tree_store_set (GTK_TREE_STORE(model), iter, COL_ACT, ++last_act, COL_HIGHLIGHT,
-							had_highlight || is_highlight, -1);
-		return TRUE;
-	}
-	return FALSE;
+	IrcContextview *self = IRC_CONTEXTVIEW(data);
+	GtkTreeModel *model = gtk_tree_view_get_model (GTK_TREE_VIEW(self));
+	GtkTreeIter iter;
+
+	if (!get_context_iter (self, ctx, &iter))
+		return;
+
+	// The row moves to the new key before the old one is freed
+	char *sort_key = create_sort_key (irc_context_get_name (ctx));
+	gtk_tree_store_set (GTK_TREE_STORE(model), &iter, COL_NAME, irc_context_get_name (ctx),
+						COL_SORT_KEY, sort_key, -1);
+	g_object_set_data_full (G_OBJECT(ctx), "contextview-sort-key", sort_key, g_free);
 }
 
 static void
-on_context_activity (IrcContext *ctx, gboolean is_highlight, gpointer data)
+add_context_row (IrcContextview *self, IrcContext *ctx, GtkTreeIter *parent)
 {
-	GtkTreeView *view = GTK_TREE_VIEW(data);
-	GtkTreeModel *model = gtk_tree_view_get_model (view);
-  	IrcContextManager *mgr = irc_context_manager_get_default ();
+	IrcContextviewPrivate *priv = irc_contextview_get_instance_private (self);
+	GtkTreeModel *model = gtk_tree_view_get_model (GTK_TREE_VIEW(self));
+	GtkTreeStore *store = GTK_TREE_STORE(model);
+	GtkTreeIter new_iter;
 
-	if (ctx != irc_context_manager_get_front_context (mgr))
-	{
-		struct foreach_data for_data = { ctx, is_highlight };
-		gtk_tree_model_foreach (model, add_activity, &for_data);
-	}
+	// Casemapped once here so sorting is a plain strcmp on a borrowed pointer,
+	// on_context_name() replaces it when the context is renamed
+	char *sort_key = create_sort_key (irc_context_get_name (ctx));
+	g_object_set_data_full (G_OBJECT(ctx), "contextview-sort-key", sort_key, g_free);
+
+	gtk_tree_store_insert_with_values (store, &new_iter, parent, -1,
+									   COL_NAME, irc_context_get_name (ctx),
+									   COL_CTX, ctx,
+									   COL_SORT_KEY, sort_key, -1);
+
+	GtkTreePath *path = gtk_tree_model_get_path (model, &new_iter);
+	g_hash_table_insert (priv->rows, ctx, gtk_tree_row_reference_new (model, path));
+	gtk_tree_path_free (path);
 }
 
 static void
 on_context_added (IrcContextManager *mgr, IrcContext *ctx, gpointer data)
 {
-	GtkTreeView *view = GTK_TREE_VIEW(data);
-	GtkTreeModel *model = gtk_tree_view_get_model (view);
-	GtkTreeStore *store = GTK_TREE_STORE(model);
+	IrcContextview *self = IRC_CONTEXTVIEW(data);
+	GtkTreeModel *model = gtk_tree_view_get_model (GTK_TREE_VIEW(self));
 
 	IrcContext *parent = irc_context_get_parent(ctx);
 	if (parent != NULL)
 	{
 		GtkTreeIter iter;
-		if (!gtk_tree_model_get_iter_first (model, &iter))
+		if (!get_context_iter (self, parent, &iter))
 		{
-			g_warning ("No toplevel iters for child..");
+			g_warning ("No toplevel iter for child..");
 			return;
 		}
-		do {
-			g_autoptr(IrcContext) row_ctx;
-			gtk_tree_model_get (model, &iter, COL_CTX, &row_ctx, -1);
-			if (row_ctx == parent)
-			{
-				GtkTreeIter new_iter;
-				gtk_tree_store_append (store, &new_iter, &iter);
-				gtk_tree_store_set (store, &new_iter, COL_NAME, irc_context_get_name (ctx), COL_CTX, ctx, -1);
-
-				GtkTreePath *path = gtk_tree_model_get_path (model, &iter);
-				gtk_tree_view_expand_to_path (view, path);
-				gtk_tree_path_free (path);
-				break;
-			}
-		}
-		while (gtk_tree_model_iter_next (model, &iter));
+
+		add_context_row (self, ctx, &iter);
+
+		GtkTreePath *path = gtk_tree_model_get_path (model, &iter);
+		gtk_tree_view_expand_to_path (GTK_TREE_VIEW(self), path);
+		gtk_tree_path_free (path);
 	}
 	else
 	{
-		GtkTreeIter new_iter;
-		gtk_tree_store_append (store, &new_iter, NULL);
-		gtk_tree_store_set (store, &new_iter, COL_NAME, irc_context_get_name (ctx), COL_CTX, ctx, -1);
+		add_context_row (self, ctx, NULL);
 
 		irc_context_manager_set_front_context (mgr, ctx);
 		//gtk_tree_selection_select_iter (gtk_tree_view_get_selection (view), &new_iter);
 	}
 
-	g_signal_connect (ctx, "activity", G_CALLBACK(on_context_activity), data);
-	g_signal_connect (ctx, "notify::active", G_CALLBACK(on_context_active), model);
+	g_signal_connect (ctx, "activity", G_CALLBACK(on_context_activity), self);
+	g_signal_connect (ctx, "notify::active", G_CALLBACK(on_context_active), self);
+	g_signal_connect (ctx, "notify::name", G_CALLBACK(on_context_name), self);
 }
 
 
@@ -301,6 +379,21 @@ irc_contextview_new (void)
 static void
 irc_contextview_finalize (GObject *object)
 {
+	IrcContextview *self = IRC_CONTEXTVIEW(object);
+	IrcContextviewPrivate *priv = irc_contextview_get_instance_private (self);
+	IrcContextManager *mgr = irc_context_manager_get_default ();
+
+	GHashTableIter iter;
+	gpointer ctx;
+
+	g_signal_handlers_disconnect_by_data (mgr, self);
+	g_hash_table_iter_init (&iter, priv->rows);
+	while (g_hash_table_iter_next (&iter, &ctx, NULL))
+		g_signal_handlers_disconnect_by_data (ctx, self);
+
+	g_clear_pointer (&priv->rows, g_hash_table_unref);
+	g_clear_pointer (&priv->pending_activity, g_hash_table_unref);
+
 	G_OBJECT_CLASS (irc_contextview_parent_class)->finalize (object);
 }
 
@@ -318,8 +411,12 @@ irc_contextview_class_init (IrcContextviewClass *klass)
 static void
 irc_contextview_init (IrcContextview *self)
 {
+	IrcContextviewPrivate *priv = irc_contextview_get_instance_private (self);
 	IrcContextManager *mgr = irc_context_manager_get_default ();
 
+	priv->rows = g_hash_table_new_full (NULL, NULL, NULL, (GDestroyNotify)gtk_tree_row_reference_free);
+	priv->pending_activity = g_hash_table_new (NULL, NULL);
+
   	g_signal_connect (mgr, "context-added", G_CALLBACK(on_context_added), self);
 	g_signal_connect (mgr, "context-removed", G_CALLBACK(on_context_removed), self);
 	g_signal_connect (mgr, "front-context-changed", G_CALLBACK(on_front_context_changed), self);
@@ -22,6 +22,7 @@
 #include "irc-application.h"
 #include "irc-context.h"
 #include "irc-context-manager.h"
+#include "irc-logger.h"
 //#include "irc-plugin-engine.h"
 #include "irc-window.h"
 #include "irc-resources.h"
@@ -39,6 +40,7 @@ typedef struct
 	PeasExtensionSet *extensions;
 	GSettings *settings;
 	GtkCssProvider *css_provider;
+	IrcLogger *logger;
 } IrcApplicationPrivate;
 
 G_DEFINE_TYPE_WITH_PRIVATE (IrcApplication, irc_application, GTK_TYPE_APPLICATION)
@@ -212,6 +214,38 @@ irc_application_preferences (GSimpleAction *action, GVariant *param, gpointer da
 	gtk_window_present (GTK_WINDOW(wid));
 }
 
+static void
+logging_changed (GSettings *settings, const char *key, gpointer data)
+{
+	IrcApplicationPrivate *priv = irc_application_get_instance_private (IRC_APPLICATION(data));
+
+	if (!g_settings_get_boolean (settings, "logging"))
+	{
+		// Pending lines are written before it goes away
+		g_clear_object (&priv->logger);
+		return;
+	}
+
+	if (priv->logger != NULL)
+		return;
+
+	g_autofree char *dir = g_build_filename (g_get_user_data_dir (), "irc-client", "logs", NULL);
+	priv->logger = irc_logger_new (irc_context_manager_get_default (), dir);
+	g_settings_bind (settings, "log-sync", priv->logger, "sync", G_SETTINGS_BIND_GET);
+}
+
+/**
+ * irc_application_get_logger:
+ *
+ * Returns: (transfer none) (nullable): The chat logger or %NULL if logging is disabled
+ */
+IrcLogger *
+irc_application_get_logger (IrcApplication *self)
+{
+	IrcApplicationPrivate *priv = irc_application_get_instance_private (self);
+	return priv->logger;
+}
+
 static GActionEntry app_entries[] = {
 	{ .name = "about", .activate = irc_application_about },
 	{ .name = "quit", .activate = irc_application_quit },
@@ -259,6 +293,21 @@ irc_application_startup (GApplication *self)
 	g_application_set_resource_base_path (self, "/se/tingping/IrcClient");
 
     G_APPLICATION_CLASS (irc_application_parent_class)->startup (self);
+
+	IrcApplicationPrivate *priv = irc_application_get_instance_private (IRC_APPLICATION(self));
+	g_signal_connect (priv->settings, "changed::logging", G_CALLBACK(logging_changed), self);
+	logging_changed (priv->settings, "logging", self);
+}
+
+static void
+irc_application_shutdown (GApplication *self)
+{
+	IrcApplicationPrivate *priv = irc_application_get_instance_private (IRC_APPLICATION(self));
+
+	g_signal_handlers_disconnect_by_func (priv->settings, logging_changed, self);
+	g_clear_object (&priv->logger);
+
+	G_APPLICATION_CLASS (irc_application_parent_class)->shutdown (self);
 }
 
 static void
@@ -284,6 +333,7 @@ irc_application_class_init (IrcApplicationClass *klass)
 	app_class->activate = irc_application_activate;
 	app_class->open = irc_application_open;
 	app_class->startup = irc_application_startup;
+	app_class->shutdown = irc_application_shutdown;
 }
 
 static void
@@ -19,6 +19,7 @@
 #pragma once
 
 #include <gtk/gtk.h>
+#include "irc-logger.h"
 
 G_BEGIN_DECLS
 
@@ -26,6 +27,7 @@ G_BEGIN_DECLS
 G_DECLARE_FINAL_TYPE (IrcApplication, irc_application, IRC, APPLICATION, GtkApplication)
 
 IrcApplication *irc_application_new (const char *id);
+IrcLogger *irc_application_get_logger (IrcApplication *self);
 
 G_END_DECLS
 
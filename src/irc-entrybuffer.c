@@ -18,7 +18,7 @@
 
 #include "irc-entrybuffer.h"
 #include "irc-colorscheme.h"
-#include "irc-user-list-item.h"
+#include "irc-user-list.h"
 #include "irc-text-common.h"
 
 struct _IrcEntrybuffer
@@ -32,8 +32,12 @@ typedef struct
 	GListModel *comp_model;
 	char *last_prefix;
 	char *last_match;
+	GPtrArray *candidates;
+	guint next_candidate;
 	int last_cursor;
 	int index;
+	int dirty_first;
+	int dirty_last;
 	gboolean ignore_changed;
 } IrcEntrybufferPrivate;
 
@@ -96,22 +100,28 @@ irc_entrybuffer_push_into_history (IrcEntrybuffer *self)
 }
 
 static const char *
-lookup_nick_by_prefix (GListModel *model, const char *prefix, const char *last_match)
+next_completion (IrcEntrybuffer *self)
 {
-	for (guint i = 0; i < g_list_model_get_n_items (model); ++i)
+	IrcEntrybufferPrivate *priv = irc_entrybuffer_get_instance_private (self);
+
+	if (priv->candidates == NULL)
 	{
-		g_autoptr(IrcUserListItem) item = IRC_USER_LIST_ITEM(g_list_model_get_item(model, i));
-		const char *nick = IRC_USER(item->user)->nick;
+		// Whoever spoke last is most likely who is being replied to
+		g_autoptr(GPtrArray) users = irc_user_list_complete (IRC_USER_LIST(priv->comp_model), priv->last_prefix, TRUE);
 
-		// If we had a previous match skip to after there
-		if (last_match && irc_str_cmp (nick, last_match) <= 0)
-			continue;
+		priv->candidates = g_ptr_array_new_full (users->len, g_free);
+		for (guint i = 0; i < users->len; ++i)
+			g_ptr_array_add (priv->candidates, g_strdup (IRC_USER(g_ptr_array_index (users, i))->nick));
+		priv->next_candidate = 0;
+	}
 
-		if (irc_str_has_prefix (nick, prefix))
-			return nick;
+	if (priv->next_candidate >= priv->candidates->len)
+	{
+		priv->next_candidate = 0; // Start over on the next attempt
+		return NULL;
 	}
 
-	return NULL;
+	return g_ptr_array_index (priv->candidates, priv->next_candidate++);
 }
 
 static void
@@ -129,6 +139,7 @@ reset_completion_state (IrcEntrybuffer *self)
 		}
 		g_clear_pointer (&priv->last_match, g_free);
 		g_clear_pointer (&priv->last_prefix, g_free);
+		g_clear_pointer (&priv->candidates, g_ptr_array_unref);
 	}
 }
 
@@ -229,7 +240,7 @@ irc_entrybuffer_tab_complete (IrcEntrybuffer *self)
 		gtk_text_buffer_get_iter_at_mark (buf, &end, comp_end);
 	}
 
-	const char *nick = lookup_nick_by_prefix (priv->comp_model, priv->last_prefix, priv->last_match);
+	const char *nick = next_completion (self);
 	g_free (priv->last_match);
 	priv->last_match = g_strdup (nick);
 	if (nick)
@@ -273,7 +284,7 @@ irc_entrybuffer_set_completion_model (IrcEntrybuffer *self, GListModel *model)
 
 	if (model != NULL)
 	{
-		g_return_if_fail (g_list_model_get_item_type (model) == IRC_TYPE_USER_LIST_ITEM);
+		g_return_if_fail (IRC_IS_USER_LIST(model));
 		priv->comp_model = g_object_ref (model);
 	}
 }
@@ -285,26 +296,72 @@ irc_entrybuffer_new (void)
 	return g_object_new (IRC_TYPE_ENTRYBUFFER, "tag-table", irc_colorscheme_get_default(), NULL);
 }
 
+static void
+mark_lines_dirty (IrcEntrybuffer *self, int first, int last)
+{
+	IrcEntrybufferPrivate *priv = irc_entrybuffer_get_instance_private (self);
+
+	if (priv->dirty_first == -1 || first < priv->dirty_first)
+		priv->dirty_first = first;
+	if (last > priv->dirty_last)
+		priv->dirty_last = last;
+}
+
+static void
+irc_entrybuffer_insert_text (GtkTextBuffer *buffer, GtkTextIter *pos, const char *text, int len)
+{
+	// The default handler emits ::changed so the range has to be known before it runs
+	const int first = gtk_text_iter_get_line (pos);
+	int last = first;
+
+	for (const char *p = text; p < text + len; ++p)
+	{
+		if (*p == '\n' || *p == '\r')
+			++last;
+	}
+
+	mark_lines_dirty (IRC_ENTRYBUFFER(buffer), first, last);
+	GTK_TEXT_BUFFER_CLASS(irc_entrybuffer_parent_class)->insert_text (buffer, pos, text, len);
+}
+
+static void
+irc_entrybuffer_delete_range (GtkTextBuffer *buffer, GtkTextIter *start, GtkTextIter *end)
+{
+	// Everything after the start is joined onto its line
+	const int line = MIN(gtk_text_iter_get_line (start), gtk_text_iter_get_line (end));
+
+	mark_lines_dirty (IRC_ENTRYBUFFER(buffer), line, line);
+	GTK_TEXT_BUFFER_CLASS(irc_entrybuffer_parent_class)->delete_range (buffer, start, end);
+}
+
 static void
 irc_entrybuffer_changed (GtkTextBuffer *buffer)
 {
+	IrcEntrybufferPrivate *priv = irc_entrybuffer_get_instance_private (IRC_ENTRYBUFFER(buffer));
+
 	reset_completion_state (IRC_ENTRYBUFFER(buffer));
 	GTK_TEXT_BUFFER_CLASS(irc_entrybuffer_parent_class)->changed (buffer);
 
+	if (priv->dirty_first == -1)
+		return;
+
+	// Only the lines touched by the edit need their tags redone
+	const int last = MIN(priv->dirty_last, gtk_text_buffer_get_line_count (buffer) - 1);
 	GtkTextIter start, end;
-	gtk_text_buffer_get_start_iter (buffer, &start);
-	end = start;
-	gboolean has_another_line = gtk_text_iter_forward_to_line_end (&end);
+	gtk_text_buffer_get_iter_at_line (buffer, &start, priv->dirty_first);
 
-	while (TRUE)
+	for (int line = priv->dirty_first; line <= last; ++line)
 	{
-		apply_irc_tags (buffer, &start, &end, TRUE);
-		if (!has_another_line || !gtk_text_iter_forward_line (&start))
-			return;
-
 		end = start;
-		has_another_line = gtk_text_iter_forward_to_line_end (&end);
+		if (!gtk_text_iter_ends_line (&end))
+			gtk_text_iter_forward_to_line_end (&end);
+
+		apply_irc_tags (buffer, &start, &end, TRUE);
+		if (!gtk_text_iter_forward_line (&start))
+			break;
 	}
+
+	priv->dirty_first = priv->dirty_last = -1;
 }
 
 static void
@@ -317,6 +374,7 @@ irc_entrybuffer_finalize (GObject *object)
 	g_clear_object (&priv->comp_model);
 	g_clear_pointer (&priv->last_match, g_free);
 	g_clear_pointer (&priv->last_prefix, g_free);
+	g_clear_pointer (&priv->candidates, g_ptr_array_unref);
 
 	G_OBJECT_CLASS (irc_entrybuffer_parent_class)->finalize (object);
 }
@@ -328,6 +386,8 @@ irc_entrybuffer_class_init (IrcEntrybufferClass *klass)
 	GtkTextBufferClass *buffer_class = GTK_TEXT_BUFFER_CLASS (klass);
 
 	buffer_class->changed = irc_entrybuffer_changed;
+	buffer_class->insert_text = irc_entrybuffer_insert_text;
+	buffer_class->delete_range = irc_entrybuffer_delete_range;
 	object_class->finalize = irc_entrybuffer_finalize;
 }
 
@@ -338,4 +398,5 @@ irc_entrybuffer_init (IrcEntrybuffer *self)
 
 	priv->history = g_queue_new ();
 	priv->index = -1;
+	priv->dirty_first = priv->dirty_last = -1;
 }
@@ -20,11 +20,13 @@
 #include "irc-textview.h"
 #include "irc-colorscheme.h"
 #include "irc-text-common.h"
+#include "irc-trace.h"
 
 typedef struct
 {
 	char *search;
 	GtkTextMark *search_mark;
+	IrcSearchIndex *index;
 } IrcTextviewPrivate;
 
 G_DEFINE_TYPE_WITH_PRIVATE (IrcTextview, irc_textview, GTK_TYPE_TEXT_VIEW)
@@ -75,6 +77,7 @@ irc_textview_append_text (IrcTextview *self, const char *text, time_t stamp)
 		return;
 	}
 
+	IRC_TRACE_BEGIN(irc_textview_append_text);
 	GtkTextBuffer *buf = gtk_text_view_get_buffer (GTK_TEXT_VIEW(self));
 	GtkTextIter iter;
 	gtk_text_buffer_get_end_iter (buf, &iter);
@@ -101,8 +104,15 @@ irc_textview_append_text (IrcTextview *self, const char *text, time_t stamp)
 	end = start;
 	gtk_text_iter_forward_to_line_end (&end);
 
+	IRC_TRACE_BEGIN(apply_irc_tags);
 	apply_irc_tags (buf, &start, &end, FALSE);
+	IRC_TRACE_END(apply_irc_tags, NULL);
+
+	IRC_TRACE_BEGIN(apply_misc_tags);
 	apply_misc_tags (buf, text, stamp_len);
+	IRC_TRACE_END(apply_misc_tags, NULL);
+
+	IRC_TRACE_END(irc_textview_append_text, text);
 }
 
 
@@ -253,13 +263,59 @@ irc_textview_get_preferred_width (GtkWidget *wid, int *min_width, int *natural_w
 	*natural_width = 1;
 }
 
+static void
+search_select_match (IrcTextview *self, GtkTextIter *start, GtkTextIter *end, GtkTextIter *mark_pos)
+{
+	IrcTextviewPrivate *priv = irc_textview_get_instance_private (self);
+	GtkTextBuffer *buf = gtk_text_view_get_buffer (GTK_TEXT_VIEW(self));
+
+	if (!priv->search_mark)
+		priv->search_mark = gtk_text_buffer_create_mark (buf, "search", mark_pos, FALSE);
+	else
+		gtk_text_buffer_move_mark (buf, priv->search_mark, mark_pos);
+	gtk_text_buffer_select_range (buf, start, end);
+	gtk_text_view_scroll_mark_onscreen (GTK_TEXT_VIEW(self), priv->search_mark);
+}
+
+static void
+search_clear_mark (IrcTextview *self)
+{
+	IrcTextviewPrivate *priv = irc_textview_get_instance_private (self);
+	GtkTextBuffer *buf = gtk_text_view_get_buffer (GTK_TEXT_VIEW(self));
+
+	if (priv->search_mark)
+	{
+		gtk_text_buffer_delete_mark (buf, priv->search_mark);
+		priv->search_mark = NULL;
+	}
+}
+
+// Buffer line of the oldest line the index can still find, or -1 if there is
+// no index numbering lines the same as the buffer and only scanning it is correct
+static int
+get_first_indexed_line (IrcTextview *self)
+{
+	IrcTextviewPrivate *priv = irc_textview_get_instance_private (self);
+	GtkTextBuffer *buf = gtk_text_view_get_buffer (GTK_TEXT_VIEW(self));
+
+	if (priv->index == NULL)
+		return -1;
+
+	const guint first_line = irc_search_index_get_first_line (priv->index);
+	const guint n_lines = irc_search_index_get_n_lines (priv->index);
+	if (n_lines == 0 || first_line + n_lines != (guint)gtk_text_buffer_get_line_count (buf))
+		return -1;
+
+	return (int)first_line;
+}
+
 static void
 irc_textview_search_previous (GSimpleAction *action, GVariant *param, gpointer data)
 {
   	IrcTextview *self = IRC_TEXTVIEW(data);
 	IrcTextviewPrivate *priv = irc_textview_get_instance_private (self);
 	GtkTextBuffer *buf = gtk_text_view_get_buffer (GTK_TEXT_VIEW(self));
-	GtkTextIter iter, start, end;
+	GtkTextIter iter, start, end, limit;
 
 	if (!priv->search)
 		return;
@@ -269,24 +325,46 @@ irc_textview_search_previous (GSimpleAction *action, GVariant *param, gpointer d
 	else
 		gtk_text_buffer_get_iter_at_mark (buf, &iter, priv->search_mark);
 
-	if (!gtk_text_iter_backward_search (&iter, priv->search, GTK_TEXT_SEARCH_TEXT_ONLY|GTK_TEXT_SEARCH_CASE_INSENSITIVE,
-								&start, &end, NULL))
+	const int first_indexed = get_first_indexed_line (self);
+	const int current_line = gtk_text_iter_get_line (&iter);
+	if (first_indexed >= 0 && current_line >= first_indexed)
 	{
-		if (priv->search_mark)
+		// The index narrows it down to lines that contain the text somewhere,
+		// only those lines are searched in the buffer
+		g_autoptr(GArray) lines = irc_search_index_search (priv->index, priv->search);
+		for (guint i = lines->len; i > 0; --i)
 		{
-			gtk_text_buffer_delete_mark (buf, priv->search_mark);
-			priv->search_mark = NULL;
+			const int line = (int)g_array_index (lines, guint, i - 1);
+			if (line > current_line)
+				continue;
+
+			if (line != current_line)
+			{
+				gtk_text_buffer_get_iter_at_line (buf, &iter, line);
+				gtk_text_iter_forward_to_line_end (&iter);
+			}
+			gtk_text_buffer_get_iter_at_line (buf, &limit, line);
+
+			if (gtk_text_iter_backward_search (&iter, priv->search, GTK_TEXT_SEARCH_TEXT_ONLY|GTK_TEXT_SEARCH_CASE_INSENSITIVE,
+											   &start, &end, &limit))
+			{
+				search_select_match (self, &start, &end, &start);
+				return;
+			}
 		}
+
+		// Anything older has been dropped from the index
+		gtk_text_buffer_get_iter_at_line (buf, &iter, first_indexed);
+	}
+
+	if (gtk_text_iter_backward_search (&iter, priv->search, GTK_TEXT_SEARCH_TEXT_ONLY|GTK_TEXT_SEARCH_CASE_INSENSITIVE,
+									   &start, &end, NULL))
+	{
+		search_select_match (self, &start, &end, &start);
 		return;
 	}
 
-	if (!priv->search_mark)
-		priv->search_mark = gtk_text_buffer_create_mark (buf, "search", &start, FALSE);
-	else
-		gtk_text_buffer_move_mark (buf, priv->search_mark, &start);
-	gtk_text_buffer_select_range (buf, &start, &end);
-	gtk_text_view_scroll_mark_onscreen (GTK_TEXT_VIEW(self), priv->search_mark);
-	return;
+	search_clear_mark (self);
 }
 
 static void
@@ -295,7 +373,7 @@ irc_textview_search_next (GSimpleAction *action, GVariant *param, gpointer data)
   	IrcTextview *self = IRC_TEXTVIEW(data);
 	IrcTextviewPrivate *priv = irc_textview_get_instance_private (self);
 	GtkTextBuffer *buf = gtk_text_view_get_buffer (GTK_TEXT_VIEW(self));
-	GtkTextIter iter, start, end;
+	GtkTextIter iter, start, end, limit;
 
   	if (!priv->search)
 		return;
@@ -305,24 +383,73 @@ irc_textview_search_next (GSimpleAction *action, GVariant *param, gpointer data)
 	else
 		gtk_text_buffer_get_iter_at_mark (buf, &iter, priv->search_mark);
 
-	if (!gtk_text_iter_forward_search (&iter, priv->search, GTK_TEXT_SEARCH_TEXT_ONLY|GTK_TEXT_SEARCH_CASE_INSENSITIVE,
-								&start, &end, NULL))
+	const int first_indexed = get_first_indexed_line (self);
+	if (first_indexed < 0)
 	{
-		if (priv->search_mark)
+		if (gtk_text_iter_forward_search (&iter, priv->search, GTK_TEXT_SEARCH_TEXT_ONLY|GTK_TEXT_SEARCH_CASE_INSENSITIVE,
+										  &start, &end, NULL))
 		{
-			gtk_text_buffer_delete_mark (buf, priv->search_mark);
-			priv->search_mark = NULL;
+			search_select_match (self, &start, &end, &end);
+			return;
 		}
+
+		search_clear_mark (self);
 		return;
 	}
 
-	if (!priv->search_mark)
-		priv->search_mark = gtk_text_buffer_create_mark (buf, "search", &end, FALSE);
-	else
-		gtk_text_buffer_move_mark (buf, priv->search_mark, &end);
-	gtk_text_buffer_select_range (buf, &start, &end);
-	gtk_text_view_scroll_mark_onscreen (GTK_TEXT_VIEW(self), priv->search_mark);
-	return;
+	int current_line = gtk_text_iter_get_line (&iter);
+	if (current_line < first_indexed)
+	{
+		// Lines dropped from the index are scanned up to the ones it has
+		gtk_text_buffer_get_iter_at_line (buf, &limit, first_indexed);
+		if (gtk_text_iter_forward_search (&iter, priv->search, GTK_TEXT_SEARCH_TEXT_ONLY|GTK_TEXT_SEARCH_CASE_INSENSITIVE,
+										  &start, &end, &limit))
+		{
+			search_select_match (self, &start, &end, &end);
+			return;
+		}
+		iter = limit;
+		current_line = first_indexed;
+	}
+
+	g_autoptr(GArray) lines = irc_search_index_search (priv->index, priv->search);
+	for (guint i = 0; i < lines->len; ++i)
+	{
+		const int line = (int)g_array_index (lines, guint, i);
+		if (line < current_line)
+			continue;
+
+		if (line != current_line)
+			gtk_text_buffer_get_iter_at_line (buf, &iter, line);
+		limit = iter;
+		gtk_text_iter_forward_to_line_end (&limit);
+
+		if (gtk_text_iter_forward_search (&iter, priv->search, GTK_TEXT_SEARCH_TEXT_ONLY|GTK_TEXT_SEARCH_CASE_INSENSITIVE,
+										  &start, &end, &limit))
+		{
+			search_select_match (self, &start, &end, &end);
+			return;
+		}
+	}
+
+	search_clear_mark (self);
+}
+
+/**
+ * irc_textview_set_search_index:
+ * @index: Index of the lines appended to this view
+ *
+ * Searches are looked up in @index rather than scanning the whole buffer
+ * when it numbers every line appended to the view the same way. Lines it
+ * has dropped, or every line if the numbers differ, are scanned instead.
+ */
+void
+irc_textview_set_search_index (IrcTextview *self, IrcSearchIndex *index)
+{
+	IrcTextviewPrivate *priv = irc_textview_get_instance_private (self);
+
+	g_clear_pointer (&priv->index, irc_search_index_unref);
+	priv->index = irc_search_index_ref (index);
 }
 
 void
@@ -369,6 +496,7 @@ irc_textview_finalize (GObject *object)
 	IrcTextviewPrivate *priv = irc_textview_get_instance_private (IRC_TEXTVIEW(object));
 
 	g_free (priv->search);
+	g_clear_pointer (&priv->index, irc_search_index_unref);
 
 	G_OBJECT_CLASS (irc_textview_parent_class)->finalize (object);
 }
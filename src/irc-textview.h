@@ -20,6 +20,7 @@
 
 #include <time.h>
 #include <gtk/gtk.h>
+#include "irc-search-index.h"
 
 G_BEGIN_DECLS
 
@@ -33,5 +34,6 @@ struct _IrcTextviewClass {
 IrcTextview *irc_textview_new (void);
 void irc_textview_append_text (IrcTextview *self, const char *text, time_t stamp);
 void irc_textview_set_search (IrcTextview *self, const char *text);
+void irc_textview_set_search_index (IrcTextview *self, IrcSearchIndex *index);
 
 G_END_DECLS
@@ -0,0 +1,347 @@
+/* irc-userlist-model.c
+ *
+ * Copyright (C) 2017 Patrick Griffis <tingping@tingping.se>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "irc-userlist-model.h"
+
+/*
+ * Exposes an #IrcUserList as a flat #GtkTreeModel so a #GtkTreeView can show
+ * it without creating a widget per user. Rows are only positions into the
+ * list, nothing is copied.
+ *
+ * The filter matches the start of nicks. Matching users are always next to
+ * each other in the list so the filter is just a range found by binary search.
+ */
+
+struct _IrcUserlistModel
+{
+	GObject parent_instance;
+
+	IrcUserList *list;
+	char *filter;
+	guint offset;
+	guint n_rows;
+	int stamp;
+};
+
+static void irc_userlist_model_tree_model_init (GtkTreeModelIface *iface);
+
+G_DEFINE_TYPE_WITH_CODE (IrcUserlistModel, irc_userlist_model, G_TYPE_OBJECT,
+						 G_IMPLEMENT_INTERFACE (GTK_TYPE_TREE_MODEL, irc_userlist_model_tree_model_init))
+
+static inline guint
+overlap (guint start1, guint len1, guint start2, guint len2)
+{
+	const guint start = MAX(start1, start2);
+	const guint end = MIN(start1 + len1, start2 + len2);
+
+	return end > start ? end - start : 0;
+}
+
+static void
+get_range (IrcUserlistModel *self, guint *offset, guint *n_rows)
+{
+	if (self->filter == NULL)
+	{
+		*offset = 0;
+		*n_rows = g_list_model_get_n_items (G_LIST_MODEL(self->list));
+	}
+	else
+	{
+		irc_user_list_get_prefix_range (self->list, self->filter, offset, n_rows);
+	}
+}
+
+static void
+emit_row_deleted (IrcUserlistModel *self, guint row)
+{
+	GtkTreePath *path = gtk_tree_path_new_from_indices ((int)row, -1);
+
+	--self->n_rows;
+	gtk_tree_model_row_deleted (GTK_TREE_MODEL(self), path);
+	gtk_tree_path_free (path);
+}
+
+static void
+emit_row_inserted (IrcUserlistModel *self, guint row)
+{
+	GtkTreePath *path = gtk_tree_path_new_from_indices ((int)row, -1);
+	GtkTreeIter iter = { .stamp = self->stamp, .user_data = GUINT_TO_POINTER(row) };
+
+	++self->n_rows;
+	gtk_tree_model_row_inserted (GTK_TREE_MODEL(self), path, &iter);
+	gtk_tree_path_free (path);
+}
+
+static void
+on_items_changed (GListModel *list, guint position, guint removed, guint added, gpointer data)
+{
+	IrcUserlistModel *self = IRC_USERLIST_MODEL(data);
+	const guint old_offset = self->offset;
+	const guint old_n_rows = self->n_rows;
+	guint new_offset, new_n_rows;
+
+	get_range (self, &new_offset, &new_n_rows);
+
+	// The rows before the change are the same in both ranges so only the
+	// overlap of the change with each range has to be signalled
+	const guint deleted = overlap (position, removed, old_offset, old_n_rows);
+	const guint inserted = overlap (position, added, new_offset, new_n_rows);
+	const guint deleted_row = MAX(position, old_offset) - old_offset;
+	const guint inserted_row = MAX(position, new_offset) - new_offset;
+
+	self->offset = new_offset;
+	++self->stamp; // Rows are positions so every iter is now invalid
+
+	for (guint i = 0; i < deleted; ++i)
+		emit_row_deleted (self, deleted_row);
+	for (guint i = 0; i < inserted; ++i)
+		emit_row_inserted (self, inserted_row + i);
+
+	g_warn_if_fail (self->n_rows == new_n_rows);
+	self->n_rows = new_n_rows;
+}
+
+/**
+ * irc_userlist_model_set_filter:
+ * @prefix: (nullable): Only show nicks starting with this
+ *
+ * It is cheaper to detach views while changing the filter.
+ */
+void
+irc_userlist_model_set_filter (IrcUserlistModel *self, const char *prefix)
+{
+	if (prefix != NULL && *prefix == '\0')
+		prefix = NULL;
+
+	if (g_strcmp0 (prefix, self->filter) == 0)
+		return;
+
+	while (self->n_rows)
+		emit_row_deleted (self, self->n_rows - 1);
+
+	g_free (self->filter);
+	self->filter = g_strdup (prefix);
+	++self->stamp;
+
+	guint n_rows;
+	get_range (self, &self->offset, &n_rows);
+	for (guint i = 0; i < n_rows; ++i)
+		emit_row_inserted (self, i);
+}
+
+static GtkTreeModelFlags
+irc_userlist_model_get_flags (GtkTreeModel *model)
+{
+	return GTK_TREE_MODEL_LIST_ONLY;
+}
+
+static int
+irc_userlist_model_get_n_columns (GtkTreeModel *model)
+{
+	return IRC_USERLIST_MODEL_N_COLUMNS;
+}
+
+static GType
+irc_userlist_model_get_column_type (GtkTreeModel *model, int column)
+{
+	switch (column)
+	{
+	case IRC_USERLIST_MODEL_COL_NICK:
+		return G_TYPE_STRING;
+	case IRC_USERLIST_MODEL_COL_USER:
+		return IRC_TYPE_USER;
+	default:
+		g_return_val_if_reached (G_TYPE_INVALID);
+	}
+}
+
+static gboolean
+irc_userlist_model_get_iter (GtkTreeModel *model, GtkTreeIter *iter, GtkTreePath *path)
+{
+	IrcUserlistModel *self = IRC_USERLIST_MODEL(model);
+
+	if (gtk_tree_path_get_depth (path) != 1)
+		return FALSE;
+
+	const int row = gtk_tree_path_get_indices (path)[0];
+	if (row < 0 || (guint)row >= self->n_rows)
+		return FALSE;
+
+	iter->stamp = self->stamp;
+	iter->user_data = GUINT_TO_POINTER((guint)row);
+	return TRUE;
+}
+
+static GtkTreePath *
+irc_userlist_model_get_path (GtkTreeModel *model, GtkTreeIter *iter)
+{
+	IrcUserlistModel *self = IRC_USERLIST_MODEL(model);
+
+	g_return_val_if_fail (iter->stamp == self->stamp, NULL);
+
+	return gtk_tree_path_new_from_indices ((int)GPOINTER_TO_UINT(iter->user_data), -1);
+}
+
+static void
+irc_userlist_model_get_value (GtkTreeModel *model, GtkTreeIter *iter, int column, GValue *value)
+{
+	IrcUserlistModel *self = IRC_USERLIST_MODEL(model);
+
+	g_return_if_fail (iter->stamp == self->stamp);
+
+	// IrcUserList caches the last position so walking rows in order is cheap
+	const guint position = self->offset + GPOINTER_TO_UINT(iter->user_data);
+	g_autoptr(IrcUserListItem) item = g_list_model_get_item (G_LIST_MODEL(self->list), position);
+
+	g_value_init (value, irc_userlist_model_get_column_type (model, column));
+	if (item == NULL)
+		return;
+
+	if (column == IRC_USERLIST_MODEL_COL_NICK)
+		g_value_set_string (value, item->user->nick);
+	else
+		g_value_set_object (value, item->user);
+}
+
+static gboolean
+irc_userlist_model_iter_next (GtkTreeModel *model, GtkTreeIter *iter)
+{
+	IrcUserlistModel *self = IRC_USERLIST_MODEL(model);
+	const guint row = GPOINTER_TO_UINT(iter->user_data) + 1;
+
+	if (row >= self->n_rows)
+		return FALSE;
+
+	iter->user_data = GUINT_TO_POINTER(row);
+	return TRUE;
+}
+
+static gboolean
+irc_userlist_model_iter_previous (GtkTreeModel *model, GtkTreeIter *iter)
+{
+	const guint row = GPOINTER_TO_UINT(iter->user_data);
+
+	if (row == 0)
+		return FALSE;
+
+	iter->user_data = GUINT_TO_POINTER(row - 1);
+	return TRUE;
+}
+
+static gboolean
+irc_userlist_model_iter_nth_child (GtkTreeModel *model, GtkTreeIter *iter, GtkTreeIter *parent, int n)
+{
+	IrcUserlistModel *self = IRC_USERLIST_MODEL(model);
+
+	if (parent != NULL || n < 0 || (guint)n >= self->n_rows)
+		return FALSE;
+
+	iter->stamp = self->stamp;
+	iter->user_data = GUINT_TO_POINTER((guint)n);
+	return TRUE;
+}
+
+static gboolean
+irc_userlist_model_iter_children (GtkTreeModel *model, GtkTreeIter *iter, GtkTreeIter *parent)
+{
+	return irc_userlist_model_iter_nth_child (model, iter, parent, 0);
+}
+
+static gboolean
+irc_userlist_model_iter_has_child (GtkTreeModel *model, GtkTreeIter *iter)
+{
+	return FALSE;
+}
+
+static int
+irc_userlist_model_iter_n_children (GtkTreeModel *model, GtkTreeIter *iter)
+{
+	IrcUserlistModel *self = IRC_USERLIST_MODEL(model);
+
+	if (iter != NULL)
+		return 0;
+
+	return (int)self->n_rows;
+}
+
+static gboolean
+irc_userlist_model_iter_parent (GtkTreeModel *model, GtkTreeIter *iter, GtkTreeIter *child)
+{
+	return FALSE;
+}
+
+/**
+ * irc_userlist_model_new:
+ * @list: Users to expose
+ *
+ * Returns: (transfer full): New model
+ */
+IrcUserlistModel *
+irc_userlist_model_new (IrcUserList *list)
+{
+	IrcUserlistModel *self = g_object_new (IRC_TYPE_USERLIST_MODEL, NULL);
+
+	self->list = g_object_ref (list);
+	get_range (self, &self->offset, &self->n_rows);
+	g_signal_connect_object (list, "items-changed", G_CALLBACK(on_items_changed), self, 0);
+
+	return self;
+}
+
+static void
+irc_userlist_model_finalize (GObject *object)
+{
+	IrcUserlistModel *self = IRC_USERLIST_MODEL(object);
+
+	g_clear_object (&self->list);
+	g_clear_pointer (&self->filter, g_free);
+
+	G_OBJECT_CLASS (irc_userlist_model_parent_class)->finalize (object);
+}
+
+static void
+irc_userlist_model_class_init (IrcUserlistModelClass *klass)
+{
+	GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+	object_class->finalize = irc_userlist_model_finalize;
+}
+
+static void
+irc_userlist_model_tree_model_init (GtkTreeModelIface *iface)
+{
+	iface->get_flags = irc_userlist_model_get_flags;
+	iface->get_n_columns = irc_userlist_model_get_n_columns;
+	iface->get_column_type = irc_userlist_model_get_column_type;
+	iface->get_iter = irc_userlist_model_get_iter;
+	iface->get_path = irc_userlist_model_get_path;
+	iface->get_value = irc_userlist_model_get_value;
+	iface->iter_next = irc_userlist_model_iter_next;
+	iface->iter_previous = irc_userlist_model_iter_previous;
+	iface->iter_children = irc_userlist_model_iter_children;
+	iface->iter_has_child = irc_userlist_model_iter_has_child;
+	iface->iter_n_children = irc_userlist_model_iter_n_children;
+	iface->iter_nth_child = irc_userlist_model_iter_nth_child;
+	iface->iter_parent = irc_userlist_model_iter_parent;
+}
+
+static void
+irc_userlist_model_init (IrcUserlistModel *self)
+{
+	self->stamp = (int)g_random_int ();
+}
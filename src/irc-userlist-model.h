@@ -0,0 +1,38 @@
+/* irc-userlist-model.h
+ *
+ * Copyright (C) 2017 Patrick Griffis <tingping@tingping.se>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <gtk/gtk.h>
+#include "irc-user-list.h"
+
+G_BEGIN_DECLS
+
+enum {
+	IRC_USERLIST_MODEL_COL_NICK,
+	IRC_USERLIST_MODEL_COL_USER,
+	IRC_USERLIST_MODEL_N_COLUMNS,
+};
+
+#define IRC_TYPE_USERLIST_MODEL (irc_userlist_model_get_type())
+G_DECLARE_FINAL_TYPE (IrcUserlistModel, irc_userlist_model, IRC, USERLIST_MODEL, GObject)
+
+IrcUserlistModel *irc_userlist_model_new (IrcUserList *list);
+void irc_userlist_model_set_filter (IrcUserlistModel *self, const char *prefix);
+
+G_END_DECLS
@@ -16,11 +16,10 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
-#include <string.h>
 #include <glib/gi18n.h>
 #include "irc-user.h"
 #include "irc-userlist.h"
-#include "irc-user-list.h"
+#include "irc-userlist-model.h"
 
 struct _IrcUserlist
 {
@@ -30,85 +29,64 @@ struct _IrcUserlist
 typedef struct
 {
 	GtkSearchEntry *search_entry;
+	GtkTreeView *view;
+	IrcUserlistModel *model;
 } IrcUserlistPrivate;
 
-enum {
-	COL_NICK,
-	COL_USER,
-	N_COL,
-};
-
 G_DEFINE_TYPE_WITH_PRIVATE (IrcUserlist, irc_userlist, GTK_TYPE_POPOVER)
 
-#if 0
 static void
 on_search_changed (GtkSearchEntry *entry, gpointer data)
 {
-	gtk_list_box_invalidate_filter (GTK_LIST_BOX(data));
-}
+	IrcUserlistPrivate *priv = irc_userlist_get_instance_private (IRC_USERLIST(data));
 
-static gboolean
-filter_func (GtkListBoxRow *row, gpointer data)
-{
-	const char *filter = gtk_entry_get_text (GTK_ENTRY(data));
-
-	if (!*filter)
-		return TRUE;
-
-   	IrcUser *user = g_object_get_data (G_OBJECT(row), "user");
-	if (irc_strcasestr (user->nick, filter) != NULL)
-		return TRUE;
-	return FALSE;
-}
-#endif
-
-static GtkWidget *
-create_widget (gpointer ptr, gpointer data)
-{
-	IrcUserListItem *item = IRC_USER_LIST_ITEM(ptr);
-	GtkWidget *row = gtk_list_box_row_new ();
-
-	GtkWidget *lbl = gtk_label_new (item->user->nick);
-	gtk_container_add (GTK_CONTAINER(row), lbl);
-
-	gtk_widget_show_all (row);
-	return row;
+	// Rebuilding the view once is cheaper than it tracking every row change
+	gtk_tree_view_set_model (priv->view, NULL);
+	irc_userlist_model_set_filter (priv->model, gtk_entry_get_text (GTK_ENTRY(entry)));
+	gtk_tree_view_set_model (priv->view, GTK_TREE_MODEL(priv->model));
 }
 
 /**
  * irc_userlist_new:
- * @model: Model of users to show
+ * @users: Users to show
  *
  * Returns: (transfer full): New userlist
  */
 IrcUserlist *
-irc_userlist_new (GListModel *model)
+irc_userlist_new (IrcUserList *users)
 {
 	GtkBox *box = GTK_BOX(gtk_box_new (GTK_ORIENTATION_VERTICAL, 0));
 	GtkWidget *sw = gtk_scrolled_window_new (NULL, NULL);
 	gtk_scrolled_window_set_policy (GTK_SCROLLED_WINDOW(sw), GTK_POLICY_NEVER, GTK_POLICY_AUTOMATIC);
 	gtk_widget_set_size_request (sw, -1, 400); // TODO: Correct sizing
 
-	GtkWidget *view = gtk_list_box_new ();
-	gtk_list_box_bind_model (GTK_LIST_BOX(view), model, create_widget, NULL, NULL);
+	// A tree view only renders the visible rows, unlike a list box which
+	// needs a widget per user
+	IrcUserlistModel *model = irc_userlist_model_new (users);
+	GtkWidget *view = gtk_tree_view_new_with_model (GTK_TREE_MODEL(model));
+	GtkCellRenderer *renderer = gtk_cell_renderer_text_new ();
+	GtkTreeViewColumn *column = gtk_tree_view_column_new_with_attributes (NULL, renderer,
+												"text", IRC_USERLIST_MODEL_COL_NICK, NULL);
+	gtk_tree_view_column_set_sizing (column, GTK_TREE_VIEW_COLUMN_FIXED);
+	gtk_tree_view_append_column (GTK_TREE_VIEW(view), column);
+	g_object_set (view, "headers-visible", FALSE,
+						"fixed-height-mode", TRUE,
+						"enable-search", FALSE, NULL);
 	gtk_container_add (GTK_CONTAINER(sw), view);
 
-#if 0
 	GtkWidget *entry = gtk_search_entry_new ();
-  	gtk_list_box_set_filter_func (GTK_LIST_BOX(view), filter_func, entry, NULL);
-	g_signal_connect (entry, "search-changed", G_CALLBACK(on_search_changed), view);
-
+	gtk_entry_set_placeholder_text (GTK_ENTRY(entry), _("Filter nicks"));
 	gtk_box_pack_start (box, entry, FALSE, TRUE, 0);
-#endif
 
   	gtk_box_pack_start (box, sw, TRUE, TRUE, 0);
 	gtk_widget_show_all (GTK_WIDGET(box));
 	IrcUserlist *list = g_object_new (IRC_TYPE_USERLIST, "child", box, NULL);
 
-#if 0
   	IrcUserlistPrivate *priv = irc_userlist_get_instance_private (list);
 	priv->search_entry = GTK_SEARCH_ENTRY(entry);
-#endif
+	priv->view = GTK_TREE_VIEW(view);
+	priv->model = model;
+	g_signal_connect (entry, "search-changed", G_CALLBACK(on_search_changed), list);
 
 	return list;
 }
@@ -116,8 +94,10 @@ irc_userlist_new (GListModel *model)
 static void
 irc_userlist_finalize (GObject *object)
 {
-	//IrcUserlist *self = (IrcUserlist *)object;
-	//IrcUserlistPrivate *priv = irc_userlist_get_instance_private (self);
+	IrcUserlist *self = (IrcUserlist *)object;
+	IrcUserlistPrivate *priv = irc_userlist_get_instance_private (self);
+
+	g_clear_object (&priv->model);
 
 	G_OBJECT_CLASS (irc_userlist_parent_class)->finalize (object);
 }
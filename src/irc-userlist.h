@@ -21,6 +21,7 @@
 
 #include <gtk/gtk.h>
 #include <gio/gio.h>
+#include "irc-user-list.h"
 
 G_BEGIN_DECLS
 
@@ -28,7 +29,7 @@ G_BEGIN_DECLS
 
 G_DECLARE_FINAL_TYPE (IrcUserlist, irc_userlist, IRC, USERLIST, GtkPopover)
 
-IrcUserlist *irc_userlist_new (GListModel *model);
+IrcUserlist *irc_userlist_new (IrcUserList *users);
 
 G_END_DECLS
 
@@ -16,6 +16,7 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <glib/gi18n.h>
 #include <gspell/gspell.h>
 
 #include "irc-utils.h"
@@ -25,14 +26,20 @@
 #include "irc-channel.h"
 #include "irc-context.h"
 #include "irc-context-manager.h"
+#include "irc-connect-scheduler.h"
 #include "irc-textview.h"
 #include "irc-chatview.h"
 #include "irc-window.h"
+#include "irc-application.h"
 #include "irc-chanstore.h"
 #include "irc-contextview.h"
 #include "irc-entry.h"
 #include "irc-entrybuffer.h"
 
+#define BACKLOG_LINES 200
+#define MAX_CONNECTING 2
+#define CONNECT_TIMEOUT 20
+
 typedef struct
 {
 	IrcChatview *tab;
@@ -73,6 +80,10 @@ typedef struct
 	GtkPaned *paned;
 	GtkRevealer *search_revealer;
 	GtkSearchEntry *search_entry;
+	GtkMenuButton *search_all_button;
+	GtkListBox *search_all_list;
+	GCancellable *search_all_cancellable;
+	IrcConnectScheduler *scheduler;
 } IrcWindowPrivate;
 
 G_DEFINE_TYPE_WITH_PRIVATE (IrcWindow, irc_window, GTK_TYPE_APPLICATION_WINDOW)
@@ -94,6 +105,17 @@ on_context_print (IrcContext *ctx, const char *line, gint64 stamp, gpointer data
 		return;*/
 }
 
+static void
+append_backlog_line (const char *text, time_t stamp, gpointer data)
+{
+	IrcContext *ctx = IRC_CONTEXT(data);
+	IrcContextUI *ctx_ui = g_object_get_data (G_OBJECT(ctx), "ctx-ui");
+
+	// Keeps the index numbering lines the same as the view
+	irc_search_index_append (irc_context_get_search_index (ctx), text);
+	irc_textview_append_text (ctx_ui->view, text, stamp);
+}
+
 static void
 on_context_added (IrcContextManager *mgr, IrcContext *ctx, gpointer data)
 {
@@ -104,6 +126,7 @@ on_context_added (IrcContextManager *mgr, IrcContext *ctx, gpointer data)
 	ctx_ui = g_new (IrcContextUI, 1);
 	ctx_ui->tab = irc_chatview_new ();
 	ctx_ui->view = irc_textview_new ();
+	irc_textview_set_search_index (ctx_ui->view, irc_context_get_search_index (ctx));
 	ctx_ui->entrybuffer = irc_entrybuffer_new ();
 	ctx_ui->popover = NULL;
 
@@ -112,26 +135,43 @@ on_context_added (IrcContextManager *mgr, IrcContext *ctx, gpointer data)
 	gtk_container_add (GTK_CONTAINER(priv->viewstack), GTK_WIDGET(ctx_ui->tab));
 	g_object_set_data_full (G_OBJECT(ctx), "ctx-ui", ctx_ui, (GDestroyNotify)irc_ctx_ui_free);
 
+	GtkApplication *app = gtk_window_get_application (GTK_WINDOW(self));
+	IrcLogger *logger = app ? irc_application_get_logger (IRC_APPLICATION(app)) : NULL;
+	if (logger != NULL)
+		irc_logger_read_backlog (logger, ctx, BACKLOG_LINES, append_backlog_line, ctx);
+
 	g_signal_connect (ctx, "print", G_CALLBACK(on_context_print), NULL);
+	g_signal_connect (ctx, "print-transient", G_CALLBACK(on_context_print), NULL);
 
 	if (IRC_IS_SERVER(ctx)) // Temp
 	{
-		irc_server_connect (IRC_SERVER(ctx));
+		// The one being looked at goes first
+		const int priority = ctx == irc_context_manager_get_front_context (mgr) ? 1 : 0;
+		irc_connect_scheduler_add (priv->scheduler, IRC_SERVER(ctx), priority);
 	}
 }
 
+static void
+on_context_removed (IrcContextManager *mgr, IrcContext *ctx, gpointer data)
+{
+  	IrcWindowPrivate *priv = irc_window_get_instance_private (IRC_WINDOW(data));
+
+	if (IRC_IS_SERVER(ctx))
+		irc_connect_scheduler_remove (priv->scheduler, IRC_SERVER(ctx));
+}
+
 static void
 update_topic (GObject *obj, GParamSpec *spec, gpointer data)
 {
 	IrcChannel *channel = IRC_CHANNEL(obj);
 	GtkHeaderBar *header = GTK_HEADER_BAR(data);
-	char *topic;
+	g_autofree char *topic = NULL;
 
 	g_object_get (channel, "topic", &topic, NULL);
 	if (topic != NULL)
 	{
-		g_autofree char *stripped = irc_strip_attributes (topic);
-		gtk_header_bar_set_subtitle (header, stripped);
+		g_autofree char *stripped = irc_has_attributes (topic) ? irc_strip_attributes (topic) : NULL;
+		gtk_header_bar_set_subtitle (header, stripped ? stripped : topic);
 		//gtk_widget_set_tooltip_text (GTK_WIDGET(header), stripped);
 	}
 }
@@ -150,12 +190,18 @@ on_front_context_changed (IrcContextManager *mgr, IrcContext *ctx, gpointer data
 	}
 	else
 	{
+		// Looking at a network that hasn't connected yet moves it up
+		IrcContext *parent = irc_context_get_parent (ctx);
+		IrcContext *server = parent ? parent : ctx;
+		if (IRC_IS_SERVER(server))
+			irc_connect_scheduler_set_priority (priv->scheduler, IRC_SERVER(server), 1);
+
 		gtk_stack_set_visible_child (priv->viewstack, GTK_WIDGET(ctx_ui->tab));
 		gtk_text_view_set_buffer (GTK_TEXT_VIEW(priv->entry), GTK_TEXT_BUFFER(ctx_ui->entrybuffer));
 		if (IRC_IS_CHANNEL (ctx) && ctx_ui->popover == NULL)
 		{
 			ctx_ui->popover = GTK_WIDGET(g_object_ref (
-									irc_userlist_new (G_LIST_MODEL(irc_channel_get_users (IRC_CHANNEL(ctx))))));
+									irc_userlist_new (irc_channel_get_users (IRC_CHANNEL(ctx)))));
 		}
 		gtk_menu_button_set_popover (priv->usersbutton, ctx_ui->popover);
 		gtk_header_bar_set_title (priv->headerbar, irc_context_get_name (ctx));
@@ -272,6 +318,90 @@ on_search_changed (GtkSearchEntry *entry, gpointer data)
 	irc_textview_set_search (view, gtk_entry_get_text (GTK_ENTRY(entry)));
 }
 
+static void
+on_search_all_result (IrcContext *ctx, GArray *lines, gpointer data)
+{
+	IrcWindow *self = IRC_WINDOW(data);
+	IrcWindowPrivate *priv = irc_window_get_instance_private (self);
+
+	g_autofree char *text = g_strdup_printf (ngettext ("%s: %u match", "%s: %u matches", lines->len),
+											 irc_context_get_name (ctx), lines->len);
+	GtkWidget *label = gtk_label_new (text);
+	gtk_label_set_xalign (GTK_LABEL(label), 0.0);
+	gtk_widget_show (label);
+	gtk_list_box_insert (priv->search_all_list, label, -1);
+
+	// The context may be gone by the time the row is activated
+	GtkWidget *row = gtk_widget_get_parent (label);
+	g_object_set_data_full (G_OBJECT(row), "context-id", g_strdup (irc_context_get_id (ctx)), g_free);
+}
+
+static void
+on_search_all_done (GObject *source, GAsyncResult *result, gpointer data)
+{
+	g_autoptr(IrcWindow) self = IRC_WINDOW(data);
+	g_autoptr(GError) err = NULL;
+
+	if (!irc_context_manager_search_finish (IRC_CONTEXT_MANAGER(source), result, &err)
+		&& !g_error_matches (err, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+		g_warning ("Failed to search: %s", err->message);
+}
+
+static void
+cancel_search_all (IrcWindow *self)
+{
+	IrcWindowPrivate *priv = irc_window_get_instance_private (self);
+
+	if (priv->search_all_cancellable)
+	{
+		g_cancellable_cancel (priv->search_all_cancellable);
+		g_clear_object (&priv->search_all_cancellable);
+	}
+}
+
+static void
+on_search_all_toggled (GtkToggleButton *button, gpointer data)
+{
+	IrcWindow *self = IRC_WINDOW(data);
+	IrcWindowPrivate *priv = irc_window_get_instance_private (self);
+
+	cancel_search_all (self);
+	if (!gtk_toggle_button_get_active (button))
+		return;
+
+	g_autoptr(GList) rows = gtk_container_get_children (GTK_CONTAINER(priv->search_all_list));
+	for (GList *l = rows; l; l = g_list_next (l))
+		gtk_widget_destroy (l->data);
+
+	const char *needle = gtk_entry_get_text (GTK_ENTRY(priv->search_entry));
+	if (!*needle)
+		return;
+
+	// Results stream in from a worker thread as each context is searched
+	priv->search_all_cancellable = g_cancellable_new ();
+	irc_context_manager_search_async (irc_context_manager_get_default (), needle, priv->search_all_cancellable,
+									  on_search_all_result, self, on_search_all_done, g_object_ref (self));
+}
+
+static void
+on_search_all_row_activated (GtkListBox *list, GtkListBoxRow *row, gpointer data)
+{
+	IrcWindow *self = IRC_WINDOW(data);
+	IrcWindowPrivate *priv = irc_window_get_instance_private (self);
+	IrcContextManager *mgr = irc_context_manager_get_default ();
+
+	IrcContext *ctx = irc_context_manager_find (mgr, g_object_get_data (G_OBJECT(row), "context-id"));
+	if (ctx == NULL)
+		return;
+
+	irc_context_manager_set_front_context (mgr, ctx);
+	gtk_toggle_button_set_active (GTK_TOGGLE_BUTTON(priv->search_all_button), FALSE);
+
+	IrcTextview *view = get_front_view (self);
+	if (view)
+		irc_textview_set_search (view, gtk_entry_get_text (GTK_ENTRY(priv->search_entry)));
+}
+
 static void
 on_search_state_changed (GSimpleAction *action, GVariant *param, gpointer data)
 {
@@ -285,6 +415,8 @@ on_search_state_changed (GSimpleAction *action, GVariant *param, gpointer data)
 		gtk_widget_grab_focus (GTK_WIDGET(priv->search_entry));
 	else
 	{
+		gtk_toggle_button_set_active (GTK_TOGGLE_BUTTON(priv->search_all_button), FALSE);
+
 		IrcTextview *view = get_front_view (self);
 		if (!view)
 			return;
@@ -316,8 +448,11 @@ irc_window_constructed (GObject *object)
 static void
 irc_window_finalize (GObject *object)
 {
-	//IrcWindow *self = IRC_WINDOW(object);
-	//IrcWindowPrivate *priv = irc_window_get_instance_private (self);
+	IrcWindow *self = IRC_WINDOW(object);
+	IrcWindowPrivate *priv = irc_window_get_instance_private (self);
+
+	g_clear_object (&priv->search_all_cancellable);
+	g_clear_object (&priv->scheduler);
 
 	G_OBJECT_CLASS (irc_window_parent_class)->finalize (object);
 }
@@ -340,11 +475,15 @@ irc_window_class_init (IrcWindowClass *klass)
 	gtk_widget_class_bind_template_child_private (wid_class, IrcWindow, sw_cv);
   	gtk_widget_class_bind_template_child_private (wid_class, IrcWindow, search_revealer);
   	gtk_widget_class_bind_template_child_private (wid_class, IrcWindow, search_entry);
+	gtk_widget_class_bind_template_child_private (wid_class, IrcWindow, search_all_button);
+	gtk_widget_class_bind_template_child_private (wid_class, IrcWindow, search_all_list);
 	gtk_widget_class_bind_template_child_private (wid_class, IrcWindow, entry_frame);
 	gtk_widget_class_bind_template_child_private (wid_class, IrcWindow, paned);
 	gtk_widget_class_bind_template_callback (wid_class, on_search_next);
 	gtk_widget_class_bind_template_callback (wid_class, on_search_previous);
   	gtk_widget_class_bind_template_callback (wid_class, on_search_changed);
+	gtk_widget_class_bind_template_callback (wid_class, on_search_all_toggled);
+	gtk_widget_class_bind_template_callback (wid_class, on_search_all_row_activated);
 }
 
 static void
@@ -376,8 +515,11 @@ irc_window_init (IrcWindow *self)
 	gtk_container_add (GTK_CONTAINER(priv->entry_frame), GTK_WIDGET(priv->entry));
 	gtk_widget_show (GTK_WIDGET(priv->entry));
 
+	priv->scheduler = irc_connect_scheduler_new (MAX_CONNECTING, CONNECT_TIMEOUT);
+
 	IrcContextManager *mgr = irc_context_manager_get_default ();
 	g_signal_connect (mgr, "context-added", G_CALLBACK(on_context_added), self);
+	g_signal_connect (mgr, "context-removed", G_CALLBACK(on_context_removed), self);
 	g_signal_connect (mgr, "front-context-changed", G_CALLBACK(on_front_context_changed), self);
 
 	g_autoptr(GSettings) settings = g_settings_new ("se.tingping.IrcClient");
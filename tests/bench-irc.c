@@ -0,0 +1,871 @@
+/*
+ * Copyright 2017 Patrick Griffis
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <gio/gio.h>
+#include "irc.h"
+
+/*
+ * Benchmarks for the code that runs for every inbound line.
+ *
+ * The corpus is generated from a fixed seed so runs are comparable, a file of
+ * raw lines can be used instead with --corpus. Each result is one JSON object
+ * per line:
+ *
+ *   {"name": "irc_message_new", "ops": 500000, "ns_per_op": 412.3, ...}
+ */
+
+#define ME "benchme"
+#define SERVER_PREFIX ":irc.example.net"
+#define N_CHANNELS 4
+#define N_MEMBERS 500
+#define N_VISITORS 200
+
+static int n_lines = 100000;
+static int n_rounds = 5;
+static int seed = 1;
+static char *corpus_path;
+static char *filter;
+static char *output_path;
+static FILE *output;
+
+static volatile guint sink;
+
+#define RAND_INDEX(rand, array) ((guint)g_rand_int_range (rand, 0, (gint32)G_N_ELEMENTS(array)))
+
+static GOptionEntry entries[] = {
+	{ "lines", 'n', 0, G_OPTION_ARG_INT, &n_lines, "Number of lines to generate", "N" },
+	{ "rounds", 'r', 0, G_OPTION_ARG_INT, &n_rounds, "Passes over the corpus per benchmark", "N" },
+	{ "seed", 's', 0, G_OPTION_ARG_INT, &seed, "Seed for the generated corpus", "SEED" },
+	{ "corpus", 'c', 0, G_OPTION_ARG_FILENAME, &corpus_path, "File of raw lines to parse instead of generated ones", "FILE" },
+	{ "filter", 'f', 0, G_OPTION_ARG_STRING, &filter, "Only run benchmarks containing this", "NAME" },
+	{ "output", 'o', 0, G_OPTION_ARG_FILENAME, &output_path, "Append results to this file", "FILE" },
+	{ NULL }
+};
+
+#ifdef __GLIBC__
+// Every allocation from GLib ends up here so counting them is cheap
+extern void *__libc_malloc (size_t size);
+extern void *__libc_calloc (size_t nmemb, size_t size);
+extern void *__libc_realloc (void *ptr, size_t size);
+
+static volatile gint n_allocs;
+
+void *
+malloc (size_t size)
+{
+	g_atomic_int_inc (&n_allocs);
+	return __libc_malloc (size);
+}
+
+void *
+calloc (size_t nmemb, size_t size)
+{
+	g_atomic_int_inc (&n_allocs);
+	return __libc_calloc (nmemb, size);
+}
+
+void *
+realloc (void *ptr, size_t size)
+{
+	g_atomic_int_inc (&n_allocs);
+	return __libc_realloc (ptr, size);
+}
+
+#define HAVE_ALLOC_COUNT 1
+#define get_allocs() ((guint)g_atomic_int_get (&n_allocs))
+#else
+#define HAVE_ALLOC_COUNT 0
+#define get_allocs() 0u
+#endif
+
+typedef struct
+{
+	const char *name;
+	guint64 start_ns;
+	guint start_allocs;
+	guint64 ops;
+	guint64 bytes;
+} Bench;
+
+static guint64
+now_ns (void)
+{
+	struct timespec ts;
+
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	return (guint64)ts.tv_sec * G_GUINT64_CONSTANT(1000000000) + (guint64)ts.tv_nsec;
+}
+
+static gboolean
+bench_start (Bench *bench, const char *name)
+{
+	if (filter != NULL && strstr (name, filter) == NULL)
+		return FALSE;
+
+	bench->name = name;
+	bench->ops = 0;
+	bench->bytes = 0;
+	bench->start_allocs = get_allocs ();
+	bench->start_ns = now_ns ();
+	return TRUE;
+}
+
+static void
+bench_stop (Bench *bench)
+{
+	const guint64 elapsed = now_ns () - bench->start_ns;
+	const guint allocs = get_allocs () - bench->start_allocs;
+	const double ops = bench->ops ? (double)bench->ops : 1.0;
+	const double seconds = (double)elapsed / 1e9;
+	g_autoptr(GString) json = g_string_new (NULL);
+
+	g_string_append_printf (json, "{\"name\": \"%s\", \"ops\": %" G_GUINT64_FORMAT ", \"ns_per_op\": %.2f, \"ops_per_sec\": %.0f",
+							bench->name, bench->ops, (double)elapsed / ops, (double)bench->ops / seconds);
+	if (bench->bytes)
+		g_string_append_printf (json, ", \"mb_per_sec\": %.2f", (double)bench->bytes / seconds / (1024 * 1024));
+	if (HAVE_ALLOC_COUNT)
+		g_string_append_printf (json, ", \"allocs_per_op\": %.2f", (double)allocs / ops);
+	else
+		g_string_append (json, ", \"allocs_per_op\": null");
+	g_string_append (json, "}\n");
+
+	fputs (json->str, output);
+	fflush (output);
+}
+
+typedef struct
+{
+	GPtrArray *lines; // Raw lines as received
+	GPtrArray *texts; // Message text of every line that has one
+	GPtrArray *legacy; // Texts with Latin-1 bytes in them
+	GPtrArray *nicks;
+	GPtrArray *session; // A whole session for one server, leaves it in the state it started in
+	guint64 lines_bytes;
+	guint64 texts_bytes;
+	guint64 legacy_bytes;
+	guint64 session_bytes;
+} Corpus;
+
+static const char *words[] = {
+	"the", "a", "is", "it", "to", "and", "lol", "ok", "yes", "no", "that", "this", "build",
+	"meson", "channel", "anyone", "know", "why", "crash", "patch", "review", "thanks", "hi",
+	"gtk", "glib", "irc", "server", "works", "for", "me", "broken", "again", "fixed", "cafe",
+	"release", "tomorrow", "https://example.org/issues/1234", "see", "here", ":)", "^^",
+	"weechat", "znc", "bouncer", "latency", "seriously", "everyone", "here?", "monday",
+};
+
+static const char *syllables[] = {
+	"ka", "to", "mi", "ra", "zen", "bo", "lu", "ne", "qu", "xi", "vor", "el", "an", "sh",
+};
+
+static const char *hosts[] = {
+	"user/%s", "gateway/web/irccloud.com/x-%s", "%s.dsl.example.net", "unaffiliated/%s",
+};
+
+typedef struct
+{
+	char *nick;
+	char *away_nick;
+	char *prefix;
+	char *away_prefix;
+	gboolean away;
+} User;
+
+static void
+user_free (gpointer data)
+{
+	User *user = data;
+
+	g_free (user->nick);
+	g_free (user->away_nick);
+	g_free (user->prefix);
+	g_free (user->away_prefix);
+	g_free (user);
+}
+
+static User *
+make_user (GRand *rand, GHashTable *seen)
+{
+	GString *nick = g_string_new (NULL);
+	const int n_syllables = g_rand_int_range (rand, 2, 5);
+
+	for (int i = 0; i < n_syllables; ++i)
+		g_string_append (nick, syllables[RAND_INDEX(rand, syllables)]);
+	if (g_rand_int_range (rand, 0, 4) == 0)
+		g_string_append_printf (nick, "%d", g_rand_int_range (rand, 0, 100));
+	if (g_rand_int_range (rand, 0, 10) == 0)
+		g_string_append_c (nick, "[]\\`_|^"[g_rand_int_range (rand, 0, 7)]);
+	if (g_hash_table_contains (seen, nick->str))
+		g_string_append_printf (nick, "%u", g_hash_table_size (seen));
+
+	User *user = g_new0 (User, 1);
+	user->nick = g_string_free (nick, FALSE);
+	user->away_nick = g_strconcat (user->nick, "|afk", NULL);
+	g_autofree char *host = g_strdup_printf (hosts[RAND_INDEX(rand, hosts)], user->nick);
+	user->prefix = g_strdup_printf ("%s!~%s@%s", user->nick, user->nick, host);
+	user->away_prefix = g_strdup_printf ("%s!~%s@%s", user->away_nick, user->nick, host);
+	g_hash_table_add (seen, user->nick);
+
+	return user;
+}
+
+static const char *
+user_nick (User *user)
+{
+	return user->away ? user->away_nick : user->nick;
+}
+
+static const char *
+user_prefix (User *user)
+{
+	return user->away ? user->away_prefix : user->prefix;
+}
+
+static char *
+make_text (GRand *rand, const char *mention)
+{
+	GString *text = g_string_new (NULL);
+	const int n_words = g_rand_int_range (rand, 1, 25);
+	const gboolean is_action = g_rand_int_range (rand, 0, 20) == 0;
+
+	if (is_action)
+		g_string_append (text, "\001ACTION ");
+
+	for (int i = 0; i < n_words; ++i)
+	{
+		const char *word = words[RAND_INDEX(rand, words)];
+
+		if (i)
+			g_string_append_c (text, ' ');
+
+		switch (g_rand_int_range (rand, 0, 40))
+		{
+		case 0:
+			g_string_append_printf (text, "\003%02d,%02d%s\003", g_rand_int_range (rand, 0, 16),
+									g_rand_int_range (rand, 0, 16), word);
+			break;
+		case 1:
+			g_string_append_printf (text, "\002%s\002", word);
+			break;
+		case 2:
+			g_string_append_printf (text, "\037%s\017", word);
+			break;
+		case 3:
+			g_string_append (text, mention ? mention : word);
+			break;
+		default:
+			g_string_append (text, word);
+		}
+	}
+
+	if (is_action)
+		g_string_append_c (text, '\001');
+
+	return g_string_free (text, FALSE);
+}
+
+static char *
+make_legacy_text (GRand *rand, const char *text)
+{
+	char *legacy = g_strdup (text);
+
+	for (char *p = legacy; *p; ++p)
+	{
+		if (*p == 'e' && g_rand_int_range (rand, 0, 8) == 0)
+			*p = '\xe9';
+	}
+
+	return legacy;
+}
+
+typedef enum
+{
+	PENDING_PART,
+	PENDING_NICK,
+	PENDING_DEVOICE,
+} PendingType;
+
+typedef struct
+{
+	PendingType type;
+	User *user;
+	guint channel;
+} Pending;
+
+static void
+add_session_line (Corpus *corpus, char *line)
+{
+	corpus->session_bytes += strlen (line);
+	g_ptr_array_add (corpus->session, line);
+}
+
+static char *
+format_pending (Pending *pending)
+{
+	switch (pending->type)
+	{
+	case PENDING_PART:
+		return g_strdup_printf (":%s PART #bench%u :Leaving", user_prefix (pending->user), pending->channel);
+	case PENDING_NICK:
+		pending->user->away = FALSE;
+		return g_strdup_printf (":%s NICK :%s", pending->user->away_prefix, pending->user->nick);
+	case PENDING_DEVOICE:
+		return g_strdup_printf (":ChanServ!ChanServ@services. MODE #bench%u -v %s", pending->channel, user_nick (pending->user));
+	default:
+		g_return_val_if_reached (NULL);
+	}
+}
+
+static void
+generate_session (Corpus *corpus, GRand *rand, GPtrArray *members, GPtrArray *visitors)
+{
+	g_autoptr(GArray) pending = g_array_new (FALSE, FALSE, sizeof(Pending));
+	g_autoptr(GHashTable) busy = g_hash_table_new (NULL, NULL);
+
+	for (guint chan = 0; chan < N_CHANNELS; ++chan)
+	{
+		add_session_line (corpus, g_strdup_printf (":" ME "!~" ME "@bench.example.net JOIN #bench%u", chan));
+
+		GString *names = g_string_new (NULL);
+		for (guint i = 0; i < N_MEMBERS; ++i)
+		{
+			User *user = g_ptr_array_index (members, (chan * N_MEMBERS / 2 + i) % members->len);
+			const int mode = g_rand_int_range (rand, 0, 20);
+
+			if (names->len)
+				g_string_append_c (names, ' ');
+			g_string_append_printf (names, "%s%s", mode == 0 ? "@" : mode == 1 ? "+" : "", user->nick);
+			if (i % 50 == 49 || i == N_MEMBERS - 1)
+			{
+				add_session_line (corpus, g_strdup_printf (SERVER_PREFIX " 353 " ME " = #bench%u :%s", chan, names->str));
+				g_string_truncate (names, 0);
+			}
+		}
+		g_string_free (names, TRUE);
+		add_session_line (corpus, g_strdup_printf (SERVER_PREFIX " 366 " ME " #bench%u :End of /NAMES list.", chan));
+	}
+
+	for (int i = 0; i < n_lines; ++i)
+	{
+		const int roll = g_rand_int_range (rand, 0, 100);
+		const guint chan = (guint)g_rand_int_range (rand, 0, N_CHANNELS);
+		User *member = g_ptr_array_index (members, (chan * N_MEMBERS / 2 + (guint)g_rand_int_range (rand, 0, N_MEMBERS)) % members->len);
+		User *visitor = g_ptr_array_index (visitors, (guint)g_rand_int_range (rand, 0, (gint32)visitors->len));
+		Pending new_pending = { 0, NULL, chan };
+		char *line;
+
+		if (roll < 6 && !g_hash_table_contains (busy, visitor))
+		{
+			line = g_strdup_printf (":%s JOIN #bench%u", user_prefix (visitor), chan);
+			new_pending.type = PENDING_PART;
+			new_pending.user = visitor;
+		}
+		else if (roll < 8 && !g_hash_table_contains (busy, member))
+		{
+			line = g_strdup_printf (":%s NICK :%s", member->prefix, member->away_nick);
+			member->away = TRUE;
+			new_pending.type = PENDING_NICK;
+			new_pending.user = member;
+		}
+		else if (roll < 10 && !g_hash_table_contains (busy, member))
+		{
+			line = g_strdup_printf (":ChanServ!ChanServ@services. MODE #bench%u +v %s", chan, user_nick (member));
+			new_pending.type = PENDING_DEVOICE;
+			new_pending.user = member;
+		}
+		else if (roll < 14 && pending->len)
+		{
+			const guint index = (guint)g_rand_int_range (rand, 0, (gint32)pending->len);
+			Pending *old = &g_array_index (pending, Pending, index);
+
+			line = format_pending (old);
+			g_hash_table_remove (busy, old->user);
+			g_array_remove_index_fast (pending, index);
+		}
+		else if (roll < 15)
+		{
+			g_autofree char *text = make_text (rand, NULL);
+			line = g_strdup_printf (SERVER_PREFIX " NOTICE " ME " :%s", text);
+		}
+		else if (roll < 16)
+		{
+			g_autofree char *text = make_text (rand, NULL);
+			line = g_strdup_printf (":%s TOPIC #bench%u :%s", user_prefix (member), chan, text);
+		}
+		else if (roll < 18)
+		{
+			// Highlights only come from playback so no notifications are shown
+			g_autofree char *text = make_text (rand, ME);
+			line = g_strdup_printf ("@time=2017-06-01T12:%02d:%02d.000Z :%s PRIVMSG #bench%u :%s",
+									i / 60 % 60, i % 60, user_prefix (member), chan, text);
+		}
+		else
+		{
+			g_autofree char *text = make_text (rand, NULL);
+			line = g_strdup_printf (":%s PRIVMSG #bench%u :%s", user_prefix (member), chan, text);
+		}
+
+		if (new_pending.user != NULL)
+		{
+			g_hash_table_add (busy, new_pending.user);
+			g_array_append_val (pending, new_pending);
+		}
+		add_session_line (corpus, line);
+	}
+
+	for (guint i = 0; i < pending->len; ++i)
+		add_session_line (corpus, format_pending (&g_array_index (pending, Pending, i)));
+
+	for (guint chan = 0; chan < N_CHANNELS; ++chan)
+		add_session_line (corpus, g_strdup_printf (":" ME "!~" ME "@bench.example.net PART #bench%u :bye", chan));
+}
+
+static gboolean
+load_corpus_file (Corpus *corpus, const char *path)
+{
+	g_autoptr(GError) err = NULL;
+	g_autofree char *contents = NULL;
+
+	if (!g_file_get_contents (path, &contents, NULL, &err))
+	{
+		g_printerr ("Failed to read corpus: %s\n", err->message);
+		return FALSE;
+	}
+
+	g_auto(GStrv) lines = g_strsplit (contents, "\n", -1);
+	for (gsize i = 0; lines[i]; ++i)
+	{
+		g_strchomp (lines[i]);
+		if (*lines[i])
+		{
+			corpus->lines_bytes += strlen (lines[i]);
+			g_ptr_array_add (corpus->lines, g_strdup (lines[i]));
+		}
+	}
+
+	return TRUE;
+}
+
+static void
+corpus_free (Corpus *corpus)
+{
+	g_ptr_array_unref (corpus->lines);
+	g_ptr_array_unref (corpus->texts);
+	g_ptr_array_unref (corpus->legacy);
+	g_ptr_array_unref (corpus->nicks);
+	g_ptr_array_unref (corpus->session);
+}
+
+static gboolean
+corpus_init (Corpus *corpus)
+{
+	g_autoptr(GRand) rand = g_rand_new_with_seed ((guint32)seed);
+	g_autoptr(GHashTable) seen = g_hash_table_new (g_str_hash, g_str_equal);
+	g_autoptr(GPtrArray) members = g_ptr_array_new_with_free_func (user_free);
+	g_autoptr(GPtrArray) visitors = g_ptr_array_new_with_free_func (user_free);
+
+	memset (corpus, 0, sizeof(Corpus));
+	corpus->lines = g_ptr_array_new_with_free_func (g_free);
+	corpus->texts = g_ptr_array_new_with_free_func (g_free);
+	corpus->legacy = g_ptr_array_new_with_free_func (g_free);
+	corpus->nicks = g_ptr_array_new_with_free_func (g_free);
+	corpus->session = g_ptr_array_new_with_free_func (g_free);
+
+	for (guint i = 0; i < N_CHANNELS * N_MEMBERS; ++i)
+		g_ptr_array_add (members, make_user (rand, seen));
+	for (guint i = 0; i < N_VISITORS; ++i)
+		g_ptr_array_add (visitors, make_user (rand, seen));
+
+	for (guint i = 0; i < members->len; ++i)
+		g_ptr_array_add (corpus->nicks, g_strdup (((User*)g_ptr_array_index (members, i))->nick));
+
+	generate_session (corpus, rand, members, visitors);
+
+	if (corpus_path != NULL)
+	{
+		if (!load_corpus_file (corpus, corpus_path))
+			return FALSE;
+	}
+	else
+	{
+		for (guint i = 0; i < corpus->session->len; ++i)
+			g_ptr_array_add (corpus->lines, g_strdup (g_ptr_array_index (corpus->session, i)));
+		corpus->lines_bytes = corpus->session_bytes;
+	}
+
+	for (guint i = 0; i < corpus->lines->len; ++i)
+	{
+		g_autoptr(IrcMessage) msg = irc_message_new (g_ptr_array_index (corpus->lines, i));
+		if (msg == NULL || msg->params == NULL)
+			continue;
+
+		const char *text = irc_message_get_param (msg, g_strv_length (msg->params) - 1);
+		if (text == NULL || !*text)
+			continue;
+
+		g_ptr_array_add (corpus->texts, g_strdup (text));
+		corpus->texts_bytes += strlen (text);
+
+		char *legacy = make_legacy_text (rand, text);
+		corpus->legacy_bytes += strlen (legacy);
+		g_ptr_array_add (corpus->legacy, legacy);
+	}
+
+	return TRUE;
+}
+
+static void
+bench_message_new (Corpus *corpus)
+{
+	Bench bench;
+
+	if (!bench_start (&bench, "irc_message_new"))
+		return;
+
+	for (int round = 0; round < n_rounds; ++round)
+	{
+		for (guint i = 0; i < corpus->lines->len; ++i)
+		{
+			IrcMessage *msg = irc_message_new (g_ptr_array_index (corpus->lines, i));
+			if (msg != NULL)
+				irc_message_free (msg);
+		}
+		bench.ops += corpus->lines->len;
+		bench.bytes += corpus->lines_bytes;
+	}
+
+	bench_stop (&bench);
+}
+
+static void
+bench_strip_attributes (Corpus *corpus)
+{
+	Bench bench;
+
+	if (!bench_start (&bench, "irc_strip_attributes"))
+		return;
+
+	for (int round = 0; round < n_rounds; ++round)
+	{
+		for (guint i = 0; i < corpus->texts->len; ++i)
+			g_free (irc_strip_attributes (g_ptr_array_index (corpus->texts, i)));
+		bench.ops += corpus->texts->len;
+		bench.bytes += corpus->texts_bytes;
+	}
+
+	bench_stop (&bench);
+}
+
+static void
+bench_strcasestr (Corpus *corpus)
+{
+	Bench bench;
+	guint found = 0;
+
+	if (!bench_start (&bench, "irc_strcasestr"))
+		return;
+
+	for (int round = 0; round < n_rounds; ++round)
+	{
+		for (guint i = 0; i < corpus->texts->len; ++i)
+		{
+			if (irc_strcasestr (g_ptr_array_index (corpus->texts, i), ME) != NULL)
+				++found;
+		}
+		bench.ops += corpus->texts->len;
+		bench.bytes += corpus->texts_bytes;
+	}
+
+	bench_stop (&bench);
+	sink = found;
+}
+
+static void
+bench_search_index (Corpus *corpus)
+{
+	g_autoptr(IrcSearchIndex) index = irc_search_index_new ();
+	Bench bench;
+	guint found = 0;
+
+	if (!bench_start (&bench, "irc_search_index_search"))
+		return;
+
+	irc_search_index_set_max_lines (index, MAX (corpus->texts->len, 1));
+	for (guint i = 0; i < corpus->texts->len; ++i)
+		irc_search_index_append (index, g_ptr_array_index (corpus->texts, i));
+
+	// Only the searches are timed
+	bench_start (&bench, "irc_search_index_search");
+
+	for (int round = 0; round < n_rounds * 20; ++round)
+	{
+		g_autoptr(GArray) lines = irc_search_index_search (index, ME);
+		found += lines->len;
+		++bench.ops;
+	}
+
+	bench_stop (&bench);
+	sink = found;
+}
+
+static void
+bench_str_hash (Corpus *corpus)
+{
+	Bench bench;
+	guint32 hash = 0;
+
+	if (!bench_start (&bench, "irc_str_hash"))
+		return;
+
+	for (int round = 0; round < n_rounds * 100; ++round)
+	{
+		for (guint i = 0; i < corpus->nicks->len; ++i)
+			hash ^= irc_str_hash (g_ptr_array_index (corpus->nicks, i));
+		bench.ops += corpus->nicks->len;
+	}
+
+	bench_stop (&bench);
+	sink = hash;
+}
+
+static void
+bench_str_cmp (Corpus *corpus)
+{
+	Bench bench;
+	int total = 0;
+
+	if (!bench_start (&bench, "irc_str_cmp"))
+		return;
+
+	for (int round = 0; round < n_rounds * 100; ++round)
+	{
+		for (guint i = 1; i < corpus->nicks->len; ++i)
+			total += irc_str_cmp (g_ptr_array_index (corpus->nicks, i - 1), g_ptr_array_index (corpus->nicks, i));
+		bench.ops += corpus->nicks->len - 1;
+	}
+
+	bench_stop (&bench);
+	sink = (guint)total;
+}
+
+static void
+bench_convert_invalid_text (Corpus *corpus)
+{
+	Bench bench;
+	GIConv converter = g_iconv_open ("UTF-8", "ISO-8859-1");
+
+	g_assert (converter != (GIConv)-1);
+
+	if (bench_start (&bench, "irc_convert_invalid_text"))
+	{
+		for (int round = 0; round < n_rounds; ++round)
+		{
+			for (guint i = 0; i < corpus->legacy->len; ++i)
+				g_free (irc_convert_invalid_text (g_ptr_array_index (corpus->legacy, i), -1, converter, "\357\277\275"));
+			bench.ops += corpus->legacy->len;
+			bench.bytes += corpus->legacy_bytes;
+		}
+		bench_stop (&bench);
+	}
+
+	g_iconv_close (converter);
+}
+
+static void
+bench_user_list (Corpus *corpus, guint size)
+{
+	static const char *prefixes[] = { "", "", "", "", "+", "@" };
+	g_autofree char *name = g_strdup_printf ("IrcUserList/add-remove/%u", size);
+	g_autoptr(GPtrArray) users = g_ptr_array_new_with_free_func (g_object_unref);
+	Bench bench;
+
+	if (filter != NULL && strstr (name, filter) == NULL)
+		return;
+
+	for (guint i = 0; i < size; ++i)
+	{
+		g_autofree char *nick = g_strdup_printf ("%s%u", (char*)g_ptr_array_index (corpus->nicks, i % corpus->nicks->len), i);
+		g_ptr_array_add (users, irc_user_new (nick));
+	}
+
+	g_autoptr(IrcUserList) list = irc_user_list_new ();
+	const int n = MAX(1, n_rounds * (int)(100000 / size));
+
+	bench_start (&bench, name);
+	for (int round = 0; round < n; ++round)
+	{
+		for (guint i = 0; i < size; ++i)
+			irc_user_list_add (list, g_ptr_array_index (users, i), prefixes[i % G_N_ELEMENTS(prefixes)]);
+		for (guint i = 0; i < size; ++i)
+			irc_user_list_remove (list, g_ptr_array_index (users, (i * 7919) % size));
+		bench.ops += size * 2;
+	}
+	bench_stop (&bench);
+}
+
+typedef struct
+{
+	GSocketService *service;
+	GPtrArray *clients;
+	IrcServer *server;
+	gboolean timed_out;
+} Session;
+
+static gboolean
+on_incoming (GSocketService *service, GSocketConnection *connection, GObject *source, gpointer data)
+{
+	Session *session = data;
+
+	// Nothing is ever sent, the server is fed directly through ::inbound
+	g_ptr_array_add (session->clients, g_object_ref (connection));
+	return TRUE;
+}
+
+static gboolean
+on_timeout (gpointer data)
+{
+	Session *session = data;
+
+	session->timed_out = TRUE;
+	return G_SOURCE_REMOVE;
+}
+
+static gboolean
+connect_session (Session *session)
+{
+	g_autoptr(GError) err = NULL;
+	g_autoptr(GSettings) settings = NULL;
+
+	const guint16 port = g_socket_listener_add_any_inet_port (G_SOCKET_LISTENER(session->service), NULL, &err);
+	if (port == 0)
+	{
+		g_printerr ("Failed to listen: %s\n", err->message);
+		return FALSE;
+	}
+	g_signal_connect (session->service, "incoming", G_CALLBACK(on_incoming), session);
+
+	session->server = g_object_new (IRC_TYPE_SERVER, "host", "127.0.0.1", "port", port, "tls", FALSE,
+									"name", "bench", NULL);
+	// Channels are added under it
+	irc_context_manager_add (irc_context_manager_get_default (), IRC_CONTEXT(session->server));
+	g_object_get (session->server, "settings", &settings, NULL);
+	g_settings_set_string (settings, "nickname", ME);
+
+	irc_server_connect (session->server);
+	const guint timeout = g_timeout_add_seconds (5, on_timeout, session);
+	while (irc_server_get_me (session->server) == NULL && !session->timed_out)
+		g_main_context_iteration (NULL, TRUE);
+
+	if (session->timed_out)
+	{
+		g_printerr ("Failed to connect to local server\n");
+		return FALSE;
+	}
+
+	g_source_remove (timeout);
+	return TRUE;
+}
+
+static void
+bench_handle_incoming (Corpus *corpus)
+{
+	Session session = { g_socket_service_new (), g_ptr_array_new_with_free_func (g_object_unref), NULL, FALSE };
+	Bench bench;
+
+	if (connect_session (&session) && bench_start (&bench, "handle_incoming"))
+	{
+		for (int round = 0; round < n_rounds; ++round)
+		{
+			for (guint i = 0; i < corpus->session->len; ++i)
+			{
+				gboolean handled;
+				g_signal_emit_by_name (session.server, "inbound", g_ptr_array_index (corpus->session, i), &handled);
+			}
+			bench.ops += corpus->session->len;
+			bench.bytes += corpus->session_bytes;
+
+			while (g_main_context_iteration (NULL, FALSE));
+		}
+		bench_stop (&bench);
+	}
+
+	if (session.server != NULL)
+	{
+		irc_server_disconnect (session.server);
+		irc_context_manager_remove (irc_context_manager_get_default (), IRC_CONTEXT(session.server));
+	}
+	g_socket_service_stop (session.service);
+	g_clear_object (&session.server);
+	g_object_unref (session.service);
+	g_ptr_array_unref (session.clients);
+}
+
+int
+main (int argc, char **argv)
+{
+	g_autoptr(GOptionContext) context = g_option_context_new ("- benchmark libirc");
+	g_autoptr(GError) err = NULL;
+	Corpus corpus;
+
+	g_option_context_add_main_entries (context, entries, NULL);
+	if (!g_option_context_parse (context, &argc, &argv, &err))
+	{
+		g_printerr ("%s\n", err->message);
+		return EXIT_FAILURE;
+	}
+	if (n_lines <= 0 || n_rounds <= 0)
+	{
+		g_printerr ("--lines and --rounds must be positive\n");
+		return EXIT_FAILURE;
+	}
+
+	output = stdout;
+	if (output_path != NULL && (output = fopen (output_path, "a")) == NULL)
+	{
+		g_printerr ("Failed to open %s\n", output_path);
+		return EXIT_FAILURE;
+	}
+
+	if (!corpus_init (&corpus))
+		return EXIT_FAILURE;
+
+	bench_message_new (&corpus);
+	bench_strip_attributes (&corpus);
+	bench_strcasestr (&corpus);
+	bench_search_index (&corpus);
+	bench_str_hash (&corpus);
+	bench_str_cmp (&corpus);
+	bench_convert_invalid_text (&corpus);
+	bench_user_list (&corpus, 10);
+	bench_user_list (&corpus, 1000);
+	bench_user_list (&corpus, 50000);
+	if (filter == NULL || strstr ("handle_incoming", filter) != NULL)
+		bench_handle_incoming (&corpus);
+
+	corpus_free (&corpus);
+	if (output != stdout)
+		fclose (output);
+
+	return EXIT_SUCCESS;
+}
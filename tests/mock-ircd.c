@@ -0,0 +1,1057 @@
+/*
+ * Copyright 2017 Patrick Griffis
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ */
+
+#include <string.h>
+#include "mock-ircd.h"
+
+/*
+ * A local stand in for an IRC server. It speaks just enough of the protocol
+ * for IrcServer to register (CAP LS 302, SASL PLAIN, 005) and answers NAMES,
+ * WHOX, MONITOR and CHATHISTORY. Tests then generate load on command.
+ *
+ * Only one client is served. Everything sent is queued and written in order,
+ * mock_ircd_sync() waits until the client handled all of it by sending a PING
+ * and waiting for the PONG.
+ */
+
+#define SERVER_NAME "mock.ircd"
+#define TIMEOUT_SECONDS 60
+#define NAMES_LINE_LEN 400
+
+typedef struct
+{
+	char *nick;
+	char *account;
+	gboolean online;
+} MockUser;
+
+typedef struct
+{
+	char *name;
+	GHashTable *members; // Set of MockUser
+	gboolean joined; // If the client is in it
+	gboolean banned; // The client can't join it
+} MockChannel;
+
+typedef struct
+{
+	MockIrcd *self;
+	GCancellable *cancel;
+	GBytes *bytes;
+} WriteData;
+
+struct _MockIrcd
+{
+	MockIrcdFlags flags;
+	GSocketService *service;
+	guint16 port;
+
+	GIOStream *conn;
+	GDataInputStream *in;
+	GCancellable *cancel;
+	GByteArray *pending;
+	gboolean writing;
+
+	char *nick;
+	gboolean got_user;
+	gboolean in_cap;
+	gboolean registered;
+	GHashTable *caps; // Acknowledged capabilities
+	GHashTable *monitor;
+	char *sasl_username;
+	char *sasl_password;
+	char *account;
+
+	GPtrArray *users;
+	GHashTable *user_table; // nick -> MockUser
+	GHashTable *channels; // name -> MockChannel
+	GHashTable *received; // command -> count
+	guint n_who_refused; // WHOs left to answer with an error
+	guint sync_serial;
+	guint synced_serial;
+	guint batch_serial;
+	guint message_serial;
+};
+
+static void
+mock_user_free (gpointer data)
+{
+	MockUser *user = data;
+
+	g_free (user->nick);
+	g_free (user->account);
+	g_free (user);
+}
+
+static void
+mock_channel_free (gpointer data)
+{
+	MockChannel *channel = data;
+
+	g_free (channel->name);
+	g_hash_table_unref (channel->members);
+	g_free (channel);
+}
+
+static void flush_pending (MockIrcd *self);
+
+static void
+on_write_ready (GObject *source, GAsyncResult *res, gpointer data)
+{
+	g_autoptr(GError) err = NULL;
+	WriteData *write = data;
+	const gboolean cancelled = g_cancellable_is_cancelled (write->cancel);
+
+	g_output_stream_write_all_finish (G_OUTPUT_STREAM(source), res, NULL, &err);
+	g_bytes_unref (write->bytes);
+	g_object_unref (write->cancel);
+
+	// The ircd might be gone already
+	if (!cancelled)
+	{
+		if (err != NULL)
+			g_warning ("Mock ircd failed to write: %s", err->message);
+
+		write->self->writing = FALSE;
+		flush_pending (write->self);
+	}
+
+	g_free (write);
+}
+
+static void
+flush_pending (MockIrcd *self)
+{
+	if (self->writing || self->conn == NULL || self->pending->len == 0)
+		return;
+
+	WriteData *write = g_new (WriteData, 1);
+	write->self = self;
+	write->cancel = g_object_ref (self->cancel);
+	write->bytes = g_byte_array_free_to_bytes (self->pending);
+	self->pending = g_byte_array_new ();
+	self->writing = TRUE;
+
+	gsize len;
+	gconstpointer buf = g_bytes_get_data (write->bytes, &len);
+	g_output_stream_write_all_async (g_io_stream_get_output_stream (self->conn), buf, len,
+									 G_PRIORITY_DEFAULT, self->cancel, on_write_ready, write);
+}
+
+static void
+queue_line (MockIrcd *self, const char *line)
+{
+	if (self->conn == NULL)
+		return; // Dropped, the client misses it
+	g_byte_array_append (self->pending, (const guint8*)line, (guint)strlen (line));
+	g_byte_array_append (self->pending, (const guint8*)"\r\n", 2);
+	flush_pending (self);
+}
+
+void
+mock_ircd_send (MockIrcd *self, const char *format, ...)
+{
+	va_list args;
+
+	va_start (args, format);
+	g_autofree char *line = g_strdup_vprintf (format, args);
+	va_end (args);
+
+	queue_line (self, line);
+}
+
+static void G_GNUC_PRINTF(3, 4)
+send_numeric (MockIrcd *self, const char *numeric, const char *format, ...)
+{
+	va_list args;
+
+	va_start (args, format);
+	g_autofree char *text = g_strdup_vprintf (format, args);
+	va_end (args);
+
+	mock_ircd_send (self, ":" SERVER_NAME " %s %s %s", numeric, self->nick ? self->nick : "*", text);
+}
+
+static char *
+user_mask (const char *nick)
+{
+	return g_strdup_printf ("%s!~%s@%s.users.mock", nick, nick, nick);
+}
+
+static char *
+client_mask (MockIrcd *self)
+{
+	return g_strdup_printf ("%s!~tester@client.mock", self->nick);
+}
+
+static gboolean
+has_cap (MockIrcd *self, const char *cap)
+{
+	return g_hash_table_contains (self->caps, cap);
+}
+
+static char *
+make_tags (MockIrcd *self, const char *batch, MockUser *user)
+{
+	const guint serial = self->message_serial++;
+	GString *tags = g_string_new (NULL);
+
+	if (batch != NULL)
+		g_string_append_printf (tags, "batch=%s;", batch);
+	if (has_cap (self, "server-time"))
+		g_string_append_printf (tags, "time=2017-06-01T%02u:%02u:%02u.%03uZ;", serial / 3600000 % 24,
+								serial / 60000 % 60, serial / 1000 % 60, serial % 1000);
+	if (has_cap (self, "message-tags"))
+	{
+		g_string_append_printf (tags, "msgid=mock%u;", serial);
+		if (user->account)
+			g_string_append_printf (tags, "account=%s;", user->account);
+	}
+
+	if (tags->len == 0)
+		return g_string_free (tags, FALSE);
+
+	tags->str[tags->len - 1] = ' ';
+	g_string_prepend_c (tags, '@');
+	return g_string_free (tags, FALSE);
+}
+
+static MockUser *
+get_user (MockIrcd *self, const char *nick)
+{
+	MockUser *user = g_hash_table_lookup (self->user_table, nick);
+
+	if (user == NULL)
+	{
+		user = g_new0 (MockUser, 1);
+		user->nick = g_strdup (nick);
+		user->account = g_strconcat ("acct_", nick, NULL);
+		g_ptr_array_add (self->users, user);
+		g_hash_table_insert (self->user_table, user->nick, user);
+	}
+
+	user->online = TRUE;
+	return user;
+}
+
+static MockChannel *
+get_channel (MockIrcd *self, const char *name)
+{
+	MockChannel *channel = g_hash_table_lookup (self->channels, name);
+
+	if (channel == NULL)
+	{
+		channel = g_new0 (MockChannel, 1);
+		channel->name = g_strdup (name);
+		channel->members = g_hash_table_new (NULL, NULL);
+		g_hash_table_insert (self->channels, channel->name, channel);
+	}
+
+	return channel;
+}
+
+static void
+send_join (MockIrcd *self, MockChannel *channel, const char *mask, const char *account)
+{
+	if (has_cap (self, "extended-join"))
+		mock_ircd_send (self, ":%s JOIN %s %s :Mock User", mask, channel->name, account ? account : "*");
+	else
+		mock_ircd_send (self, ":%s JOIN %s", mask, channel->name);
+}
+
+static void
+append_name (MockIrcd *self, MockChannel *channel, GString *names, const char *prefix, const char *nick)
+{
+	if (names->len)
+		g_string_append_c (names, ' ');
+	g_string_append (names, prefix);
+
+	if (has_cap (self, "userhost-in-names"))
+	{
+		g_autofree char *mask = user_mask (nick);
+		g_string_append (names, mask);
+	}
+	else
+		g_string_append (names, nick);
+
+	if (names->len > NAMES_LINE_LEN)
+	{
+		send_numeric (self, "353", "= %s :%s", channel->name, names->str);
+		g_string_truncate (names, 0);
+	}
+}
+
+static void
+send_names (MockIrcd *self, MockChannel *channel)
+{
+	g_autoptr(GString) names = g_string_new (NULL);
+	GHashTableIter iter;
+	gpointer user;
+	guint i = 0;
+
+	g_string_append_printf (names, "@%s", self->nick);
+
+	g_hash_table_iter_init (&iter, channel->members);
+	while (g_hash_table_iter_next (&iter, &user, NULL))
+	{
+		const char *prefix = i % 50 == 0 ? "@" : i % 10 == 1 ? "+" : "";
+		append_name (self, channel, names, prefix, ((MockUser*)user)->nick);
+		++i;
+	}
+
+	if (names->len)
+		send_numeric (self, "353", "= %s :%s", channel->name, names->str);
+	send_numeric (self, "366", "%s :End of /NAMES list.", channel->name);
+}
+
+static void
+client_join (MockIrcd *self, const char *name)
+{
+	MockChannel *channel = get_channel (self, name);
+	g_autofree char *mask = client_mask (self);
+
+	if (channel->banned)
+	{
+		send_numeric (self, "474", "%s :Cannot join channel (+b)", channel->name);
+		return;
+	}
+
+	channel->joined = TRUE;
+	send_join (self, channel, mask, self->account);
+	send_names (self, channel);
+}
+
+static void
+send_welcome (MockIrcd *self)
+{
+	g_autofree char *mask = client_mask (self);
+
+	send_numeric (self, "001", ":Welcome to the Mock IRC Network %s", mask);
+	send_numeric (self, "002", ":Your host is " SERVER_NAME ", running version mock-1.0");
+	send_numeric (self, "003", ":This server was created today");
+	send_numeric (self, "004", SERVER_NAME " mock-1.0 iowx beIiklmnopstv");
+	send_numeric (self, "005", "CHANTYPES=# PREFIX=(ov)@+ CHANMODES=beI,k,l,imnpst CASEMAPPING=rfc1459 "
+				  "NETWORK=Mock CHATHISTORY=1000 TARGMAX=PRIVMSG:4,NOTICE:4,JOIN:10%s%s :are supported by this server",
+				  self->flags & MOCK_IRCD_WHOX ? " WHOX" : "",
+				  self->flags & MOCK_IRCD_MONITOR ? " MONITOR=100" : "");
+	send_numeric (self, "375", ":- " SERVER_NAME " Message of the day -");
+	send_numeric (self, "372", ":- This server only exists for tests");
+	send_numeric (self, "376", ":End of /MOTD command.");
+}
+
+static void
+try_register (MockIrcd *self)
+{
+	if (self->registered || self->in_cap || !self->got_user || self->nick == NULL)
+		return;
+
+	self->registered = TRUE;
+	send_welcome (self);
+}
+
+static void
+handle_cap (MockIrcd *self, GStrv params)
+{
+	const char *sub = params[1];
+
+	if (sub == NULL)
+		return;
+
+	if (!g_ascii_strcasecmp (sub, "LS"))
+	{
+		self->in_cap = TRUE;
+		mock_ircd_send (self, ":" SERVER_NAME " CAP %s LS :multi-prefix server-time message-tags account-notify "
+						"extended-join away-notify chghost cap-notify userhost-in-names batch draft/chathistory%s",
+						self->nick ? self->nick : "*", self->flags & MOCK_IRCD_SASL ? " sasl=PLAIN" : "");
+	}
+	else if (!g_ascii_strcasecmp (sub, "REQ") && params[2] != NULL)
+	{
+		g_auto(GStrv) caps = g_strsplit (params[2], " ", 0);
+
+		for (gsize i = 0; caps[i]; ++i)
+		{
+			if (*caps[i])
+				g_hash_table_add (self->caps, g_strdup (caps[i]));
+		}
+		mock_ircd_send (self, ":" SERVER_NAME " CAP %s ACK :%s", self->nick ? self->nick : "*", params[2]);
+	}
+	else if (!g_ascii_strcasecmp (sub, "END"))
+	{
+		self->in_cap = FALSE;
+		try_register (self);
+	}
+}
+
+static void
+handle_authenticate (MockIrcd *self, const char *param)
+{
+	if (param == NULL)
+		return;
+
+	if (!g_ascii_strcasecmp (param, "PLAIN"))
+	{
+		mock_ircd_send (self, "AUTHENTICATE +");
+		return;
+	}
+	else if (!strcmp (param, "*"))
+	{
+		send_numeric (self, "906", ":SASL authentication aborted");
+		return;
+	}
+
+	// authzid \0 authcid \0 password
+	gsize len;
+	g_autofree char *decoded = (char*)g_base64_decode (param, &len);
+	const char *authcid = memchr (decoded, '\0', len);
+	const char *password = authcid ? memchr (authcid + 1, '\0', len - (gsize)(authcid + 1 - decoded)) : NULL;
+
+	if (password != NULL && self->sasl_username != NULL &&
+		g_strcmp0 (authcid + 1, self->sasl_username) == 0 &&
+		(gsize)(password + 1 - decoded) + strlen (self->sasl_password) == len &&
+		memcmp (password + 1, self->sasl_password, strlen (self->sasl_password)) == 0)
+	{
+		g_autofree char *mask = client_mask (self);
+
+		g_free (self->account);
+		self->account = g_strdup (self->sasl_username);
+		send_numeric (self, "900", "%s %s :You are now logged in as %s", mask, self->account, self->account);
+		send_numeric (self, "903", ":SASL authentication successful");
+	}
+	else
+		send_numeric (self, "904", ":SASL authentication failed");
+}
+
+static void
+handle_nick (MockIrcd *self, const char *nick)
+{
+	if (nick == NULL)
+		return;
+
+	if (g_hash_table_contains (self->user_table, nick))
+	{
+		send_numeric (self, "433", "%s :Nickname is already in use", nick);
+		return;
+	}
+
+	if (self->registered)
+	{
+		g_autofree char *mask = client_mask (self);
+		mock_ircd_send (self, ":%s NICK :%s", mask, nick);
+	}
+
+	g_free (self->nick);
+	self->nick = g_strdup (nick);
+	try_register (self);
+}
+
+static void
+handle_part (MockIrcd *self, const char *targets)
+{
+	g_auto(GStrv) names = g_strsplit (targets, ",", 0);
+	g_autofree char *mask = client_mask (self);
+
+	for (gsize i = 0; names[i]; ++i)
+	{
+		MockChannel *channel = g_hash_table_lookup (self->channels, names[i]);
+
+		if (channel == NULL || !channel->joined)
+		{
+			send_numeric (self, "442", "%s :You're not on that channel", names[i]);
+			continue;
+		}
+
+		channel->joined = FALSE;
+		mock_ircd_send (self, ":%s PART %s", mask, channel->name);
+	}
+}
+
+static void
+handle_who (MockIrcd *self, const char *target, const char *fields)
+{
+	MockChannel *channel = g_hash_table_lookup (self->channels, target);
+	const char *token = fields ? strchr (fields, ',') : NULL;
+
+	if (self->n_who_refused)
+	{
+		--self->n_who_refused;
+		send_numeric (self, "416", "WHO :Too many lines in the output");
+		return;
+	}
+
+	if (channel != NULL && fields != NULL && *fields == '%' && self->flags & MOCK_IRCD_WHOX)
+	{
+		GHashTableIter iter;
+		gpointer data;
+
+		// Always the fields IrcServer asks for: channel user host server nick flags account realname
+		g_hash_table_iter_init (&iter, channel->members);
+		while (g_hash_table_iter_next (&iter, &data, NULL))
+		{
+			MockUser *user = data;
+			send_numeric (self, "354", "%s %s ~%s %s.users.mock " SERVER_NAME " %s H %s :Mock User",
+						  token ? token + 1 : "0", channel->name, user->nick, user->nick, user->nick,
+						  user->account ? user->account : "0");
+		}
+	}
+
+	send_numeric (self, "315", "%s :End of /WHO list.", target);
+}
+
+static void
+handle_monitor (MockIrcd *self, const char *sub, const char *targets)
+{
+	if (sub == NULL || !(self->flags & MOCK_IRCD_MONITOR))
+		return;
+
+	if (!strcmp (sub, "C"))
+	{
+		g_hash_table_remove_all (self->monitor);
+		return;
+	}
+	else if (targets == NULL || (strcmp (sub, "+") && strcmp (sub, "-")))
+		return;
+
+	g_auto(GStrv) nicks = g_strsplit (targets, ",", 0);
+	g_autoptr(GString) online = g_string_new (NULL);
+	g_autoptr(GString) offline = g_string_new (NULL);
+
+	for (gsize i = 0; nicks[i]; ++i)
+	{
+		if (*sub == '-')
+		{
+			g_hash_table_remove (self->monitor, nicks[i]);
+			continue;
+		}
+
+		MockUser *user = g_hash_table_lookup (self->user_table, nicks[i]);
+		g_hash_table_add (self->monitor, g_strdup (nicks[i]));
+
+		if (user != NULL && user->online)
+		{
+			g_autofree char *mask = user_mask (user->nick);
+			g_string_append_printf (online, "%s%s", online->len ? "," : "", mask);
+		}
+		else
+			g_string_append_printf (offline, "%s%s", offline->len ? "," : "", nicks[i]);
+	}
+
+	if (online->len)
+		send_numeric (self, "730", ":%s", online->str);
+	if (offline->len)
+		send_numeric (self, "731", ":%s", offline->str);
+}
+
+static void
+handle_chathistory (MockIrcd *self, GStrv params)
+{
+	// Only CHATHISTORY LATEST <target> * <limit>
+	if (g_strv_length (params) < 5 || g_ascii_strcasecmp (params[1], "LATEST"))
+	{
+		mock_ircd_send (self, ":" SERVER_NAME " FAIL CHATHISTORY INVALID_PARAMS :Unsupported");
+		return;
+	}
+
+	mock_ircd_send_history (self, params[2], (guint)g_ascii_strtoull (params[4], NULL, 10));
+}
+
+static void
+handle_pong (MockIrcd *self, const char *token)
+{
+	if (token == NULL || !g_str_has_prefix (token, "mock-sync-"))
+		return;
+
+	const guint serial = (guint)g_ascii_strtoull (token + strlen ("mock-sync-"), NULL, 10);
+	self->synced_serial = MAX(self->synced_serial, serial);
+}
+
+static GStrv
+parse_line (char *line)
+{
+	GPtrArray *params = g_ptr_array_new ();
+	char *trailing = strstr (line, " :");
+
+	if (trailing != NULL)
+		*trailing = '\0';
+
+	g_auto(GStrv) words = g_strsplit (line, " ", 0);
+	for (gsize i = 0; words[i]; ++i)
+	{
+		if (*words[i])
+			g_ptr_array_add (params, g_strdup (words[i]));
+	}
+	if (trailing != NULL)
+		g_ptr_array_add (params, g_strdup (trailing + 2));
+	g_ptr_array_add (params, NULL);
+
+	return (GStrv)g_ptr_array_free (params, FALSE);
+}
+
+static void
+handle_line (MockIrcd *self, char *line)
+{
+	g_auto(GStrv) params = parse_line (line);
+	const char *command = params[0];
+
+	if (command == NULL)
+		return;
+
+	g_autofree char *key = g_ascii_strup (command, -1);
+	const guint count = GPOINTER_TO_UINT(g_hash_table_lookup (self->received, key));
+	g_hash_table_insert (self->received, g_strdup (key), GUINT_TO_POINTER(count + 1));
+
+	const char *param = params[1];
+	if (!strcmp (key, "CAP"))
+		handle_cap (self, params);
+	else if (!strcmp (key, "AUTHENTICATE"))
+		handle_authenticate (self, param);
+	else if (!strcmp (key, "NICK"))
+		handle_nick (self, param);
+	else if (!strcmp (key, "USER"))
+	{
+		self->got_user = TRUE;
+		try_register (self);
+	}
+	else if (!strcmp (key, "PING"))
+		mock_ircd_send (self, ":" SERVER_NAME " PONG " SERVER_NAME " :%s", param ? param : "");
+	else if (!strcmp (key, "PONG"))
+		handle_pong (self, params[g_strv_length (params) - 1]);
+	else if (!self->registered)
+		send_numeric (self, "451", ":You have not registered");
+	else if (!strcmp (key, "JOIN") && param != NULL)
+	{
+		g_auto(GStrv) names = g_strsplit (param, ",", 0);
+		for (gsize i = 0; names[i]; ++i)
+			client_join (self, names[i]);
+	}
+	else if (!strcmp (key, "PART") && param != NULL)
+		handle_part (self, param);
+	else if (!strcmp (key, "WHO") && param != NULL)
+		handle_who (self, param, params[2]);
+	else if (!strcmp (key, "MONITOR"))
+		handle_monitor (self, param, param ? params[2] : NULL);
+	else if (!strcmp (key, "CHATHISTORY"))
+		handle_chathistory (self, params);
+}
+
+static void
+on_line_ready (GObject *source, GAsyncResult *res, gpointer data)
+{
+	g_autoptr(GError) err = NULL;
+	g_autofree char *line = g_data_input_stream_read_line_finish (G_DATA_INPUT_STREAM(source), res, NULL, &err);
+
+	if (g_error_matches (err, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+		return; // The ircd is gone
+
+	MockIrcd *self = data;
+	if (line == NULL)
+	{
+		if (err != NULL)
+			g_debug ("Mock ircd failed to read: %s", err->message);
+		return;
+	}
+
+	handle_line (self, line);
+	g_data_input_stream_read_line_async (self->in, G_PRIORITY_DEFAULT, self->cancel, on_line_ready, self);
+}
+
+static gboolean
+on_incoming (GSocketService *service, GSocketConnection *connection, GObject *source, gpointer data)
+{
+	MockIrcd *self = data;
+
+	if (self->conn != NULL)
+		return FALSE;
+
+	self->conn = g_object_ref (G_IO_STREAM(connection));
+	self->in = g_data_input_stream_new (g_io_stream_get_input_stream (self->conn));
+	g_data_input_stream_set_newline_type (self->in, G_DATA_STREAM_NEWLINE_TYPE_CR_LF);
+	g_data_input_stream_read_line_async (self->in, G_PRIORITY_DEFAULT, self->cancel, on_line_ready, self);
+
+	flush_pending (self);
+	return TRUE;
+}
+
+/**
+ * mock_ircd_new:
+ * @flags: Optional features to advertise
+ *
+ * Starts listening on a random local port right away.
+ */
+MockIrcd *
+mock_ircd_new (MockIrcdFlags flags)
+{
+	g_autoptr(GError) err = NULL;
+	MockIrcd *self = g_new0 (MockIrcd, 1);
+
+	self->flags = flags;
+	self->cancel = g_cancellable_new ();
+	self->pending = g_byte_array_new ();
+	self->caps = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+	self->monitor = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+	self->users = g_ptr_array_new_with_free_func (mock_user_free);
+	self->user_table = g_hash_table_new (g_str_hash, g_str_equal);
+	self->channels = g_hash_table_new_full (g_str_hash, g_str_equal, NULL, mock_channel_free);
+	self->received = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+
+	self->service = g_socket_service_new ();
+	self->port = g_socket_listener_add_any_inet_port (G_SOCKET_LISTENER(self->service), NULL, &err);
+	g_assert_no_error (err);
+	g_signal_connect (self->service, "incoming", G_CALLBACK(on_incoming), self);
+
+	return self;
+}
+
+void
+mock_ircd_free (MockIrcd *self)
+{
+	g_cancellable_cancel (self->cancel);
+	g_socket_service_stop (self->service);
+	g_signal_handlers_disconnect_by_data (self->service, self);
+
+	if (self->conn != NULL)
+		g_io_stream_close (self->conn, NULL, NULL);
+
+	g_clear_object (&self->in);
+	g_clear_object (&self->conn);
+	g_clear_object (&self->service);
+	g_clear_object (&self->cancel);
+	g_byte_array_unref (self->pending);
+	g_hash_table_unref (self->caps);
+	g_hash_table_unref (self->monitor);
+	g_hash_table_unref (self->channels);
+	g_hash_table_unref (self->user_table);
+	g_hash_table_unref (self->received);
+	g_ptr_array_unref (self->users);
+	g_free (self->nick);
+	g_free (self->sasl_username);
+	g_free (self->sasl_password);
+	g_free (self->account);
+	g_free (self);
+}
+
+guint16
+mock_ircd_get_port (MockIrcd *self)
+{
+	return self->port;
+}
+
+void
+mock_ircd_set_sasl_account (MockIrcd *self, const char *username, const char *password)
+{
+	g_free (self->sasl_username);
+	g_free (self->sasl_password);
+	self->sasl_username = g_strdup (username);
+	self->sasl_password = g_strdup (password);
+}
+
+/**
+ * mock_ircd_get_account:
+ *
+ * Returns: Account the client logged into with SASL or %NULL
+ */
+const char *
+mock_ircd_get_account (MockIrcd *self)
+{
+	return self->account;
+}
+
+const char *
+mock_ircd_get_nick (MockIrcd *self)
+{
+	return self->nick;
+}
+
+/**
+ * mock_ircd_get_n_received:
+ * @command: Uppercase command name
+ *
+ * Returns: How many times the client sent @command
+ */
+guint
+mock_ircd_get_n_received (MockIrcd *self, const char *command)
+{
+	return GPOINTER_TO_UINT(g_hash_table_lookup (self->received, command));
+}
+
+/**
+ * mock_ircd_refuse_who:
+ * @n_who: How many WHOs
+ *
+ * The next @n_who WHOs get ERR_TOOMANYMATCHES and no reply at all.
+ */
+void
+mock_ircd_refuse_who (MockIrcd *self, guint n_who)
+{
+	self->n_who_refused = n_who;
+}
+
+/**
+ * mock_ircd_drop:
+ *
+ * Closes the connection like a network failure would, without an ERROR or
+ * QUIT. Channels are remembered and the next connection is served fresh,
+ * anything sent until then is lost.
+ */
+void
+mock_ircd_drop (MockIrcd *self)
+{
+	GHashTableIter iter;
+	gpointer channel;
+
+	// Reads and writes in flight see the old cancellable and give up
+	g_cancellable_cancel (self->cancel);
+	g_clear_object (&self->cancel);
+	self->cancel = g_cancellable_new ();
+	self->writing = FALSE;
+	g_byte_array_set_size (self->pending, 0);
+
+	if (self->conn != NULL)
+	{
+		g_socket_shutdown (g_socket_connection_get_socket (G_SOCKET_CONNECTION(self->conn)), TRUE, TRUE, NULL);
+		g_io_stream_close (self->conn, NULL, NULL);
+	}
+	g_clear_object (&self->in);
+	g_clear_object (&self->conn);
+
+	g_clear_pointer (&self->nick, g_free);
+	g_clear_pointer (&self->account, g_free);
+	g_hash_table_remove_all (self->caps);
+	g_hash_table_remove_all (self->monitor);
+	self->got_user = self->in_cap = self->registered = FALSE;
+	self->synced_serial = self->sync_serial;
+
+	g_hash_table_iter_init (&iter, self->channels);
+	while (g_hash_table_iter_next (&iter, NULL, &channel))
+		((MockChannel*)channel)->joined = FALSE;
+}
+
+static gboolean
+wake_up (gpointer data)
+{
+	return G_SOURCE_CONTINUE;
+}
+
+static void
+iterate_until (MockIrcd *self, gboolean (*done) (MockIrcd *self))
+{
+	const gint64 deadline = g_get_monotonic_time () + TIMEOUT_SECONDS * G_USEC_PER_SEC;
+	const guint wake_id = g_timeout_add (100, wake_up, NULL);
+
+	while (!done (self))
+	{
+		g_assert_cmpint (g_get_monotonic_time (), <, deadline);
+		g_main_context_iteration (NULL, TRUE);
+	}
+
+	g_source_remove (wake_id);
+}
+
+static gboolean
+is_registered (MockIrcd *self)
+{
+	return self->registered;
+}
+
+/**
+ * mock_ircd_wait_registered:
+ *
+ * Runs the main context until the client finished registering and handled
+ * the welcome burst.
+ */
+void
+mock_ircd_wait_registered (MockIrcd *self)
+{
+	iterate_until (self, is_registered);
+	mock_ircd_sync (self);
+}
+
+static gboolean
+is_synced (MockIrcd *self)
+{
+	return self->synced_serial == self->sync_serial;
+}
+
+/**
+ * mock_ircd_sync:
+ *
+ * Runs the main context until the client handled everything sent before.
+ */
+void
+mock_ircd_sync (MockIrcd *self)
+{
+	mock_ircd_send (self, "PING :mock-sync-%u", ++self->sync_serial);
+	iterate_until (self, is_synced);
+}
+
+/**
+ * mock_ircd_populate:
+ * @n_channels: Channels to create
+ * @n_users: Users in each of them
+ *
+ * Creates `#chan0`... each with the same users `user0`... and joins the client
+ * to all of them.
+ */
+void
+mock_ircd_populate (MockIrcd *self, guint n_channels, guint n_users)
+{
+	for (guint i = 0; i < n_channels; ++i)
+	{
+		g_autofree char *name = g_strdup_printf ("#chan%u", i);
+		MockChannel *channel = get_channel (self, name);
+
+		for (guint j = 0; j < n_users; ++j)
+		{
+			g_autofree char *nick = g_strdup_printf ("user%u", j);
+			g_hash_table_add (channel->members, get_user (self, nick));
+		}
+
+		client_join (self, name);
+	}
+}
+
+/**
+ * mock_ircd_join_part_storm:
+ * @channel: Channel the client is in
+ * @n_users: How many users join and then part
+ */
+void
+mock_ircd_join_part_storm (MockIrcd *self, const char *name, guint n_users)
+{
+	MockChannel *channel = get_channel (self, name);
+	g_autoptr(GPtrArray) joined = g_ptr_array_new ();
+
+	for (guint i = 0; i < n_users; ++i)
+	{
+		g_autofree char *nick = g_strdup_printf ("storm%u", i);
+		g_autofree char *mask = user_mask (nick);
+		MockUser *user = get_user (self, nick);
+
+		g_hash_table_add (channel->members, user);
+		g_ptr_array_add (joined, user);
+		send_join (self, channel, mask, user->account);
+	}
+
+	for (guint i = 0; i < joined->len; ++i)
+	{
+		MockUser *user = g_ptr_array_index (joined, i);
+		g_autofree char *mask = user_mask (user->nick);
+
+		g_hash_table_remove (channel->members, user);
+		mock_ircd_send (self, ":%s PART %s :Storm", mask, channel->name);
+	}
+}
+
+/**
+ * mock_ircd_ban:
+ * @channel: Channel to ban the client from
+ *
+ * Later JOINs to @channel get ERR_BANNEDFROMCHAN, the client is not kicked.
+ */
+void
+mock_ircd_ban (MockIrcd *self, const char *name)
+{
+	get_channel (self, name)->banned = TRUE;
+}
+
+/**
+ * mock_ircd_netsplit:
+ * @n_users: How many users quit
+ *
+ * The oldest users still online quit from every channel at once.
+ */
+void
+mock_ircd_netsplit (MockIrcd *self, guint n_users)
+{
+	for (guint i = 0; i < self->users->len && n_users; ++i)
+	{
+		MockUser *user = g_ptr_array_index (self->users, i);
+		GHashTableIter iter;
+		gpointer channel;
+
+		if (!user->online)
+			continue;
+
+		g_autofree char *mask = user_mask (user->nick);
+		mock_ircd_send (self, ":%s QUIT :*.net *.split", mask);
+		user->online = FALSE;
+		--n_users;
+
+		g_hash_table_iter_init (&iter, self->channels);
+		while (g_hash_table_iter_next (&iter, NULL, &channel))
+			g_hash_table_remove (((MockChannel*)channel)->members, user);
+	}
+}
+
+static void
+send_privmsgs (MockIrcd *self, MockChannel *channel, const char *batch, guint n_messages)
+{
+	g_autoptr(GPtrArray) members = g_hash_table_get_keys_as_ptr_array (channel->members);
+
+	if (members->len == 0)
+		return;
+
+	for (guint i = 0; i < n_messages; ++i)
+	{
+		MockUser *user = g_ptr_array_index (members, i % members->len);
+		g_autofree char *tags = make_tags (self, batch, user);
+		g_autofree char *mask = user_mask (user->nick);
+
+		mock_ircd_send (self, "%s:%s PRIVMSG %s :Message %u with \002some\002 \00304formatting\003 in it",
+						tags, mask, channel->name, i);
+	}
+}
+
+/**
+ * mock_ircd_flood:
+ * @channel: Channel with users in it
+ * @n_messages: Messages to send
+ *
+ * Members take turns sending messages, tagged with whatever the client
+ * negotiated.
+ */
+void
+mock_ircd_flood (MockIrcd *self, const char *name, guint n_messages)
+{
+	send_privmsgs (self, get_channel (self, name), NULL, n_messages);
+}
+
+/**
+ * mock_ircd_send_history:
+ * @channel: Channel with users in it
+ * @n_messages: Messages to send
+ *
+ * Sends history like a reply to CHATHISTORY, in a batch if negotiated.
+ */
+void
+mock_ircd_send_history (MockIrcd *self, const char *name, guint n_messages)
+{
+	MockChannel *channel = get_channel (self, name);
+
+	if (!has_cap (self, "batch"))
+	{
+		send_privmsgs (self, channel, NULL, n_messages);
+		return;
+	}
+
+	g_autofree char *batch = g_strdup_printf ("history%u", self->batch_serial++);
+	mock_ircd_send (self, ":" SERVER_NAME " BATCH +%s chathistory %s", batch, channel->name);
+	send_privmsgs (self, channel, batch, n_messages);
+	mock_ircd_send (self, ":" SERVER_NAME " BATCH -%s", batch);
+}
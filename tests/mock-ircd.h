@@ -0,0 +1,60 @@
+/*
+ * Copyright 2017 Patrick Griffis
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ */
+
+#pragma once
+
+#include <gio/gio.h>
+
+G_BEGIN_DECLS
+
+typedef enum
+{
+	MOCK_IRCD_NONE = 0,
+	MOCK_IRCD_SASL = 1 << 0,
+	MOCK_IRCD_WHOX = 1 << 1,
+	MOCK_IRCD_MONITOR = 1 << 2,
+} MockIrcdFlags;
+
+typedef struct _MockIrcd MockIrcd;
+
+MockIrcd *mock_ircd_new (MockIrcdFlags flags);
+void mock_ircd_free (MockIrcd *self);
+guint16 mock_ircd_get_port (MockIrcd *self);
+void mock_ircd_set_sasl_account (MockIrcd *self, const char *username, const char *password);
+const char *mock_ircd_get_account (MockIrcd *self);
+const char *mock_ircd_get_nick (MockIrcd *self);
+guint mock_ircd_get_n_received (MockIrcd *self, const char *command);
+void mock_ircd_refuse_who (MockIrcd *self, guint n_who);
+
+void mock_ircd_drop (MockIrcd *self);
+void mock_ircd_wait_registered (MockIrcd *self);
+void mock_ircd_sync (MockIrcd *self);
+void mock_ircd_send (MockIrcd *self, const char *format, ...) G_GNUC_PRINTF(2, 3);
+
+void mock_ircd_populate (MockIrcd *self, guint n_channels, guint n_users);
+void mock_ircd_join_part_storm (MockIrcd *self, const char *channel, guint n_users);
+void mock_ircd_netsplit (MockIrcd *self, guint n_users);
+void mock_ircd_ban (MockIrcd *self, const char *channel);
+void mock_ircd_flood (MockIrcd *self, const char *channel, guint n_messages);
+void mock_ircd_send_history (MockIrcd *self, const char *channel, guint n_messages);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC(MockIrcd, mock_ircd_free)
+
+G_END_DECLS
@@ -0,0 +1,98 @@
+/*
+ * Copyright 2017 Patrick Griffis
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ */
+
+#include <string.h>
+#include <glib.h>
+#include "irc-converter.h"
+
+static void
+test_decode (void)
+{
+	g_autoptr(GError) err = NULL;
+	g_autoptr(IrcConverter) decoder = irc_converter_new ("UTF-8", "CP1252", "\xef\xbf\xbd", &err);
+	g_assert_no_error (err);
+	gsize len;
+
+	g_assert_cmpstr (irc_converter_convert (decoder, "caf\xe9 \x80", 6, &len), ==, "caf\xc3\xa9 \xe2\x82\xac");
+	g_assert_cmpuint (len, ==, 9);
+
+	// Undefined bytes are replaced inline, the rest of the line still converts
+	g_assert_cmpstr (irc_converter_convert (decoder, "a\x81\xe9\x81z", 5, NULL), ==,
+					 "a\xef\xbf\xbd\xc3\xa9\xef\xbf\xbdz");
+
+	// Longer than the initial buffer
+	g_autofree char *line = g_strnfill (2000, '\xe9');
+	const char *converted = irc_converter_convert (decoder, line, 2000, &len);
+	g_assert_cmpuint (len, ==, 4000);
+	g_assert_true (g_str_has_prefix (converted, "\xc3\xa9\xc3\xa9"));
+	g_assert_cmpuint (strlen (converted), ==, 4000);
+
+	g_assert_cmpstr (irc_converter_convert (decoder, "", 0, &len), ==, "");
+	g_assert_cmpuint (len, ==, 0);
+}
+
+static void
+test_encode (void)
+{
+	g_autoptr(GError) err = NULL;
+	g_autoptr(IrcConverter) encoder = irc_converter_new ("ISO-8859-1", "UTF-8", "?", &err);
+	g_assert_no_error (err);
+
+	// Characters missing from the target are replaced once, invalid bytes each
+	g_assert_cmpstr (irc_converter_convert (encoder, "caf\xc3\xa9 \xe2\x82\xac \xff\xfe.", 13, NULL), ==,
+					 "caf\xe9 ? ??.");
+
+	g_autoptr(IrcConverter) latin1 = irc_converter_new ("ISO-8859-1", "UTF-8", "\xe2\x82\xac", &err);
+	g_assert_no_error (err);
+	g_assert_cmpstr (irc_converter_convert (latin1, "\xe2\x82\xac", 3, NULL), ==, "?");
+
+	g_assert_null (irc_converter_new ("UTF-8", "NOT-A-CHARSET", "?", &err));
+	g_assert_error (err, G_CONVERT_ERROR, G_CONVERT_ERROR_NO_CONVERSION);
+}
+
+static void
+test_shift_state (void)
+{
+	g_autoptr(IrcConverter) encoder = irc_converter_new ("ISO-2022-JP", "UTF-8", "?", NULL);
+
+	if (encoder == NULL)
+	{
+		g_test_skip ("ISO-2022-JP is not supported");
+		return;
+	}
+
+	// Each line returns to ASCII at the end and around the fallback
+	const char *text = "\xe6\x97\xa5\xff\xe6\x97\xa5";
+	g_assert_cmpstr (irc_converter_convert (encoder, text, strlen (text), NULL), ==,
+					 "\033$BF|\033(B?\033$BF|\033(B");
+	g_assert_cmpstr (irc_converter_convert (encoder, "a", 1, NULL), ==, "a");
+}
+
+int
+main (int argc, char **argv)
+{
+	g_test_init (&argc, &argv, NULL);
+
+	g_test_add_func ("/irc/converter/decode", test_decode);
+	g_test_add_func ("/irc/converter/encode", test_encode);
+	g_test_add_func ("/irc/converter/shift-state", test_shift_state);
+
+	return g_test_run ();
+}
@@ -0,0 +1,194 @@
+/*
+ * Copyright 2017 Patrick Griffis
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ */
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include "irc-logger.h"
+#include "irc-server.h"
+#include "irc-channel.h"
+
+static time_t
+make_time (int day, int hour, int minute)
+{
+	struct tm tm = { .tm_year = 117, .tm_mon = 4, .tm_mday = day, .tm_hour = hour, .tm_min = minute, .tm_isdst = -1 };
+
+	return mktime (&tm);
+}
+
+static char *
+get_contents (const char *path)
+{
+	char *contents = NULL;
+
+	g_assert_true (g_file_get_contents (path, &contents, NULL, NULL));
+	return contents;
+}
+
+static void
+remove_dir (const char *path)
+{
+	g_autoptr(GDir) dir = g_dir_open (path, 0, NULL);
+	const char *name;
+
+	while (dir && (name = g_dir_read_name (dir)) != NULL)
+	{
+		g_autofree char *child = g_build_filename (path, name, NULL);
+
+		if (g_file_test (child, G_FILE_TEST_IS_DIR))
+			remove_dir (child);
+		else
+			g_unlink (child);
+	}
+
+	g_rmdir (path);
+}
+
+static void
+test_logger (void)
+{
+	g_autoptr(GError) err = NULL;
+	g_autofree char *dir = g_dir_make_tmp ("irc-logger-XXXXXX", &err);
+	g_assert_no_error (err);
+
+	IrcContextManager *mgr = irc_context_manager_get_default ();
+	IrcServer *server = g_object_new (IRC_TYPE_SERVER, "host", "127.0.0.1", "tls", FALSE, "name", "net", NULL);
+	irc_context_manager_add (mgr, IRC_CONTEXT(server));
+
+	// Contexts that exist before the logger are logged too
+	IrcLogger *logger = irc_logger_new (mgr, dir);
+	IrcChannel *channel = irc_channel_new (IRC_CONTEXT(server), "#chan/x");
+	irc_context_manager_add (mgr, IRC_CONTEXT(channel));
+
+	irc_context_print_with_time (IRC_CONTEXT(server), "\002Welcome", make_time (1, 9, 0));
+	irc_context_print_with_time (IRC_CONTEXT(channel), "\00304hello\017 world", make_time (1, 23, 59));
+	irc_context_print_with_time (IRC_CONTEXT(channel), "one\ntwo", make_time (2, 0, 1));
+	irc_context_print_transient (IRC_CONTEXT(server), "PASS <hidden>", make_time (1, 9, 1));
+	irc_logger_flush (logger);
+
+	g_autofree char *server_path = irc_logger_get_path (logger, IRC_CONTEXT(server), make_time (1, 0, 0));
+	g_autofree char *day1_path = irc_logger_get_path (logger, IRC_CONTEXT(channel), make_time (1, 0, 0));
+	g_autofree char *day2_path = irc_logger_get_path (logger, IRC_CONTEXT(channel), make_time (2, 0, 0));
+	g_assert_true (g_str_has_suffix (server_path, "/net/(server)/2017-05-01.log"));
+	g_assert_true (g_str_has_suffix (day1_path, "/net/#chan_x/2017-05-01.log"));
+	g_assert_true (g_str_has_suffix (day2_path, "/net/#chan_x/2017-05-02.log"));
+
+	g_autofree char *server_log = get_contents (server_path);
+	g_autofree char *day1_log = get_contents (day1_path);
+	g_autofree char *day2_log = get_contents (day2_path);
+	g_assert_cmpstr (server_log, ==, "[09:00:00] Welcome\n");
+	g_assert_cmpstr (day1_log, ==, "[23:59:00] hello world\n");
+	g_assert_cmpstr (day2_log, ==, "[00:01:00] one\n[00:01:00] two\n");
+
+	// Files are appended to and pending lines are written on finalize
+	irc_context_print_with_time (IRC_CONTEXT(server), "Bye", make_time (1, 9, 5));
+	g_object_unref (logger);
+
+	g_autofree char *server_log2 = get_contents (server_path);
+	g_assert_cmpstr (server_log2, ==, "[09:00:00] Welcome\n[09:05:00] Bye\n");
+
+	irc_context_manager_remove (mgr, IRC_CONTEXT(server));
+	g_object_unref (channel);
+	g_object_unref (server);
+
+	remove_dir (dir);
+}
+
+static void
+collect_line (const char *text, time_t stamp, gpointer data)
+{
+	GPtrArray *lines = data;
+
+	g_ptr_array_add (lines, g_strdup_printf ("%" G_GINT64_FORMAT " %s", (gint64)stamp, text));
+}
+
+static char *
+expected_line (int day, guint i)
+{
+	return g_strdup_printf ("%" G_GINT64_FORMAT " msg %u", (gint64)make_time (day, 10, 0) + i, i);
+}
+
+static void
+test_backlog (void)
+{
+	g_autoptr(GError) err = NULL;
+	g_autofree char *dir = g_dir_make_tmp ("irc-logger-XXXXXX", &err);
+	g_assert_no_error (err);
+
+	IrcContextManager *mgr = irc_context_manager_get_default ();
+	IrcServer *server = g_object_new (IRC_TYPE_SERVER, "host", "127.0.0.1", "tls", FALSE, "name", "net2", NULL);
+	irc_context_manager_add (mgr, IRC_CONTEXT(server));
+	IrcChannel *channel = irc_channel_new (IRC_CONTEXT(server), "#chan");
+	irc_context_manager_add (mgr, IRC_CONTEXT(channel));
+	IrcLogger *logger = irc_logger_new (mgr, dir);
+
+	for (guint i = 0; i < 300; ++i)
+	{
+		g_autofree char *line = g_strdup_printf ("msg %u", i);
+		irc_context_print_with_time (IRC_CONTEXT(channel), line, make_time (1, 10, 0) + i);
+		if (i < 50)
+			irc_context_print_with_time (IRC_CONTEXT(channel), line, make_time (2, 10, 0) + i);
+	}
+	irc_logger_flush (logger);
+
+	// The end of the first day followed by the second
+	g_autoptr(GPtrArray) lines = g_ptr_array_new_with_free_func (g_free);
+	irc_logger_read_backlog (logger, IRC_CONTEXT(channel), 100, collect_line, lines);
+	g_assert_cmpuint (lines->len, ==, 100);
+	g_autofree char *first = expected_line (1, 250);
+	g_autofree char *last = expected_line (2, 49);
+	g_assert_cmpstr (g_ptr_array_index (lines, 0), ==, first);
+	g_assert_cmpstr (g_ptr_array_index (lines, 99), ==, last);
+
+	// Paging back through a single day
+	g_autofree char *path = irc_logger_get_path (logger, IRC_CONTEXT(channel), make_time (1, 0, 0));
+	g_autoptr(IrcLogFile) file = irc_log_file_new (path, &err);
+	g_assert_no_error (err);
+
+	g_ptr_array_set_size (lines, 0);
+	gsize offset = irc_log_file_read_before (file, irc_log_file_get_size (file), 64, collect_line, lines);
+	offset = irc_log_file_read_before (file, offset, 64, collect_line, lines);
+	g_assert_cmpuint (lines->len, ==, 128);
+	g_autofree char *page_first = expected_line (1, 172);
+	g_assert_cmpstr (g_ptr_array_index (lines, 64), ==, page_first);
+
+	// Every 64th message is indexed
+	g_ptr_array_set_size (lines, 0);
+	offset = irc_log_file_lookup_time (file, make_time (1, 10, 0) + 150);
+	irc_log_file_read_before (file, offset, 1, collect_line, lines);
+	g_autofree char *before_index = expected_line (1, 127);
+	g_assert_cmpstr (g_ptr_array_index (lines, 0), ==, before_index);
+
+	g_object_unref (logger);
+	irc_context_manager_remove (mgr, IRC_CONTEXT(server));
+	g_object_unref (channel);
+	g_object_unref (server);
+	remove_dir (dir);
+}
+
+int
+main (int argc, char **argv)
+{
+	g_test_init (&argc, &argv, NULL);
+
+	g_test_add_func ("/irc/logger/logger", test_logger);
+	g_test_add_func ("/irc/logger/backlog", test_backlog);
+
+	return g_test_run ();
+}
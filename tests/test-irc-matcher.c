@@ -0,0 +1,81 @@
+/*
+ * Copyright 2017 Patrick Griffis
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ */
+
+#include <glib.h>
+#include "irc-matcher.h"
+
+static void
+test_boundaries (void)
+{
+	const char *words[] = { "Ann", NULL };
+	g_autoptr(IrcMatcher) matcher = irc_matcher_new (words);
+
+	g_assert_true (irc_matcher_match (matcher, "Ann"));
+	g_assert_true (irc_matcher_match (matcher, "Ann: hi"));
+	g_assert_true (irc_matcher_match (matcher, "hi ann"));
+	g_assert_true (irc_matcher_match (matcher, "<ANN> hi"));
+	g_assert_true (irc_matcher_match (matcher, "announce, ann!"));
+	g_assert_false (irc_matcher_match (matcher, "announce"));
+	g_assert_false (irc_matcher_match (matcher, "Joann"));
+	g_assert_false (irc_matcher_match (matcher, "Ann_ is away"));
+	g_assert_false (irc_matcher_match (matcher, "Anné"));
+	g_assert_false (irc_matcher_match (matcher, ""));
+}
+
+static void
+test_words (void)
+{
+	const char *words[] = { "nick[a]", "", "she", "he", "hers", "c++", "nick[a]", NULL };
+	g_autoptr(IrcMatcher) matcher = irc_matcher_new (words);
+
+	// Folded according to the RFC
+	g_assert_true (irc_matcher_match (matcher, "NICK{A}: ping"));
+	g_assert_true (irc_matcher_match (matcher, "ask him or her or he"));
+	g_assert_true (irc_matcher_match (matcher, "is it hers?"));
+	g_assert_false (irc_matcher_match (matcher, "ushers"));
+	g_assert_false (irc_matcher_match (matcher, "shell"));
+
+	// Edges that are not nick characters need no boundary
+	g_assert_true (irc_matcher_match (matcher, "learning c++11"));
+	g_assert_false (irc_matcher_match (matcher, "abc++"));
+}
+
+static void
+test_empty (void)
+{
+	const char *words[] = { "", NULL };
+	g_autoptr(IrcMatcher) empty = irc_matcher_new (words);
+	g_autoptr(IrcMatcher) none = irc_matcher_new (NULL);
+
+	g_assert_false (irc_matcher_match (empty, "anything"));
+	g_assert_false (irc_matcher_match (none, "anything"));
+}
+
+int
+main (int argc, char **argv)
+{
+	g_test_init (&argc, &argv, NULL);
+
+	g_test_add_func ("/irc/matcher/boundaries", test_boundaries);
+	g_test_add_func ("/irc/matcher/words", test_words);
+	g_test_add_func ("/irc/matcher/empty", test_empty);
+
+	return g_test_run ();
+}
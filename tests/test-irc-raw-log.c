@@ -0,0 +1,121 @@
+/*
+ * Copyright 2017 Patrick Griffis
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ */
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include "irc-raw-log.h"
+
+static void
+test_ring (void)
+{
+	g_autoptr(IrcRawLog) log = irc_raw_log_new (3);
+	IrcRawLogDirection direction;
+
+	g_assert_cmpuint (irc_raw_log_get_n_lines (log), ==, 0);
+
+	irc_raw_log_append (log, IRC_RAW_LOG_OUTBOUND, "NICK tester\r\n", 11);
+	irc_raw_log_append (log, IRC_RAW_LOG_INBOUND, ":server 001 tester :Welcome", -1);
+	g_assert_cmpuint (irc_raw_log_get_n_lines (log), ==, 2);
+	g_assert_cmpstr (irc_raw_log_get_line (log, 0, &direction, NULL), ==, "NICK tester");
+	g_assert_cmpint (direction, ==, IRC_RAW_LOG_OUTBOUND);
+	g_assert_cmpstr (irc_raw_log_get_line (log, 1, &direction, NULL), ==, ":server 001 tester :Welcome");
+	g_assert_cmpint (direction, ==, IRC_RAW_LOG_INBOUND);
+
+	for (guint i = 0; i < 5; ++i)
+	{
+		g_autofree char *line = g_strdup_printf ("PING :%u", i);
+		irc_raw_log_append (log, IRC_RAW_LOG_INBOUND, line, -1);
+	}
+
+	// Only the newest are kept, oldest first
+	g_assert_cmpuint (irc_raw_log_get_n_lines (log), ==, 3);
+	g_assert_cmpstr (irc_raw_log_get_line (log, 0, NULL, NULL), ==, "PING :2");
+	g_assert_cmpstr (irc_raw_log_get_line (log, 2, NULL, NULL), ==, "PING :4");
+}
+
+static void
+test_redact (void)
+{
+	g_autoptr(IrcRawLog) log = irc_raw_log_new (8);
+
+	irc_raw_log_append (log, IRC_RAW_LOG_OUTBOUND, "PASS hunter2\r\nCAP LS 302", -1);
+	irc_raw_log_append (log, IRC_RAW_LOG_OUTBOUND, "AUTHENTICATE dGVzdAB0ZXN0AGh1bnRlcjI=", -1);
+	irc_raw_log_append (log, IRC_RAW_LOG_INBOUND, "AUTHENTICATE +", -1);
+	irc_raw_log_append (log, IRC_RAW_LOG_OUTBOUND, "oper admin hunter2", -1);
+	irc_raw_log_append (log, IRC_RAW_LOG_OUTBOUND, "PRIVMSG #chan :PASS hunter2", -1);
+
+	g_assert_cmpstr (irc_raw_log_get_line (log, 0, NULL, NULL), ==, "PASS <hidden>\r\nCAP LS 302");
+	g_assert_cmpstr (irc_raw_log_get_line (log, 1, NULL, NULL), ==, "AUTHENTICATE <hidden>");
+	g_assert_cmpstr (irc_raw_log_get_line (log, 2, NULL, NULL), ==, "AUTHENTICATE +");
+	g_assert_cmpstr (irc_raw_log_get_line (log, 3, NULL, NULL), ==, "oper <hidden>");
+	g_assert_cmpstr (irc_raw_log_get_line (log, 4, NULL, NULL), ==, "PRIVMSG #chan :PASS hunter2");
+}
+
+static void
+test_file (void)
+{
+	g_autoptr(GError) err = NULL;
+	g_autofree char *dir = g_dir_make_tmp ("irc-raw-log-XXXXXX", &err);
+	g_assert_no_error (err);
+
+	g_autofree char *path = g_build_filename (dir, "test.log", NULL);
+	g_autofree char *old_path = g_strconcat (path, ".1", NULL);
+	g_autoptr(GFile) file = g_file_new_for_path (path);
+	IrcRawLog *log = irc_raw_log_new (10);
+
+	g_assert_true (irc_raw_log_set_file (log, file, 10, &err));
+	g_assert_no_error (err);
+
+	// Over the maximum size so the first write rotates
+	irc_raw_log_append (log, IRC_RAW_LOG_INBOUND, "PING :first", -1);
+	while (!g_file_test (old_path, G_FILE_TEST_EXISTS))
+		g_main_context_iteration (NULL, TRUE);
+
+	// Pending writes keep it alive, the line waits if the rotation hasn't finished
+	irc_raw_log_append (log, IRC_RAW_LOG_OUTBOUND, "PONG :second", -1);
+	irc_raw_log_unref (log);
+
+	g_autofree char *contents = NULL;
+	while (!g_file_get_contents (path, &contents, NULL, NULL) || !g_str_has_suffix (contents, " << PONG :second\n"))
+	{
+		g_clear_pointer (&contents, g_free);
+		g_main_context_iteration (NULL, TRUE);
+	}
+
+	g_autofree char *old_contents = NULL;
+	g_assert_true (g_file_get_contents (old_path, &old_contents, NULL, NULL));
+	g_assert_true (g_str_has_suffix (old_contents, " >> PING :first\n"));
+
+	g_unlink (path);
+	g_unlink (old_path);
+	g_rmdir (dir);
+}
+
+int
+main (int argc, char **argv)
+{
+	g_test_init (&argc, &argv, NULL);
+
+	g_test_add_func ("/irc/raw-log/ring", test_ring);
+	g_test_add_func ("/irc/raw-log/redact", test_redact);
+	g_test_add_func ("/irc/raw-log/file", test_file);
+
+	return g_test_run ();
+}
@@ -0,0 +1,108 @@
+/*
+ * Copyright 2017 Patrick Griffis
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ */
+
+#include <glib.h>
+#include "irc-search-index.h"
+
+static void
+assert_lines (GArray *lines, guint n, ...)
+{
+	va_list args;
+
+	g_assert_cmpuint (lines->len, ==, n);
+
+	va_start (args, n);
+	for (guint i = 0; i < n; ++i)
+		g_assert_cmpuint (g_array_index (lines, guint, i), ==, va_arg (args, guint));
+	va_end (args);
+
+	g_array_unref (lines);
+}
+
+static void
+test_search (void)
+{
+	g_autoptr(IrcSearchIndex) index = irc_search_index_new ();
+
+	irc_search_index_append (index, "<TingPing> Hello World");
+	irc_search_index_append (index, "<foo> \002bold\002 statement");
+	irc_search_index_append (index, "First line\r\n\r\nSecond line");
+	irc_search_index_append (index, "<bar> hello again");
+
+	g_assert_cmpuint (irc_search_index_get_n_lines (index), ==, 5);
+
+	assert_lines (irc_search_index_search (index, "hello"), 2, 0, 4);
+	assert_lines (irc_search_index_search (index, "HELLO WORLD"), 1, 0);
+	assert_lines (irc_search_index_search (index, "bold statement"), 1, 1);
+	assert_lines (irc_search_index_search (index, "line"), 2, 2, 3);
+	assert_lines (irc_search_index_search (index, "<"), 3, 0, 1, 4);
+	assert_lines (irc_search_index_search (index, "nothing"), 0);
+	assert_lines (irc_search_index_search (index, ""), 0);
+
+	// Skipped lines are counted but never found
+	irc_search_index_skip (index, "<< PASS hello\nAUTHENTICATE hello");
+	irc_search_index_append (index, "hello");
+	g_assert_cmpuint (irc_search_index_get_n_lines (index), ==, 8);
+	assert_lines (irc_search_index_search (index, "hello"), 3, 0, 4, 7);
+	assert_lines (irc_search_index_search (index, "he"), 3, 0, 4, 7);
+
+	irc_search_index_clear (index);
+	g_assert_cmpuint (irc_search_index_get_n_lines (index), ==, 0);
+	assert_lines (irc_search_index_search (index, "hello"), 0);
+}
+
+static void
+test_max_lines (void)
+{
+	g_autoptr(IrcSearchIndex) index = irc_search_index_new ();
+
+	irc_search_index_set_max_lines (index, 80);
+	for (guint i = 0; i < 200; ++i)
+	{
+		g_autofree char *line = g_strdup_printf ("<user%u> message number %u about things", i % 30, i);
+		irc_search_index_append (index, line);
+	}
+
+	// The oldest lines are gone and the rest keep their numbers
+	const guint first_line = irc_search_index_get_first_line (index);
+	g_assert_cmpuint (irc_search_index_get_n_lines (index), <=, 80);
+	g_assert_cmpuint (first_line + irc_search_index_get_n_lines (index), ==, 200);
+	g_assert_cmpuint (first_line, >, 5);
+	assert_lines (irc_search_index_search (index, "number 5 "), 0);
+	assert_lines (irc_search_index_search (index, "number 199 "), 1, 199);
+	assert_lines (irc_search_index_search (index, "number 150 "), 1, 150);
+	assert_lines (irc_search_index_search (index, "99"), 1, 199);
+
+	irc_search_index_set_max_lines (index, 10);
+	g_assert_cmpuint (irc_search_index_get_n_lines (index), <=, 10);
+	assert_lines (irc_search_index_search (index, "number 150 "), 0);
+	assert_lines (irc_search_index_search (index, "number 199 "), 1, 199);
+}
+
+int
+main (int argc, char **argv)
+{
+	g_test_init (&argc, &argv, NULL);
+
+	g_test_add_func ("/irc/search-index/search", test_search);
+	g_test_add_func ("/irc/search-index/max-lines", test_max_lines);
+
+	return g_test_run ();
+}
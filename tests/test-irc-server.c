@@ -18,34 +18,661 @@
  *
  */
 
+#include <string.h>
 #include <glib.h>
 #include "irc-server.h"
+#include "irc-channel.h"
+#include "irc-context-manager.h"
+#include "irc-connect-scheduler.h"
+#include "mock-ircd.h"
+
+typedef struct
+{
+	MockIrcd *ircd;
+	IrcServer *server;
+	char *name;
+} Fixture;
+
+static void
+discard_print (const char *string)
+{
+}
+
+static IrcServer *
+new_server (MockIrcd *ircd, char **name)
+{
+	static guint serial;
+	g_autoptr(GSettings) settings = NULL;
+
+	*name = g_strdup_printf ("mock%u", serial++);
+	IrcServer *server = g_object_new (IRC_TYPE_SERVER, "host", "127.0.0.1", "port", mock_ircd_get_port (ircd),
+									  "tls", FALSE, "name", *name, NULL);
+	irc_context_manager_add (irc_context_manager_get_default (), IRC_CONTEXT(server));
+
+	g_object_get (server, "settings", &settings, NULL);
+	g_settings_set_string (settings, "nickname", "tester");
+	return server;
+}
+
+static void
+fixture_connect (Fixture *fixture, MockIrcdFlags flags)
+{
+	g_autoptr(GSettings) settings = NULL;
+
+	fixture->ircd = mock_ircd_new (flags);
+	fixture->server = new_server (fixture->ircd, &fixture->name);
+
+	g_object_get (fixture->server, "settings", &settings, NULL);
+	if (flags & MOCK_IRCD_SASL)
+	{
+		mock_ircd_set_sasl_account (fixture->ircd, "tester", "hunter2");
+		g_settings_set_string (settings, "sasl-username", "tester");
+		g_settings_set_string (settings, "sasl-password", "hunter2");
+	}
+
+	irc_server_connect (fixture->server);
+	mock_ircd_wait_registered (fixture->ircd);
+}
+
+static void
+fixture_setup (Fixture *fixture, gconstpointer data)
+{
+	fixture_connect (fixture, MOCK_IRCD_NONE);
+}
+
+static void
+fixture_setup_full (Fixture *fixture, gconstpointer data)
+{
+	fixture_connect (fixture, MOCK_IRCD_SASL | MOCK_IRCD_WHOX | MOCK_IRCD_MONITOR);
+}
+
+static void
+fixture_teardown (Fixture *fixture, gconstpointer data)
+{
+	irc_server_disconnect (fixture->server);
+	irc_context_manager_remove (irc_context_manager_get_default (), IRC_CONTEXT(fixture->server));
+	g_object_unref (fixture->server);
+	mock_ircd_free (fixture->ircd);
+	g_free (fixture->name);
+}
+
+static IrcChannel *
+get_channel (Fixture *fixture, const char *channel)
+{
+	g_autofree char *id = g_strdup_printf ("%s/%s", fixture->name, channel);
+	IrcContext *ctx = irc_context_manager_find (irc_context_manager_get_default (), id);
+
+	g_assert_nonnull (ctx);
+	g_assert_true (IRC_IS_CHANNEL(ctx));
+	return IRC_CHANNEL(ctx);
+}
+
+static guint
+get_n_users (Fixture *fixture, const char *channel)
+{
+	IrcUserList *list = irc_channel_get_users (get_channel (fixture, channel));
+
+	return g_list_model_get_n_items (G_LIST_MODEL(list));
+}
+
+static void
+test_register (Fixture *fixture, gconstpointer data)
+{
+	IrcUser *me = irc_server_get_me (fixture->server);
+
+	g_assert_nonnull (me);
+	g_assert_cmpstr (me->nick, ==, "tester");
+	g_assert_cmpstr (mock_ircd_get_nick (fixture->ircd), ==, "tester");
+	g_assert_cmpuint (mock_ircd_get_n_received (fixture->ircd, "USER"), ==, 1);
+	g_assert_cmpuint (mock_ircd_get_n_received (fixture->ircd, "AUTHENTICATE"), ==, 0);
+	g_assert_null (mock_ircd_get_account (fixture->ircd));
+}
+
+static void
+test_sasl (Fixture *fixture, gconstpointer data)
+{
+	g_assert_cmpuint (mock_ircd_get_n_received (fixture->ircd, "AUTHENTICATE"), ==, 2);
+	g_assert_cmpstr (mock_ircd_get_account (fixture->ircd), ==, "tester");
+}
+
+static void
+test_populate (Fixture *fixture, gconstpointer data)
+{
+	mock_ircd_populate (fixture->ircd, 20, 500);
+	mock_ircd_sync (fixture->ircd);
+
+	// Every user plus us
+	g_assert_cmpuint (get_n_users (fixture, "#chan0"), ==, 501);
+	g_assert_cmpuint (get_n_users (fixture, "#chan19"), ==, 501);
+}
+
+static void
+on_users_updated (IrcServer *server, GPtrArray *users, gpointer data)
+{
+	g_ptr_array_add (data, GUINT_TO_POINTER(users->len));
+}
+
+static void
+wait_for_who (Fixture *fixture, guint n_who)
+{
+	for (guint i = 0; i < 20 && mock_ircd_get_n_received (fixture->ircd, "WHO") < n_who; ++i)
+		mock_ircd_sync (fixture->ircd);
+	// The replies to the last WHO are sent after it
+	mock_ircd_sync (fixture->ircd);
+}
+
+static void
+test_whox (Fixture *fixture, gconstpointer data)
+{
+	g_autoptr(GPtrArray) updates = g_ptr_array_new ();
+	g_signal_connect (fixture->server, "users-updated", G_CALLBACK(on_users_updated), updates);
+
+	// Every channel gets a WHO, one after the other
+	mock_ircd_populate (fixture->ircd, 2, 1000);
+	wait_for_who (fixture, 2);
+
+	g_assert_cmpuint (mock_ircd_get_n_received (fixture->ircd, "WHO"), ==, 2);
+
+	// The same users are in both so the second reply changed nothing
+	g_assert_cmpuint (updates->len, ==, 1);
+	g_assert_cmpuint (GPOINTER_TO_UINT(g_ptr_array_index (updates, 0)), ==, 1000);
+	g_signal_handlers_disconnect_by_func (fixture->server, on_users_updated, updates);
+
+	IrcUserList *list = irc_channel_get_users (get_channel (fixture, "#chan1"));
+	guint position, n_items;
+	irc_user_list_get_prefix_range (list, "user42", &position, &n_items);
+	g_assert_cmpuint (n_items, >, 0);
+
+	g_autoptr(IrcUserListItem) item = g_list_model_get_item (G_LIST_MODEL(list), position);
+	g_assert_cmpstr (item->user->nick, ==, "user42");
+	g_assert_cmpstr (item->user->account, ==, "acct_user42");
+}
+
+static void
+test_who_skipped (Fixture *fixture, gconstpointer data)
+{
+	// #chan0 is too big to be worth it, #chan1 still gets one
+	mock_ircd_populate (fixture->ircd, 1, 2500);
+	mock_ircd_populate (fixture->ircd, 2, 10);
+	wait_for_who (fixture, 1);
+
+	g_assert_cmpuint (mock_ircd_get_n_received (fixture->ircd, "WHO"), ==, 1);
+}
+
+static void
+test_who_refused (Fixture *fixture, gconstpointer data)
+{
+	g_autoptr(GPtrArray) updates = g_ptr_array_new ();
+	g_signal_connect (fixture->server, "users-updated", G_CALLBACK(on_users_updated), updates);
+
+	// The first WHO never gets a 315, the queue still moves on
+	mock_ircd_refuse_who (fixture->ircd, 1);
+	mock_ircd_populate (fixture->ircd, 2, 10);
+	wait_for_who (fixture, 2);
+
+	g_assert_cmpuint (mock_ircd_get_n_received (fixture->ircd, "WHO"), ==, 2);
+	g_assert_cmpuint (updates->len, ==, 1);
+	g_signal_handlers_disconnect_by_func (fixture->server, on_users_updated, updates);
+}
+
+static void
+test_nick_during_who (Fixture *fixture, gconstpointer data)
+{
+	mock_ircd_populate (fixture->ircd, 1, 10);
+	wait_for_who (fixture, 1);
+
+	// The list is sorted by the new nick before the reply ends
+	mock_ircd_send (fixture->ircd, ":mock.ircd 354 tester 152 #chan0 ~user3 user3.users.mock mock.ircd user3 H acct_user3 :Mock User");
+	mock_ircd_send (fixture->ircd, ":user3!~user3@user3.users.mock NICK aaa");
+	mock_ircd_sync (fixture->ircd);
+
+	IrcUserList *list = irc_channel_get_users (get_channel (fixture, "#chan0"));
+	guint position, n_items;
+	irc_user_list_get_prefix_range (list, "aaa", &position, &n_items);
+	g_assert_cmpuint (n_items, ==, 1);
+	g_autoptr(IrcUserListItem) item = g_list_model_get_item (G_LIST_MODEL(list), position);
+	g_assert_cmpstr (item->user->nick, ==, "aaa");
+
+	mock_ircd_send (fixture->ircd, ":mock.ircd 315 tester #chan0 :End of /WHO list.");
+	mock_ircd_sync (fixture->ircd);
+	g_assert_cmpuint (get_n_users (fixture, "#chan0"), ==, 11);
+}
+
+static void
+test_join_part_storm (Fixture *fixture, gconstpointer data)
+{
+	mock_ircd_populate (fixture->ircd, 1, 10);
+	mock_ircd_join_part_storm (fixture->ircd, "#chan0", 5000);
+	mock_ircd_sync (fixture->ircd);
+
+	g_assert_cmpuint (get_n_users (fixture, "#chan0"), ==, 11);
+}
+
+static void
+test_netsplit (Fixture *fixture, gconstpointer data)
+{
+	mock_ircd_populate (fixture->ircd, 5, 3000);
+	mock_ircd_sync (fixture->ircd);
+	mock_ircd_netsplit (fixture->ircd, 2500);
+	mock_ircd_sync (fixture->ircd);
+
+	g_assert_cmpuint (get_n_users (fixture, "#chan0"), ==, 501);
+	g_assert_cmpuint (get_n_users (fixture, "#chan4"), ==, 501);
+}
+
+static void
+test_flood (Fixture *fixture, gconstpointer data)
+{
+	mock_ircd_populate (fixture->ircd, 1, 50);
+	mock_ircd_sync (fixture->ircd);
+
+	IrcSearchIndex *index = irc_context_get_search_index (IRC_CONTEXT(get_channel (fixture, "#chan0")));
+	const guint before = irc_search_index_get_first_line (index) + irc_search_index_get_n_lines (index);
+
+	mock_ircd_flood (fixture->ircd, "#chan0", 20000);
+	mock_ircd_sync (fixture->ircd);
+
+	// The oldest lines may have been dropped but are still counted
+	const guint after = irc_search_index_get_first_line (index) + irc_search_index_get_n_lines (index);
+	g_assert_cmpuint (after - before, ==, 20000);
+}
+
+static void
+test_history (Fixture *fixture, gconstpointer data)
+{
+	mock_ircd_populate (fixture->ircd, 1, 50);
+	mock_ircd_sync (fixture->ircd);
+
+	IrcSearchIndex *index = irc_context_get_search_index (IRC_CONTEXT(get_channel (fixture, "#chan0")));
+	const guint before = irc_search_index_get_n_lines (index);
+
+	mock_ircd_send_history (fixture->ircd, "#chan0", 1000);
+	mock_ircd_sync (fixture->ircd);
+
+	g_assert_cmpuint (irc_search_index_get_n_lines (index) - before, ==, 1000);
+}
+
+static void
+test_stats (Fixture *fixture, gconstpointer data)
+{
+	guint64 count;
+
+	mock_ircd_populate (fixture->ircd, 1, 50);
+	mock_ircd_flood (fixture->ircd, "#chan0", 100);
+	mock_ircd_sync (fixture->ircd);
+
+	g_autoptr(GVariant) stats = g_variant_ref_sink (irc_server_get_stats (fixture->server));
+	g_autoptr(GVariant) commands = g_variant_lookup_value (stats, "commands", G_VARIANT_TYPE("a{sa{sv}}"));
+	g_assert_nonnull (commands);
+
+	g_autoptr(GVariant) privmsg = g_variant_lookup_value (commands, "PRIVMSG", G_VARIANT_TYPE_VARDICT);
+	g_assert_nonnull (privmsg);
+	g_assert_true (g_variant_lookup (privmsg, "count", "t", &count));
+	g_assert_cmpuint (count, ==, 100);
+	g_assert_true (g_variant_lookup (privmsg, "prints", "t", &count));
+	g_assert_cmpuint (count, ==, 100);
+
+	g_autoptr(GVariant) names = g_variant_lookup_value (commands, "353", G_VARIANT_TYPE_VARDICT);
+	g_assert_nonnull (names);
+}
+
+static void
+count_removed (GListModel *list, guint position, guint removed, guint added, gpointer data)
+{
+	*(guint*)data += removed;
+}
+
+static void
+test_reconnect (Fixture *fixture, gconstpointer data)
+{
+	mock_ircd_populate (fixture->ircd, 2, 100);
+	mock_ircd_sync (fixture->ircd);
+
+	IrcChannel *channel = get_channel (fixture, "#chan0");
+	IrcUserList *list = irc_channel_get_users (channel);
+	g_autoptr(GPtrArray) users = irc_user_list_complete (list, "user42", FALSE);
+	g_assert_cmpuint (users->len, ==, 1);
+	guint removed = 0;
+	g_signal_connect (list, "items-changed", G_CALLBACK(count_removed), &removed);
+
+	// Users that quit while it was gone are removed, the rest are left alone
+	mock_ircd_drop (fixture->ircd);
+	mock_ircd_netsplit (fixture->ircd, 10);
+	mock_ircd_wait_registered (fixture->ircd);
+	mock_ircd_sync (fixture->ircd);
+
+	gboolean active;
+	g_object_get (channel, "active", &active, NULL);
+	g_assert_true (active);
+	g_assert_cmpuint (get_n_users (fixture, "#chan0"), ==, 91);
+	g_assert_cmpuint (removed, ==, 11); // Plus yourself from the old connection
+	g_assert_true (irc_user_list_contains (list, g_ptr_array_index (users, 0)));
+	g_assert_cmpuint (mock_ircd_get_n_received (fixture->ircd, "JOIN"), ==, 1);
+
+	g_signal_handlers_disconnect_by_func (list, count_removed, &removed);
+}
+
+static void
+test_reconnect_own_nick (Fixture *fixture, gconstpointer data)
+{
+	mock_ircd_populate (fixture->ircd, 1, 5);
+	mock_ircd_send (fixture->ircd, ":tester!~tester@client.mock NICK tester_");
+	mock_ircd_send (fixture->ircd, ":tester!~tester@tester.users.mock JOIN #chan0");
+	mock_ircd_sync (fixture->ircd);
+	g_assert_cmpuint (get_n_users (fixture, "#chan0"), ==, 7);
+
+	// Whoever had the configured nick is gone once we have it again
+	mock_ircd_drop (fixture->ircd);
+	mock_ircd_wait_registered (fixture->ircd);
+	mock_ircd_sync (fixture->ircd);
+
+	IrcUser *me = irc_server_get_me (fixture->server);
+	g_assert_cmpstr (me->nick, ==, "tester");
+	g_assert_cmpuint (get_n_users (fixture, "#chan0"), ==, 6);
+	g_assert_true (irc_user_list_contains (irc_channel_get_users (get_channel (fixture, "#chan0")), me));
+}
+
+static void
+test_reconnect_banned (Fixture *fixture, gconstpointer data)
+{
+	mock_ircd_populate (fixture->ircd, 2, 5);
+	mock_ircd_sync (fixture->ircd);
+
+	// Users of a channel that can't be rejoined aren't kept around
+	mock_ircd_ban (fixture->ircd, "#chan1");
+	mock_ircd_drop (fixture->ircd);
+	mock_ircd_wait_registered (fixture->ircd);
+	mock_ircd_sync (fixture->ircd);
+
+	gboolean active;
+	g_object_get (get_channel (fixture, "#chan1"), "active", &active, NULL);
+	g_assert_false (active);
+	g_assert_cmpuint (get_n_users (fixture, "#chan1"), ==, 0);
+	g_assert_cmpuint (get_n_users (fixture, "#chan0"), ==, 6);
+}
+
+static void
+on_print (IrcContext *ctx, const char *message, gint64 stamp, gpointer data)
+{
+	g_ptr_array_add (data, g_strdup (message));
+}
+
+static void
+test_highlight_formatted (Fixture *fixture, gconstpointer data)
+{
+	g_autoptr(GPtrArray) prints = g_ptr_array_new_with_free_func (g_free);
+
+	mock_ircd_populate (fixture->ircd, 1, 5);
+	mock_ircd_sync (fixture->ircd);
+	IrcChannel *channel = get_channel (fixture, "#chan0");
+	g_signal_connect (channel, "print", G_CALLBACK(on_print), prints);
+
+	// Old timestamps so nothing notifies
+	mock_ircd_send (fixture->ircd, "@time=2020-01-01T00:00:00.000Z :user1!~user1@user1.users.mock PRIVMSG #chan0 :\0034tester\003: hi");
+	mock_ircd_send (fixture->ircd, "@time=2020-01-01T00:00:00.000Z :user1!~user1@user1.users.mock PRIVMSG #chan0 :ping \002tester\002");
+	mock_ircd_send (fixture->ircd, "@time=2020-01-01T00:00:00.000Z :user1!~user1@user1.users.mock PRIVMSG #chan0 :\0034testers\003: hi");
+	mock_ircd_sync (fixture->ircd);
+
+	g_assert_cmpuint (prints->len, ==, 3);
+	g_assert_true (g_str_has_prefix (g_ptr_array_index (prints, 0), "\002\00303"));
+	g_assert_true (g_str_has_prefix (g_ptr_array_index (prints, 1), "\002\00303"));
+	g_assert_false (g_str_has_prefix (g_ptr_array_index (prints, 2), "\002\00303"));
+
+	g_signal_handlers_disconnect_by_func (channel, on_print, prints);
+}
+
+static void
+on_search_result (IrcContext *ctx, GArray *lines, gpointer data)
+{
+	g_hash_table_insert (data, g_strdup (irc_context_get_name (ctx)), GUINT_TO_POINTER(lines->len));
+}
+
+static void
+on_search_done (GObject *source, GAsyncResult *result, gpointer data)
+{
+	g_autoptr(GError) err = NULL;
+
+	g_assert_true (irc_context_manager_search_finish (IRC_CONTEXT_MANAGER(source), result, &err));
+	g_assert_no_error (err);
+	*(gboolean*)data = TRUE;
+}
+
+static void
+test_search_all (Fixture *fixture, gconstpointer data)
+{
+	g_autoptr(GHashTable) results = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+	gboolean done = FALSE;
+
+	mock_ircd_populate (fixture->ircd, 3, 5);
+	mock_ircd_sync (fixture->ircd);
+
+	mock_ircd_send (fixture->ircd, "@time=2020-01-01T00:00:00.000Z :user1!~user1@user1.users.mock PRIVMSG #chan0 :a Zebra crossing");
+	mock_ircd_send (fixture->ircd, "@time=2020-01-01T00:00:00.000Z :user2!~user2@user2.users.mock PRIVMSG #chan0 :another zebra");
+	mock_ircd_send (fixture->ircd, "@time=2020-01-01T00:00:00.000Z :user1!~user1@user1.users.mock PRIVMSG #chan2 :\002zebra\002");
+	mock_ircd_sync (fixture->ircd);
+
+	// Each context's matches arrive before the search completes
+	irc_context_manager_search_async (irc_context_manager_get_default (), "zebra", NULL,
+									  on_search_result, results, on_search_done, &done);
+	while (!done)
+		g_main_context_iteration (NULL, TRUE);
+
+	g_assert_cmpuint (g_hash_table_size (results), ==, 2);
+	g_assert_cmpuint (GPOINTER_TO_UINT(g_hash_table_lookup (results, "#chan0")), ==, 2);
+	g_assert_cmpuint (GPOINTER_TO_UINT(g_hash_table_lookup (results, "#chan2")), ==, 1);
+}
+
+static void
+test_monitor_overflow (Fixture *fixture, gconstpointer data)
+{
+	// The mock allows MONITOR=100
+	for (guint i = 0; i < 105; ++i)
+		mock_ircd_send (fixture->ircd, "@time=2020-01-01T00:00:00.000Z :query%u!~q@query.mock PRIVMSG tester :hi", i);
+	mock_ircd_sync (fixture->ircd);
+
+	// Queries past the limit are still checked with ISON
+	mock_ircd_drop (fixture->ircd);
+	mock_ircd_wait_registered (fixture->ircd);
+	mock_ircd_sync (fixture->ircd);
+	g_assert_cmpuint (mock_ircd_get_n_received (fixture->ircd, "ISON"), ==, 1);
+}
+
+static void
+count_ready (IrcServer *server, gpointer data)
+{
+	++*(guint*)data;
+}
+
+static void
+test_motd_again (Fixture *fixture, gconstpointer data)
+{
+	guint ready = 0;
+
+	mock_ircd_populate (fixture->ircd, 2, 5);
+	mock_ircd_sync (fixture->ircd);
+	mock_ircd_drop (fixture->ircd);
+	g_signal_connect (fixture->server, "ready", G_CALLBACK(count_ready), &ready);
+	mock_ircd_wait_registered (fixture->ircd);
+	mock_ircd_sync (fixture->ircd);
+	g_assert_cmpuint (ready, ==, 1);
+	g_assert_cmpuint (mock_ircd_get_n_received (fixture->ircd, "JOIN"), ==, 1);
+
+	// A /MOTD later on is only shown
+	mock_ircd_send (fixture->ircd, ":mock.ircd 422 tester :MOTD File is missing");
+	mock_ircd_send (fixture->ircd, ":mock.ircd 376 tester :End of /MOTD command.");
+	mock_ircd_sync (fixture->ircd);
+	g_assert_cmpuint (ready, ==, 1);
+	g_assert_cmpuint (mock_ircd_get_n_received (fixture->ircd, "JOIN"), ==, 1);
+
+	g_signal_handlers_disconnect_by_func (fixture->server, count_ready, &ready);
+}
+
+static void
+test_rejoin_batched (Fixture *fixture, gconstpointer data)
+{
+	mock_ircd_populate (fixture->ircd, 25, 5);
+	mock_ircd_sync (fixture->ircd);
+
+	mock_ircd_drop (fixture->ircd);
+	mock_ircd_wait_registered (fixture->ircd);
+	mock_ircd_sync (fixture->ircd);
+
+	// TARGMAX allows 10 channels a line
+	g_assert_cmpuint (mock_ircd_get_n_received (fixture->ircd, "JOIN"), ==, 3);
+	for (guint i = 0; i < 25; ++i)
+	{
+		g_autofree char *name = g_strdup_printf ("#chan%u", i);
+		gboolean active;
+
+		g_object_get (get_channel (fixture, name), "active", &active, NULL);
+		g_assert_true (active);
+		g_assert_cmpuint (get_n_users (fixture, name), ==, 6);
+	}
+}
+
+static void
+record_event (GPtrArray *events, IrcServer *server, const char *event)
+{
+	g_ptr_array_add (events, g_strconcat (irc_context_get_name (IRC_CONTEXT(server)), " ", event, NULL));
+}
+
+static void
+on_connected_event (IrcServer *server, gpointer data)
+{
+	record_event (data, server, "connected");
+}
 
 static void
-on_server_connected(IrcServer *serv, gpointer data)
+on_ready_event (IrcServer *server, gpointer data)
 {
-  g_print("yes\n");
+	record_event (data, server, "ready");
 }
 
 static void
-on_server_line(IrcServer *serv, const char *line, gpointer data)
+watch_server (IrcServer *server, GPtrArray *events)
 {
-  g_print("%s\n", line);
+	g_signal_connect (server, "connected", G_CALLBACK(on_connected_event), events);
+	g_signal_connect (server, "ready", G_CALLBACK(on_ready_event), events);
 }
 
 static void
-test_server (void)
+free_server (IrcServer *server)
 {
-	IrcServer *serv;
+	irc_server_disconnect (server);
+	irc_context_manager_remove (irc_context_manager_get_default (), IRC_CONTEXT(server));
+	g_object_unref (server);
+}
+
+static void
+test_scheduler (void)
+{
+	g_autoptr(MockIrcd) low_ircd = mock_ircd_new (MOCK_IRCD_NONE);
+	g_autoptr(MockIrcd) high_ircd = mock_ircd_new (MOCK_IRCD_NONE);
+	g_autofree char *low_name = NULL, *high_name = NULL;
+	IrcServer *low = new_server (low_ircd, &low_name);
+	IrcServer *high = new_server (high_ircd, &high_name);
+	g_autoptr(IrcConnectScheduler) scheduler = irc_connect_scheduler_new (1, 60);
+	g_autoptr(GPtrArray) events = g_ptr_array_new_with_free_func (g_free);
 
-	GMainLoop *main_loop = g_main_loop_new (NULL, FALSE);
+	watch_server (low, events);
+	watch_server (high, events);
 
-	serv = irc_server_new("chat.freenode.net");
-	g_signal_connect (serv, "connected", G_CALLBACK(on_server_connected), NULL);
-  	g_signal_connect (serv, "raw-line", G_CALLBACK(on_server_line), NULL);
-	irc_server_connect (serv);
+	// Added together so the priority decides, only one connects at a time
+	irc_connect_scheduler_add (scheduler, low, 0);
+	irc_connect_scheduler_add (scheduler, high, 1);
+	g_assert_cmpuint (irc_connect_scheduler_get_n_queued (scheduler), ==, 2);
 
-	g_main_loop_run (main_loop);
+	mock_ircd_wait_registered (high_ircd);
+	mock_ircd_wait_registered (low_ircd);
+	g_assert_cmpuint (irc_connect_scheduler_get_n_queued (scheduler), ==, 0);
+
+	const char * const expected[] = { "connected", "ready", "connected", "ready" };
+	g_assert_cmpuint (events->len, ==, G_N_ELEMENTS(expected));
+	for (guint i = 0; i < G_N_ELEMENTS(expected); ++i)
+	{
+		g_autofree char *event = g_strconcat (i < 2 ? high_name : low_name, " ", expected[i], NULL);
+		g_assert_cmpstr (g_ptr_array_index (events, i), ==, event);
+	}
+
+	free_server (low);
+	free_server (high);
+}
+
+// Outbound lines logged after the first skip lines, waits until there are n
+static GPtrArray *
+wait_for_sent (IrcServer *server, guint skip, guint n)
+{
+	IrcRawLog *log = irc_server_get_raw_log (server);
+	GPtrArray *sent = g_ptr_array_new_with_free_func (g_free);
+
+	while (TRUE)
+	{
+		g_ptr_array_set_size (sent, 0);
+		for (guint i = skip; i < irc_raw_log_get_n_lines (log); ++i)
+		{
+			IrcRawLogDirection direction;
+			const char *line = irc_raw_log_get_line (log, i, &direction, NULL);
+
+			if (direction == IRC_RAW_LOG_OUTBOUND)
+				g_ptr_array_add (sent, g_strdup (line));
+		}
+
+		if (sent->len >= n)
+			return sent;
+		g_main_context_iteration (NULL, TRUE);
+	}
+}
+
+static void
+test_write_command (Fixture *fixture, gconstpointer data)
+{
+	const char * const params[] = { "#chan0", NULL };
+	const char * const tags[] = { "+draft/reply=a;b c\\d", "+typing", NULL };
+	const guint skip = irc_raw_log_get_n_lines (irc_server_get_raw_log (fixture->server));
+
+	irc_server_write_command (fixture->server, NULL, "PRIVMSG", params, "hello\r\nworld");
+	irc_server_write_command (fixture->server, tags, "TAGMSG", params, NULL);
+	irc_server_write_linef (fixture->server, "PRIVMSG %s :%d", "#chan0", 42);
+
+	g_autoptr(GPtrArray) sent = wait_for_sent (fixture->server, skip, 3);
+	g_assert_cmpstr (g_ptr_array_index (sent, 0), ==, "PRIVMSG #chan0 :hello  world");
+	g_assert_cmpstr (g_ptr_array_index (sent, 1), ==, "@+draft/reply=a\\:b\\sc\\\\d;+typing TAGMSG #chan0");
+	g_assert_cmpstr (g_ptr_array_index (sent, 2), ==, "PRIVMSG #chan0 :42");
+
+	mock_ircd_sync (fixture->ircd);
+	g_assert_cmpuint (mock_ircd_get_n_received (fixture->ircd, "PRIVMSG"), ==, 2);
+}
+
+static void
+test_write_message (Fixture *fixture, gconstpointer data)
+{
+	// Joining tells us our own user and host
+	mock_ircd_populate (fixture->ircd, 1, 1);
+	mock_ircd_sync (fixture->ircd);
+
+	const char *prefix = ":tester!~tester@client.mock ";
+	const guint skip = irc_raw_log_get_n_lines (irc_server_get_raw_log (fixture->server));
+	g_autoptr(GString) text = g_string_new ("\002");
+	for (guint i = 0; i < 100; ++i)
+		g_string_append (text, "word\xc3\xa9 ");
+
+	irc_server_write_message (fixture->server, "#chan0", text->str, FALSE);
+	irc_server_write_message (fixture->server, "#chan0", "waves", TRUE);
+
+	g_autoptr(GPtrArray) sent = wait_for_sent (fixture->server, skip, 3);
+	g_assert_cmpuint (sent->len, ==, 3);
+	for (guint i = 0; i < 2; ++i)
+	{
+		const char *line = g_ptr_array_index (sent, i);
+
+		g_assert_cmpuint (strlen (prefix) + strlen (line), <=, 510);
+		g_assert_true (g_str_has_prefix (line, "PRIVMSG #chan0 :\002word"));
+		g_assert_true (g_utf8_validate (line, -1, NULL));
+	}
+	g_assert_cmpstr (g_ptr_array_index (sent, 2), ==, "PRIVMSG #chan0 :\001ACTION waves\001");
+
+	mock_ircd_sync (fixture->ircd);
+	g_assert_cmpuint (mock_ircd_get_n_received (fixture->ircd, "PRIVMSG"), ==, 3);
 }
 
 int
@@ -53,7 +680,32 @@ main (int argc, char **argv)
 {
 	g_test_init (&argc, &argv, NULL);
 
-	g_test_add_func ("/irc/server", test_server);
+	// Every line is echoed otherwise
+	g_set_print_handler (discard_print);
+
+	g_test_add ("/irc/server/register", Fixture, NULL, fixture_setup, test_register, fixture_teardown);
+	g_test_add ("/irc/server/sasl", Fixture, NULL, fixture_setup_full, test_sasl, fixture_teardown);
+	g_test_add ("/irc/server/populate", Fixture, NULL, fixture_setup, test_populate, fixture_teardown);
+	g_test_add ("/irc/server/whox", Fixture, NULL, fixture_setup_full, test_whox, fixture_teardown);
+	g_test_add ("/irc/server/who-skipped", Fixture, NULL, fixture_setup_full, test_who_skipped, fixture_teardown);
+	g_test_add ("/irc/server/nick-during-who", Fixture, NULL, fixture_setup_full, test_nick_during_who, fixture_teardown);
+	g_test_add ("/irc/server/who-refused", Fixture, NULL, fixture_setup_full, test_who_refused, fixture_teardown);
+	g_test_add ("/irc/server/join-part-storm", Fixture, NULL, fixture_setup, test_join_part_storm, fixture_teardown);
+	g_test_add ("/irc/server/netsplit", Fixture, NULL, fixture_setup, test_netsplit, fixture_teardown);
+	g_test_add ("/irc/server/flood", Fixture, NULL, fixture_setup, test_flood, fixture_teardown);
+	g_test_add ("/irc/server/history", Fixture, NULL, fixture_setup, test_history, fixture_teardown);
+	g_test_add ("/irc/server/stats", Fixture, NULL, fixture_setup, test_stats, fixture_teardown);
+	g_test_add ("/irc/server/reconnect", Fixture, NULL, fixture_setup, test_reconnect, fixture_teardown);
+	g_test_add ("/irc/server/reconnect-own-nick", Fixture, NULL, fixture_setup, test_reconnect_own_nick, fixture_teardown);
+	g_test_add ("/irc/server/reconnect-banned", Fixture, NULL, fixture_setup, test_reconnect_banned, fixture_teardown);
+	g_test_add ("/irc/server/highlight-formatted", Fixture, NULL, fixture_setup, test_highlight_formatted, fixture_teardown);
+	g_test_add ("/irc/server/search-all", Fixture, NULL, fixture_setup, test_search_all, fixture_teardown);
+	g_test_add ("/irc/server/monitor-overflow", Fixture, NULL, fixture_setup_full, test_monitor_overflow, fixture_teardown);
+	g_test_add ("/irc/server/motd-again", Fixture, NULL, fixture_setup, test_motd_again, fixture_teardown);
+	g_test_add ("/irc/server/rejoin-batched", Fixture, NULL, fixture_setup, test_rejoin_batched, fixture_teardown);
+	g_test_add ("/irc/server/write-command", Fixture, NULL, fixture_setup, test_write_command, fixture_teardown);
+	g_test_add ("/irc/server/write-message", Fixture, NULL, fixture_setup, test_write_message, fixture_teardown);
+	g_test_add_func ("/irc/server/scheduler", test_scheduler);
 
 	return g_test_run ();
 }
@@ -0,0 +1,135 @@
+/*
+ * Copyright 2017 Patrick Griffis
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ */
+
+#include <glib.h>
+#include "irc-user-list.h"
+
+static IrcUser *
+add_user (IrcUserList *list, const char *nick)
+{
+	IrcUser *user = irc_user_new (nick);
+	irc_user_list_add (list, user, NULL);
+	return user;
+}
+
+static void
+assert_nicks (GPtrArray *users, ...)
+{
+	va_list args;
+	guint i = 0;
+	const char *nick;
+
+	va_start (args, users);
+	while ((nick = va_arg (args, const char*)) != NULL)
+	{
+		g_assert_cmpuint (i, <, users->len);
+		g_assert_cmpstr (IRC_USER(g_ptr_array_index (users, i))->nick, ==, nick);
+		++i;
+	}
+	va_end (args);
+
+	g_assert_cmpuint (i, ==, users->len);
+	g_ptr_array_unref (users);
+}
+
+static void
+test_complete (void)
+{
+	g_autoptr(IrcUserList) list = irc_user_list_new ();
+
+	g_object_unref (add_user (list, "bob"));
+	g_autoptr(IrcUser) ann = add_user (list, "Ann");
+	g_object_unref (add_user (list, "announcer"));
+	g_autoptr(IrcUser) anna = add_user (list, "anna");
+	g_object_unref (add_user (list, "[away]"));
+	g_object_unref (add_user (list, "an"));
+
+	g_assert_cmpuint (g_list_model_get_n_items (G_LIST_MODEL(list)), ==, 6);
+
+	assert_nicks (irc_user_list_complete (list, "ANN", FALSE), "Ann", "anna", "announcer", NULL);
+	assert_nicks (irc_user_list_complete (list, "{", FALSE), "[away]", NULL);
+	assert_nicks (irc_user_list_complete (list, "c", FALSE), NULL);
+	assert_nicks (irc_user_list_complete (list, "bob", FALSE), "bob", NULL);
+
+	guint position, n_items;
+	irc_user_list_get_prefix_range (list, "an", &position, &n_items);
+	g_assert_cmpuint (position, ==, 0);
+	g_assert_cmpuint (n_items, ==, 4);
+
+	irc_user_list_touch (list, ann);
+	g_usleep (10);
+	irc_user_list_touch (list, anna);
+	assert_nicks (irc_user_list_complete (list, "ann", TRUE), "anna", "Ann", "announcer", NULL);
+
+	g_assert_true (irc_user_list_remove (list, anna));
+	g_assert_false (irc_user_list_contains (list, anna));
+	assert_nicks (irc_user_list_complete (list, "ann", TRUE), "Ann", "announcer", NULL);
+
+	g_object_set (ann, "nick", "zed", NULL);
+	assert_nicks (irc_user_list_complete (list, "ann", FALSE), "announcer", NULL);
+	assert_nicks (irc_user_list_complete (list, "z", FALSE), "zed", NULL);
+
+	irc_user_list_clear (list);
+	g_assert_cmpuint (g_list_model_get_n_items (G_LIST_MODEL(list)), ==, 0);
+}
+
+static void
+count_removed (GListModel *list, guint position, guint removed, guint added, gpointer data)
+{
+	*(guint*)data += removed;
+}
+
+static void
+test_sync (void)
+{
+	g_autoptr(IrcUserList) list = irc_user_list_new ();
+	g_autoptr(IrcUser) ann = add_user (list, "ann");
+	g_autoptr(IrcUser) bob = add_user (list, "bob");
+	g_autoptr(IrcUser) cat = irc_user_new ("cat");
+	guint removed = 0;
+
+	g_signal_connect (list, "items-changed", G_CALLBACK(count_removed), &removed);
+
+	// Only bob leaves, ann stays and gets a new prefix
+	irc_user_list_begin_sync (list);
+	irc_user_list_add (list, ann, "@");
+	irc_user_list_add (list, cat, NULL);
+	irc_user_list_end_sync (list);
+
+	g_assert_cmpuint (removed, ==, 1);
+	g_assert_false (irc_user_list_contains (list, bob));
+	g_assert_cmpstr (irc_user_list_get_users_prefix (list, ann), ==, "@");
+	assert_nicks (irc_user_list_complete (list, "", FALSE), "ann", "cat", NULL);
+
+	// Not syncing
+	irc_user_list_end_sync (list);
+	g_assert_cmpuint (g_list_model_get_n_items (G_LIST_MODEL(list)), ==, 2);
+}
+
+int
+main (int argc, char **argv)
+{
+	g_test_init (&argc, &argv, NULL);
+
+	g_test_add_func ("/irc/user-list/complete", test_complete);
+	g_test_add_func ("/irc/user-list/sync", test_sync);
+
+	return g_test_run ();
+}
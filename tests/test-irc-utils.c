@@ -19,9 +19,11 @@
  */
 
 
+#include <string.h>
 #include <glib.h>
 #include <gio/gio.h>
 #include "irc-utils.h"
+#include "irc-private.h"
 
 static void
 test_cmp (void)
@@ -44,6 +46,22 @@ test_strip (void)
 
 	g_autofree char *stripped3 = irc_strip_attributes ("\004,,test \004FFFFFF,FFFFFFtest \004FFFFFF,test \004FFZZYYQQ \00400FF00FF \004\004FF");
 	g_assert_cmpstr (stripped3, ==, ",,test test ,test FFZZYYQQ FF FF");
+
+	// Long clean runs and attributes on either side of 16 byte chunks
+	g_autofree char *stripped4 = irc_strip_attributes ("a plain line\tthat is longer than a chunk, caf\xc3\xa9");
+	g_assert_cmpstr (stripped4, ==, "a plain line\tthat is longer than a chunk, caf\xc3\xa9");
+	g_autofree char *stripped5 = irc_strip_attributes ("0123456789abcde\002f\0020123456789abcdef\00304,05x\017");
+	g_assert_cmpstr (stripped5, ==, "0123456789abcdef0123456789abcdefx");
+}
+
+static void
+test_has_attributes (void)
+{
+	g_assert_false (irc_has_attributes (""));
+	g_assert_false (irc_has_attributes ("\001ACTION waves\001"));
+	g_assert_false (irc_has_attributes ("tabs\tand \xe2\x9c\x93 are not attributes, nor is this long tail"));
+	g_assert_true (irc_has_attributes ("0123456789abcdef0123456789abcdef\035"));
+	g_assert_true (irc_has_attributes ("\004FF00FFpink"));
 }
 
 static void
@@ -85,6 +103,104 @@ test_strstr (void)
 	g_assert_true (haystack == match);
 }
 
+static void
+assert_matches_scalar (const char *s1, const char *s2)
+{
+	g_assert_cmpint (irc_str_cmp (s1, s2), ==, irc_str_cmp_scalar (s1, s2));
+	g_assert_cmpint (irc_str_equal (s1, s2), ==, irc_str_cmp_scalar (s1, s2) == 0);
+	g_assert_cmpint (irc_str_has_prefix (s1, s2), ==, irc_str_has_prefix_scalar (s1, s2));
+	g_assert_cmpuint (irc_str_hash (s1), ==, irc_str_hash_scalar (s1));
+	g_assert_true (irc_strcasestr (s1, s2) == irc_strcasestr_scalar (s1, s2));
+	g_assert_true (irc_strcasestr (s2, s1) == irc_strcasestr_scalar (s2, s1));
+}
+
+static void
+test_fold_reference (void)
+{
+	// Every pair of bytes, in and around the first and second 16 byte chunks
+	const gsize offsets[] = { 0, 1, 15, 16, 17, 31, 32 };
+	char s1[64], s2[64];
+
+	for (gsize i = 0; i < G_N_ELEMENTS (offsets); ++i)
+	{
+		const gsize at = offsets[i];
+
+		memset (s1, 'n', at);
+		memset (s2, 'N', at);
+		for (guint c1 = 1; c1 < 256; ++c1)
+		{
+			for (guint c2 = 1; c2 < 256; ++c2)
+			{
+				s1[at] = (char)c1;
+				s2[at] = (char)c2;
+				strcpy (s1 + at + 1, "{Nick}\\Tail^");
+				strcpy (s2 + at + 1, "[nICK]|");
+				assert_matches_scalar (s1, s2);
+
+				s1[at + 1] = '\0';
+				assert_matches_scalar (s1, s2);
+				assert_matches_scalar (s2, s1);
+
+				// High bytes against the terminator, either way around
+				s2[at] = '\0';
+				assert_matches_scalar (s1, s2);
+				assert_matches_scalar (s2, s1);
+			}
+		}
+	}
+
+	// The needle only matches after a run of partial matches
+	const char *haystack = "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaAAAAAAAAB";
+	g_assert_true (irc_strcasestr (haystack, "aaaaaaaab") == haystack + 40);
+	g_assert_true (irc_strcasestr (haystack, "aaaaaaaab") == irc_strcasestr_scalar (haystack, "aaaaaaaab"));
+}
+
+static void
+assert_utf8_matches (const char *str, gsize len)
+{
+	g_assert_cmpint (irc_utf8_validate (str, len), ==, g_utf8_validate (str, (gssize)len, NULL));
+}
+
+static void
+test_utf8_validate (void)
+{
+	// Every two and three byte sequence after ASCII and across a chunk boundary
+	const gsize offsets[] = { 0, 14, 15, 16, 30 };
+	char buf[64];
+
+	for (gsize i = 0; i < G_N_ELEMENTS (offsets); ++i)
+	{
+		const gsize at = offsets[i];
+
+		memset (buf, 'a', sizeof(buf));
+		for (guint c1 = 0; c1 < 256; ++c1)
+		{
+			for (guint c2 = 0; c2 < 256; ++c2)
+			{
+				buf[at] = (char)c1;
+				buf[at + 1] = (char)c2;
+				buf[at + 2] = 'a';
+				assert_utf8_matches (buf, at + 1);
+				assert_utf8_matches (buf, at + 2);
+				assert_utf8_matches (buf, at + 20);
+
+				for (guint c3 = 0x7F; c3 <= 0xC0; ++c3)
+				{
+					buf[at + 2] = (char)c3;
+					assert_utf8_matches (buf, at + 3);
+				}
+			}
+		}
+	}
+
+	const char *four = "\xf0\x90\x80\x80 \xf4\x8f\xbf\xbf";
+	g_assert_true (irc_utf8_validate (four, strlen (four)));
+	g_assert_false (irc_utf8_validate ("\xf4\x90\x80\x80", 4));
+	g_assert_false (irc_utf8_validate ("\xf0\x8f\xbf\xbf", 4));
+	g_assert_false (irc_utf8_validate ("\xf0\x90\x80", 3));
+	g_assert_true (irc_utf8_validate ("", 0));
+}
+
 static void
 test_strv (void)
 {
@@ -107,6 +223,70 @@ test_strv (void)
 	g_strfreev (new);
 }
 
+static void
+test_batch (void)
+{
+	const char * const channels[] = { "#a", "#bb", "#key", "#ccc", "#key2", NULL };
+	const char * const keys[] = { "", "", "secret", "", "hunter2", NULL };
+
+	// Keyed channels first, keys listed after the channels
+	g_auto(GStrv) lines = irc_batch_targets ("JOIN", channels, keys, ',', 0, 510);
+	g_assert_cmpuint (g_strv_length (lines), ==, 1);
+	g_assert_cmpstr (lines[0], ==, "JOIN #key,#key2,#a,#bb,#ccc secret,hunter2");
+
+	// Every line fits, keys counted
+	g_auto(GStrv) short_lines = irc_batch_targets ("JOIN", channels, keys, ',', 0, 25);
+	g_assert_cmpuint (g_strv_length (short_lines), ==, 3);
+	g_assert_cmpstr (short_lines[0], ==, "JOIN #key secret");
+	g_assert_cmpstr (short_lines[1], ==, "JOIN #key2,#a,#bb hunter2");
+	g_assert_cmpstr (short_lines[2], ==, "JOIN #ccc");
+
+	g_auto(GStrv) limited = irc_batch_targets ("ISON", channels, NULL, ' ', 2, 510);
+	g_assert_cmpuint (g_strv_length (limited), ==, 3);
+	g_assert_cmpstr (limited[0], ==, "ISON #a #bb");
+	g_assert_cmpstr (limited[2], ==, "ISON #key2");
+
+	const char * const none[] = { NULL };
+	g_auto(GStrv) empty = irc_batch_targets ("MONITOR +", none, NULL, ',', 0, 510);
+	g_assert_cmpuint (g_strv_length (empty), ==, 0);
+}
+
+static void
+test_split (void)
+{
+	g_auto(GStrv) fits = irc_split_message ("hello world", 510);
+	g_assert_cmpuint (g_strv_length (fits), ==, 1);
+	g_assert_cmpstr (fits[0], ==, "hello world");
+
+	// Between words, the space is dropped
+	g_auto(GStrv) words = irc_split_message ("aaa bbb ccc", 7);
+	g_assert_cmpuint (g_strv_length (words), ==, 2);
+	g_assert_cmpstr (words[0], ==, "aaa bbb");
+	g_assert_cmpstr (words[1], ==, "ccc");
+
+	// Long words are cut but never inside a character
+	g_auto(GStrv) chars = irc_split_message ("abcd\xc3\xa9\xc3\xa9", 5);
+	g_assert_cmpuint (g_strv_length (chars), ==, 2);
+	g_assert_cmpstr (chars[0], ==, "abcd");
+	g_assert_cmpstr (chars[1], ==, "\xc3\xa9\xc3\xa9");
+
+	// Formatting carries over, colors as two digits
+	g_auto(GStrv) bold = irc_split_message ("\002ab cd", 4);
+	g_assert_cmpstr (bold[0], ==, "\002ab");
+	g_assert_cmpstr (bold[1], ==, "\002cd");
+
+	g_auto(GStrv) color = irc_split_message ("\0034,5xx\035 yy", 9);
+	g_assert_cmpuint (g_strv_length (color), ==, 2);
+	g_assert_cmpstr (color[0], ==, "\0034,5xx\035");
+	g_assert_cmpstr (color[1], ==, "\00304,05\035yy");
+
+	g_auto(GStrv) reset = irc_split_message ("\002a\017 bc", 3);
+	g_assert_cmpstr (reset[1], ==, "bc");
+
+	g_auto(GStrv) empty = irc_split_message ("", 510);
+	g_assert_cmpuint (g_strv_length (empty), ==, 0);
+}
+
 static void
 test_converter (void)
 {
@@ -136,9 +316,14 @@ main (int argc, char **argv)
 	g_test_init (&argc, &argv, NULL);
 
 	g_test_add_func ("/irc/utils/strip", test_strip);
+	g_test_add_func ("/irc/utils/has-attributes", test_has_attributes);
 	g_test_add_func ("/irc/utils/cmp", test_cmp);
 	g_test_add_func ("/irc/utils/strstr", test_strstr);
+	g_test_add_func ("/irc/utils/batch", test_batch);
+	g_test_add_func ("/irc/utils/split", test_split);
 	g_test_add_func ("/irc/utils/hash", test_hash);
+	g_test_add_func ("/irc/utils/fold-reference", test_fold_reference);
+	g_test_add_func ("/irc/utils/utf8-validate", test_utf8_validate);
 	g_test_add_func ("/irc/utils/strv", test_strv);
 	g_test_add_func ("/irc/utils/converter", test_converter);
 
@@ -0,0 +1,353 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <gio/gio.h>
+#include "irc.h"
+
+/*
+ * Feeds a capture made with irc_server_start_capture() (or IRC_CAPTURE_DIR)
+ * into an IrcServer through a local socket, either at the recorded speed or
+ * as fast as possible, and reports how quickly it was handled.
+ *
+ * Latency is measured from when a line is written to the socket until the
+ * server finished handling it, handling time only covers ::inbound.
+ */
+
+typedef struct
+{
+	gint64 time;
+	const char *data;
+	gsize len;
+} Record;
+
+typedef struct
+{
+	char *contents;
+	char *nick;
+	GArray *records;
+
+	GSocketService *service;
+	GOutputStream *out;
+	GInputStream *in;
+	char discard[4096];
+	GByteArray *pending;
+	gboolean writing;
+	guint next_record;
+	guint timeout;
+	gint64 start;
+
+	IrcServer *server;
+	gint64 *sent;
+	gint64 *latency;
+	gint64 *handling;
+	guint n_handled;
+	gint64 first_sent;
+	gint64 last_handled;
+	GMainLoop *loop;
+} Replay;
+
+static Replay replay;
+static gboolean fast;
+static char *nick_override;
+
+static GOptionEntry entries[] = {
+	{ "fast", 'f', 0, G_OPTION_ARG_NONE, &fast, "Send lines as fast as possible instead of at recorded speed", NULL },
+	{ "nick", 'n', 0, G_OPTION_ARG_STRING, &nick_override, "Nickname to use instead of the recorded one", "NICK" },
+	{ NULL }
+};
+
+static gboolean
+parse_capture (const char *path, GError **error)
+{
+	gsize len;
+
+	if (!g_file_get_contents (path, &replay.contents, &len, error))
+		return FALSE;
+
+	const char *p = replay.contents;
+	const char *end = p + len;
+	const char *eol = memchr (p, '\n', len);
+
+	if (eol == NULL || !g_str_has_prefix (p, "IRCCAPTURE 1 "))
+	{
+		g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA, "Not a capture file");
+		return FALSE;
+	}
+
+	replay.nick = g_strndup (p + strlen ("IRCCAPTURE 1 "), (gsize)(eol - p) - strlen ("IRCCAPTURE 1 "));
+	replay.records = g_array_new (FALSE, FALSE, sizeof(Record));
+
+	for (p = eol + 1; p < end;)
+	{
+		Record record;
+		char *data;
+
+		record.time = g_ascii_strtoll (p, &data, 10);
+		record.len = (gsize)g_ascii_strtoull (data, &data, 10);
+		// The data is followed by a newline, contents are always nul terminated
+		if (*data != '\n' || (gsize)(end - data) < record.len + 2)
+		{
+			g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA, "Truncated record %u", replay.records->len);
+			return FALSE;
+		}
+
+		record.data = data + 1;
+		g_array_append_val (replay.records, record);
+		p = record.data + record.len + 1;
+	}
+
+	return TRUE;
+}
+
+static void flush_pending (void);
+
+static void
+on_write_ready (GObject *source, GAsyncResult *res, gpointer data)
+{
+	g_autoptr(GError) err = NULL;
+	g_autoptr(GBytes) bytes = data;
+
+	if (!g_output_stream_write_all_finish (G_OUTPUT_STREAM(source), res, NULL, &err))
+	{
+		g_printerr ("Failed to write: %s\n", err->message);
+		g_main_loop_quit (replay.loop);
+		return;
+	}
+
+	replay.writing = FALSE;
+	flush_pending ();
+}
+
+static void
+flush_pending (void)
+{
+	if (replay.writing || replay.pending->len == 0)
+		return;
+
+	GBytes *bytes = g_byte_array_free_to_bytes (replay.pending);
+	replay.pending = g_byte_array_new ();
+	replay.writing = TRUE;
+
+	gsize len;
+	gconstpointer data = g_bytes_get_data (bytes, &len);
+	g_output_stream_write_all_async (replay.out, data, len, G_PRIORITY_DEFAULT, NULL, on_write_ready, bytes);
+}
+
+static gboolean
+send_records (gpointer data)
+{
+	const gint64 now = g_get_monotonic_time ();
+
+	replay.timeout = 0;
+
+	for (; replay.next_record < replay.records->len; ++replay.next_record)
+	{
+		Record *record = &g_array_index (replay.records, Record, replay.next_record);
+
+		if (!fast && record->time > now - replay.start)
+		{
+			const gint64 delay_ms = (record->time - (now - replay.start)) / 1000;
+			replay.timeout = g_timeout_add ((guint)delay_ms, send_records, NULL);
+			break;
+		}
+
+		replay.sent[replay.next_record] = now;
+		g_byte_array_append (replay.pending, (const guint8*)record->data, (guint)record->len);
+		g_byte_array_append (replay.pending, (const guint8*)"\r\n", 2);
+	}
+
+	flush_pending ();
+	return G_SOURCE_REMOVE;
+}
+
+static void
+on_discard_ready (GObject *source, GAsyncResult *res, gpointer data)
+{
+	g_autoptr(GError) err = NULL;
+
+	// Whatever the client sends back is ignored
+	if (g_input_stream_read_finish (G_INPUT_STREAM(source), res, &err) > 0)
+		g_input_stream_read_async (replay.in, replay.discard, sizeof(replay.discard), G_PRIORITY_LOW,
+								   NULL, on_discard_ready, NULL);
+}
+
+static gboolean
+on_incoming (GSocketService *service, GSocketConnection *connection, GObject *source, gpointer data)
+{
+	if (replay.out != NULL)
+		return FALSE;
+
+	replay.out = g_object_ref (g_io_stream_get_output_stream (G_IO_STREAM(connection)));
+	replay.in = g_object_ref (g_io_stream_get_input_stream (G_IO_STREAM(connection)));
+	g_object_set_data_full (G_OBJECT(replay.out), "connection", g_object_ref (connection), g_object_unref);
+
+	g_input_stream_read_async (replay.in, replay.discard, sizeof(replay.discard), G_PRIORITY_LOW,
+							   NULL, on_discard_ready, NULL);
+
+	replay.start = g_get_monotonic_time ();
+	replay.first_sent = replay.start;
+	send_records (NULL);
+	return TRUE;
+}
+
+static gboolean
+replay_server_inbound (IrcServer *server, const char *line)
+{
+	gboolean handled = FALSE;
+	const gint64 start = g_get_monotonic_time ();
+
+	g_signal_chain_from_overridden_handler (server, line, &handled);
+
+	const gint64 end = g_get_monotonic_time ();
+	if (replay.n_handled < replay.records->len)
+	{
+		replay.handling[replay.n_handled] = end - start;
+		replay.latency[replay.n_handled] = end - replay.sent[replay.n_handled];
+		replay.last_handled = end;
+		if (++replay.n_handled == replay.records->len)
+			g_main_loop_quit (replay.loop);
+	}
+
+	return handled;
+}
+
+static void
+replay_server_class_init (gpointer klass, gpointer data)
+{
+	g_signal_override_class_handler ("inbound", G_TYPE_FROM_CLASS(klass), G_CALLBACK(replay_server_inbound));
+}
+
+static GType
+replay_server_get_type (void)
+{
+	static GType type;
+
+	if (type == 0)
+	{
+		// IrcServerClass is private so only the sizes are known here
+		GTypeQuery query;
+		g_type_query (IRC_TYPE_SERVER, &query);
+		type = g_type_register_static_simple (IRC_TYPE_SERVER, "IrcReplayServer", query.class_size,
+											  replay_server_class_init, query.instance_size, NULL, 0);
+	}
+
+	return type;
+}
+
+static int
+compare_gint64 (gconstpointer a, gconstpointer b)
+{
+	const gint64 x = *(const gint64*)a;
+	const gint64 y = *(const gint64*)b;
+
+	return (x > y) - (x < y);
+}
+
+static gint64
+percentile (gint64 *values, guint n, guint pct)
+{
+	if (n == 0)
+		return 0;
+
+	return values[MIN(n - 1, (guint)((guint64)n * pct / 100))];
+}
+
+static void
+print_results (void)
+{
+	struct rusage usage;
+	const guint n = replay.n_handled;
+	const double seconds = (double)(replay.last_handled - replay.first_sent) / 1e6;
+
+	qsort (replay.latency, n, sizeof(gint64), compare_gint64);
+	qsort (replay.handling, n, sizeof(gint64), compare_gint64);
+	getrusage (RUSAGE_SELF, &usage);
+
+	printf ("{\"lines\": %u, \"seconds\": %.3f, \"lines_per_sec\": %.0f, "
+			"\"latency_p50_us\": %" G_GINT64_FORMAT ", \"latency_p99_us\": %" G_GINT64_FORMAT ", "
+			"\"handling_p50_us\": %" G_GINT64_FORMAT ", \"handling_p99_us\": %" G_GINT64_FORMAT ", "
+			"\"peak_rss_kb\": %ld}\n",
+			n, seconds, seconds > 0 ? (double)n / seconds : 0.0,
+			percentile (replay.latency, n, 50), percentile (replay.latency, n, 99),
+			percentile (replay.handling, n, 50), percentile (replay.handling, n, 99),
+			usage.ru_maxrss);
+}
+
+static void
+discard_print (const char *string)
+{
+}
+
+int
+main (int argc, char **argv)
+{
+	g_autoptr(GOptionContext) context = g_option_context_new ("CAPTURE - replay a capture into IrcServer");
+	g_autoptr(GError) err = NULL;
+	g_autoptr(GSettings) settings = NULL;
+
+	// Never touch the real configuration
+	g_setenv ("GSETTINGS_BACKEND", "memory", TRUE);
+
+	g_option_context_add_main_entries (context, entries, NULL);
+	if (!g_option_context_parse (context, &argc, &argv, &err) || argc != 2)
+	{
+		g_printerr ("%s\n", err ? err->message : "A capture file is required");
+		return EXIT_FAILURE;
+	}
+
+	if (!parse_capture (argv[1], &err))
+	{
+		g_printerr ("Failed to read %s: %s\n", argv[1], err->message);
+		return EXIT_FAILURE;
+	}
+
+	replay.pending = g_byte_array_new ();
+	replay.sent = g_new0 (gint64, replay.records->len);
+	replay.latency = g_new0 (gint64, replay.records->len);
+	replay.handling = g_new0 (gint64, replay.records->len);
+	replay.loop = g_main_loop_new (NULL, FALSE);
+
+	replay.service = g_socket_service_new ();
+	const guint16 port = g_socket_listener_add_any_inet_port (G_SOCKET_LISTENER(replay.service), NULL, &err);
+	if (port == 0)
+	{
+		g_printerr ("Failed to listen: %s\n", err->message);
+		return EXIT_FAILURE;
+	}
+	g_signal_connect (replay.service, "incoming", G_CALLBACK(on_incoming), NULL);
+
+	replay.server = g_object_new (replay_server_get_type (), "host", "127.0.0.1", "port", port, "tls", FALSE,
+								  "name", "replay", NULL);
+	g_object_get (replay.server, "settings", &settings, NULL);
+	g_settings_set_string (settings, "nickname", nick_override ? nick_override : replay.nick);
+
+	// Every inbound line is echoed otherwise which would be most of the cost
+	g_set_print_handler (discard_print);
+
+	if (replay.records->len)
+	{
+		irc_server_connect (replay.server);
+		g_main_loop_run (replay.loop);
+	}
+
+	print_results ();
+
+	if (replay.timeout)
+		g_source_remove (replay.timeout);
+	g_socket_service_stop (replay.service);
+	g_clear_object (&replay.server);
+	g_clear_object (&replay.out);
+	g_clear_object (&replay.in);
+	g_object_unref (replay.service);
+	g_byte_array_unref (replay.pending);
+	g_array_unref (replay.records);
+	g_free (replay.contents);
+	g_main_loop_unref (replay.loop);
+	g_free (replay.sent);
+	g_free (replay.latency);
+	g_free (replay.handling);
+	g_free (replay.nick);
+
+	return EXIT_SUCCESS;
+}